@@ -0,0 +1,55 @@
+# Assembler regression checks: prints "ok" when every encoding below
+# does what its source says on this simulator, "FAIL <n>" otherwise.
+#
+#   mu-mips -t off -b script asm-checks.asm	(script: run 1000)
+
+.data
+words:	.word 1, 2, 3, 0x1234
+ok:	.asciiz "ok\n"
+fail:	.asciiz "FAIL "
+
+.text
+main:
+	# 1: a negative offset, the way -N($sp) stack accesses use it
+	li $s0, 1
+	la $t1, words
+	addi $t1, $t1, 16
+	lw $t0, -4($t1)
+	li $t2, 0x1234
+	bne $t0, $t2, failed
+
+	# 2: addiu with a negative immediate
+	li $s0, 2
+	addiu $t3, $zero, -1
+	li $t4, 0xFFFFFFFF
+	bne $t3, $t4, failed
+
+	# 3: bltz and bgez on a negative value
+	li $s0, 3
+	bgez $t3, failed
+	bltz $t3, negative
+	j failed
+negative:
+	# 4: bltz and bgez on zero and a positive value
+	li $s0, 4
+	bltz $t2, failed
+	bltz $zero, failed
+	bgez $zero, passed
+	j failed
+
+passed:
+	li $v0, 4
+	la $a0, ok
+	syscall
+	li $v0, 10
+	syscall
+
+failed:
+	li $v0, 4
+	la $a0, fail
+	syscall
+	li $v0, 1
+	move $a0, $s0
+	syscall
+	li $v0, 10
+	syscall
@@ -0,0 +1,1114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Assembler for .asm sources (-f asm, or a .asm/.s file name), built  */
+/* into the loader: one pass over the mapped file straight into the    */
+/* image's text words and data bytes, then the references to labels   */
+/* that were not defined yet are patched from the symbol table.        */
+/*                                                                     */
+/* It takes the instructions the simulator decodes, labels, .text,     */
+/* .data, .word, .half, .byte, .ascii, .asciiz, .space and .align, and */
+/* the usual pseudo instructions (li, la, move, nop, b, beqz, bnez,    */
+/* bgt, blt, bge, ble, not, neg, mul, an immediate as the last operand */
+/* of an R-type instruction, and label(reg) operands). Expansions use  */
+/* $at. Encodings follow what this simulator executes: a branch offset */
+/* is counted from the branch itself, addi is the sign-extending add   */
+/* immediate (a negative addiu becomes addi), loads and stores         */
+/* zero-extend their offset (a label address splits into its plain     */
+/* high and low halves, a negative offset goes through $at), and       */
+/* bltz/bgez, which decode as no-ops, test the sign bit with srl into  */
+/* $at and branch on that.                                             */
+/*                                                                     */
+/* Text starts at MEM_TEXT_BEGIN, data at MEM_DATA_BEGIN, execution at */
+/* main if there is one, and ends with an exit syscall for programs    */
+/* that run off their last instruction. The labels stay with the       */
+/* image, see mips_image_symbol().                                     */
+/***************************************************************/
+#define ASM_LINE_MAX		1024
+#define ASM_OPERANDS_MAX	4
+#define ASM_PENDING_MAX		16	/* labels waiting for the next item */
+#define ASM_MAX_ERRORS		20
+
+#define REG_ZERO	0
+#define REG_AT		1
+#define REG_V0		2
+#define REG_RA		31
+
+#define SECTION_TEXT	0
+#define SECTION_DATA	1
+
+/* operand kinds */
+#define OP_REG		0
+#define OP_IMM		1
+#define OP_SYM		2	/* symbol + value */
+#define OP_MEM		3	/* value (+ symbol) (reg) */
+
+/* how a fixup patches its word once the symbol is known */
+#define FIX_BRANCH	0	/* 16-bit word offset from the branch */
+#define FIX_JUMP	1	/* 26-bit word address in the same 256MB */
+#define FIX_HI		2	/* high half */
+#define FIX_LO		3	/* low half */
+#define FIX_WORD	4	/* the whole address */
+
+#define NO_SYMBOL	0xFFFFFFFF
+
+/* instruction forms */
+enum {
+	F_RRR, F_SHIFT, F_MULDIV, F_RS, F_RD, F_JALR, F_NONE, F_JUMP, F_BRANCH, F_BRANCHZ,
+	F_IMM, F_LUI, F_MEM,
+	/* pseudo instructions */
+	F_LI, F_LA, F_MOVE, F_NOP, F_B, F_BEQZ, F_BCMP, F_NOT, F_NEG, F_MUL
+};
+
+typedef struct {
+	const char *name;
+	uint8_t form;
+	uint8_t op;	/* opcode, or for F_BCMP: 1 = swap operands, 2 = branch if slt is 0 */
+	uint8_t fn;	/* function; F_RRR: opcode of the immediate form; F_BRANCHZ: rt */
+} asm_op_t;
+
+static const asm_op_t OPS[] = {
+	{ "add", F_RRR, 0x00, 0x20 },	{ "addu", F_RRR, 0x00, 0x21 },
+	{ "sub", F_RRR, 0x00, 0x22 },	{ "subu", F_RRR, 0x00, 0x23 },
+	{ "and", F_RRR, 0x00, 0x24 },	{ "or", F_RRR, 0x00, 0x25 },
+	{ "xor", F_RRR, 0x00, 0x26 },	{ "nor", F_RRR, 0x00, 0x27 },
+	{ "slt", F_RRR, 0x00, 0x2A },
+	{ "sll", F_SHIFT, 0x00, 0x00 },	{ "srl", F_SHIFT, 0x00, 0x02 },	{ "sra", F_SHIFT, 0x00, 0x03 },
+	{ "mult", F_MULDIV, 0x00, 0x18 },	{ "multu", F_MULDIV, 0x00, 0x19 },
+	{ "div", F_MULDIV, 0x00, 0x1A },	{ "divu", F_MULDIV, 0x00, 0x1B },
+	{ "jr", F_RS, 0x00, 0x08 },	{ "mthi", F_RS, 0x00, 0x11 },	{ "mtlo", F_RS, 0x00, 0x13 },
+	{ "mfhi", F_RD, 0x00, 0x10 },	{ "mflo", F_RD, 0x00, 0x12 },
+	{ "jalr", F_JALR, 0x00, 0x09 },
+	{ "syscall", F_NONE, 0x00, 0x0C },	{ "sync", F_NONE, 0x00, 0x0F },
+	{ "j", F_JUMP, 0x02, 0 },	{ "jal", F_JUMP, 0x03, 0 },
+	{ "beq", F_BRANCH, 0x04, 0 },	{ "bne", F_BRANCH, 0x05, 0 },
+	{ "blez", F_BRANCHZ, 0x06, 0 },	{ "bgtz", F_BRANCHZ, 0x07, 0 },
+	{ "bltz", F_BRANCHZ, 0x01, 0 },	{ "bgez", F_BRANCHZ, 0x01, 1 },
+	{ "addi", F_IMM, 0x08, 0x20 },	{ "addiu", F_IMM, 0x09, 0x21 },
+	{ "slti", F_IMM, 0x0A, 0x2A },	{ "andi", F_IMM, 0x0C, 0x24 },
+	{ "ori", F_IMM, 0x0D, 0x25 },	{ "xori", F_IMM, 0x0E, 0x26 },
+	{ "lui", F_LUI, 0x0F, 0 },
+	{ "lb", F_MEM, 0x20, 0 },	{ "lh", F_MEM, 0x21, 0 },	{ "lw", F_MEM, 0x23, 0 },
+	{ "sb", F_MEM, 0x28, 0 },	{ "sh", F_MEM, 0x29, 0 },	{ "sw", F_MEM, 0x2B, 0 },
+	{ "ll", F_MEM, 0x30, 0 },	{ "sc", F_MEM, 0x38, 0 },
+	{ "li", F_LI, 0, 0 },		{ "la", F_LA, 0, 0 },
+	{ "move", F_MOVE, 0, 0 },	{ "nop", F_NOP, 0, 0 },
+	{ "b", F_B, 0, 0 },
+	{ "beqz", F_BEQZ, 0x04, 0 },	{ "bnez", F_BEQZ, 0x05, 0 },
+	{ "blt", F_BCMP, 0, 0 },	{ "bgt", F_BCMP, 1, 0 },
+	{ "bge", F_BCMP, 2, 0 },	{ "ble", F_BCMP, 3, 0 },
+	{ "not", F_NOT, 0, 0 },		{ "neg", F_NEG, 0, 0 },
+	{ "mul", F_MUL, 0, 0 },
+};
+
+static const char *REG_NAMES[32] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+typedef struct {
+	int kind;
+	int reg;
+	uint32_t value;
+	uint32_t symbol;	/* NO_SYMBOL, or an index into the symbols */
+} operand_t;
+
+typedef struct {
+	char *name;
+	uint32_t address;
+	int defined;
+	int line;		/* first reference, for undefined symbols */
+} asm_symbol_t;
+
+typedef struct {
+	uint8_t kind, section;
+	uint32_t offset;	/* of the patched word in its section, in bytes */
+	uint32_t symbol, addend;
+	int line;
+} fixup_t;
+
+typedef struct {
+	const char *path;
+	int line, errors, section;
+
+	uint32_t *text;
+	uint32_t text_size, text_capacity;	/* words */
+	uint8_t *data;
+	uint32_t data_size, data_capacity;	/* bytes */
+
+	asm_symbol_t *symbols;
+	uint32_t num_symbols, symbol_capacity;
+	uint32_t *hash;				/* symbol index + 1, 0 for a free slot */
+	uint32_t hash_size;
+
+	fixup_t *fixups;
+	uint32_t num_fixups, fixup_capacity;
+
+	uint32_t pending[ASM_PENDING_MAX];	/* labels bound by the next item */
+	int num_pending;
+} assembler_t;
+
+static void *grow(void *p, uint32_t *capacity, uint32_t needed, size_t size)
+{
+	if (needed <= *capacity) {
+		return p;
+	}
+	*capacity = (*capacity * 2 > needed) ? *capacity * 2 : needed + 16;
+	p = realloc(p, *capacity * size);
+	if (p == NULL) {
+		printf("Error: out of memory assembling a program\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static int asm_error(assembler_t *as, const char *message, const char *what)
+{
+	if (as->errors < ASM_MAX_ERRORS) {
+		printf("Error: %s:%d: %s%s%s\n", as->path, as->line, message, what ? " " : "", what ? what : "");
+	}
+	as->errors++;
+	return FALSE;
+}
+
+/***************************************************************/
+/* Symbols: an open addressing table over the symbol array, so a       */
+/* reference is found in one probe whatever the size of the program    */
+/***************************************************************/
+static uint32_t hash_name(const char *name)
+{
+	uint32_t h = 2166136261u;
+
+	while (*name) {
+		h = (h ^ (uint8_t)*name++) * 16777619u;
+	}
+	return h;
+}
+
+static void rehash(assembler_t *as)
+{
+	uint32_t i, slot;
+
+	free(as->hash);
+	as->hash_size = as->hash_size ? as->hash_size * 2 : 256;
+	as->hash = calloc(as->hash_size, sizeof(uint32_t));
+	if (as->hash == NULL) {
+		printf("Error: out of memory assembling a program\n");
+		exit(-1);
+	}
+	for (i = 0; i < as->num_symbols; i++) {
+		slot = hash_name(as->symbols[i].name) & (as->hash_size - 1);
+		while (as->hash[slot] != 0) {
+			slot = (slot + 1) & (as->hash_size - 1);
+		}
+		as->hash[slot] = i + 1;
+	}
+}
+
+/* index of name, entered as undefined the first time it is seen */
+static uint32_t intern(assembler_t *as, const char *name)
+{
+	uint32_t slot, i;
+
+	if (2 * (as->num_symbols + 1) > as->hash_size) {
+		rehash(as);
+	}
+	slot = hash_name(name) & (as->hash_size - 1);
+	while (as->hash[slot] != 0) {
+		i = as->hash[slot] - 1;
+		if (strcmp(as->symbols[i].name, name) == 0) {
+			return i;
+		}
+		slot = (slot + 1) & (as->hash_size - 1);
+	}
+	as->symbols = grow(as->symbols, &as->symbol_capacity, as->num_symbols + 1, sizeof(asm_symbol_t));
+	i = as->num_symbols++;
+	as->symbols[i].name = strdup(name);
+	if (as->symbols[i].name == NULL) {
+		printf("Error: out of memory assembling a program\n");
+		exit(-1);
+	}
+	as->symbols[i].address = 0;
+	as->symbols[i].defined = FALSE;
+	as->symbols[i].line = as->line;
+	as->hash[slot] = i + 1;
+	return i;
+}
+
+static uint32_t section_address(const assembler_t *as)
+{
+	return (as->section == SECTION_TEXT) ? MEM_TEXT_BEGIN + 4 * as->text_size : MEM_DATA_BEGIN + as->data_size;
+}
+
+/* give the labels seen since the last item the current address */
+static void bind_labels(assembler_t *as)
+{
+	int i;
+
+	for (i = 0; i < as->num_pending; i++) {
+		as->symbols[as->pending[i]].address = section_address(as);
+	}
+	as->num_pending = 0;
+}
+
+static void define_label(assembler_t *as, const char *name)
+{
+	uint32_t i = intern(as, name);
+
+	if (as->symbols[i].defined) {
+		asm_error(as, "label defined twice:", name);
+		return;
+	}
+	if (as->num_pending == ASM_PENDING_MAX) {
+		bind_labels(as);
+	}
+	as->symbols[i].defined = TRUE;
+	as->pending[as->num_pending++] = i;
+}
+
+/***************************************************************/
+/* Emitting text and data                                              */
+/***************************************************************/
+static void add_fixup(assembler_t *as, int kind, uint32_t symbol, uint32_t addend)
+{
+	fixup_t *f;
+
+	as->fixups = grow(as->fixups, &as->fixup_capacity, as->num_fixups + 1, sizeof(fixup_t));
+	f = &as->fixups[as->num_fixups++];
+	f->kind = kind;
+	f->section = as->section;
+	f->offset = (as->section == SECTION_TEXT) ? 4 * as->text_size : as->data_size;
+	f->symbol = symbol;
+	f->addend = addend;
+	f->line = as->line;
+}
+
+static void emit(assembler_t *as, uint32_t word)
+{
+	as->text = grow(as->text, &as->text_capacity, as->text_size + 1, sizeof(uint32_t));
+	as->text[as->text_size++] = word;
+}
+
+static void emit_r(assembler_t *as, int rs, int rt, int rd, int sa, int fn)
+{
+	emit(as, (rs << 21) | (rt << 16) | (rd << 11) | ((sa & 0x1F) << 6) | fn);
+}
+
+static void emit_i(assembler_t *as, int op, int rs, int rt, uint32_t imm)
+{
+	emit(as, (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF));
+}
+
+/* an I-type instruction whose immediate is the high/low half of symbol + addend */
+static void emit_i_fixup(assembler_t *as, int kind, int op, int rs, int rt, uint32_t symbol, uint32_t addend)
+{
+	if (symbol != NO_SYMBOL) {
+		add_fixup(as, kind, symbol, addend);
+		emit_i(as, op, rs, rt, 0);
+	} else {
+		emit_i(as, op, rs, rt, (kind == FIX_HI) ? addend >> 16 : addend);
+	}
+}
+
+/* load a constant in as few instructions as this simulator allows */
+static void emit_li(assembler_t *as, int reg, uint32_t value)
+{
+	if (value <= 0xFFFF) {
+		emit_i(as, 0x0D, REG_ZERO, reg, value);		/* ori */
+	} else if ((int32_t)value >= -32768 && (int32_t)value < 0) {
+		emit_i(as, 0x08, REG_ZERO, reg, value);		/* addi */
+	} else {
+		emit_i(as, 0x0F, REG_ZERO, reg, value >> 16);	/* lui */
+		if (value & 0xFFFF) {
+			emit_i(as, 0x0D, reg, reg, value);
+		}
+	}
+}
+
+static void emit_branch(assembler_t *as, int op, int rs, int rt, const operand_t *target)
+{
+	if (target->kind == OP_SYM) {
+		add_fixup(as, FIX_BRANCH, target->symbol, target->value);
+		emit_i(as, op, rs, rt, 0);
+	} else {
+		/* a number is a byte offset from the branch, as this simulator adds it */
+		if ((target->value & 0x3) || (int32_t)target->value < -131072 || (int32_t)target->value > 131068) {
+			asm_error(as, "bad branch offset", NULL);
+		}
+		emit_i(as, op, rs, rt, (int32_t)target->value >> 2);
+	}
+}
+
+static void data_bytes(assembler_t *as, const void *bytes, uint32_t n)
+{
+	as->data = grow(as->data, &as->data_capacity, as->data_size + n, 1);
+	if (bytes != NULL) {
+		memcpy(as->data + as->data_size, bytes, n);
+	} else {
+		memset(as->data + as->data_size, 0, n);
+	}
+	as->data_size += n;
+}
+
+/* little-endian, as the guest memory */
+static void data_value(assembler_t *as, uint32_t value, int size)
+{
+	uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+
+	data_bytes(as, bytes, size);
+}
+
+static void align(assembler_t *as, uint32_t alignment)
+{
+	if (as->section == SECTION_DATA && (as->data_size & (alignment - 1))) {
+		data_bytes(as, NULL, alignment - (as->data_size & (alignment - 1)));
+	}
+}
+
+/***************************************************************/
+/* Operands                                                            */
+/***************************************************************/
+static int parse_register(const char *s, int *reg)
+{
+	char *end;
+	long n;
+	int i;
+
+	if (s[0] != '$') {
+		return FALSE;
+	}
+	s++;
+	if (isdigit((unsigned char)s[0])) {
+		n = strtol(s, &end, 10);
+		if (*end != '\0' || n < 0 || n > 31) {
+			return FALSE;
+		}
+		*reg = n;
+		return TRUE;
+	}
+	for (i = 0; i < 32; i++) {
+		if (strcmp(s, REG_NAMES[i]) == 0) {
+			*reg = i;
+			return TRUE;
+		}
+	}
+	if (strcmp(s, "s8") == 0) {
+		*reg = 30;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static int parse_number(const char *s, uint32_t *value)
+{
+	const char *digits = (s[0] == '-' || s[0] == '+') ? s + 1 : s;
+	unsigned long long v;
+	char *end;
+
+	if (s[0] == '\'' && s[1] != '\0' && s[1] != '\\' && s[2] == '\'' && s[3] == '\0') {
+		*value = (uint8_t)s[1];
+		return TRUE;
+	}
+	if (!isdigit((unsigned char)digits[0])) {
+		return FALSE;
+	}
+	v = strtoull(digits, &end, 0);
+	if (*end != '\0' || v > 0xFFFFFFFFull) {
+		return FALSE;
+	}
+	*value = (s[0] == '-') ? -(uint32_t)v : (uint32_t)v;
+	return TRUE;
+}
+
+static int is_name(const char *s)
+{
+	if (!isalpha((unsigned char)*s) && *s != '_' && *s != '.') {
+		return FALSE;
+	}
+	for (s++; *s; s++) {
+		if (!isalnum((unsigned char)*s) && *s != '_' && *s != '.' && *s != '$') {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* a number, or a label with an optional +/- number */
+static int parse_value(assembler_t *as, char *s, operand_t *o)
+{
+	char *sign;
+
+	o->symbol = NO_SYMBOL;
+	if (parse_number(s, &o->value)) {
+		o->kind = OP_IMM;
+		return TRUE;
+	}
+	o->value = 0;
+	sign = strpbrk(s, "+-");
+	if (sign != NULL) {
+		if (!parse_number(sign, &o->value)) {
+			return FALSE;
+		}
+		*sign = '\0';
+	}
+	if (!is_name(s)) {
+		return FALSE;
+	}
+	o->kind = OP_SYM;
+	o->symbol = intern(as, s);
+	return TRUE;
+}
+
+static int parse_operand(assembler_t *as, char *s, operand_t *o)
+{
+	char *open, *close;
+
+	if (parse_register(s, &o->reg)) {
+		o->kind = OP_REG;
+		return TRUE;
+	}
+	open = strchr(s, '(');
+	if (open == NULL) {
+		return parse_value(as, s, o);
+	}
+	close = strchr(open, ')');
+	if (close == NULL || close[1] != '\0') {
+		return FALSE;
+	}
+	*open = '\0';
+	*close = '\0';
+	if (!parse_register(open + 1, &o->reg)) {
+		return FALSE;
+	}
+	if (s[0] == '\0') {
+		o->value = 0;
+		o->symbol = NO_SYMBOL;
+	} else if (!parse_value(as, s, o)) {
+		return FALSE;
+	}
+	o->kind = OP_MEM;
+	return TRUE;
+}
+
+/***************************************************************/
+/* One instruction; ops holds its operands. Returns FALSE on an error. */
+/***************************************************************/
+static int fits_signed(uint32_t v)
+{
+	return (int32_t)v >= -32768 && (int32_t)v <= 32767;
+}
+
+static int assemble(assembler_t *as, const asm_op_t *op, operand_t *o, int n)
+{
+	int rt;
+
+#define KINDS(k0, k1, k2) (n == ((k0) >= 0) + ((k1) >= 0) + ((k2) >= 0) \
+	&& ((k0) < 0 || o[0].kind == (k0)) && ((k1) < 0 || o[1].kind == (k1)) && ((k2) < 0 || o[2].kind == (k2)))
+
+	switch (op->form) {
+		case F_RRR:
+			if (KINDS(OP_REG, OP_REG, OP_REG)) {
+				emit_r(as, o[1].reg, o[2].reg, o[0].reg, 0, op->fn);
+				return TRUE;
+			}
+			if (!KINDS(OP_REG, OP_REG, OP_IMM) || op->fn == 0x27) {
+				break;
+			}
+			if (op->fn == 0x22 || op->fn == 0x23) {
+				o[2].value = -o[2].value;
+			}
+			if (op->fn <= 0x23) {
+				/* add/sub an immediate: addi sign-extends here, addiu does not */
+				if (fits_signed(o[2].value)) {
+					emit_i(as, 0x08, o[1].reg, o[0].reg, o[2].value);
+				} else {
+					emit_li(as, REG_AT, o[2].value);
+					emit_r(as, o[1].reg, REG_AT, o[0].reg, 0, 0x20);
+				}
+				return TRUE;
+			}
+			if ((op->fn == 0x2A) ? fits_signed(o[2].value) : o[2].value <= 0xFFFF) {
+				emit_i(as, (op->fn == 0x2A) ? 0x0A : op->fn - 0x18, o[1].reg, o[0].reg, o[2].value);
+			} else {
+				emit_li(as, REG_AT, o[2].value);
+				emit_r(as, o[1].reg, REG_AT, o[0].reg, 0, op->fn);
+			}
+			return TRUE;
+		case F_SHIFT:
+			if (!KINDS(OP_REG, OP_REG, OP_IMM) || o[2].value > 31) {
+				break;
+			}
+			emit_r(as, 0, o[1].reg, o[0].reg, o[2].value, op->fn);
+			return TRUE;
+		case F_MULDIV:
+			if (!KINDS(OP_REG, OP_REG, -1)) {
+				break;
+			}
+			emit_r(as, o[0].reg, o[1].reg, 0, 0, op->fn);
+			return TRUE;
+		case F_RS:
+			if (!KINDS(OP_REG, -1, -1)) {
+				break;
+			}
+			emit_r(as, o[0].reg, 0, 0, 0, op->fn);
+			return TRUE;
+		case F_RD:
+			if (!KINDS(OP_REG, -1, -1)) {
+				break;
+			}
+			emit_r(as, 0, 0, o[0].reg, 0, op->fn);
+			return TRUE;
+		case F_JALR:
+			if (KINDS(OP_REG, -1, -1)) {
+				emit_r(as, o[0].reg, 0, REG_RA, 0, op->fn);
+				return TRUE;
+			}
+			if (!KINDS(OP_REG, OP_REG, -1)) {
+				break;
+			}
+			emit_r(as, o[1].reg, 0, o[0].reg, 0, op->fn);
+			return TRUE;
+		case F_NONE:
+			if (n != 0) {
+				break;
+			}
+			emit_r(as, 0, 0, 0, 0, op->fn);
+			return TRUE;
+		case F_JUMP:
+			if (KINDS(OP_SYM, -1, -1)) {
+				add_fixup(as, FIX_JUMP, o[0].symbol, o[0].value);
+				emit(as, op->op << 26);
+				return TRUE;
+			}
+			if (!KINDS(OP_IMM, -1, -1)) {
+				break;
+			}
+			emit(as, (op->op << 26) | ((o[0].value >> 2) & 0x3FFFFFF));
+			return TRUE;
+		case F_BRANCH:
+			if (n != 3 || o[0].kind != OP_REG || (o[2].kind != OP_SYM && o[2].kind != OP_IMM)) {
+				break;
+			}
+			if (o[1].kind == OP_IMM) {
+				emit_li(as, REG_AT, o[1].value);
+				o[1].reg = REG_AT;
+			} else if (o[1].kind != OP_REG) {
+				break;
+			}
+			emit_branch(as, op->op, o[0].reg, o[1].reg, &o[2]);
+			return TRUE;
+		case F_BRANCHZ:
+			if (n != 2 || o[0].kind != OP_REG || (o[1].kind != OP_SYM && o[1].kind != OP_IMM)) {
+				break;
+			}
+			if (op->op == 0x01) {
+				/* regimm does nothing here: bltz/bgez test the sign bit in $at */
+				emit_r(as, 0, o[0].reg, REG_AT, 31, 0x02);
+				emit_branch(as, op->fn ? 0x04 : 0x05, REG_AT, REG_ZERO, &o[1]);
+				return TRUE;
+			}
+			emit_branch(as, op->op, o[0].reg, op->fn, &o[1]);
+			return TRUE;
+		case F_IMM:
+			if (!KINDS(OP_REG, OP_REG, OP_IMM)) {
+				break;
+			}
+			if (op->op == 0x09 && o[2].value > 0xFFFF && fits_signed(o[2].value)) {
+				/* addiu zero-extends here: a negative immediate goes through addi */
+				emit_i(as, 0x08, o[1].reg, o[0].reg, o[2].value);
+			} else if ((op->op == 0x08 || op->op == 0x0A) ? fits_signed(o[2].value) : o[2].value <= 0xFFFF) {
+				emit_i(as, op->op, o[1].reg, o[0].reg, o[2].value);
+			} else {
+				emit_li(as, REG_AT, o[2].value);
+				emit_r(as, o[1].reg, REG_AT, o[0].reg, 0, op->fn);
+			}
+			return TRUE;
+		case F_LUI:
+			if (!KINDS(OP_REG, OP_IMM, -1) || (o[1].value > 0xFFFF && !fits_signed(o[1].value))) {
+				break;
+			}
+			emit_i(as, op->op, 0, o[0].reg, o[1].value);
+			return TRUE;
+		case F_MEM:
+			if (n != 2 || o[0].kind != OP_REG || o[1].kind == OP_REG) {
+				break;
+			}
+			if (o[1].kind == OP_MEM && o[1].symbol == NO_SYMBOL && o[1].value <= 0xFFFF) {
+				emit_i(as, op->op, o[1].reg, o[0].reg, o[1].value);
+				return TRUE;
+			}
+			/* a label, a negative or a large offset: $at = high half (+ base), then the low half */
+			emit_i_fixup(as, FIX_HI, 0x0F, 0, REG_AT, o[1].symbol, o[1].value);
+			if (o[1].kind == OP_MEM && o[1].reg != REG_ZERO) {
+				emit_r(as, REG_AT, o[1].reg, REG_AT, 0, 0x21);
+			}
+			emit_i_fixup(as, FIX_LO, op->op, REG_AT, o[0].reg, o[1].symbol, o[1].value);
+			return TRUE;
+		case F_LI:
+			if (!KINDS(OP_REG, OP_IMM, -1)) {
+				break;
+			}
+			emit_li(as, o[0].reg, o[1].value);
+			return TRUE;
+		case F_LA:
+			if (KINDS(OP_REG, OP_IMM, -1)) {
+				emit_li(as, o[0].reg, o[1].value);
+				return TRUE;
+			}
+			if (!KINDS(OP_REG, OP_SYM, -1)) {
+				break;
+			}
+			emit_i_fixup(as, FIX_HI, 0x0F, 0, o[0].reg, o[1].symbol, o[1].value);
+			emit_i_fixup(as, FIX_LO, 0x0D, o[0].reg, o[0].reg, o[1].symbol, o[1].value);
+			return TRUE;
+		case F_MOVE:
+			if (!KINDS(OP_REG, OP_REG, -1)) {
+				break;
+			}
+			emit_r(as, o[1].reg, REG_ZERO, o[0].reg, 0, 0x21);
+			return TRUE;
+		case F_NOP:
+			if (n != 0) {
+				break;
+			}
+			emit(as, 0);
+			return TRUE;
+		case F_B:
+			if (n != 1 || (o[0].kind != OP_SYM && o[0].kind != OP_IMM)) {
+				break;
+			}
+			emit_branch(as, 0x04, REG_ZERO, REG_ZERO, &o[0]);
+			return TRUE;
+		case F_BEQZ:
+			if (n != 2 || o[0].kind != OP_REG || (o[1].kind != OP_SYM && o[1].kind != OP_IMM)) {
+				break;
+			}
+			emit_branch(as, op->op, o[0].reg, REG_ZERO, &o[1]);
+			return TRUE;
+		case F_BCMP:
+			if (n != 3 || o[0].kind != OP_REG || (o[2].kind != OP_SYM && o[2].kind != OP_IMM)) {
+				break;
+			}
+			if (o[1].kind == OP_IMM) {
+				emit_li(as, REG_AT, o[1].value);
+				o[1].reg = REG_AT;
+			} else if (o[1].kind != OP_REG) {
+				break;
+			}
+			/* blt: slt a, b; bgt: slt b, a; bge and ble branch when that is 0 */
+			rt = (op->op & 1) ? o[0].reg : o[1].reg;
+			emit_r(as, (op->op & 1) ? o[1].reg : o[0].reg, rt, REG_AT, 0, 0x2A);
+			emit_branch(as, (op->op & 2) ? 0x04 : 0x05, REG_AT, REG_ZERO, &o[2]);
+			return TRUE;
+		case F_NOT:
+			if (!KINDS(OP_REG, OP_REG, -1)) {
+				break;
+			}
+			emit_r(as, o[1].reg, REG_ZERO, o[0].reg, 0, 0x27);
+			return TRUE;
+		case F_NEG:
+			if (!KINDS(OP_REG, OP_REG, -1)) {
+				break;
+			}
+			emit_r(as, REG_ZERO, o[1].reg, o[0].reg, 0, 0x22);
+			return TRUE;
+		case F_MUL:
+			if (!KINDS(OP_REG, OP_REG, OP_REG)) {
+				break;
+			}
+			emit_r(as, o[1].reg, o[2].reg, 0, 0, 0x18);
+			emit_r(as, 0, 0, o[0].reg, 0, 0x12);
+			return TRUE;
+	}
+#undef KINDS
+	return asm_error(as, "bad operands for", op->name);
+}
+
+/***************************************************************/
+/* Directives                                                          */
+/***************************************************************/
+static int string_literal(assembler_t *as, const char *s, int terminate)
+{
+	char c;
+
+	if (*s++ != '"') {
+		return asm_error(as, "expected a string", NULL);
+	}
+	for (; *s != '"'; s++) {
+		c = *s;
+		if (c == '\0') {
+			return asm_error(as, "unterminated string", NULL);
+		}
+		if (c == '\\') {
+			switch (*++s) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '0': c = '\0'; break;
+				case '\\': c = '\\'; break;
+				case '"': c = '"'; break;
+				default:
+					return asm_error(as, "unknown escape in a string", NULL);
+			}
+		}
+		data_bytes(as, &c, 1);
+	}
+	while (isspace((unsigned char)*++s));
+	if (*s != '\0') {
+		return asm_error(as, "junk after a string", NULL);
+	}
+	if (terminate) {
+		data_bytes(as, "", 1);
+	}
+	return TRUE;
+}
+
+/* .word/.half/.byte items: values, labels (.word only) or value:count */
+static int data_items(assembler_t *as, char *args, int size)
+{
+	operand_t o;
+	uint32_t count, i;
+	char *item, *colon;
+
+	for (item = strtok(args, ", \t"); item != NULL; item = strtok(NULL, ", \t")) {
+		count = 1;
+		colon = strchr(item, ':');
+		if (colon != NULL) {
+			*colon = '\0';
+			if (!parse_number(colon + 1, &count)) {
+				return asm_error(as, "bad repeat count", colon + 1);
+			}
+		}
+		if (!parse_value(as, item, &o)) {
+			return asm_error(as, "bad value", item);
+		}
+		if (o.kind == OP_SYM && size != 4) {
+			return asm_error(as, "a label needs a .word:", item);
+		}
+		for (i = 0; i < count; i++) {
+			if (o.kind == OP_SYM) {
+				add_fixup(as, FIX_WORD, o.symbol, o.value);
+			}
+			if (as->section == SECTION_TEXT) {
+				emit(as, o.kind == OP_SYM ? 0 : o.value);
+			} else {
+				data_value(as, o.kind == OP_SYM ? 0 : o.value, size);
+			}
+		}
+	}
+	return TRUE;
+}
+
+static int directive(assembler_t *as, const char *name, char *args)
+{
+	uint32_t n;
+
+	if (strcmp(name, ".text") == 0 || strcmp(name, ".data") == 0) {
+		if (*args != '\0') {
+			return asm_error(as, "sections start at their default address:", args);
+		}
+		bind_labels(as);
+		as->section = (name[1] == 't') ? SECTION_TEXT : SECTION_DATA;
+		return TRUE;
+	}
+	if (strcmp(name, ".globl") == 0 || strcmp(name, ".global") == 0 || strcmp(name, ".extern") == 0
+		|| strcmp(name, ".ent") == 0 || strcmp(name, ".end") == 0 || strcmp(name, ".set") == 0) {
+		return TRUE;
+	}
+	if (strcmp(name, ".word") == 0 || strcmp(name, ".half") == 0 || strcmp(name, ".byte") == 0) {
+		n = (name[1] == 'w') ? 4 : (name[1] == 'h') ? 2 : 1;
+		if (as->section == SECTION_TEXT && n != 4) {
+			return asm_error(as, "only .word in .text:", name);
+		}
+		align(as, n);
+		bind_labels(as);
+		return data_items(as, args, n);
+	}
+	if (as->section == SECTION_TEXT) {
+		return asm_error(as, "only allowed in .data:", name);
+	}
+	if (strcmp(name, ".ascii") == 0 || strcmp(name, ".asciiz") == 0) {
+		bind_labels(as);
+		return string_literal(as, args, name[6] == 'z');
+	}
+	if (strcmp(name, ".space") == 0) {
+		if (!parse_number(args, &n) || n > MEM_PAGE_SIZE * 4096) {
+			return asm_error(as, "bad .space size", args);
+		}
+		bind_labels(as);
+		data_bytes(as, NULL, n);
+		return TRUE;
+	}
+	if (strcmp(name, ".align") == 0) {
+		if (!parse_number(args, &n) || n > 12) {
+			return asm_error(as, "bad .align", args);
+		}
+		align(as, 1u << n);
+		return TRUE;
+	}
+	return asm_error(as, "unknown directive", name);
+}
+
+/***************************************************************/
+/* One source line: labels, then a directive or an instruction         */
+/***************************************************************/
+static void assemble_line(assembler_t *as, char *s)
+{
+	char *p, *name, *args, *words[ASM_OPERANDS_MAX + 1];
+	operand_t o[ASM_OPERANDS_MAX];
+	int in_string = FALSE, n = 0, i;
+	size_t k;
+
+	/* strip the comment */
+	for (p = s; *p; p++) {
+		if (*p == '"' && (p == s || p[-1] != '\\')) {
+			in_string = !in_string;
+		} else if (*p == '#' && !in_string) {
+			*p = '\0';
+			break;
+		}
+	}
+
+	while (1) {
+		while (isspace((unsigned char)*s)) {
+			s++;
+		}
+		if (*s == '\0') {
+			return;
+		}
+		name = s;
+		while (*s && !isspace((unsigned char)*s) && *s != ':') {
+			s++;
+		}
+		if (*s != ':') {
+			break;
+		}
+		*s++ = '\0';
+		if (!is_name(name)) {
+			asm_error(as, "bad label", name);
+			return;
+		}
+		define_label(as, name);
+	}
+	if (*s != '\0') {
+		*s++ = '\0';
+	}
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+	args = s;
+	for (p = args + strlen(args); p > args && isspace((unsigned char)p[-1]); p--);
+	*p = '\0';
+
+	if (name[0] == '.') {
+		directive(as, name, args);
+		return;
+	}
+
+	for (k = 0; k < sizeof(OPS) / sizeof(OPS[0]); k++) {
+		if (strcmp(OPS[k].name, name) == 0) {
+			break;
+		}
+	}
+	if (k == sizeof(OPS) / sizeof(OPS[0])) {
+		asm_error(as, "unknown instruction", name);
+		return;
+	}
+	if (as->section != SECTION_TEXT) {
+		asm_error(as, "instruction outside .text:", name);
+		return;
+	}
+
+	/* operands are separated by commas or blanks; "4 ($sp)" is one */
+	for (p = strtok(args, ", \t"); p != NULL; p = strtok(NULL, ", \t")) {
+		if (p[0] == '(' && n > 0 && words[n - 1] + strlen(words[n - 1]) + 1 == p) {
+			memmove(words[n - 1] + strlen(words[n - 1]), p, strlen(p) + 1);
+			continue;
+		}
+		if (n == ASM_OPERANDS_MAX) {
+			asm_error(as, "too many operands for", name);
+			return;
+		}
+		words[n++] = p;
+	}
+	for (i = 0; i < n; i++) {
+		if (!parse_operand(as, words[i], &o[i])) {
+			asm_error(as, "bad operand", words[i]);
+			return;
+		}
+	}
+	bind_labels(as);
+	assemble(as, &OPS[k], o, n);
+}
+
+/***************************************************************/
+/* Patch every reference now that all labels are known                 */
+/***************************************************************/
+static void resolve(assembler_t *as)
+{
+	fixup_t *f;
+	asm_symbol_t *sym;
+	uint32_t i, target, pc, *word, value;
+	int32_t offset;
+
+	for (i = 0; i < as->num_fixups; i++) {
+		f = &as->fixups[i];
+		sym = &as->symbols[f->symbol];
+		as->line = f->line;
+		if (!sym->defined) {
+			asm_error(as, "undefined label", sym->name);
+			continue;
+		}
+		target = sym->address + f->addend;
+		if (f->section == SECTION_DATA) {
+			as->data[f->offset] = target;
+			as->data[f->offset + 1] = target >> 8;
+			as->data[f->offset + 2] = target >> 16;
+			as->data[f->offset + 3] = target >> 24;
+			continue;
+		}
+		word = &as->text[f->offset / 4];
+		pc = MEM_TEXT_BEGIN + f->offset;
+		switch (f->kind) {
+			case FIX_BRANCH:
+				offset = (int32_t)(target - pc) >> 2;
+				if ((target & 0x3) || offset < -32768 || offset > 32767) {
+					asm_error(as, "branch out of range:", sym->name);
+				}
+				value = offset & 0xFFFF;
+				break;
+			case FIX_JUMP:
+				if ((target & 0x3) || (target & 0xF0000000) != (pc & 0xF0000000)) {
+					asm_error(as, "jump out of range:", sym->name);
+				}
+				value = (target >> 2) & 0x3FFFFFF;
+				break;
+			case FIX_HI:
+				value = target >> 16;
+				break;
+			case FIX_LO:
+				value = target & 0xFFFF;
+				break;
+			default:
+				*word = target;
+				continue;
+		}
+		*word |= value;
+	}
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+	return strcmp(((const mips_symbol_t *)a)->name, ((const mips_symbol_t *)b)->name);
+}
+
+/***************************************************************/
+/* Assemble len bytes of source into image; path is for the messages.  */
+/* Returns FALSE after printing the errors.                            */
+/***************************************************************/
+int asm_parse(mips_image_t *image, const uint8_t *p, size_t len, const char *path)
+{
+	assembler_t as;
+	char line[ASM_LINE_MAX];
+	const uint8_t *end = p + len, *eol;
+	uint32_t i, main_symbol, *words;
+
+	memset(&as, 0, sizeof(as));
+	as.path = path;
+	as.section = SECTION_TEXT;
+
+	while (p < end) {
+		as.line++;
+		eol = memchr(p, '\n', end - p);
+		if (eol == NULL) {
+			eol = end;
+		}
+		if (eol - p >= ASM_LINE_MAX) {
+			asm_error(&as, "line too long", NULL);
+		} else {
+			memcpy(line, p, eol - p);
+			line[eol - p] = '\0';
+			assemble_line(&as, line);
+		}
+		p = eol + 1;
+	}
+	bind_labels(&as);
+	/* running off the end of the text exits, as SPIM's startup code does */
+	as.section = SECTION_TEXT;
+	emit_li(&as, REG_V0, 10);
+	emit_r(&as, REG_ZERO, REG_ZERO, REG_ZERO, 0, 0x0C);	/* syscall */
+	resolve(&as);
+
+	if (as.errors == 0) {
+		image->base = MEM_TEXT_BEGIN;
+		image->size = as.text_size;
+		image->words = as.text ? as.text : calloc(1, sizeof(uint32_t));
+		as.text = NULL;
+		if (as.data_size > 0) {
+			data_bytes(&as, NULL, -as.data_size & 0x3);
+			words = malloc(as.data_size);
+			if (words == NULL) {
+				printf("Error: out of memory assembling a program\n");
+				exit(-1);
+			}
+			for (i = 0; i < as.data_size / 4; i++) {
+				words[i] = as.data[4 * i] | (as.data[4 * i + 1] << 8) | (as.data[4 * i + 2] << 16)
+					| ((uint32_t)as.data[4 * i + 3] << 24);
+			}
+			mips_image_add_data(image, MEM_DATA_BEGIN, words, as.data_size / 4);
+			free(words);
+		}
+		image->symbols = malloc((as.num_symbols ? as.num_symbols : 1) * sizeof(mips_symbol_t));
+		if (image->words == NULL || image->symbols == NULL) {
+			printf("Error: out of memory assembling a program\n");
+			exit(-1);
+		}
+		for (i = 0; i < as.num_symbols; i++) {
+			image->symbols[i].name = as.symbols[i].name;
+			image->symbols[i].address = as.symbols[i].address;
+		}
+		image->num_symbols = as.num_symbols;
+		qsort(image->symbols, image->num_symbols, sizeof(mips_symbol_t), compare_symbols);
+		image->entry = MEM_TEXT_BEGIN;
+		if (mips_image_symbol(image, "main", &main_symbol)) {
+			image->entry = main_symbol;
+		}
+	} else {
+		if (as.errors > ASM_MAX_ERRORS) {
+			printf("Error: %s: %d more errors\n", path, as.errors - ASM_MAX_ERRORS);
+		}
+		for (i = 0; i < as.num_symbols; i++) {
+			free(as.symbols[i].name);
+		}
+	}
+	free(as.text);
+	free(as.data);
+	free(as.symbols);
+	free(as.hash);
+	free(as.fixups);
+	return as.errors == 0;
+}
+
+int mips_image_symbol(const mips_image_t *image, const char *name, uint32_t *address)
+{
+	mips_symbol_t key, *found;
+
+	if (image->num_symbols == 0) {
+		return FALSE;
+	}
+	key.name = (char *)name;
+	found = bsearch(&key, image->symbols, image->num_symbols, sizeof(mips_symbol_t), compare_symbols);
+	if (found == NULL) {
+		return FALSE;
+	}
+	*address = found->address;
+	return TRUE;
+}
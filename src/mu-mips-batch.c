@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* mu-mips-batch: run every program of a manifest to completion on all */
+/* cores and write the final registers of each one as JSON.              */
+/*                                                                                                                  */
+/* One manifest line per run: a program file followed by optional initial  */
+/* register settings, applied after loading like the input/high/low       */
+/* commands. '#' starts a comment.                                                            */
+/*                                                                                                                  */
+/*   ../inputs/test1.in                                                                         */
+/*   ../inputs/test2.in  r4=10 r5=0x20 hi=1 lo=-1                                 */
+/*                                                                                                                  */
+/* Runs are spread over the worker threads in contiguous ranges; a worker */
+/* whose range is empty steals half of the largest remaining range of     */
+/* another worker. Each worker reuses one mips_sim_t, and runs of the same */
+/* program share its mips_image_t.                                                      */
+/*                                                                                                                  */
+/* With -l n the runs of each program go in groups of n that a worker     */
+/* executes together on a mips_lanes_t, n inputs per vector operation;   */
+/* the groups are what the workers share out then. -r writes every run's */
+/* registers the way the simulator's rdump command shows them instead of */
+/* JSON.                                                                                                           */
+/***************************************************************/
+
+#define BATCH_MAX_SETTINGS (MIPS_REGS + 2)
+#define BATCH_MAX_WORKERS 1024
+
+typedef struct {
+	int reg;
+	uint32_t value;
+} batch_setting_t;
+
+typedef struct {
+	/* from the manifest */
+	char *program;
+	int line;
+	uint32_t first;			/* index of the first job of the same program */
+	mips_image_t *image;		/* NULL if the program can't be read */
+	batch_setting_t settings[BATCH_MAX_SETTINGS];
+	int num_settings;
+	/* results */
+	uint64_t instructions;
+	int halted;
+	uint32_t regs[MIPS_SIM_PC + 1];
+} batch_job_t;
+
+/* -l: jobs ORDER[first..first+count) run together, all of one program */
+typedef struct {
+	uint32_t first, count;
+} batch_group_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t head, tail;		/* jobs (or groups) [head, tail) not started yet */
+} batch_queue_t;
+
+typedef struct {
+	int id;
+	pthread_t thread;
+} batch_worker_t;
+
+static batch_job_t *JOBS;
+static uint32_t NUM_JOBS;
+static uint32_t *ORDER;			/* -l: job indices, grouped by program */
+static batch_group_t *GROUPS;
+static uint32_t NUM_GROUPS, NUM_LANES;
+static batch_queue_t *QUEUES;
+static int NUM_WORKERS;
+static int BATCH_ENGINE = ENGINE_THREADED;
+static uint64_t BATCH_MAX_INSTRUCTIONS = UINT64_MAX;
+
+/***************************************************************/
+/* Parse "r4=10", "hi=0x10", "lo=-1". Returns FALSE if malformed.     */
+/***************************************************************/
+static int parse_setting(const char *text, batch_setting_t *s)
+{
+	const char *eq = strchr(text, '=');
+	char *end;
+	long reg;
+
+	if (eq == NULL || eq[1] == '\0') {
+		return FALSE;
+	}
+	if (strncmp(text, "hi=", 3) == 0 || strncmp(text, "HI=", 3) == 0) {
+		s->reg = MIPS_SIM_HI;
+	} else if (strncmp(text, "lo=", 3) == 0 || strncmp(text, "LO=", 3) == 0) {
+		s->reg = MIPS_SIM_LO;
+	} else {
+		if (*text == 'r' || *text == 'R' || *text == '$') {
+			text++;
+		}
+		reg = strtol(text, &end, 10);
+		if (end != eq || end == text || reg < 0 || reg >= MIPS_REGS) {
+			return FALSE;
+		}
+		s->reg = reg;
+	}
+	s->value = (uint32_t)strtoll(eq + 1, &end, 0);
+	return *end == '\0';
+}
+
+/***************************************************************/
+/* Parse an option argument that must be a whole number in [min, max], */
+/* decimal or 0x hex. Exits with a message naming the option if not.   */
+/***************************************************************/
+static uint64_t parse_option(int opt, const char *text, uint64_t min, uint64_t max)
+{
+	unsigned long long v;
+	char *end;
+
+	errno = 0;
+	v = strtoull(text, &end, 0);
+	if (!isdigit((unsigned char)text[0]) || *end != '\0' || errno != 0 || v < min || v > max) {
+		fprintf(stderr, "Error: -%c takes a number from %llu to %llu, not %s\n", opt,
+			(unsigned long long)min, (unsigned long long)max, text);
+		exit(1);
+	}
+	return v;
+}
+
+/***************************************************************/
+/* Read the manifest into JOBS, sharing one image per program file     */
+/***************************************************************/
+static void read_manifest(FILE *fp, const char *name)
+{
+	char *line = NULL, *token, *save;
+	size_t size = 0;
+	uint32_t capacity = 0, i;
+	int line_no = 0;
+	batch_job_t *job;
+
+	while (getline(&line, &size, fp) != -1) {
+		line_no++;
+		if (strchr(line, '#') != NULL) {
+			*strchr(line, '#') = '\0';
+		}
+		token = strtok_r(line, " \t\r\n", &save);
+		if (token == NULL) {
+			continue;
+		}
+		if (NUM_JOBS == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			JOBS = realloc(JOBS, capacity * sizeof(batch_job_t));
+			if (JOBS == NULL) {
+				printf("Error: out of memory reading %s\n", name);
+				exit(-1);
+			}
+		}
+		job = &JOBS[NUM_JOBS];
+		memset(job, 0, sizeof(*job));
+		job->program = strdup(token);
+		job->line = line_no;
+
+		while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if (job->num_settings == BATCH_MAX_SETTINGS || !parse_setting(token, &job->settings[job->num_settings])) {
+				fprintf(stderr, "Error: %s:%d: bad register setting %s\n", name, line_no, token);
+				exit(1);
+			}
+			job->num_settings++;
+		}
+
+		for (i = 0; i < NUM_JOBS; i++) {
+			if (strcmp(JOBS[i].program, job->program) == 0) {
+				break;
+			}
+		}
+		job->first = i;
+		job->image = (i < NUM_JOBS) ? JOBS[i].image : mips_image_load(job->program);
+		if (job->image != NULL && i < NUM_JOBS) {
+			mips_image_retain(job->image);
+		}
+		NUM_JOBS++;
+	}
+	free(line);
+}
+
+/***************************************************************/
+/* Take the next job of worker id, stealing when its own range is empty. */
+/* Returns FALSE once no work is left anywhere.                                       */
+/***************************************************************/
+static int next_job(int id, uint32_t *job)
+{
+	batch_queue_t *own = &QUEUES[id], *victim;
+	uint32_t best, n, stolen;
+	int i, v;
+
+	while (1) {
+		pthread_mutex_lock(&own->lock);
+		if (own->head < own->tail) {
+			*job = own->head++;
+			pthread_mutex_unlock(&own->lock);
+			return TRUE;
+		}
+		pthread_mutex_unlock(&own->lock);
+
+		/* pick the worker with the most work left; it may shrink before we lock it */
+		best = 0;
+		v = -1;
+		for (i = 0; i < NUM_WORKERS; i++) {
+			if (i == id) {
+				continue;
+			}
+			pthread_mutex_lock(&QUEUES[i].lock);
+			if (QUEUES[i].tail - QUEUES[i].head > best) {
+				best = QUEUES[i].tail - QUEUES[i].head;
+				v = i;
+			}
+			pthread_mutex_unlock(&QUEUES[i].lock);
+		}
+		if (v < 0) {
+			return FALSE;
+		}
+
+		/* never hold two locks: only this worker refills its own queue */
+		victim = &QUEUES[v];
+		pthread_mutex_lock(&victim->lock);
+		n = (victim->tail - victim->head + 1) / 2;
+		victim->tail -= n;
+		stolen = victim->tail;
+		pthread_mutex_unlock(&victim->lock);
+		if (n == 0) {
+			continue;
+		}
+		pthread_mutex_lock(&own->lock);
+		own->head = stolen;
+		own->tail = stolen + n;
+		pthread_mutex_unlock(&own->lock);
+	}
+}
+
+/***************************************************************/
+/* -l: split the jobs of every program into groups of NUM_LANES        */
+/***************************************************************/
+static int order_compare(const void *a, const void *b)
+{
+	const batch_job_t *x = &JOBS[*(const uint32_t *)a], *y = &JOBS[*(const uint32_t *)b];
+
+	if (x->first != y->first) {
+		return (x->first < y->first) ? -1 : 1;
+	}
+	return (*(const uint32_t *)a < *(const uint32_t *)b) ? -1 : 1;
+}
+
+static void make_groups()
+{
+	uint32_t i, count;
+
+	ORDER = malloc((NUM_JOBS + 1) * sizeof(uint32_t));
+	GROUPS = malloc((NUM_JOBS + 1) * sizeof(batch_group_t));
+	if (ORDER == NULL || GROUPS == NULL) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	for (i = 0; i < NUM_JOBS; i++) {
+		ORDER[i] = i;
+	}
+	qsort(ORDER, NUM_JOBS, sizeof(uint32_t), order_compare);
+	for (i = 0; i < NUM_JOBS; i += count) {
+		for (count = 1; count < NUM_LANES && i + count < NUM_JOBS; count++) {
+			if (JOBS[ORDER[i + count]].first != JOBS[ORDER[i]].first) {
+				break;
+			}
+		}
+		GROUPS[NUM_GROUPS].first = i;
+		GROUPS[NUM_GROUPS].count = count;
+		NUM_GROUPS++;
+	}
+}
+
+static void run_group(mips_lanes_t *lanes, const batch_group_t *group)
+{
+	mips_image_t *image = JOBS[ORDER[group->first]].image;
+	batch_job_t *job;
+	uint32_t lane;
+	int i;
+
+	if (image == NULL) {
+		return;
+	}
+	mips_lanes_load(lanes, image, group->count);
+	for (lane = 0; lane < group->count; lane++) {
+		job = &JOBS[ORDER[group->first + lane]];
+		for (i = 0; i < job->num_settings; i++) {
+			mips_lanes_set_reg(lanes, lane, job->settings[i].reg, job->settings[i].value);
+		}
+	}
+	mips_lanes_run(lanes, BATCH_MAX_INSTRUCTIONS);
+	for (lane = 0; lane < group->count; lane++) {
+		job = &JOBS[ORDER[group->first + lane]];
+		job->instructions = mips_lanes_instruction_count(lanes, lane);
+		job->halted = !mips_lanes_running(lanes, lane);
+		for (i = 0; i <= MIPS_SIM_PC; i++) {
+			job->regs[i] = mips_lanes_get_reg(lanes, lane, i);
+		}
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	batch_worker_t *w = arg;
+	mips_sim_t *sim = mips_sim_create();
+	mips_lanes_t *lanes = NULL;
+	batch_job_t *job;
+	uint32_t index;
+	int i;
+
+	if (NUM_LANES > 0) {
+		lanes = mips_lanes_create(NUM_LANES);
+	}
+	if (sim == NULL || (NUM_LANES > 0 && lanes == NULL)) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	mips_sim_set_engine(sim, BATCH_ENGINE);
+
+	while (lanes != NULL && next_job(w->id, &index)) {
+		run_group(lanes, &GROUPS[index]);
+	}
+	while (lanes == NULL && next_job(w->id, &index)) {
+		job = &JOBS[index];
+		if (job->image == NULL) {
+			continue;
+		}
+		mips_sim_load(sim, job->image);
+		for (i = 0; i < job->num_settings; i++) {
+			mips_sim_set_reg(sim, job->settings[i].reg, job->settings[i].value);
+		}
+		job->instructions = mips_sim_run(sim, BATCH_MAX_INSTRUCTIONS);
+		job->halted = !mips_sim_running(sim);
+		for (i = 0; i <= MIPS_SIM_PC; i++) {
+			job->regs[i] = mips_sim_get_reg(sim, i);
+		}
+	}
+	mips_lanes_destroy(lanes);
+	mips_sim_destroy(sim);
+	return NULL;
+}
+
+/***************************************************************/
+/* JSON output, one object per manifest line in manifest order          */
+/***************************************************************/
+static void json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(out, "\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(out, "\\u%04x", *s);
+		} else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static void write_json(FILE *out)
+{
+	batch_job_t *job;
+	uint32_t i;
+	int r;
+
+	fprintf(out, "[\n");
+	for (i = 0; i < NUM_JOBS; i++) {
+		job = &JOBS[i];
+		fprintf(out, "  {\"program\": ");
+		json_string(out, job->program);
+		fprintf(out, ", \"line\": %d", job->line);
+		if (job->image == NULL) {
+			fprintf(out, ", \"error\": \"can't open program file\"}");
+		} else {
+			fprintf(out, ", \"instructions\": %llu, \"halted\": %s, \"pc\": \"0x%08x\",\n   \"regs\": [",
+				(unsigned long long)job->instructions, job->halted ? "true" : "false", job->regs[MIPS_SIM_PC]);
+			for (r = 0; r < MIPS_REGS; r++) {
+				fprintf(out, "%s\"0x%08x\"", r ? ", " : "", job->regs[r]);
+			}
+			fprintf(out, "],\n   \"hi\": \"0x%08x\", \"lo\": \"0x%08x\"}", job->regs[MIPS_SIM_HI], job->regs[MIPS_SIM_LO]);
+		}
+		fprintf(out, "%s\n", i + 1 < NUM_JOBS ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+/***************************************************************/
+/* -r: every run like the rdump command, in manifest order              */
+/***************************************************************/
+static void write_rdump(FILE *out)
+{
+	batch_job_t *job;
+	uint32_t i;
+	int r;
+
+	for (i = 0; i < NUM_JOBS; i++) {
+		job = &JOBS[i];
+		fprintf(out, "-------------------------------------\n");
+		fprintf(out, "Dumping Register Content\n");
+		fprintf(out, "-------------------------------------\n");
+		fprintf(out, "Run\t: %s:%d%s\n", job->program, job->line, (job->image != NULL && !job->halted) ? " (stopped at -n)" : "");
+		if (job->image == NULL) {
+			fprintf(out, "Error\t: can't open program file\n");
+			continue;
+		}
+		fprintf(out, "# Instructions Executed\t: %llu\n", (unsigned long long)job->instructions);
+		fprintf(out, "PC\t: 0x%08x\n", job->regs[MIPS_SIM_PC]);
+		fprintf(out, "-------------------------------------\n");
+		fprintf(out, "[Register]\t[Value]\n");
+		fprintf(out, "-------------------------------------\n");
+		for (r = 0; r < MIPS_REGS; r++) {
+			fprintf(out, "[R%d]\t: 0x%08x\n", r, job->regs[r]);
+		}
+		fprintf(out, "-------------------------------------\n");
+		fprintf(out, "[HI]\t: 0x%08x\n", job->regs[MIPS_SIM_HI]);
+		fprintf(out, "[LO]\t: 0x%08x\n", job->regs[MIPS_SIM_LO]);
+		fprintf(out, "-------------------------------------\n");
+	}
+}
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *manifest, *out = stdout;
+	batch_worker_t *workers;
+	uint64_t total = 0;
+	uint32_t i, start;
+	double seconds;
+	int opt, w, failed = 0, rdump = FALSE;
+	uint32_t units;
+
+	NUM_WORKERS = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:e:n:o:l:r")) != -1) {
+		switch (opt) {
+			case 'j':
+				NUM_WORKERS = parse_option(opt, optarg, 1, BATCH_MAX_WORKERS);
+				break;
+			case 'e':
+				if (strcmp(optarg, "interp") == 0) {
+					BATCH_ENGINE = ENGINE_INTERP;
+				} else if (strcmp(optarg, "threaded") == 0) {
+					BATCH_ENGINE = ENGINE_THREADED;
+				} else if (strcmp(optarg, "jit") == 0) {
+					BATCH_ENGINE = ENGINE_JIT;
+				} else {
+					fprintf(stderr, "Error: unknown engine %s (interp, threaded, jit)\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'n':
+				BATCH_MAX_INSTRUCTIONS = parse_option(opt, optarg, 0, UINT64_MAX);
+				break;
+			case 'l':
+				NUM_LANES = parse_option(opt, optarg, 1, MIPS_LANES_MAX);
+				break;
+			case 'r':
+				rdump = TRUE;
+				break;
+			case 'o':
+				out = fopen(optarg, "w");
+				if (out == NULL) {
+					fprintf(stderr, "Error: Can't create %s\n", optarg);
+					exit(1);
+				}
+				break;
+			default:
+				exit(1);
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-j threads] [-e interp|threaded|jit] [-n max instructions] [-l lanes] [-r] [-o out] <manifest>\n", argv[0]);
+		exit(1);
+	}
+	if (NUM_WORKERS < 1) {
+		NUM_WORKERS = 1;
+	}
+
+	manifest = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+	if (manifest == NULL) {
+		fprintf(stderr, "Error: Can't open manifest %s\n", argv[optind]);
+		exit(1);
+	}
+	read_manifest(manifest, argv[optind]);
+	if (manifest != stdin) {
+		fclose(manifest);
+	}
+
+	units = NUM_JOBS;
+	if (NUM_LANES > 0) {
+		make_groups();
+		units = NUM_GROUPS;
+	}
+
+	QUEUES = calloc(NUM_WORKERS, sizeof(batch_queue_t));
+	workers = calloc(NUM_WORKERS, sizeof(batch_worker_t));
+	if (QUEUES == NULL || workers == NULL) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	for (w = 0, start = 0; w < NUM_WORKERS; w++) {
+		pthread_mutex_init(&QUEUES[w].lock, NULL);
+		QUEUES[w].head = start;
+		start += units / NUM_WORKERS + ((uint32_t)w < units % NUM_WORKERS);
+		QUEUES[w].tail = start;
+	}
+
+	seconds = now_seconds();
+	for (w = 0; w < NUM_WORKERS; w++) {
+		workers[w].id = w;
+		if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0) {
+			fprintf(stderr, "Error: can't start worker thread\n");
+			exit(-1);
+		}
+	}
+	for (w = 0; w < NUM_WORKERS; w++) {
+		pthread_join(workers[w].thread, NULL);
+	}
+	seconds = now_seconds() - seconds;
+
+	if (rdump) {
+		write_rdump(out);
+	} else {
+		write_json(out);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	for (i = 0; i < NUM_JOBS; i++) {
+		if (JOBS[i].image == NULL) {
+			fprintf(stderr, "Error: %s:%d: Can't open program file %s\n", argv[optind], JOBS[i].line, JOBS[i].program);
+			failed++;
+		}
+		total += JOBS[i].instructions;
+		mips_image_release(JOBS[i].image);
+		free(JOBS[i].program);
+	}
+	fprintf(stderr, "%u programs, %llu instructions in %.3f s (%.2f MIPS, %d threads", NUM_JOBS,
+		(unsigned long long)total, seconds, seconds > 0 ? total / seconds / 1e6 : 0.0, NUM_WORKERS);
+	if (NUM_LANES > 0) {
+		fprintf(stderr, ", %u groups of up to %u lanes, %s", NUM_GROUPS, NUM_LANES, mips_lanes_isa());
+	}
+	fprintf(stderr, ")\n");
+	free(ORDER);
+	free(GROUPS);
+	return failed ? 1 : 0;
+}
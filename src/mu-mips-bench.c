@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* mu-mips-bench: simulator speed on a fixed set of guest kernels       */
+/* (make bench). Every kernel runs to completion with tracing off on   */
+/* each engine, in a child process of its own so the peak RSS belongs */
+/* to that run alone. One JSON object per run goes to stdout:          */
+/*                                                                                                                  */
+/*   {"kernel": "fib", "engine": "jit", "instructions": 19320015,       */
+/*    "seconds": 0.101, "mips": 191.2, "ns_per_inst": 5.23,             */
+/*    "peak_rss_kb": 3412, "checksum": "0x3a4f01c2"}                    */
+/*                                                                                                                  */
+/* The checksum covers the final registers; it must be the same on     */
+/* every engine, and the exit status is 1 when it is not.              */
+/*                                                                                                                  */
+/* The kernels only use instructions the simulator implements. Stores  */
+/* are still no-ops, so bubblesort runs its compare/swap sequence over */
+/* data that never gets sorted: every pass does the same work. The     */
+/* selfmod kernel rewrites its own text through ll/sc, the one store   */
+/* that does reach memory.                                             */
+/***************************************************************/
+
+#define BENCH_TARGET 20000000.0	/* guest instructions per kernel at -s 1 */
+#define BENCH_MAX_ENGINES 3
+
+/* registers */
+#define ZERO	0
+#define V0	2
+#define A0	4
+#define A1	5
+#define T0	8
+#define T1	9
+#define T2	10
+#define T3	11
+#define S0	16
+#define S1	17
+#define S2	18
+#define S3	19
+#define S4	20
+#define S5	21
+#define S6	22
+#define S7	23
+#define RA	31
+
+#define OP_R(fn, rd, rs, rt, sa) (((rs) << 21) | ((rt) << 16) | ((rd) << 11) | ((sa) << 6) | (fn))
+#define OP_I(op, rt, rs, imm) (((op) << 26) | ((rs) << 21) | ((rt) << 16) | ((imm) & 0xFFFF))
+
+#define ADD(rd, rs, rt)		OP_R(0x20, rd, rs, rt, 0)
+#define XOR(rd, rs, rt)		OP_R(0x26, rd, rs, rt, 0)
+#define SLT(rd, rs, rt)		OP_R(0x2A, rd, rs, rt, 0)
+#define SLL(rd, rt, sa)		OP_R(0x00, rd, 0, rt, sa)
+#define SRL(rd, rt, sa)		OP_R(0x02, rd, 0, rt, sa)
+#define MULT(rs, rt)		OP_R(0x18, 0, rs, rt, 0)
+#define DIV(rs, rt)		OP_R(0x1A, 0, rs, rt, 0)
+#define MFHI(rd)		OP_R(0x10, rd, 0, 0, 0)
+#define MFLO(rd)		OP_R(0x12, rd, 0, 0, 0)
+#define JR(rs)			OP_R(0x08, 0, rs, 0, 0)
+#define SYSCALL			OP_R(0x0C, 0, 0, 0, 0)
+#define ADDI(rt, rs, imm)	OP_I(0x08, rt, rs, imm)
+#define ADDIU(rt, rs, imm)	OP_I(0x09, rt, rs, imm)
+#define ANDI(rt, rs, imm)	OP_I(0x0C, rt, rs, imm)
+#define ORI(rt, rs, imm)	OP_I(0x0D, rt, rs, imm)
+#define LUI(rt, imm)		OP_I(0x0F, rt, 0, imm)
+#define LW(rt, imm, rs)		OP_I(0x23, rt, rs, imm)
+#define SW(rt, imm, rs)		OP_I(0x2B, rt, rs, imm)
+#define LL(rt, imm, rs)		OP_I(0x30, rt, rs, imm)
+#define SC(rt, imm, rs)		OP_I(0x38, rt, rs, imm)
+
+/***************************************************************/
+/* A kernel under construction. Branch offsets are counted from the   */
+/* branch itself, as the simulator does.                              */
+/***************************************************************/
+typedef struct {
+	uint32_t words[256];
+	uint32_t n;
+	uint32_t *data;
+	uint32_t data_size;
+} bench_asm_t;
+
+typedef struct {
+	const char *name;
+	void (*build)(bench_asm_t *a, uint32_t size, uint32_t reps);
+	uint32_t size;			/* kernel specific: array length, ... */
+	double per_rep;			/* guest instructions per repetition, roughly */
+} bench_kernel_t;
+
+typedef struct {
+	uint64_t instructions;
+	double seconds;
+	uint32_t checksum;
+} bench_result_t;
+
+static void emit(bench_asm_t *a, uint32_t word)
+{
+	a->words[a->n++] = word;
+}
+
+static void li(bench_asm_t *a, int rt, uint32_t value)
+{
+	emit(a, LUI(rt, value >> 16));
+	emit(a, ORI(rt, rt, value & 0xFFFF));
+}
+
+/* branch to the instruction at index target */
+static void branch(bench_asm_t *a, int op, int rs, int rt, uint32_t target)
+{
+	emit(a, OP_I(op, rt, rs, target - a->n));
+}
+
+#define BEQ(a, rs, rt, target)	branch(a, 0x04, rs, rt, target)
+#define BNE(a, rs, rt, target)	branch(a, 0x05, rs, rt, target)
+#define BGTZ(a, rs, target)	branch(a, 0x07, rs, 0, target)
+
+static void patch_branch(bench_asm_t *a, uint32_t at, uint32_t target)
+{
+	a->words[at] = (a->words[at] & 0xFFFF0000) | ((target - at) & 0xFFFF);
+}
+
+static void patch_jal(bench_asm_t *a, uint32_t at, uint32_t target)
+{
+	a->words[at] = (0x03 << 26) | (((MEM_TEXT_BEGIN + 4 * target) >> 2) & 0x3FFFFFF);
+}
+
+static void halt(bench_asm_t *a)
+{
+	emit(a, ADDIU(V0, ZERO, 10));
+	emit(a, SYSCALL);
+}
+
+static void random_data(bench_asm_t *a, uint32_t size)
+{
+	uint32_t i, x = 2463534242u;
+
+	a->data = malloc(size * sizeof(uint32_t));
+	if (a->data == NULL) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	for (i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		a->data[i] = x & 0xFFFF;
+	}
+	a->data_size = size;
+}
+
+/***************************************************************/
+/* Bubble sort of size words in the data segment, without early exit   */
+/***************************************************************/
+static void build_bubblesort(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t rep, outer, inner, skip;
+
+	random_data(a, size);
+	li(a, S3, reps);
+	rep = a->n;
+	li(a, S0, size - 1);
+	outer = a->n;
+	li(a, S1, MEM_DATA_BEGIN);
+	emit(a, ADD(S2, S0, ZERO));
+	inner = a->n;
+	emit(a, LW(T0, 0, S1));
+	emit(a, LW(T1, 4, S1));
+	emit(a, SLT(T2, T1, T0));
+	skip = a->n;
+	BEQ(a, T2, ZERO, 0);
+	emit(a, SW(T0, 4, S1));
+	emit(a, SW(T1, 0, S1));
+	emit(a, ADDIU(S4, S4, 1));
+	patch_branch(a, skip, a->n);
+	emit(a, ADDIU(S1, S1, 4));
+	emit(a, ADDI(S2, S2, -1));
+	BGTZ(a, S2, inner);
+	emit(a, ADDI(S0, S0, -1));
+	BGTZ(a, S0, outer);
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+}
+
+/***************************************************************/
+/* Iterative Fibonacci up to F(size), one call per step                  */
+/***************************************************************/
+static void build_fib(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t rep, loop, step;
+
+	li(a, S3, reps);
+	rep = a->n;
+	emit(a, ADDIU(A0, ZERO, 0));
+	emit(a, ADDIU(A1, ZERO, 1));
+	emit(a, ADDIU(S0, ZERO, size));
+	loop = a->n;
+	emit(a, 0);			/* jal step, patched below */
+	emit(a, ADDI(S0, S0, -1));
+	BGTZ(a, S0, loop);
+	emit(a, ADD(S4, S4, A0));
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+
+	step = a->n;
+	emit(a, ADD(T0, A0, A1));
+	emit(a, ADD(A0, A1, ZERO));
+	emit(a, ADD(A1, T0, ZERO));
+	emit(a, JR(RA));
+	patch_jal(a, loop, step);
+}
+
+/***************************************************************/
+/* Sum size words of data, four loads per iteration                       */
+/***************************************************************/
+static void build_stream(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t rep, loop;
+
+	random_data(a, size);
+	li(a, S3, reps);
+	rep = a->n;
+	li(a, S1, MEM_DATA_BEGIN);
+	li(a, S2, MEM_DATA_BEGIN + 4 * size);
+	loop = a->n;
+	emit(a, LW(T0, 0, S1));
+	emit(a, LW(T1, 4, S1));
+	emit(a, LW(T2, 8, S1));
+	emit(a, LW(T3, 12, S1));
+	emit(a, ADD(S4, S4, T0));
+	emit(a, ADD(S4, S4, T1));
+	emit(a, ADD(S4, S4, T2));
+	emit(a, ADD(S4, S4, T3));
+	emit(a, ADDIU(S1, S1, 16));
+	BNE(a, S1, S2, loop);
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+}
+
+/***************************************************************/
+/* Branches on xorshift bits: taken 1/2, 3/4 and data dependent,     */
+/* size rounds per repetition                                        */
+/***************************************************************/
+static void build_branchy(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t rep, loop, skip;
+
+	li(a, S0, 0x2545F491);
+	li(a, S3, reps);
+	rep = a->n;
+	emit(a, ADDIU(S2, ZERO, size));
+	loop = a->n;
+	emit(a, SLL(T0, S0, 13));
+	emit(a, XOR(S0, S0, T0));
+	emit(a, SRL(T0, S0, 17));
+	emit(a, XOR(S0, S0, T0));
+	emit(a, SLL(T0, S0, 5));
+	emit(a, XOR(S0, S0, T0));
+	emit(a, ANDI(T1, S0, 1));
+	skip = a->n;
+	BEQ(a, T1, ZERO, 0);
+	emit(a, ADDIU(S4, S4, 1));
+	patch_branch(a, skip, a->n);
+	emit(a, ANDI(T1, S0, 6));
+	skip = a->n;
+	BNE(a, T1, ZERO, 0);
+	emit(a, ADDIU(S5, S5, 3));
+	patch_branch(a, skip, a->n);
+	emit(a, SLT(T2, S0, S6));
+	emit(a, ADD(S6, S0, ZERO));
+	skip = a->n;
+	BEQ(a, T2, ZERO, 0);
+	emit(a, ADDIU(S7, S7, 1));
+	patch_branch(a, skip, a->n);
+	emit(a, ADDI(S2, S2, -1));
+	BGTZ(a, S2, loop);
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+}
+
+/***************************************************************/
+/* An LCG through mult, then a divide by its low byte, size steps    */
+/* per repetition                                                    */
+/***************************************************************/
+static void build_muldiv(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t rep, loop;
+
+	li(a, S0, 12345);
+	li(a, S1, 1103515245);
+	li(a, S3, reps);
+	rep = a->n;
+	emit(a, ADDIU(S2, ZERO, size));
+	loop = a->n;
+	emit(a, MULT(S0, S1));
+	emit(a, MFLO(T0));
+	emit(a, MFHI(T1));
+	emit(a, ADDIU(S0, T0, 12345));
+	emit(a, ANDI(T2, S0, 0xFF));
+	emit(a, ORI(T2, T2, 1));
+	emit(a, DIV(S0, T2));
+	emit(a, MFLO(T3));
+	emit(a, MFHI(T1));
+	emit(a, ADD(S4, S4, T3));
+	emit(a, XOR(S5, S5, T1));
+	emit(a, ADDI(S2, S2, -1));
+	BGTZ(a, S2, loop);
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+}
+
+/***************************************************************/
+/* Self-modifying code: every iteration an sc flips the immediate of */
+/* the addi right behind it, so each engine has to drop the code it  */
+/* translated in the middle of a block; size flips per repetition    */
+/***************************************************************/
+static void build_selfmod(bench_asm_t *a, uint32_t size, uint32_t reps)
+{
+	uint32_t at, rep, loop;
+
+	at = a->n;
+	li(a, S1, 0);			/* address of the addi, patched below */
+	li(a, S2, ADDI(S4, S4, 1) ^ ADDI(S4, S4, 2));
+	li(a, S3, reps);
+	rep = a->n;
+	emit(a, ADDIU(S6, ZERO, size));
+	loop = a->n;
+	emit(a, LL(T0, 0, S1));
+	emit(a, XOR(T0, T0, S2));
+	emit(a, SC(T0, 0, S1));
+	emit(a, ADD(S5, S5, T0));
+	a->words[at] = LUI(S1, (MEM_TEXT_BEGIN + 4 * a->n) >> 16);
+	a->words[at + 1] = ORI(S1, S1, (MEM_TEXT_BEGIN + 4 * a->n) & 0xFFFF);
+	emit(a, ADDI(S4, S4, 1));
+	emit(a, ADDI(S6, S6, -1));
+	BGTZ(a, S6, loop);
+	emit(a, ADDI(S3, S3, -1));
+	BGTZ(a, S3, rep);
+	halt(a);
+}
+
+static const bench_kernel_t KERNELS[] = {
+	{ "bubblesort-64", build_bubblesort, 64, 4.0 * 64 * 64 },
+	{ "bubblesort-256", build_bubblesort, 256, 4.0 * 256 * 256 },
+	{ "bubblesort-1024", build_bubblesort, 1024, 4.0 * 1024 * 1024 },
+	{ "fib", build_fib, 46, 46 * 7 + 7 },
+	{ "stream", build_stream, 1 << 20, (1 << 20) / 4 * 10 },
+	{ "branchy", build_branchy, 64, 64 * 17 + 3 },
+	{ "muldiv", build_muldiv, 64, 64 * 13 + 3 },
+	{ "selfmod", build_selfmod, 64, 64 * 7 + 3 },
+};
+#define NUM_KERNELS (sizeof(KERNELS) / sizeof(KERNELS[0]))
+
+static const char *ENGINE_NAMES[] = { "interp", "threaded", "jit" };
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/***************************************************************/
+/* Build, load and run one kernel (in the child process)                */
+/***************************************************************/
+static bench_result_t run_kernel(const bench_kernel_t *k, int engine, double scale)
+{
+	bench_asm_t a;
+	bench_result_t r;
+	mips_image_t *image;
+	mips_sim_t *sim;
+	double reps = BENCH_TARGET * scale / k->per_rep;
+	int i;
+
+	memset(&a, 0, sizeof(a));
+	k->build(&a, k->size, reps < 1 ? 1 : (uint32_t)reps);
+	image = mips_image_create(MEM_TEXT_BEGIN, MEM_TEXT_BEGIN, a.words, a.n);
+	if (a.data != NULL) {
+		mips_image_add_data(image, MEM_DATA_BEGIN, a.data, a.data_size);
+		free(a.data);
+	}
+	sim = mips_sim_create();
+	if (sim == NULL) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	mips_sim_set_engine(sim, engine);
+	mips_sim_load(sim, image);
+
+	r.seconds = now_seconds();
+	r.instructions = mips_sim_run(sim, UINT64_MAX);
+	r.seconds = now_seconds() - r.seconds;
+
+	r.checksum = 0;
+	for (i = 0; i <= MIPS_SIM_LO; i++) {
+		r.checksum = (r.checksum ^ mips_sim_get_reg(sim, i)) * 16777619u;
+	}
+	mips_sim_destroy(sim);
+	mips_image_release(image);
+	return r;
+}
+
+/***************************************************************/
+/* Run one kernel in a child; its result comes back through a pipe and */
+/* its peak RSS from wait4(). FALSE if the child failed.                  */
+/***************************************************************/
+static int run_child(const bench_kernel_t *k, int engine, double scale, bench_result_t *r, long *rss_kb)
+{
+	struct rusage usage;
+	int fds[2], status, got;
+	pid_t pid;
+
+	if (pipe(fds) != 0) {
+		return FALSE;
+	}
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		return FALSE;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		*r = run_kernel(k, engine, scale);
+		_exit(write(fds[1], r, sizeof(*r)) == sizeof(*r) ? 0 : 1);
+	}
+	close(fds[1]);
+	got = read(fds[0], r, sizeof(*r));
+	close(fds[0]);
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || got != sizeof(*r)) {
+		return FALSE;
+	}
+	*rss_kb = usage.ru_maxrss;
+	return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *out = stdout;
+	bench_result_t r;
+	const char *only = NULL;
+	double scale = 1.0;
+	char *end;
+	long rss_kb;
+	uint32_t k, first_checksum = 0;
+	int engines[BENCH_MAX_ENGINES] = { ENGINE_INTERP, ENGINE_THREADED, ENGINE_JIT };
+	int num_engines = BENCH_MAX_ENGINES, opt, e, failed = 0;
+
+	while ((opt = getopt(argc, argv, "e:k:s:o:")) != -1) {
+		switch (opt) {
+			case 'e':
+				for (e = 0; e < BENCH_MAX_ENGINES; e++) {
+					if (strcmp(optarg, ENGINE_NAMES[e]) == 0) {
+						break;
+					}
+				}
+				if (e == BENCH_MAX_ENGINES) {
+					fprintf(stderr, "Error: unknown engine %s (interp, threaded, jit)\n", optarg);
+					exit(1);
+				}
+				engines[0] = e;
+				num_engines = 1;
+				break;
+			case 'k':
+				only = optarg;
+				break;
+			case 's':
+				scale = strtod(optarg, &end);
+				if (end == optarg || *end != '\0' || !(scale > 0)) {
+					fprintf(stderr, "Error: bad scale %s (a positive number)\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				out = fopen(optarg, "w");
+				if (out == NULL) {
+					fprintf(stderr, "Error: Can't create %s\n", optarg);
+					exit(1);
+				}
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-e interp|threaded|jit] [-k kernel prefix] [-s scale] [-o out.json]\n", argv[0]);
+				exit(1);
+		}
+	}
+
+	for (k = 0; k < NUM_KERNELS; k++) {
+		if (only != NULL && strncmp(KERNELS[k].name, only, strlen(only)) != 0) {
+			continue;
+		}
+		for (e = 0; e < num_engines; e++) {
+			if (!run_child(&KERNELS[k], engines[e], scale, &r, &rss_kb)) {
+				fprintf(stderr, "Error: %s on %s did not finish\n", KERNELS[k].name, ENGINE_NAMES[engines[e]]);
+				failed = 1;
+				continue;
+			}
+			fprintf(out, "{\"kernel\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, "
+				"\"mips\": %.2f, \"ns_per_inst\": %.3f, \"peak_rss_kb\": %ld, \"checksum\": \"0x%08x\"}\n",
+				KERNELS[k].name, ENGINE_NAMES[engines[e]], (unsigned long long)r.instructions, r.seconds,
+				r.seconds > 0 ? r.instructions / r.seconds / 1e6 : 0.0,
+				r.instructions ? r.seconds * 1e9 / r.instructions : 0.0, rss_kb, r.checksum);
+			fflush(out);
+			if (e == 0) {
+				first_checksum = r.checksum;
+			} else if (r.checksum != first_checksum) {
+				fprintf(stderr, "Error: %s: %s disagrees with %s\n", KERNELS[k].name,
+					ENGINE_NAMES[engines[e]], ENGINE_NAMES[engines[0]]);
+				failed = 1;
+			}
+		}
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	return failed;
+}
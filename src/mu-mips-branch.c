@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Branch prediction model (branch command, -B). Another observer on   */
+/* the interpreter: after each beq, bne, blez, bgtz, j, jal, jr or     */
+/* jalr, branch_record() asks the predictor what fetch would have      */
+/* guessed and compares it with NEXT_STATE.PC.                         */
+/*                                                                     */
+/* Directions come from one of: static (backward taken, forward not),  */
+/* bimodal (2-bit counters by PC), gshare (2-bit counters by PC xor    */
+/* global history) or tournament (bimodal and gshare with a 2-bit      */
+/* chooser by PC). Targets come from a direct-mapped BTB, except       */
+/* jr $31, which pops a return address stack that jal/jalr push. A     */
+/* branch is mispredicted if its direction is wrong or it is taken and */
+/* the predicted target is; each misprediction costs PENALTY cycles on */
+/* top of one cycle per instruction.                                   */
+/***************************************************************/
+#define BRANCH_STATIC		0
+#define BRANCH_BIMODAL		1
+#define BRANCH_GSHARE		2
+#define BRANCH_TOURNAMENT	3
+
+#define BRANCH_BTB_BITS		9	/* 512 entries */
+#define BRANCH_RAS_DEPTH	16
+#define BRANCH_NONE		0xFFFFFFFF
+#define BRANCH_WORST_PCS	20
+
+typedef struct {
+	uint64_t executed, taken, mispredicts;
+} branch_site_t;
+
+typedef struct branch_struct {
+	int kind;
+	uint32_t bits, mask, penalty;
+
+	/* flat predictor state: 2-bit saturating counters, 2 or more is taken */
+	uint8_t *bimodal, *gshare, *chooser;	/* chooser 2 or more picks gshare */
+	uint32_t history;
+
+	uint32_t btb_tags[1 << BRANCH_BTB_BITS], btb_targets[1 << BRANCH_BTB_BITS];
+	uint32_t ras[BRANCH_RAS_DEPTH];
+	uint32_t ras_top, ras_count;	/* a full stack overwrites its oldest entry */
+
+	/* per-branch PC, open addressing, BRANCH_NONE marks a free slot */
+	uint32_t *pcs;
+	branch_site_t *sites;
+	uint32_t capacity, used;
+
+	uint64_t instructions, conditional, jumps, returns;
+	uint64_t direction_misses, target_misses, return_misses;
+} branch_t;
+
+static const char *KIND_NAMES[] = { "static", "bimodal", "gshare", "tournament" };
+
+static void *branch_alloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (p == NULL) {
+		printf("Error: out of memory for the branch predictor\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/***************************************************************/
+/* kind[:table bits[:penalty]], e.g. gshare:12:3. Returns FALSE if     */
+/* malformed.                                                          */
+/***************************************************************/
+int branch_start(mips_sim_t *sim, const char *spec)
+{
+	char buf[64], *field, *end, *save;
+	branch_t *b;
+	int kind;
+	uint32_t bits = 12, penalty = 3;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	field = strtok_r(buf, ":", &save);
+	if (field == NULL) {
+		return FALSE;
+	}
+	for (kind = BRANCH_TOURNAMENT; kind >= 0; kind--) {
+		if (strcmp(field, KIND_NAMES[kind]) == 0) {
+			break;
+		}
+	}
+	if (kind < 0) {
+		return FALSE;
+	}
+	if ((field = strtok_r(NULL, ":", &save)) != NULL) {
+		bits = strtoul(field, &end, 0);
+		if (*end != '\0' || bits < 1 || bits > 24) {
+			return FALSE;
+		}
+		if ((field = strtok_r(NULL, ":", &save)) != NULL) {
+			penalty = strtoul(field, &end, 0);
+			if (*end != '\0' || strtok_r(NULL, ":", &save) != NULL) {
+				return FALSE;
+			}
+		}
+	}
+
+	branch_stop(sim);
+	b = branch_alloc(sizeof(branch_t));
+	b->kind = kind;
+	b->bits = bits;
+	b->mask = (1u << bits) - 1;
+	b->penalty = penalty;
+	/* start weakly taken / weakly bimodal */
+	b->bimodal = branch_alloc(1u << bits);
+	b->gshare = branch_alloc(1u << bits);
+	b->chooser = branch_alloc(1u << bits);
+	memset(b->bimodal, 2, 1u << bits);
+	memset(b->gshare, 2, 1u << bits);
+	memset(b->chooser, 1, 1u << bits);
+	memset(b->btb_tags, 0xFF, sizeof(b->btb_tags));
+	b->capacity = 256;
+	b->pcs = branch_alloc(b->capacity * sizeof(uint32_t));
+	b->sites = branch_alloc(b->capacity * sizeof(branch_site_t));
+	memset(b->pcs, 0xFF, b->capacity * sizeof(uint32_t));
+	sim->BRANCH = b;
+	return TRUE;
+}
+
+void branch_stop(mips_sim_t *sim)
+{
+	branch_t *b = sim->BRANCH;
+
+	if (b == NULL) {
+		return;
+	}
+	free(b->bimodal);
+	free(b->gshare);
+	free(b->chooser);
+	free(b->pcs);
+	free(b->sites);
+	free(b);
+	sim->BRANCH = NULL;
+}
+
+static uint32_t site_slot(const branch_t *b, uint32_t pc)
+{
+	uint32_t i = ((pc >> 2) * 2654435761u) & (b->capacity - 1);
+
+	while (b->pcs[i] != pc && b->pcs[i] != BRANCH_NONE) {
+		i = (i + 1) & (b->capacity - 1);
+	}
+	return i;
+}
+
+static branch_site_t *site(branch_t *b, uint32_t pc)
+{
+	uint32_t slot = site_slot(b, pc), *pcs, old, i;
+	branch_site_t *sites;
+
+	if (b->pcs[slot] == pc) {
+		return &b->sites[slot];
+	}
+	if (2 * (b->used + 1) > b->capacity) {
+		pcs = b->pcs;
+		sites = b->sites;
+		old = b->capacity;
+		b->capacity *= 2;
+		b->pcs = branch_alloc(b->capacity * sizeof(uint32_t));
+		b->sites = branch_alloc(b->capacity * sizeof(branch_site_t));
+		memset(b->pcs, 0xFF, b->capacity * sizeof(uint32_t));
+		for (i = 0; i < old; i++) {
+			if (pcs[i] != BRANCH_NONE) {
+				slot = site_slot(b, pcs[i]);
+				b->pcs[slot] = pcs[i];
+				b->sites[slot] = sites[i];
+			}
+		}
+		free(pcs);
+		free(sites);
+		slot = site_slot(b, pc);
+	}
+	b->pcs[slot] = pc;
+	b->used++;
+	return &b->sites[slot];
+}
+
+static void train(uint8_t *counter, int taken)
+{
+	if (taken && *counter < 3) {
+		(*counter)++;
+	} else if (!taken && *counter > 0) {
+		(*counter)--;
+	}
+}
+
+/***************************************************************/
+/* Predict and train the direction of the conditional branch at pc     */
+/***************************************************************/
+static int direction(branch_t *b, uint32_t pc, int backward, int taken)
+{
+	uint32_t i = (pc >> 2) & b->mask, g = ((pc >> 2) ^ b->history) & b->mask;
+	int bimodal = b->bimodal[i] >= 2, gshare = b->gshare[g] >= 2, predicted;
+
+	switch (b->kind) {
+		case BRANCH_STATIC:
+			predicted = backward;
+			break;
+		case BRANCH_BIMODAL:
+			predicted = bimodal;
+			break;
+		case BRANCH_GSHARE:
+			predicted = gshare;
+			break;
+		default:
+			predicted = (b->chooser[i] >= 2) ? gshare : bimodal;
+			if (bimodal != gshare) {
+				train(&b->chooser[i], gshare == taken);
+			}
+			break;
+	}
+	train(&b->bimodal[i], taken);
+	train(&b->gshare[g], taken);
+	b->history = (b->history << 1) | taken;
+	return predicted;
+}
+
+/* predicted target from the BTB, BRANCH_NONE on a miss; then learn target */
+static uint32_t btb(branch_t *b, uint32_t pc, uint32_t target)
+{
+	uint32_t i = (pc >> 2) & ((1 << BRANCH_BTB_BITS) - 1);
+	uint32_t predicted = (b->btb_tags[i] == pc) ? b->btb_targets[i] : BRANCH_NONE;
+
+	b->btb_tags[i] = pc;
+	b->btb_targets[i] = target;
+	return predicted;
+}
+
+static void push(branch_t *b, uint32_t address)
+{
+	b->ras_top = (b->ras_top + 1) % BRANCH_RAS_DEPTH;
+	b->ras[b->ras_top] = address;
+	if (b->ras_count < BRANCH_RAS_DEPTH) {
+		b->ras_count++;
+	}
+}
+
+static uint32_t pop(branch_t *b)
+{
+	uint32_t address;
+
+	if (b->ras_count == 0) {
+		return BRANCH_NONE;
+	}
+	address = b->ras[b->ras_top];
+	b->ras_top = (b->ras_top + BRANCH_RAS_DEPTH - 1) % BRANCH_RAS_DEPTH;
+	b->ras_count--;
+	return address;
+}
+
+/***************************************************************/
+/* Account the instruction d that just ran at CURRENT_STATE.PC        */
+/***************************************************************/
+void branch_record(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	branch_t *b = sim->BRANCH;
+	uint32_t pc = sim->CURRENT_STATE.PC, target = sim->NEXT_STATE.PC, predicted;
+	int taken = (target != pc + 4), miss;
+	branch_site_t *s;
+
+	b->instructions++;
+	if (d->handler == NULL) {
+		return;
+	}
+	if (d->opcode >= 0x04 && d->opcode <= 0x07) {
+		/* beq, bne, blez, bgtz */
+		b->conditional++;
+		miss = (direction(b, pc, (d->immediate & 0x8000) != 0, taken) != taken);
+		b->direction_misses += miss;
+		if (taken) {
+			/* train the BTB even when the direction was mispredicted */
+			predicted = btb(b, pc, target);
+			if (!miss && predicted != target) {
+				b->target_misses++;
+				miss = TRUE;
+			}
+		}
+	} else if (d->opcode == 0x02 || d->opcode == 0x03 || (d->opcode == 0x00 && (d->function == 0x08 || d->function == 0x09))) {
+		b->jumps++;
+		if (d->opcode == 0x00 && d->function == 0x08 && d->rs == 31) {
+			b->returns++;
+			miss = (pop(b) != target);
+			b->return_misses += miss;
+		} else {
+			miss = (btb(b, pc, target) != target);
+			b->target_misses += miss;
+		}
+		if (d->opcode == 0x03 || (d->opcode == 0x00 && d->function == 0x09)) {
+			push(b, pc + 4);
+		}
+	} else {
+		return;
+	}
+
+	s = site(b, pc);
+	s->executed++;
+	s->taken += taken;
+	s->mispredicts += miss;
+}
+
+static int compare_desc(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x < y) - (x > y);
+}
+
+/***************************************************************/
+/* Accuracy, the cycle estimate and the worst-predicted branches       */
+/***************************************************************/
+void branch_print(mips_sim_t *sim)
+{
+	branch_t *b = sim->BRANCH;
+	uint64_t branches = b->conditional + b->jumps;
+	uint64_t misses = b->direction_misses + b->target_misses + b->return_misses;
+	uint64_t cycles = b->instructions + misses * b->penalty, (*worst)[2];
+	uint32_t i, n;
+	branch_site_t *s;
+	char text[TRACE_LINE_MAX], *c;
+
+	printf("-------------------------------------\n");
+	printf("Branch predictor: %s, %u-bit tables, %u-entry BTB, %u-entry RAS, %u cycle penalty\n",
+		KIND_NAMES[b->kind], b->bits, 1 << BRANCH_BTB_BITS, BRANCH_RAS_DEPTH, b->penalty);
+	printf("-------------------------------------\n");
+	printf("Branches\t: %llu (%llu conditional, %llu jumps, %llu returns)\n", (unsigned long long)branches,
+		(unsigned long long)b->conditional, (unsigned long long)(b->jumps - b->returns),
+		(unsigned long long)b->returns);
+	printf("Accuracy\t: %.2f%%\n", branches ? 100.0 * (branches - misses) / branches : 100.0);
+	printf("Mispredicts\t: %llu\n", (unsigned long long)misses);
+	printf("  direction\t: %llu\n", (unsigned long long)b->direction_misses);
+	printf("  target\t: %llu\n", (unsigned long long)b->target_misses);
+	printf("  return\t: %llu\n", (unsigned long long)b->return_misses);
+	printf("Cycles\t\t: %llu (%llu penalty)\n", (unsigned long long)cycles,
+		(unsigned long long)(misses * b->penalty));
+	printf("CPI\t\t: %.3f\n", b->instructions ? (double)cycles / b->instructions : 0.0);
+
+	printf("-------------------------------------\n");
+	printf("[PC]\t\t[Executed]\t[Taken %%]\t[Accuracy %%]\t[Instruction]\n");
+	worst = branch_alloc((b->used ? b->used : 1) * sizeof(worst[0]));
+	for (i = 0, n = 0; i < b->capacity; i++) {
+		if (b->pcs[i] != BRANCH_NONE) {
+			worst[n][0] = b->sites[i].mispredicts;
+			worst[n++][1] = i;
+		}
+	}
+	qsort(worst, n, sizeof(worst[0]), compare_desc);
+	for (i = 0; i < n && i < BRANCH_WORST_PCS; i++) {
+		s = &b->sites[worst[i][1]];
+		format_instruction(mem_read_32(sim, b->pcs[worst[i][1]]), text, sizeof(text));
+		for (c = text; *c; c++) {
+			if (*c == '\n') {
+				*c = ' ';
+			}
+		}
+		printf("0x%08x\t%-12llu\t%6.2f\t\t%6.2f\t\t%s\n", b->pcs[worst[i][1]], (unsigned long long)s->executed,
+			100.0 * s->taken / s->executed, 100.0 * (s->executed - s->mispredicts) / s->executed, text);
+	}
+	free(worst);
+	printf("-------------------------------------\n\n");
+}
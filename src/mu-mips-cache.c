@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Cache hierarchy model (cache command, -C): split L1I/L1D in front   */
+/* of a unified L2 in front of memory. Like the other models it is fed */
+/* by the interpreter after each instruction: the fetch goes to L1I,   */
+/* loads and stores to L1D, at the address the simulator uses (rs plus */
+/* the zero-extended offset). Only tags are kept, in flat set-major    */
+/* arrays.                                                             */
+/*                                                                     */
+/* Each level has its own size, associativity, line size, replacement  */
+/* (LRU, tree PLRU or random), write policy and hit latency.           */
+/* Write-back levels allocate on a write miss and write dirty victims  */
+/* to the next level; write-through levels pass every write on and do  */
+/* not allocate. An access costs the latencies of every level it       */
+/* reaches.                                                            */
+/***************************************************************/
+#define CACHE_INVALID	0xFFFFFFFF	/* never a line number */
+#define CACHE_LRU	0
+#define CACHE_PLRU	1
+#define CACHE_RANDOM	2
+
+#define CACHE_REGIONS	5		/* text, data, kdata, ktext, anything else */
+
+typedef struct cache_level_struct {
+	const char *name;
+	uint32_t size, ways, line, latency;
+	int replacement, write_back;
+
+	uint32_t sets, line_bits, set_mask;
+	uint32_t *tags;			/* line number per way, sets * ways */
+	uint8_t *dirty;
+	uint64_t *stamps;		/* LRU: last use per way */
+	uint64_t *plru;			/* PLRU: tree bits per set */
+	uint64_t clock;
+	uint32_t random;
+	struct cache_level_struct *next;	/* NULL: memory */
+
+	uint64_t reads, writes, read_misses, write_misses, writebacks;
+} cache_level_t;
+
+typedef struct cache_struct {
+	cache_level_t l1i, l1d, l2;
+	uint32_t memory_latency;
+	uint64_t accesses[CACHE_REGIONS], misses[CACHE_REGIONS], cycles[CACHE_REGIONS];
+} cache_model_t;
+
+static const char *REPLACEMENT_NAMES[] = { "lru", "plru", "random" };
+static const char *REGION_NAMES[CACHE_REGIONS] = { "text", "data", "kdata", "ktext", "other" };
+
+static int log2_exact(uint32_t v)
+{
+	int bits = 0;
+
+	if (v == 0 || (v & (v - 1)) != 0) {
+		return -1;
+	}
+	while ((1u << bits) != v) {
+		bits++;
+	}
+	return bits;
+}
+
+/***************************************************************/
+/* Parse a size with an optional k/m suffix, 0 if malformed            */
+/***************************************************************/
+static uint32_t parse_size(const char *s, char **end)
+{
+	unsigned long v = strtoul(s, end, 0);
+
+	if (**end == 'k' || **end == 'K') {
+		v <<= 10;
+		(*end)++;
+	} else if (**end == 'm' || **end == 'M') {
+		v <<= 20;
+		(*end)++;
+	}
+	return (*end == s) ? 0 : v;
+}
+
+/***************************************************************/
+/* size:ways:line:lru|plru|random:wb|wt[:latency], e.g.                */
+/* 32k:8:64:plru:wb Returns FALSE if malformed.                        */
+/***************************************************************/
+static int parse_level(cache_level_t *c, const char *spec)
+{
+	char buf[64], *field, *end, *save;
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	field = strtok_r(buf, ":", &save);
+	for (i = 0; field != NULL; i++, field = strtok_r(NULL, ":", &save)) {
+		switch (i) {
+			case 0:
+				c->size = parse_size(field, &end);
+				break;
+			case 1:
+				c->ways = strtoul(field, &end, 0);
+				break;
+			case 2:
+				c->line = parse_size(field, &end);
+				break;
+			case 3:
+				for (c->replacement = CACHE_RANDOM; c->replacement >= 0; c->replacement--) {
+					if (strcmp(field, REPLACEMENT_NAMES[c->replacement]) == 0) {
+						break;
+					}
+				}
+				if (c->replacement < 0) {
+					return FALSE;
+				}
+				continue;
+			case 4:
+				if (strcmp(field, "wb") != 0 && strcmp(field, "wt") != 0) {
+					return FALSE;
+				}
+				c->write_back = (strcmp(field, "wb") == 0);
+				continue;
+			case 5:
+				c->latency = strtoul(field, &end, 0);
+				break;
+			default:
+				return FALSE;
+		}
+		if (*end != '\0') {
+			return FALSE;
+		}
+	}
+	return i >= 5 && log2_exact(c->size) >= 0 && log2_exact(c->ways) >= 0 && log2_exact(c->line) >= 2
+		&& c->ways <= 64 && c->size >= c->ways * c->line;
+}
+
+static void *cache_alloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (p == NULL) {
+		printf("Error: out of memory for the cache model\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static void level_init(cache_level_t *c, const char *name, cache_level_t *next)
+{
+	c->name = name;
+	c->next = next;
+	c->sets = c->size / (c->ways * c->line);
+	c->line_bits = log2_exact(c->line);
+	c->set_mask = c->sets - 1;
+	c->tags = cache_alloc(c->sets * c->ways * sizeof(uint32_t));
+	memset(c->tags, 0xFF, c->sets * c->ways * sizeof(uint32_t));
+	c->dirty = cache_alloc(c->sets * c->ways);
+	c->stamps = cache_alloc(c->sets * c->ways * sizeof(uint64_t));
+	c->plru = cache_alloc(c->sets * sizeof(uint64_t));
+	c->random = 2463534242u;
+}
+
+static void level_free(cache_level_t *c)
+{
+	free(c->tags);
+	free(c->dirty);
+	free(c->stamps);
+	free(c->plru);
+}
+
+/***************************************************************/
+/* Tree PLRU over ways (a power of two): node n has children 2n+1 and  */
+/* 2n+2, its bit set means the older half is the right one.            */
+/***************************************************************/
+static void plru_touch(uint64_t *bits, uint32_t ways, uint32_t way)
+{
+	uint32_t node = 0, half = ways / 2;
+
+	while (half > 0) {
+		if (way & half) {
+			*bits &= ~(1ull << node);	/* used right, left is older */
+			node = 2 * node + 2;
+		} else {
+			*bits |= 1ull << node;
+			node = 2 * node + 1;
+		}
+		half /= 2;
+	}
+}
+
+static uint32_t plru_victim(uint64_t bits, uint32_t ways)
+{
+	uint32_t node = 0, way = 0, half = ways / 2;
+
+	while (half > 0) {
+		if (bits & (1ull << node)) {
+			way |= half;
+			node = 2 * node + 2;
+		} else {
+			node = 2 * node + 1;
+		}
+		half /= 2;
+	}
+	return way;
+}
+
+static void touch(cache_level_t *c, uint32_t set, uint32_t way)
+{
+	if (c->replacement == CACHE_LRU) {
+		c->stamps[set * c->ways + way] = ++c->clock;
+	} else if (c->replacement == CACHE_PLRU) {
+		plru_touch(&c->plru[set], c->ways, way);
+	}
+}
+
+static uint32_t victim(cache_level_t *c, uint32_t set)
+{
+	uint32_t *tags = &c->tags[set * c->ways], way, best = 0;
+
+	for (way = 0; way < c->ways; way++) {
+		if (tags[way] == CACHE_INVALID) {
+			return way;
+		}
+	}
+	if (c->replacement == CACHE_PLRU) {
+		return plru_victim(c->plru[set], c->ways);
+	}
+	if (c->replacement == CACHE_RANDOM) {
+		c->random ^= c->random << 13;
+		c->random ^= c->random >> 17;
+		c->random ^= c->random << 5;
+		return c->random & (c->ways - 1);
+	}
+	for (way = 1; way < c->ways; way++) {
+		if (c->stamps[set * c->ways + way] < c->stamps[set * c->ways + best]) {
+			best = way;
+		}
+	}
+	return best;
+}
+
+/***************************************************************/
+/* One access at level c (NULL: memory); returns its latency in cycles */
+/* and, when miss is not NULL, sets *miss if the line was not in c     */
+/***************************************************************/
+static uint32_t level_access(cache_model_t *m, cache_level_t *c, uint32_t address, int write, int *miss)
+{
+	uint32_t line, set, way, *tags;
+	uint32_t latency;
+
+	if (miss != NULL) {
+		*miss = TRUE;
+	}
+	if (c == NULL) {
+		return m->memory_latency;
+	}
+	line = address >> c->line_bits;
+	set = line & c->set_mask;
+	tags = &c->tags[set * c->ways];
+	latency = c->latency;
+	if (write) {
+		c->writes++;
+	} else {
+		c->reads++;
+	}
+
+	for (way = 0; way < c->ways; way++) {
+		if (tags[way] == line) {
+			if (miss != NULL) {
+				*miss = FALSE;
+			}
+			touch(c, set, way);
+			if (write && c->write_back) {
+				c->dirty[set * c->ways + way] = TRUE;
+			} else if (write) {
+				latency += level_access(m, c->next, address, TRUE, NULL);
+			}
+			return latency;
+		}
+	}
+
+	if (write) {
+		c->write_misses++;
+		if (!c->write_back) {
+			return latency + level_access(m, c->next, address, TRUE, NULL);
+		}
+	} else {
+		c->read_misses++;
+	}
+	way = victim(c, set);
+	if (tags[way] != CACHE_INVALID && c->dirty[set * c->ways + way]) {
+		/* the write-back is off the critical path */
+		c->writebacks++;
+		level_access(m, c->next, tags[way] << c->line_bits, TRUE, NULL);
+	}
+	latency += level_access(m, c->next, address, FALSE, NULL);
+	tags[way] = line;
+	c->dirty[set * c->ways + way] = write;
+	touch(c, set, way);
+	return latency;
+}
+
+static int region_of(uint32_t address)
+{
+	if (address >= MEM_TEXT_BEGIN && address <= MEM_TEXT_END) {
+		return 0;
+	}
+	if (address >= MEM_DATA_BEGIN && address <= MEM_DATA_END) {
+		return 1;
+	}
+	if (address >= MEM_KDATA_BEGIN && address <= MEM_KDATA_END) {
+		return 2;
+	}
+	if (address >= MEM_KTEXT_BEGIN && address <= MEM_KTEXT_END) {
+		return 3;
+	}
+	return 4;
+}
+
+static void access_l1(cache_model_t *m, cache_level_t *l1, uint32_t address, int write)
+{
+	int region = region_of(address), miss;
+	uint32_t latency = level_access(m, l1, address, write, &miss);
+
+	m->accesses[region]++;
+	m->cycles[region] += latency;
+	m->misses[region] += miss;
+}
+
+/***************************************************************/
+/* Start the model. specs holds level=spec pairs separated by commas   */
+/* (l1i, l1d, l2, mem=latency); levels not given keep their defaults.  */
+/* Returns FALSE if a spec is malformed.                               */
+/***************************************************************/
+int cache_start(mips_sim_t *sim, const char *specs)
+{
+	cache_model_t *m = cache_alloc(sizeof(cache_model_t));
+	char buf[256], *item, *value, *save, *end;
+	cache_level_t *c;
+
+	parse_level(&m->l1i, "32k:8:64:plru:wb:1");
+	parse_level(&m->l1d, "32k:8:64:plru:wb:1");
+	parse_level(&m->l2, "256k:8:64:lru:wb:10");
+	m->memory_latency = 100;
+
+	snprintf(buf, sizeof(buf), "%s", specs ? specs : "");
+	for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		value = strchr(item, '=');
+		if (value == NULL) {
+			free(m);
+			return FALSE;
+		}
+		*value++ = '\0';
+		c = strcmp(item, "l1i") == 0 ? &m->l1i : strcmp(item, "l1d") == 0 ? &m->l1d : strcmp(item, "l2") == 0 ? &m->l2 : NULL;
+		if (strcmp(item, "mem") == 0) {
+			m->memory_latency = strtoul(value, &end, 0);
+			if (*end == '\0') {
+				continue;
+			}
+		}
+		if (c == NULL || !parse_level(c, value)) {
+			free(m);
+			return FALSE;
+		}
+	}
+
+	cache_stop(sim);
+	level_init(&m->l2, "L2", NULL);
+	level_init(&m->l1i, "L1I", &m->l2);
+	level_init(&m->l1d, "L1D", &m->l2);
+	sim->CACHE = m;
+	return TRUE;
+}
+
+void cache_stop(mips_sim_t *sim)
+{
+	cache_model_t *m = sim->CACHE;
+
+	if (m == NULL) {
+		return;
+	}
+	level_free(&m->l1i);
+	level_free(&m->l1d);
+	level_free(&m->l2);
+	free(m);
+	sim->CACHE = NULL;
+}
+
+/***************************************************************/
+/* The fetch and the data access of the instruction d that just ran    */
+/***************************************************************/
+void cache_record(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	cache_model_t *m = sim->CACHE;
+	uint32_t address;
+
+	access_l1(m, &m->l1i, sim->CURRENT_STATE.PC, FALSE);
+	if (d->handler == NULL) {
+		return;
+	}
+	address = sim->CURRENT_STATE.REGS[d->rs] + d->immediate;
+	switch (d->opcode) {
+		case 0x20: case 0x21: case 0x23:	/* lb, lh, lw */
+			access_l1(m, &m->l1d, address, FALSE);
+			break;
+		case 0x28: case 0x29: case 0x2B:	/* sb, sh, sw */
+			access_l1(m, &m->l1d, address, TRUE);
+			break;
+	}
+}
+
+static void print_level(const cache_level_t *c)
+{
+	uint64_t accesses = c->reads + c->writes, misses = c->read_misses + c->write_misses;
+	char geometry[64];
+
+	snprintf(geometry, sizeof(geometry), "%uK %u-way %uB %s %s %u cyc", c->size >> 10, c->ways, c->line,
+		REPLACEMENT_NAMES[c->replacement], c->write_back ? "wb" : "wt", c->latency);
+	printf("%-8s%-32s%-12llu%-12llu%7.2f%%   %llu\n", c->name, geometry, (unsigned long long)accesses,
+		(unsigned long long)misses, accesses ? 100.0 * misses / accesses : 0.0,
+		(unsigned long long)c->writebacks);
+}
+
+/***************************************************************/
+/* Hit/miss rates per level, AMAT per region                           */
+/***************************************************************/
+void cache_print(mips_sim_t *sim)
+{
+	cache_model_t *m = sim->CACHE;
+	int r;
+
+	printf("-------------------------------------\n");
+	printf("Caches (memory %u cycles)\n", m->memory_latency);
+	printf("-------------------------------------\n");
+	printf("%-8s%-32s%-12s%-12s%-11s%s\n", "[Level]", "[Geometry]", "[Accesses]", "[Misses]", "[Miss %]",
+		"[Writebacks]");
+	print_level(&m->l1i);
+	print_level(&m->l1d);
+	print_level(&m->l2);
+	printf("-------------------------------------\n");
+	printf("%-10s%-12s%-12s%s\n", "[Region]", "[Accesses]", "[L1 misses]", "[AMAT]");
+	for (r = 0; r < CACHE_REGIONS; r++) {
+		if (m->accesses[r] == 0) {
+			continue;
+		}
+		printf("%-10s%-12llu%-12llu%.2f\n", REGION_NAMES[r], (unsigned long long)m->accesses[r],
+			(unsigned long long)m->misses[r], (double)m->cycles[r] / m->accesses[r]);
+	}
+	printf("-------------------------------------\n\n");
+}
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Checkpoints (save/load commands): registers, instruction count,     */
+/* run flag, heap break and every non-zero page, written front to back */
+/* in one pass. All fields are little-endian:                          */
+/*                                                                     */
+/*   "MIPSCKPT", version, RUN_FLAG, INSTRUCTION_COUNT (64 bits), PC,   */
+/*   R0-R31, HI, LO, heap break                                        */
+/*   per page: page number, packed length, packed contents             */
+/*   CHECKPOINT_END, number of pages                                   */
+/*                                                                     */
+/* A page is packed as 16-bit tokens, a 2-bit kind over a word count:  */
+/* a run of zero words, a run of one repeated word (followed by it),   */
+/* or literal words (followed by them). Words are copied as the bytes  */
+/* of the guest page.                                                  */
+/*                                                                     */
+/* Loading maps the file and only checks it; each page stays packed in */
+/* the mapping until the guest first touches it (mem_page_entry()).    */
+/***************************************************************/
+#define CHECKPOINT_MAGIC	"MIPSCKPT"
+#define CHECKPOINT_VERSION	2
+#define CHECKPOINT_HEADER	(8 + 4 + 4 + 8 + 4 * (4 + MIPS_REGS))
+#define CHECKPOINT_END		0xFFFFFFFF	/* never a page number */
+
+#define TOKEN_ZERO	0
+#define TOKEN_REPEAT	1
+#define TOKEN_LITERAL	2
+#define TOKEN_KIND(t)	((t) >> 14)
+#define TOKEN_COUNT(t)	((t) & 0x3FFF)
+#define PAGE_WORDS	(MEM_PAGE_SIZE / 4)
+#define PACKED_MAX	(2 * PAGE_WORDS + MEM_PAGE_SIZE)	/* alternating zero and literal words */
+
+static void put_16(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_32(uint8_t *p, uint32_t v)
+{
+	put_16(p, v);
+	put_16(p + 2, v >> 16);
+}
+
+static uint32_t get_16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_32(const uint8_t *p)
+{
+	return get_16(p) | (get_16(p + 2) << 16);
+}
+
+static uint32_t word_at(const uint8_t *page, uint32_t i)
+{
+	uint32_t w;
+	memcpy(&w, page + 4 * i, 4);
+	return w;
+}
+
+/***************************************************************/
+/* Pack a page into out, returning the packed length (0: all zero)     */
+/***************************************************************/
+static uint32_t pack(const uint8_t *page, uint8_t *out)
+{
+	uint32_t i = 0, n, w, len = 0;
+	int all_zero = TRUE;
+
+	while (i < PAGE_WORDS) {
+		w = word_at(page, i);
+		for (n = 1; i + n < PAGE_WORDS && word_at(page, i + n) == w; n++);
+		if (w == 0) {
+			put_16(out + len, (TOKEN_ZERO << 14) | n);
+			len += 2;
+		} else if (n >= 3) {
+			put_16(out + len, (TOKEN_REPEAT << 14) | n);
+			memcpy(out + len + 2, page + 4 * i, 4);
+			len += 6;
+			all_zero = FALSE;
+		} else {
+			/* literal until a zero word or a run of three */
+			for (n = 1; i + n < PAGE_WORDS; n++) {
+				w = word_at(page, i + n);
+				if (w == 0 || (i + n + 2 < PAGE_WORDS && word_at(page, i + n + 1) == w
+					&& word_at(page, i + n + 2) == w)) {
+					break;
+				}
+			}
+			put_16(out + len, (TOKEN_LITERAL << 14) | n);
+			memcpy(out + len + 2, page + 4 * i, 4 * n);
+			len += 2 + 4 * n;
+			all_zero = FALSE;
+		}
+		i += n;
+	}
+	return all_zero ? 0 : len;
+}
+
+/***************************************************************/
+/* Unpack a page: packed is its length word followed by its tokens.    */
+/* With page NULL only checks that the tokens make exactly one page.   */
+/***************************************************************/
+int checkpoint_unpack(const uint8_t *packed, uint8_t *page)
+{
+	uint32_t len = get_32(packed), pos = 0, words = 0, token, n, i;
+	const uint8_t *p = packed + 4;
+
+	while (pos + 2 <= len) {
+		token = get_16(p + pos);
+		n = TOKEN_COUNT(token);
+		pos += 2;
+		if (n == 0 || words + n > PAGE_WORDS) {
+			return FALSE;
+		}
+		switch (TOKEN_KIND(token)) {
+			case TOKEN_ZERO:
+				if (page != NULL) {
+					memset(page + 4 * words, 0, 4 * n);
+				}
+				break;
+			case TOKEN_REPEAT:
+				if (pos + 4 > len) {
+					return FALSE;
+				}
+				for (i = 0; page != NULL && i < n; i++) {
+					memcpy(page + 4 * (words + i), p + pos, 4);
+				}
+				pos += 4;
+				break;
+			case TOKEN_LITERAL:
+				if (pos + 4 * n > len) {
+					return FALSE;
+				}
+				if (page != NULL) {
+					memcpy(page + 4 * words, p + pos, 4 * n);
+				}
+				pos += 4 * n;
+				break;
+			default:
+				return FALSE;
+		}
+		words += n;
+	}
+	return pos == len && words == PAGE_WORDS;
+}
+
+/***************************************************************/
+/* Write the checkpoint to path.tmp, then rename it over path, so a    */
+/* checkpoint the simulation is mapped from stays intact until then    */
+/***************************************************************/
+int mips_sim_save(mips_sim_t *sim, const char *path)
+{
+	uint8_t header[CHECKPOINT_HEADER], record[8], packed[PACKED_MAX];
+	uint32_t i, j, len, pages = 0;
+	mem_page_t *entry;
+	char *tmp;
+	FILE *out;
+	int ok, saved_errno;
+
+	if (sim->NUM_CORES > 1) {
+		/* one set of registers per file */
+		errno = ENOTSUP;
+		return FALSE;
+	}
+	tmp = malloc(strlen(path) + 5);
+	if (tmp == NULL) {
+		printf("Error: out of memory saving %s\n", path);
+		exit(-1);
+	}
+	sprintf(tmp, "%s.tmp", path);
+	out = fopen(tmp, "wb");
+	if (out == NULL) {
+		free(tmp);
+		return FALSE;
+	}
+
+	memcpy(header, CHECKPOINT_MAGIC, 8);
+	put_32(header + 8, CHECKPOINT_VERSION);
+	put_32(header + 12, sim->RUN_FLAG);
+	put_32(header + 16, sim->INSTRUCTION_COUNT);
+	put_32(header + 20, sim->INSTRUCTION_COUNT >> 32);
+	put_32(header + 24, sim->CURRENT_STATE.PC);
+	for (i = 0; i < MIPS_REGS; i++) {
+		put_32(header + 28 + 4 * i, sim->CURRENT_STATE.REGS[i]);
+	}
+	put_32(header + 28 + 4 * MIPS_REGS, sim->CURRENT_STATE.HI);
+	put_32(header + 32 + 4 * MIPS_REGS, sim->CURRENT_STATE.LO);
+	put_32(header + 36 + 4 * MIPS_REGS, sim->HEAP_BREAK);
+	fwrite(header, 1, sizeof(header), out);
+
+	for (i = 0; i < MEM_L1_ENTRIES; i++) {
+		if (sim->MEM_PAGE_TABLE[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < MEM_L2_ENTRIES; j++) {
+			entry = &sim->MEM_PAGE_TABLE[i][j];
+			put_32(record, (i << MEM_L2_BITS) | j);
+			if (entry->packed != NULL) {
+				/* never touched since it was loaded, copy it as it is */
+				fwrite(record, 1, 4, out);
+				fwrite(entry->packed, 1, 4 + get_32(entry->packed), out);
+			} else if (entry->data != NULL && (len = pack(entry->data, packed)) > 0) {
+				put_32(record + 4, len);
+				fwrite(record, 1, 8, out);
+				fwrite(packed, 1, len, out);
+			} else {
+				continue;
+			}
+			pages++;
+		}
+	}
+	put_32(record, CHECKPOINT_END);
+	put_32(record + 4, pages);
+	fwrite(record, 1, 8, out);
+
+	ok = !ferror(out);
+	ok = (fclose(out) == 0) && ok;
+	if (ok && rename(tmp, path) == 0) {
+		free(tmp);
+		return TRUE;
+	}
+	saved_errno = errno;
+	unlink(tmp);
+	free(tmp);
+	errno = saved_errno;
+	return FALSE;
+}
+
+/***************************************************************/
+/* Walk the page records of a mapped checkpoint, mapping each page     */
+/* into sim, or only checking them when sim is NULL                    */
+/***************************************************************/
+static int walk_pages(mips_sim_t *sim, const uint8_t *p, size_t size)
+{
+	size_t pos = CHECKPOINT_HEADER;
+	uint32_t page_no, pages = 0;
+
+	while (pos + 8 <= size) {
+		page_no = get_32(p + pos);
+		if (page_no == CHECKPOINT_END) {
+			return get_32(p + pos + 4) == pages && pos + 8 == size;
+		}
+		if (page_no >= (1u << (32 - MEM_PAGE_BITS)) || get_32(p + pos + 4) > size - pos - 8) {
+			return FALSE;
+		}
+		if (sim != NULL) {
+			mem_map_packed(sim, page_no, p + pos + 4);
+		} else if (!checkpoint_unpack(p + pos + 4, NULL)) {
+			return FALSE;
+		}
+		pos += 8 + get_32(p + pos + 4);
+		pages++;
+	}
+	return FALSE;
+}
+
+int mips_sim_restore(mips_sim_t *sim, const char *path)
+{
+	const uint8_t *p;
+	struct stat st;
+	size_t size;
+	uint32_t i;
+	int fd;
+
+	if (sim->NUM_CORES > 1) {
+		errno = ENOTSUP;
+		return FALSE;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return FALSE;
+	}
+	size = st.st_size;
+	if (size < CHECKPOINT_HEADER + 8) {
+		close(fd);
+		errno = EINVAL;
+		return FALSE;
+	}
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return FALSE;
+	}
+	if (memcmp(p, CHECKPOINT_MAGIC, 8) != 0 || get_32(p + 8) != CHECKPOINT_VERSION || !walk_pages(NULL, p, size)) {
+		munmap((void *)p, size);
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	free_memory(sim);
+	sim->CHECKPOINT_MAP = p;
+	sim->CHECKPOINT_SIZE = size;
+	walk_pages(sim, p, size);
+
+	sim->RUN_FLAG = get_32(p + 12);
+	sim->CURRENT_STATE.PC = get_32(p + 24);
+	for (i = 0; i < MIPS_REGS; i++) {
+		sim->CURRENT_STATE.REGS[i] = get_32(p + 28 + 4 * i);
+	}
+	sim->CURRENT_STATE.HI = get_32(p + 28 + 4 * MIPS_REGS);
+	sim->CURRENT_STATE.LO = get_32(p + 32 + 4 * MIPS_REGS);
+	sim->HEAP_BREAK = get_32(p + 36 + 4 * MIPS_REGS);
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->STOP_REASON = STOP_NONE;
+	sim->RESUME = FALSE;
+	sim->INSTRUCTION_COUNT = get_32(p + 16) | ((uint64_t)get_32(p + 20) << 32);
+	snapshot_take(sim);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Drop the checkpoint mapping once no page points into it             */
+/***************************************************************/
+void checkpoint_unmap(mips_sim_t *sim)
+{
+	if (sim->CHECKPOINT_MAP != NULL) {
+		munmap((void *)sim->CHECKPOINT_MAP, sim->CHECKPOINT_SIZE);
+		sim->CHECKPOINT_MAP = NULL;
+		sim->CHECKPOINT_SIZE = 0;
+	}
+}
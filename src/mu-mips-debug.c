@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Breakpoints and watchpoints (break, watch, delete, continue).       */
+/*                                                                     */
+/* A breakpoint is patched into the decoded instruction at its address */
+/* (debug_patch()): the entry gets debug_breakpoint() as its handler   */
+/* and ends its block. Image text is patched in a private copy of the  */
+/* image's decodes, decode cache entries as they are decoded. Hitting  */
+/* one stops the run before the instruction, which does not count.     */
+/*                                                                     */
+/* A watchpoint flags its page in WATCH_PAGES. mem_tlb_fill() never    */
+/* caches a flagged page, so every access to it comes back there and   */
+/* is checked against the watchpoints; other pages keep their TLB      */
+/* hits. A hit stops the run after the accessing instruction, so only  */
+/* the interpreter's per-instruction loop runs while any is set.       */
+/*                                                                     */
+/* With nothing set none of this is on any path: engine_run() only     */
+/* leaves the selected engine for the interpreter while something is.  */
+/***************************************************************/
+static const char *ACCESS_NAMES[] = { "", "r", "w", "rw" };
+
+/***************************************************************/
+/* Handler of a patched entry: stop at it, or after continue run the   */
+/* real instruction once                                               */
+/***************************************************************/
+static void debug_breakpoint(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	decoded_inst_t real;
+
+	if (sim->RESUME && sim->STOP_PC == d->pc) {
+		sim->RESUME = FALSE;
+		decode_instruction(d->instruction, &real);
+		real.pc = d->pc;
+		if (real.handler != NULL) {
+			real.handler(sim, &real);
+		}
+		return;
+	}
+	sim->NEXT->PC = d->pc;
+	sim->RUN_FLAG = FALSE;
+	sim->STOP_REASON = STOP_BREAK;
+	sim->STOP_PC = d->pc;
+}
+
+static int is_breakpoint(const mips_sim_t *sim, uint32_t pc)
+{
+	uint32_t i;
+
+	for (i = 0; i < sim->NUM_BREAKPOINTS; i++) {
+		if (sim->BREAKPOINTS[i] == pc) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Patch a freshly decoded entry if it sits on a breakpoint            */
+/***************************************************************/
+void debug_patch(mips_sim_t *sim, decoded_inst_t *d)
+{
+	if (is_breakpoint(sim, d->pc)) {
+		d->handler = debug_breakpoint;
+		d->ends_block = TRUE;
+	}
+}
+
+/***************************************************************/
+/* Point IMAGE_DECODED at the image's shared decodes, or at a private  */
+/* copy with the breakpoints patched in, and drop every cached decode  */
+/* and translation so they are redone with the current breakpoints.    */
+/***************************************************************/
+void debug_attach_image(mips_sim_t *sim)
+{
+	uint32_t i, index;
+
+	free(sim->PATCHED_DECODES);
+	sim->PATCHED_DECODES = NULL;
+	sim->IMAGE_DECODED = (sim->IMAGE != NULL) ? sim->IMAGE->decoded : NULL;
+	if (sim->NUM_BREAKPOINTS > 0 && sim->IMAGE != NULL && sim->IMAGE->size > 0) {
+		sim->PATCHED_DECODES = malloc(sim->IMAGE->size * sizeof(decoded_inst_t));
+		if (sim->PATCHED_DECODES == NULL) {
+			printf("Error: out of memory patching breakpoints\n");
+			exit(-1);
+		}
+		memcpy(sim->PATCHED_DECODES, sim->IMAGE->decoded, sim->IMAGE->size * sizeof(decoded_inst_t));
+		for (i = 0; i < sim->NUM_BREAKPOINTS; i++) {
+			index = (sim->BREAKPOINTS[i] - sim->IMAGE->base) >> 2;
+			if (index < sim->IMAGE->size && (sim->BREAKPOINTS[i] & 0x3) == 0) {
+				debug_patch(sim, &sim->PATCHED_DECODES[index]);
+			}
+		}
+		sim->IMAGE_DECODED = sim->PATCHED_DECODES;
+	}
+	decode_flush(sim);
+}
+
+int debug_break(mips_sim_t *sim, uint32_t address)
+{
+	if (is_breakpoint(sim, address)) {
+		return TRUE;
+	}
+	if (sim->NUM_BREAKPOINTS == DEBUG_MAX_BREAKPOINTS) {
+		return FALSE;
+	}
+	sim->BREAKPOINTS[sim->NUM_BREAKPOINTS++] = address;
+	debug_attach_image(sim);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Rebuild the page flags from the watchpoints, dropping the bitmap    */
+/* with the last one                                                   */
+/***************************************************************/
+static void flag_pages(mips_sim_t *sim)
+{
+	uint32_t i, address;
+
+	if (sim->NUM_WATCHES == 0) {
+		free(sim->WATCH_PAGES);
+		sim->WATCH_PAGES = NULL;
+	} else {
+		if (sim->WATCH_PAGES == NULL) {
+			sim->WATCH_PAGES = calloc(CODE_PAGE_WORDS, sizeof(uint32_t));
+			if (sim->WATCH_PAGES == NULL) {
+				printf("Error: out of memory for watchpoints\n");
+				exit(-1);
+			}
+		}
+		memset(sim->WATCH_PAGES, 0, CODE_PAGE_WORDS * sizeof(uint32_t));
+		for (i = 0; i < sim->NUM_WATCHES; i++) {
+			/* a watched word may straddle two pages */
+			address = sim->WATCHES[i].address;
+			WATCH_PAGE_MARK(sim, address);
+			WATCH_PAGE_MARK(sim, address + 3);
+		}
+	}
+	mem_tlb_flush(sim);
+}
+
+int debug_watch(mips_sim_t *sim, uint32_t address, int access)
+{
+	uint32_t i;
+
+	for (i = 0; i < sim->NUM_WATCHES; i++) {
+		if (sim->WATCHES[i].address == address) {
+			sim->WATCHES[i].access = access;
+			return TRUE;
+		}
+	}
+	if (sim->NUM_WATCHES == DEBUG_MAX_WATCHES) {
+		return FALSE;
+	}
+	sim->WATCHES[sim->NUM_WATCHES].address = address;
+	sim->WATCHES[sim->NUM_WATCHES++].access = access;
+	flag_pages(sim);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Remove the breakpoint and watchpoint at address; returns how many   */
+/***************************************************************/
+int debug_delete(mips_sim_t *sim, uint32_t address)
+{
+	uint32_t i, n;
+	int removed = 0;
+
+	for (i = 0, n = 0; i < sim->NUM_BREAKPOINTS; i++) {
+		if (sim->BREAKPOINTS[i] != address) {
+			sim->BREAKPOINTS[n++] = sim->BREAKPOINTS[i];
+		}
+	}
+	if (n != sim->NUM_BREAKPOINTS) {
+		removed += sim->NUM_BREAKPOINTS - n;
+		sim->NUM_BREAKPOINTS = n;
+		debug_attach_image(sim);
+	}
+	for (i = 0, n = 0; i < sim->NUM_WATCHES; i++) {
+		if (sim->WATCHES[i].address != address) {
+			sim->WATCHES[n++] = sim->WATCHES[i];
+		}
+	}
+	if (n != sim->NUM_WATCHES) {
+		removed += sim->NUM_WATCHES - n;
+		sim->NUM_WATCHES = n;
+		flag_pages(sim);
+	}
+	return removed;
+}
+
+void debug_delete_all(mips_sim_t *sim)
+{
+	sim->NUM_BREAKPOINTS = 0;
+	sim->NUM_WATCHES = 0;
+	debug_attach_image(sim);
+	flag_pages(sim);
+}
+
+/***************************************************************/
+/* An access to a flagged page while the guest runs                    */
+/***************************************************************/
+void debug_watch_hit(mips_sim_t *sim, uint32_t address, int access)
+{
+	uint32_t i;
+
+	for (i = 0; i < sim->NUM_WATCHES; i++) {
+		/* the word accessed at address overlaps the watched word */
+		if ((sim->WATCHES[i].access & access) && address + 3 - (sim->WATCHES[i].address & ~0x3) < 7) {
+			sim->RUN_FLAG = FALSE;
+			sim->STOP_REASON = STOP_WATCH;
+			sim->STOP_PC = sim->CURRENT_STATE.PC;
+			sim->STOP_ADDRESS = sim->WATCHES[i].address;
+			sim->STOP_ACCESS = access;
+			return;
+		}
+	}
+}
+
+/***************************************************************/
+/* Let a run stopped at a breakpoint or watchpoint go on; from a       */
+/* breakpoint its instruction runs first without stopping again.       */
+/***************************************************************/
+void debug_resume(mips_sim_t *sim)
+{
+	if (sim->STOP_REASON == STOP_NONE) {
+		return;
+	}
+	sim->RESUME = (sim->STOP_REASON == STOP_BREAK && sim->CURRENT_STATE.PC == sim->STOP_PC);
+	sim->STOP_REASON = STOP_NONE;
+	sim->RUN_FLAG = TRUE;
+}
+
+void debug_list(const mips_sim_t *sim)
+{
+	uint32_t i;
+
+	if (!SIM_DEBUGGING(sim)) {
+		printf("No breakpoints or watchpoints\n");
+	}
+	for (i = 0; i < sim->NUM_BREAKPOINTS; i++) {
+		printf("break\t0x%08x\n", sim->BREAKPOINTS[i]);
+	}
+	for (i = 0; i < sim->NUM_WATCHES; i++) {
+		printf("watch\t0x%08x %s\n", sim->WATCHES[i].address, ACCESS_NAMES[sim->WATCHES[i].access]);
+	}
+	printf("\n");
+}
+
+/***************************************************************/
+/* What stopped the last run, if it was not a syscall                  */
+/***************************************************************/
+void debug_report(const mips_sim_t *sim)
+{
+	if (sim->STOP_REASON == STOP_BREAK) {
+		printf("Breakpoint at 0x%08x\n\n", sim->STOP_PC);
+	} else if (sim->STOP_REASON == STOP_WATCH) {
+		printf("Watchpoint 0x%08x: %s by the instruction at 0x%08x\n\n", sim->STOP_ADDRESS,
+			sim->STOP_ACCESS == WATCH_READ ? "read" : "written", sim->STOP_PC);
+	}
+}
+
+void debug_free(mips_sim_t *sim)
+{
+	free(sim->PATCHED_DECODES);
+	sim->PATCHED_DECODES = NULL;
+	sim->IMAGE_DECODED = NULL;
+	free(sim->WATCH_PAGES);
+	sim->WATCH_PAGES = NULL;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Disassembler shared by the simulator's traces and print command and */
+/* by mu-mips-tracedump. It only depends on the instruction word.        */
+/***************************************************************/
+
+/************************************************************/
+/* Format an instruction word in MIPS assembly into buf, exactly as     */
+/* print_instruction() shows it. Returns the length written.               */
+/************************************************************/
+int format_instruction(uint32_t instruction, char *buf, int size){
+	uint32_t opcode, rs, rt, rd, sa, immediate, function, offset;
+
+	opcode = (instruction & 0xFC000000) >> 26;
+	rs = (instruction & 0x3E00000) >> 21;
+	rt = (instruction & 0x1F0000) >> 16;
+	rd = (instruction & 0xF800) >> 11;
+	sa = (instruction & 0x7C0) >> 6;
+	immediate = (instruction & 0xFFFF);
+	function = (instruction & 0x3F);
+	offset = (instruction & 0x3FFFFFF);
+
+	buf[0] = '\0';
+	if(opcode == 0x00){
+		switch(function){
+			case 0x0C:
+				//syscall
+				return snprintf(buf, size, "SYSCALL\n");
+			case 0x0F:
+				//sync
+				return snprintf(buf, size, "\nSYNC\n");
+			case 0x20:
+				//add
+				return snprintf(buf, size, "\nADD  $%d $%d $%d\n", rd, rs, rt);
+			case 0x21:
+				//addu
+				return snprintf(buf, size, "\nADD  $%d $%d $%d\n", rd, rs, rt);
+			case 0x22:
+				//sub
+				return snprintf(buf, size, "\nSUB  $%d $%d $%d\n", rd, rs, rt);
+			case 0x23:
+				//subu
+				return snprintf(buf, size, "\nSUBU  $%d $%d $%d\n", rd, rs, rt);
+			case 0x24:
+				//and
+				return snprintf(buf, size, "\nAND  $%d $%d $%d\n", rd, rs, rt);
+			case 0x25:
+				//or
+				return snprintf(buf, size, "\nOR  $%d $%d $%d\n", rd, rs, rt);
+			case 0x26:
+				//xor
+				return snprintf(buf, size, "\nXOR  $%d $%d $%d\n", rd, rs, rt);
+			case 0x27:
+				//nor
+				return snprintf(buf, size, "\nNOR  $%d $%d $%d\n", rd, rs, rt);
+			case 0x2A:
+				//slt
+				return snprintf(buf, size, "\nSLT  $%d $%d $%d\n", rd, rs, rt);
+			case 0x18:
+				//mult
+				return snprintf(buf, size, "\nMULT  $%d $%d \n", rs, rt);
+			case 0x19:
+				//multu
+				return snprintf(buf, size, "\nMULTU  $%d $%d ", rs, rt);
+			case 0x1A:
+				//div
+				return snprintf(buf, size, "\nDIV  $%d $%d ", rs, rt);
+			case 0x1B:
+				//divu
+				return snprintf(buf, size, "\nDIVU  $%d $%d\n", rs, rt);
+			case 0x00:
+				//sll
+				return snprintf(buf, size, "\nSLL  $%d $%d $%d\n", rd, rt, sa);
+			case 0x02:
+				//srl
+				return snprintf(buf, size, "\nSRL  $%d $%d $%d\n", rd, rt, sa);
+			case 0x03:
+				//sra
+				return snprintf(buf, size, "\nSRA  $%d $%d $%d\n", rd, rt, sa);
+			case 0x08:
+				//jr
+				return snprintf(buf, size, "\nJR  $%d\n", rs);
+			case 0x09:
+				//jalr
+				return snprintf(buf, size, "\nJALR  $%d \nJALR $%d $%d\n", rs, rd, rs);
+			case 0x10:
+				//mfhi
+				return snprintf(buf, size, "\nMFHI  $%d \n", rd);
+			case 0x11:
+				//mthi
+				return snprintf(buf, size, "\nMTHI  $%d \n", rs);
+			case 0x12:
+				//mflo
+				return snprintf(buf, size, "\nMFLO  $%d \n", rd);
+			case 0x13:
+				//mtlo
+				return snprintf(buf, size, "\nMTLO  $%d \n", rs);
+		}
+	}
+	else{
+		switch(opcode){
+			case 0x02:
+				//J
+				return snprintf(buf, size, "\nJ  %d\n", offset);
+			case 0x03:
+				//JAL
+				return snprintf(buf, size, "\nJAL  %d\n", offset);
+			case 0x04:
+				//beq
+				return snprintf(buf, size, "\nBEQ  $%d $%d %d\n", rs, rt, immediate);
+			case 0x05:
+				//bne
+				return snprintf(buf, size, "\nBNE  $%d $%d %d\n", rs, rt, immediate);
+			case 0x06:
+				//blez
+				return snprintf(buf, size, "\nBLEZ  $%d %d\n", rs, immediate);
+			case 0x07:
+				//bgtz
+				return snprintf(buf, size, "\nBGTZ  $%d %d\n", rs, immediate);
+			case 0x08:
+				//ADDI
+				return snprintf(buf, size, "\nADDI  $%d $%d %d\n", rt, rs, immediate);
+			case 0x09:
+				//ADDIU
+				return snprintf(buf, size, "\nADDIU  $%d $%d %d\n", rt, rs, immediate);
+			case 0x0C:
+				//ANDI
+				return snprintf(buf, size, "\nANDI  $%d $%d %d\n", rt, rs, immediate);
+			case 0x0D:
+				//ori
+				return snprintf(buf, size, "\nORI  $%d $%d %d\n", rt, rs, immediate);
+			case 0x0E:
+				//xori
+				return snprintf(buf, size, "\nXORI  $%d $%d %d\n", rt, rs, immediate);
+			case 0x0A:
+				//slti
+				return snprintf(buf, size, "\nSLTI  $%d $%d %d\n", rt, rs, immediate);
+			case 0x20:
+				//lb
+				return snprintf(buf, size, "\nLB  $%d %d $%d \n", rt, immediate, rs);
+			case 0x23:
+				//lw
+				return snprintf(buf, size, "\nLW  $%d %d $%d \n", rt, immediate, rs);
+			case 0x21:
+				//lh
+				return snprintf(buf, size, "\nLH  $%d %d $%d \n", rt, immediate, rs);
+			case 0x2B:
+				//sw
+				return snprintf(buf, size, "\nSW  $%d %d $%d \n", rt, immediate, rs);
+			case 0x28:
+				//sb
+				return snprintf(buf, size, "\nSB  $%d %d $%d \n", rt, immediate, rs);
+			case 0x29:
+				//sh
+				return snprintf(buf, size, "\nSH  $%d %d $%d\n", rt, immediate, rs);
+			case 0x0F:
+				//lui
+				return snprintf(buf, size, "\nLUI  $%d %d\n", rt, immediate);
+			case 0x30:
+				//ll
+				return snprintf(buf, size, "\nLL  $%d %d $%d \n", rt, immediate, rs);
+			case 0x38:
+				//sc
+				return snprintf(buf, size, "\nSC  $%d %d $%d \n", rt, immediate, rs);
+		}
+	}
+	return 0;
+}
+
+/* mnemonics by function (opcode 0x00) and by opcode, NULL if unknown */
+static const char *FUNCTION_NAMES[64] = {
+	[0x00] = "SLL", [0x02] = "SRL", [0x03] = "SRA", [0x08] = "JR", [0x09] = "JALR",
+	[0x0C] = "SYSCALL", [0x0F] = "SYNC", [0x10] = "MFHI", [0x11] = "MTHI", [0x12] = "MFLO", [0x13] = "MTLO",
+	[0x18] = "MULT", [0x19] = "MULTU", [0x1A] = "DIV", [0x1B] = "DIVU",
+	[0x20] = "ADD", [0x21] = "ADDU", [0x22] = "SUB", [0x23] = "SUBU",
+	[0x24] = "AND", [0x25] = "OR", [0x26] = "XOR", [0x27] = "NOR", [0x2A] = "SLT",
+};
+
+static const char *OPCODE_NAMES[64] = {
+	[0x01] = "REGIMM", [0x02] = "J", [0x03] = "JAL", [0x04] = "BEQ", [0x05] = "BNE",
+	[0x06] = "BLEZ", [0x07] = "BGTZ", [0x08] = "ADDI", [0x09] = "ADDIU", [0x0A] = "SLTI",
+	[0x0C] = "ANDI", [0x0D] = "ORI", [0x0E] = "XORI", [0x0F] = "LUI",
+	[0x20] = "LB", [0x21] = "LH", [0x23] = "LW", [0x28] = "SB", [0x29] = "SH", [0x2B] = "SW",
+	[0x30] = "LL", [0x38] = "SC",
+};
+
+/************************************************************/
+/* Mnemonic of an instruction word, "UNKNOWN" if it has none            */
+/************************************************************/
+const char *instruction_name(uint32_t instruction){
+	const char *name;
+
+	if ((instruction >> 26) == 0x00) {
+		name = FUNCTION_NAMES[instruction & 0x3F];
+	} else {
+		name = OPCODE_NAMES[instruction >> 26];
+	}
+	return name ? name : "UNKNOWN";
+}
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Tiered basic-block JIT to x86-64 (-e jit)                                                     */
+/*                                                                                                                               */
+/* Blocks start out interpreted in place (interp_block()); every entry    */
+/* bumps a counter.                                                        */
+/* Once a block has been entered JIT_HOT_THRESHOLD times its leading run of */
+/* supported instructions (ALU, mult/div and HI/LO moves, shifts, branches, */
+/* jumps, lw, lui, and the loads/stores that are still no-ops) is compiled */
+/* into native code. Guest registers stay in the mips_sim_t, addressed     */
+/* through rbx. A compiled block always runs to its end and stores the next PC:    */
+/* the branch/jump outcome, or the address of the first unsupported         */
+/* instruction so the interpreter can take over there. Compiled code never */
+/* stores to guest memory, so self-modifying writes can only happen in the */
+/* interpreter; they bump CODE_GEN and the block is recompiled on entry.    */
+/* Like the threaded engine it never traces (see engine_run()).           */
+/***************************************************************/
+
+#define JIT_HOT_THRESHOLD 16
+#define JIT_MAX_INSTS 64
+#define JIT_BLOCK_BITS 12
+#define JIT_BLOCK_SIZE (1 << JIT_BLOCK_BITS)
+#define JIT_BUFFER_SIZE (16 << 20)
+#define JIT_MAX_BLOCK_BYTES 4096	/* worst case for JIT_MAX_INSTS plus prologue/epilogue */
+
+typedef void (*jit_code_t)(mips_sim_t *sim);
+
+typedef struct {
+	uint32_t pc;		/* block start */
+	uint32_t gen;		/* valid only while equal to CODE_GEN */
+	uint32_t entries;	/* times entered while interpreted */
+	uint32_t count;		/* guest instructions in the compiled code */
+	jit_code_t code;	/* NULL until compiled */
+	int failed;		/* first instruction unsupported, do not retry */
+} jit_block_t;
+
+
+/***************************************************************/
+/* x86-64 encoding helpers. eax/ecx/edx are scratch, rbx holds the        */
+/* mips_sim_t pointer, rdi/esi carry it and the lw address into            */
+/* mem_read_32().                                                                                     */
+/***************************************************************/
+#define X_EAX 0
+#define X_ECX 1
+#define X_EDX 2
+#define X_EBX 3
+#define X_ESI 6
+
+#define OFF_PC offsetof(mips_sim_t, CURRENT_STATE.PC)
+#define OFF_REG(r) (offsetof(mips_sim_t, CURRENT_STATE.REGS) + 4 * (r))
+#define OFF_HI offsetof(mips_sim_t, CURRENT_STATE.HI)
+#define OFF_LO offsetof(mips_sim_t, CURRENT_STATE.LO)
+
+typedef struct {
+	uint8_t buf[JIT_MAX_BLOCK_BYTES];
+	uint32_t len;
+} jit_emitter_t;
+
+/* per-simulation JIT state, sim->JIT */
+typedef struct jit_state_struct {
+	jit_block_t blocks[JIT_BLOCK_SIZE];
+	uint8_t *buffer, *buffer_ptr;	/* JIT_BUFFER_SIZE of executable memory */
+	jit_emitter_t emitter;
+} jit_state_t;
+
+static void emit8(jit_emitter_t *e, uint8_t b)
+{
+	e->buf[e->len++] = b;
+}
+
+static void emit32(jit_emitter_t *e, uint32_t v)
+{
+	memcpy(&e->buf[e->len], &v, 4);
+	e->len += 4;
+}
+
+static void emit64(jit_emitter_t *e, uint64_t v)
+{
+	memcpy(&e->buf[e->len], &v, 8);
+	e->len += 8;
+}
+
+/* opcode with a [rbx + disp32] operand */
+static void emit_rbx_op(jit_emitter_t *e, uint8_t opcode, int reg, uint32_t disp)
+{
+	emit8(e, opcode);
+	emit8(e, 0x80 | (reg << 3) | X_EBX);
+	emit32(e, disp);
+}
+
+/* mov reg, dword [rbx + disp] */
+static void emit_load(jit_emitter_t *e, int reg, uint32_t disp)
+{
+	emit_rbx_op(e, 0x8B, reg, disp);
+}
+
+/* mov dword [rbx + disp], reg */
+static void emit_store(jit_emitter_t *e, int reg, uint32_t disp)
+{
+	emit_rbx_op(e, 0x89, reg, disp);
+}
+
+/* mov dword [rbx + disp], imm32 */
+static void emit_store_imm(jit_emitter_t *e, uint32_t disp, uint32_t imm)
+{
+	emit_rbx_op(e, 0xC7, 0, disp);
+	emit32(e, imm);
+}
+
+/* <alu> eax, ecx */
+static void emit_alu_eax_ecx(jit_emitter_t *e, uint8_t opcode)
+{
+	emit8(e, opcode);
+	emit8(e, 0xC0 | (X_ECX << 3) | X_EAX);
+}
+
+/* <alu> eax, imm32 using the short accumulator forms (05/25/0D/35/3D) */
+static void emit_alu_eax_imm(jit_emitter_t *e, uint8_t opcode, uint32_t imm)
+{
+	emit8(e, opcode);
+	emit32(e, imm);
+}
+
+/* setb al; movzx eax, al */
+static void emit_setb_eax(jit_emitter_t *e)
+{
+	emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC0);
+	emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);
+}
+
+/* PC = condition ? taken : not_taken, with the flags already set */
+static void emit_branch_pc(jit_emitter_t *e, uint8_t cmov, uint32_t taken, uint32_t not_taken)
+{
+	emit8(e, 0xB8 + X_ECX); emit32(e, taken);
+	emit8(e, 0xB8 + X_EDX); emit32(e, not_taken);
+	emit8(e, 0x0F); emit8(e, cmov); emit8(e, 0xC0 | (X_EDX << 3) | X_ECX);
+	emit_store(e, X_EDX, OFF_PC);
+}
+
+static void emit_epilogue(jit_emitter_t *e)
+{
+	emit8(e, 0x5B);		/* pop rbx */
+	emit8(e, 0xC3);		/* ret */
+}
+
+/***************************************************************/
+/* Emit one guest instruction. Returns FALSE if it is not supported,       */
+/* sets *end when it transferred control and closed the block.              */
+/***************************************************************/
+static int jit_emit_instruction(jit_emitter_t *e, const decoded_inst_t *d, uint32_t pc, int *end)
+{
+	uint32_t simm = (uint32_t)(int32_t)(int16_t)d->immediate;
+	uint32_t zimm = d->immediate, skip;
+
+	if (d->handler == NULL) {
+		return FALSE;
+	}
+
+	if (d->opcode == 0x00) {
+		switch (d->function) {
+			case 0x20: case 0x21:	/* add, addu */
+			case 0x22: case 0x23:	/* sub, subu */
+			case 0x24: case 0x25:	/* and, or */
+			case 0x26: case 0x27:	/* xor, nor */
+			case 0x2A:		/* slt */
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit_load(e, X_ECX, OFF_REG(d->rt));
+				switch (d->function) {
+					case 0x20: case 0x21: emit_alu_eax_ecx(e, 0x01); break;
+					case 0x22: case 0x23: emit_alu_eax_ecx(e, 0x29); break;
+					case 0x24: emit_alu_eax_ecx(e, 0x21); break;
+					case 0x25: emit_alu_eax_ecx(e, 0x09); break;
+					case 0x26: emit_alu_eax_ecx(e, 0x31); break;
+					case 0x27:
+						emit_alu_eax_ecx(e, 0x09);
+						emit8(e, 0xF7); emit8(e, 0xD0);		/* not eax */
+						break;
+					case 0x2A:
+						emit_alu_eax_ecx(e, 0x39);		/* cmp eax, ecx (unsigned, as the interpreter) */
+						emit_setb_eax(e);
+						break;
+				}
+				emit_store(e, X_EAX, OFF_REG(d->rd));
+				return TRUE;
+			case 0x00:		/* sll */
+			case 0x02: case 0x03:	/* srl, sra (both shift in zeros) */
+				emit_load(e, X_EAX, OFF_REG(d->rt));
+				if (d->sa != 0) {
+					emit8(e, 0xC1);
+					emit8(e, d->function == 0x00 ? 0xE0 : 0xE8);
+					emit8(e, d->sa);
+				}
+				emit_store(e, X_EAX, OFF_REG(d->rd));
+				return TRUE;
+			case 0x18: case 0x19:	/* mult, multu (32-bit product, as the interpreter) */
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit_load(e, X_ECX, OFF_REG(d->rt));
+				emit8(e, 0x0F); emit8(e, 0xAF); emit8(e, 0xC0 | (X_EAX << 3) | X_ECX);	/* imul eax, ecx */
+				emit_store(e, X_EAX, OFF_LO);
+				emit_store_imm(e, OFF_HI, 0);
+				return TRUE;
+			case 0x1A: case 0x1B:	/* div, divu (unsigned; HI and LO unchanged on a zero divisor) */
+				emit_load(e, X_ECX, OFF_REG(d->rt));
+				emit8(e, 0x85); emit8(e, 0xC0 | (X_ECX << 3) | X_ECX);	/* test ecx, ecx */
+				emit8(e, 0x74); emit8(e, 0);				/* jz past the stores */
+				skip = e->len;
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit8(e, 0x31); emit8(e, 0xC0 | (X_EDX << 3) | X_EDX);	/* xor edx, edx */
+				emit8(e, 0xF7); emit8(e, 0xF0 | X_ECX);			/* div ecx */
+				emit_store(e, X_EAX, OFF_LO);
+				emit_store(e, X_EDX, OFF_HI);
+				e->buf[skip - 1] = e->len - skip;
+				return TRUE;
+			case 0x10:		/* mfhi */
+			case 0x12:		/* mflo */
+				emit_load(e, X_EAX, d->function == 0x10 ? OFF_HI : OFF_LO);
+				emit_store(e, X_EAX, OFF_REG(d->rd));
+				return TRUE;
+			case 0x11:		/* mthi */
+			case 0x13:		/* mtlo */
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit_store(e, X_EAX, d->function == 0x11 ? OFF_HI : OFF_LO);
+				return TRUE;
+			case 0x08:		/* jr */
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit_store(e, X_EAX, OFF_PC);
+				*end = TRUE;
+				return TRUE;
+			case 0x09:		/* jalr */
+				emit_load(e, X_EAX, OFF_REG(d->rs));
+				emit_store_imm(e, OFF_REG(d->rd), pc + 4);
+				emit_store(e, X_EAX, OFF_PC);
+				*end = TRUE;
+				return TRUE;
+		}
+		return FALSE;
+	}
+
+	switch (d->opcode) {
+		case 0x02:	/* j */
+		case 0x03:	/* jal */
+			if (d->opcode == 0x03) {
+				emit_store_imm(e, OFF_REG(31), pc + 4);
+			}
+			emit_store_imm(e, OFF_PC, ((pc >> 28) << 28) + (d->offset << 2));
+			*end = TRUE;
+			return TRUE;
+		case 0x04:	/* beq */
+		case 0x05:	/* bne */
+			emit_load(e, X_EAX, OFF_REG(d->rs));
+			emit_load(e, X_ECX, OFF_REG(d->rt));
+			emit_alu_eax_ecx(e, 0x39);
+			emit_branch_pc(e, d->opcode == 0x04 ? 0x44 : 0x45, pc + (simm << 2), pc + 4);
+			*end = TRUE;
+			return TRUE;
+		case 0x06:	/* blez */
+		case 0x07:	/* bgtz */
+			emit_load(e, X_EAX, OFF_REG(d->rs));
+			emit_alu_eax_imm(e, 0x3D, 0);
+			emit_branch_pc(e, d->opcode == 0x06 ? 0x4E : 0x4F, pc + (simm << 2), pc + 4);
+			*end = TRUE;
+			return TRUE;
+		case 0x08:	/* addi */
+		case 0x09:	/* addiu (zero extended, as the interpreter) */
+		case 0x0C:	/* andi */
+		case 0x0D:	/* ori */
+		case 0x0E:	/* xori */
+		case 0x0A:	/* slti */
+			emit_load(e, X_EAX, OFF_REG(d->rs));
+			switch (d->opcode) {
+				case 0x08: emit_alu_eax_imm(e, 0x05, simm); break;
+				case 0x09: emit_alu_eax_imm(e, 0x05, zimm); break;
+				case 0x0C: emit_alu_eax_imm(e, 0x25, zimm); break;
+				case 0x0D: emit_alu_eax_imm(e, 0x0D, zimm); break;
+				case 0x0E: emit_alu_eax_imm(e, 0x35, zimm); break;
+				case 0x0A:
+					emit_alu_eax_imm(e, 0x3D, simm);
+					emit_setb_eax(e);
+					break;
+			}
+			emit_store(e, X_EAX, OFF_REG(d->rt));
+			return TRUE;
+		case 0x0F:	/* lui */
+			emit_store_imm(e, OFF_REG(d->rt), zimm << 16);
+			return TRUE;
+		case 0x23:	/* lw */
+			emit_load(e, X_ESI, OFF_REG(d->rs));
+			emit8(e, 0x81); emit8(e, 0xC0 | X_ESI); emit32(e, zimm);	/* add esi, imm32 */
+			emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);			/* mov rdi, rbx */
+			emit8(e, 0x48); emit8(e, 0xB8 + X_EAX);				/* mov rax, mem_read_32 */
+			emit64(e, (uint64_t)(uintptr_t)mem_read_32);
+			emit8(e, 0xFF); emit8(e, 0xD0);					/* call rax */
+			emit_store(e, X_EAX, OFF_REG(d->rt));
+			return TRUE;
+		case 0x01:	/* regimm */
+		case 0x20:	/* lb */
+		case 0x21:	/* lh */
+		case 0x28:	/* sb */
+		case 0x29:	/* sh */
+		case 0x2B:	/* sw */
+			/* decoded only, no effect in the interpreter either */
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Drop every compiled block and start refilling the code buffer       */
+/***************************************************************/
+static void jit_flush(jit_state_t *jit)
+{
+	memset(jit->blocks, 0, sizeof(jit->blocks));
+	jit->buffer_ptr = jit->buffer;
+}
+
+/***************************************************************/
+/* Compile the block at b->pc. Leaves b->code NULL when its first          */
+/* instruction is unsupported.                                                                      */
+/***************************************************************/
+static void jit_compile(mips_sim_t *sim, jit_block_t *b)
+{
+	jit_state_t *jit = sim->JIT;
+	jit_emitter_t *e = &jit->emitter;
+	decoded_inst_t d;
+	uint32_t pc = b->pc, n = 0;
+	int end = FALSE;
+
+	if (jit->buffer == NULL) {
+		jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (jit->buffer == MAP_FAILED) {
+			printf("Error: cannot map JIT code buffer\n");
+			exit(-1);
+		}
+		jit->buffer_ptr = jit->buffer;
+	}
+
+	code_page_mark(sim, b->pc);
+	e->len = 0;
+	emit8(e, 0x53);			/* push rbx */
+	emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);	/* mov rbx, rdi */
+
+	while (!end && n < JIT_MAX_INSTS) {
+		decode_instruction(mem_read_32(sim, pc), &d);
+		if (!jit_emit_instruction(e, &d, pc, &end)) {
+			break;
+		}
+		n++;
+		pc += 4;
+		if ((pc & MEM_PAGE_MASK) == 0) {
+			break;
+		}
+	}
+
+	b->failed = (n == 0);
+	if (n == 0) {
+		return;
+	}
+	if (!end) {
+		/* hand the rest of the block back to the interpreter */
+		emit_store_imm(e, OFF_PC, pc);
+	}
+	emit_epilogue(e);
+
+	if (jit->buffer_ptr + e->len > jit->buffer + JIT_BUFFER_SIZE) {
+		uint32_t block_pc = b->pc;
+		jit_flush(jit);
+		b->pc = block_pc;
+		b->gen = sim->CODE_GEN;
+	}
+	memcpy(jit->buffer_ptr, e->buf, e->len);
+	b->code = (jit_code_t)jit->buffer_ptr;
+	b->count = n;
+	jit->buffer_ptr += e->len;
+	sim->JIT_BLOCKS_COMPILED++;
+}
+
+/***************************************************************/
+/* Run a compiled block, and with -V replay it on the interpreter and     */
+/* check that both produce the same architectural state.                     */
+/***************************************************************/
+static void jit_execute(mips_sim_t *sim, jit_block_t *b)
+{
+	CPU_State before, native;
+	uint32_t i;
+
+	if (!sim->JIT_VERIFY) {
+		b->code(sim);
+		sim->INSTRUCTION_COUNT += b->count;
+		sim->JIT_NATIVE_INSTRUCTIONS += b->count;
+		return;
+	}
+
+	before = sim->CURRENT_STATE;
+	b->code(sim);
+	native = sim->CURRENT_STATE;
+	sim->CURRENT_STATE = before;
+	sim->NEXT_STATE = before;
+	for (i = 0; i < b->count; i++) {
+		cycle(sim);
+	}
+	if (memcmp(&native, &sim->CURRENT_STATE, sizeof(CPU_State)) != 0) {
+		printf("JIT mismatch in block 0x%08x (%u instructions): native PC 0x%08x, interpreter PC 0x%08x\n",
+			b->pc, b->count, native.PC, sim->CURRENT_STATE.PC);
+		for (i = 0; i < MIPS_REGS; i++) {
+			if (native.REGS[i] != sim->CURRENT_STATE.REGS[i]) {
+				printf("\t[R%d] native 0x%08x interpreter 0x%08x\n", i, native.REGS[i], sim->CURRENT_STATE.REGS[i]);
+			}
+		}
+		exit(2);
+	}
+	sim->JIT_NATIVE_INSTRUCTIONS += b->count;
+}
+
+/***************************************************************/
+/* Execute up to max instructions, stopping early when RUN_FLAG drops. */
+/* Returns the number of instructions executed.                                    */
+/***************************************************************/
+uint32_t jit_run(mips_sim_t *sim, uint32_t max)
+{
+	uint32_t executed = 0, pc, n;
+	jit_block_t *b;
+
+	if (sim->JIT == NULL) {
+		sim->JIT = calloc(1, sizeof(jit_state_t));
+		if (sim->JIT == NULL) {
+			printf("Error: out of memory for the JIT\n");
+			exit(-1);
+		}
+	}
+
+	while (sim->RUN_FLAG && executed < max) {
+		pc = sim->CURRENT_STATE.PC;
+		b = &sim->JIT->blocks[(pc >> 2) & (JIT_BLOCK_SIZE - 1)];
+		if (b->pc != pc || b->gen != sim->CODE_GEN) {
+			memset(b, 0, sizeof(*b));
+			b->pc = pc;
+			b->gen = sim->CODE_GEN;
+		}
+
+		if (b->code == NULL && !b->failed && (pc & 0x3) == 0 && ++b->entries >= JIT_HOT_THRESHOLD) {
+			jit_compile(sim, b);
+		}
+
+		if (b->code != NULL && b->count <= max - executed) {
+			jit_execute(sim, b);
+			executed += b->count;
+			continue;
+		}
+
+		/* interpret up to and including the next control transfer */
+		n = interp_block(sim, max - executed);
+		sim->INSTRUCTION_COUNT += n;
+		executed += n;
+	}
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	return executed;
+}
+
+/***************************************************************/
+/* Release the code buffer and block table of a simulation                  */
+/***************************************************************/
+void jit_free(mips_sim_t *sim)
+{
+	if (sim->JIT == NULL) {
+		return;
+	}
+	if (sim->JIT->buffer != NULL) {
+		munmap(sim->JIT->buffer, JIT_BUFFER_SIZE);
+	}
+	free(sim->JIT);
+	sim->JIT = NULL;
+}
@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Lane-parallel runs of one program over many inputs (mips_lanes_t)   */
+/*                                                                     */
+/* A group of up to MIPS_LANES_MAX guests runs the same image. Their   */
+/* registers are kept structure-of-arrays, one vector of every lane's  */
+/* value per register, and the lanes at the same PC execute each       */
+/* instruction together as vector operations under a lane mask. The  */
+/* loop is compiled for AVX-512, for AVX2 and for the baseline ISA;    */
+/* the widest one the host supports is picked at the first run. A      */
+/* 16-lane vector is one AVX-512 register, two AVX2 ones.              */
+/*                                                                     */
+/* While every running lane is at the same PC only a scalar PC is      */
+/* kept. A branch or jr that sends lanes different ways stores each    */
+/* lane's PC in the PC vector; from then on the lanes at the lowest PC */
+/* run first and the rest wait, which brings them back together at the */
+/* join point of an if/else or after a loop, and the scalar PC takes   */
+/* over again once all running lanes meet. Straight-line code is       */
+/* translated once per basic block, like the threaded engine does, so  */
+/* lanes are picked, counted and moved on once per block; a block run  */
+/* for some lanes stops where the next waiting lane is, to let it join. */
+/*                                                                     */
+/* Each lane also has a mips_sim_t of its own for its memory, heap and */
+/* console. lw reads through it lane by lane; syscall, ll, sc and sync */
+/* run the interpreter's handler on it with the lane's registers       */
+/* copied in and out. Results are the same as mips_sim_run() on every */
+/* lane's inputs.                                                      */
+/***************************************************************/
+#define LANES_MAX MIPS_LANES_MAX
+#define LANES_CHUNK	0x7FFFFFFF	/* instructions per lane between folds of COUNT */
+#define LANES_BLOCK_OPS 64
+#define LANES_BLOCK_BITS 12
+#define LANES_BLOCK_SIZE (1 << LANES_BLOCK_BITS)
+
+typedef uint32_t lane_vec_t __attribute__((vector_size(4 * LANES_MAX)));
+typedef int32_t lane_svec_t __attribute__((vector_size(4 * LANES_MAX)));
+
+/* every lane x / all ones in the lanes of a bit mask */
+#define BROADCAST(x)	((lane_vec_t){0} + (uint32_t)(x))
+#define LANE_MASK(bits)	((lane_vec_t)((BROADCAST(bits) & LANE_BIT) != 0))
+
+enum {
+	L_ADD, L_SUB, L_MULT, L_DIV, L_AND, L_OR, L_XOR, L_NOR, L_SLT,
+	L_SLL, L_SRL, L_MFHI, L_MTHI, L_MFLO, L_MTLO,
+	L_ADDI, L_ANDI, L_ORI, L_XORI, L_SLTI, L_LW, L_LUI,
+	L_J, L_JAL, L_JR, L_JALR, L_BEQ, L_BNE, L_BLEZ, L_BGTZ,
+	L_SCALAR,	/* syscall, ll, sc, sync: the handler, one lane at a time */
+	L_NOP		/* no effect: unimplemented, or decoded only (lb, sw, ...) */
+};
+
+typedef struct {
+	uint8_t kind, rs, rt, rd, sa;
+	uint32_t imm;	/* immediate, already extended, or the absolute jump/branch target */
+	const decoded_inst_t *d;	/* L_SCALAR: whose handler to run */
+} lane_op_t;
+
+/* a basic block of the shared text, translated once like the threaded engine's */
+typedef struct lanes_block_struct {
+	uint32_t pc;
+	uint32_t gen;		/* valid only while equal to BLOCK_GEN */
+	uint32_t count;
+	lane_op_t ops[];
+} lanes_block_t;
+
+struct mips_lanes {
+	/* first, so every vector is aligned with the struct */
+	lane_vec_t REGS[MIPS_REGS];
+	lane_vec_t HI, LO;
+	lane_vec_t PC;		/* between runs, and while DIVERGED */
+	lane_vec_t COUNT;	/* instructions since the last fold into TOTAL */
+
+	uint32_t NUM_LANES;
+	uint32_t RUNNING;	/* bit per lane still running in this run */
+	uint32_t UNIFORM_PC;	/* PC of every running lane while DIVERGED is FALSE */
+	int DIVERGED;
+	/* text every lane fetches unmodified from the image, the lowest    */
+	/* IMAGE_WORDS of their sims; anywhere else decodes are compared */
+	uint32_t TEXT_BASE, TEXT_WORDS;
+	lanes_block_t **BLOCKS;
+	uint32_t BLOCK_GEN;
+	mips_image_t *BLOCK_IMAGE;	/* the blocks' image, to tell a new one by */
+	uint64_t TOTAL[LANES_MAX];
+	mips_sim_t *SIMS[LANES_MAX];
+};
+
+/* bit i of lane i, to turn lane bits into a vector mask */
+static const lane_vec_t LANE_BIT = {
+	1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+	1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15,
+};
+
+static void (*LANES_LOOP)(mips_lanes_t *lanes, uint32_t max);
+static const char *LANES_ISA;
+static pthread_once_t LANES_ISA_ONCE = PTHREAD_ONCE_INIT;
+
+/***************************************************************/
+/* Translate a decoded instruction to its lane op, with the immediate  */
+/* extended the way the interpreter's handler does it, or the absolute */
+/* jump/branch target                                                  */
+/***************************************************************/
+static void lane_op(const decoded_inst_t *d, lane_op_t *op)
+{
+	uint32_t simm = (uint32_t)(int32_t)(int16_t)d->immediate;
+
+	op->rs = d->rs;
+	op->rt = d->rt;
+	op->rd = d->rd;
+	op->sa = d->sa;
+	op->imm = d->immediate;
+	op->d = d;
+	op->kind = L_NOP;
+	if (d->handler == NULL) {
+		return;
+	}
+	if (d->opcode == 0x00) {
+		switch (d->function) {
+			case 0x20: case 0x21: op->kind = L_ADD; break;
+			case 0x22: case 0x23: op->kind = L_SUB; break;
+			case 0x18: case 0x19: op->kind = L_MULT; break;
+			case 0x1A: case 0x1B: op->kind = L_DIV; break;
+			case 0x24: op->kind = L_AND; break;
+			case 0x25: op->kind = L_OR; break;
+			case 0x26: op->kind = L_XOR; break;
+			case 0x27: op->kind = L_NOR; break;
+			case 0x2A: op->kind = L_SLT; break;
+			case 0x00: op->kind = L_SLL; break;
+			case 0x02: case 0x03: op->kind = L_SRL; break;
+			case 0x08: op->kind = L_JR; break;
+			case 0x09: op->kind = L_JALR; break;
+			case 0x10: op->kind = L_MFHI; break;
+			case 0x11: op->kind = L_MTHI; break;
+			case 0x12: op->kind = L_MFLO; break;
+			case 0x13: op->kind = L_MTLO; break;
+			case 0x0C: case 0x0F: op->kind = L_SCALAR; break;
+		}
+		return;
+	}
+	switch (d->opcode) {
+		case 0x02:
+		case 0x03:
+			op->imm = ((d->pc >> 28) << 28) + (d->offset << 2);
+			op->kind = (d->opcode == 0x02) ? L_J : L_JAL;
+			break;
+		case 0x04:
+		case 0x05:
+		case 0x06:
+		case 0x07:
+			op->imm = d->pc + (simm << 2);
+			op->kind = L_BEQ + (d->opcode - 0x04);
+			break;
+		case 0x08: op->imm = simm; op->kind = L_ADDI; break;
+		case 0x09: op->kind = L_ADDI; break;
+		case 0x0C: op->kind = L_ANDI; break;
+		case 0x0D: op->kind = L_ORI; break;
+		case 0x0E: op->kind = L_XORI; break;
+		case 0x0A: op->imm = simm; op->kind = L_SLTI; break;
+		case 0x23: op->kind = L_LW; break;
+		case 0x0F: op->imm = d->immediate << 16; op->kind = L_LUI; break;
+		case 0x30: case 0x38: op->kind = L_SCALAR; break;
+	}
+}
+
+/***************************************************************/
+/* The block at pc, an aligned address of the shared text, translated */
+/* from lane's decodes on a miss                                       */
+/***************************************************************/
+static const lanes_block_t *lanes_block(mips_lanes_t *lanes, uint32_t pc, uint32_t lane)
+{
+	lanes_block_t **slot = &lanes->BLOCKS[(pc >> 2) & (LANES_BLOCK_SIZE - 1)];
+	lane_op_t ops[LANES_BLOCK_OPS];
+	const decoded_inst_t *d;
+	uint32_t n = 0, end = lanes->TEXT_BASE + 4 * lanes->TEXT_WORDS;
+
+	if (*slot != NULL && (*slot)->pc == pc && (*slot)->gen == lanes->BLOCK_GEN) {
+		return *slot;
+	}
+	do {
+		d = decode_fetch(lanes->SIMS[lane], pc + 4 * n);
+		lane_op(d, &ops[n++]);
+	} while (!d->ends_block && n < LANES_BLOCK_OPS && pc + 4 * n < end);
+
+	free(*slot);
+	*slot = malloc(sizeof(lanes_block_t) + n * sizeof(lane_op_t));
+	if (*slot == NULL) {
+		printf("Error: out of memory for the lane block cache\n");
+		exit(-1);
+	}
+	(*slot)->pc = pc;
+	(*slot)->gen = lanes->BLOCK_GEN;
+	(*slot)->count = n;
+	memcpy((*slot)->ops, ops, n * sizeof(lane_op_t));
+	return *slot;
+}
+
+/***************************************************************/
+/* Run the interpreter's handler for one lane on its own sim           */
+/***************************************************************/
+static void lane_scalar(mips_lanes_t *lanes, uint32_t i, const decoded_inst_t *d)
+{
+	mips_sim_t *sim = lanes->SIMS[i];
+	int r;
+
+	for (r = 0; r < MIPS_REGS; r++) {
+		sim->CURRENT_STATE.REGS[r] = lanes->REGS[r][i];
+	}
+	sim->CURRENT_STATE.HI = lanes->HI[i];
+	sim->CURRENT_STATE.LO = lanes->LO[i];
+	sim->CURRENT_STATE.PC = d->pc + 4;
+	sim->NEXT = &sim->CURRENT_STATE;
+	d->handler(sim, d);
+	sim->NEXT = &sim->NEXT_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	for (r = 0; r < MIPS_REGS; r++) {
+		lanes->REGS[r][i] = sim->CURRENT_STATE.REGS[r];
+	}
+	lanes->HI[i] = sim->CURRENT_STATE.HI;
+	lanes->LO[i] = sim->CURRENT_STATE.LO;
+	lanes->PC[i] = sim->CURRENT_STATE.PC;
+	if (!sim->RUN_FLAG) {
+		lanes->RUNNING &= ~(1u << i);
+	}
+}
+
+/***************************************************************/
+/* After an sc: shrink the shared text to what every lane still       */
+/* fetches from the image. TRUE if it shrank, which drops the blocks.  */
+/***************************************************************/
+static int shared_text(mips_lanes_t *lanes)
+{
+	uint32_t i, words = lanes->TEXT_WORDS;
+
+	for (i = 0; i < lanes->NUM_LANES; i++) {
+		if (lanes->SIMS[i]->IMAGE_WORDS < words) {
+			words = lanes->SIMS[i]->IMAGE_WORDS;
+		}
+	}
+	if (words == lanes->TEXT_WORDS) {
+		return FALSE;
+	}
+	lanes->TEXT_WORDS = words;
+	lanes->BLOCK_GEN++;
+	return TRUE;
+}
+
+/***************************************************************/
+/* The lanes of mask that fetch the same instruction word at pc as the */
+/* lowest of them, outside the text they are known to share           */
+/***************************************************************/
+static uint32_t same_text(mips_lanes_t *lanes, uint32_t mask, uint32_t pc, const decoded_inst_t *d)
+{
+	uint32_t i, same = 0;
+
+	for (i = 0; i < lanes->NUM_LANES; i++) {
+		if ((mask & (1u << i)) && decode_fetch(lanes->SIMS[i], pc)->instruction == d->instruction) {
+			same |= 1u << i;
+		}
+	}
+	return same;
+}
+
+/***************************************************************/
+/* Up to max instructions on every lane in RUNNING, counted in COUNT.  */
+/* Like the threaded engine it never traces. Built once per ISA below, */
+/* so every vector operation here is inlined into code for that ISA.   */
+/***************************************************************/
+static inline __attribute__((always_inline)) void lanes_loop(mips_lanes_t *lanes, uint32_t max)
+{
+	const lanes_block_t *block;
+	const lane_op_t *op, *start, *end;
+	const decoded_inst_t *d;
+	lane_op_t single;
+	lane_vec_t m, v, target;
+	uint32_t mask, bits, pc, next, wait, n, steps, i;
+	int same;
+
+	steps = 0;
+	while (lanes->RUNNING) {
+		if (steps == 0) {
+			/* no lane can have run out of max since the last check */
+			steps = max;
+			for (i = 0; i < lanes->NUM_LANES; i++) {
+				if (!(lanes->RUNNING & (1u << i))) {
+					continue;
+				}
+				if (lanes->COUNT[i] >= max) {
+					if (!lanes->DIVERGED) {
+						lanes->PC[i] = lanes->UNIFORM_PC;
+					}
+					lanes->RUNNING &= ~(1u << i);
+				} else if (max - lanes->COUNT[i] < steps) {
+					steps = max - lanes->COUNT[i];
+				}
+			}
+			if (lanes->RUNNING == 0) {
+				break;
+			}
+		}
+
+		/* the lanes to run: all of them, or the ones at the lowest PC while */
+		/* the others wait at theirs, the lowest of which is wait           */
+		wait = UINT32_MAX;
+		if (!lanes->DIVERGED) {
+			pc = lanes->UNIFORM_PC;
+			mask = lanes->RUNNING;
+		} else {
+			pc = UINT32_MAX;
+			for (i = 0; i < lanes->NUM_LANES; i++) {
+				if ((lanes->RUNNING & (1u << i)) && lanes->PC[i] < pc) {
+					pc = lanes->PC[i];
+				}
+			}
+			mask = 0;
+			for (i = 0; i < lanes->NUM_LANES; i++) {
+				if (!(lanes->RUNNING & (1u << i))) {
+					continue;
+				}
+				if (lanes->PC[i] == pc) {
+					mask |= 1u << i;
+				} else if (lanes->PC[i] < wait) {
+					wait = lanes->PC[i];
+				}
+			}
+			if (mask == lanes->RUNNING) {
+				lanes->DIVERGED = FALSE;
+				lanes->UNIFORM_PC = pc;
+			}
+		}
+
+		if (pc - lanes->TEXT_BASE < 4 * lanes->TEXT_WORDS && !(pc & 0x3)) {
+			block = lanes_block(lanes, pc, __builtin_ctz(mask));
+			start = block->ops;
+			n = block->count;
+			/* stop where waiting lanes are, so they join in */
+			if (wait - pc < 4 * n) {
+				n = (wait - pc + 3) / 4;
+			}
+		} else {
+			/* one instruction at a time, for the lanes that agree on it */
+			d = decode_fetch(lanes->SIMS[__builtin_ctz(mask)], pc);
+			mask = same_text(lanes, mask, pc, d);
+			if (mask != lanes->RUNNING && !lanes->DIVERGED) {
+				for (i = 0; i < lanes->NUM_LANES; i++) {
+					lanes->PC[i] = (lanes->RUNNING & (1u << i)) ? pc : lanes->PC[i];
+				}
+				lanes->DIVERGED = TRUE;
+			}
+			lane_op(d, &single);
+			start = &single;
+			n = 1;
+		}
+		if (n > steps) {
+			n = steps;
+		}
+		m = LANE_MASK(mask);
+		next = pc + 4 * n;
+		same = TRUE;
+
+#define R(r)		lanes->REGS[r]
+#define SET(x, value)	do { v = (value); (x) = (v & m) | ((x) & ~m); } while (0)
+		for (op = start, end = start + n; op < end; op++) {
+			switch (op->kind) {
+				case L_ADD:  SET(R(op->rd), R(op->rs) + R(op->rt)); break;
+				case L_SUB:  SET(R(op->rd), R(op->rs) - R(op->rt)); break;
+				case L_AND:  SET(R(op->rd), R(op->rs) & R(op->rt)); break;
+				case L_OR:   SET(R(op->rd), R(op->rs) | R(op->rt)); break;
+				case L_XOR:  SET(R(op->rd), R(op->rs) ^ R(op->rt)); break;
+				case L_NOR:  SET(R(op->rd), ~(R(op->rs) | R(op->rt))); break;
+				case L_SLT:  SET(R(op->rd), (lane_vec_t)(R(op->rs) < R(op->rt)) & 1); break;
+				case L_SLL:  SET(R(op->rd), R(op->rt) << op->sa); break;
+				case L_SRL:  SET(R(op->rd), R(op->rt) >> op->sa); break;
+				case L_MFHI: SET(R(op->rd), lanes->HI); break;
+				case L_MFLO: SET(R(op->rd), lanes->LO); break;
+				case L_MTHI: SET(lanes->HI, R(op->rs)); break;
+				case L_MTLO: SET(lanes->LO, R(op->rs)); break;
+				case L_ADDI: SET(R(op->rt), R(op->rs) + op->imm); break;
+				case L_ANDI: SET(R(op->rt), R(op->rs) & op->imm); break;
+				case L_ORI:  SET(R(op->rt), R(op->rs) | op->imm); break;
+				case L_XORI: SET(R(op->rt), R(op->rs) ^ op->imm); break;
+				case L_SLTI: SET(R(op->rt), (lane_vec_t)(R(op->rs) < op->imm) & 1); break;
+				case L_LUI:  SET(R(op->rt), BROADCAST(op->imm)); break;
+				case L_MULT:
+					/* the handler's product is 32 bits wide, so HI is always 0 */
+					SET(lanes->LO, R(op->rs) * R(op->rt));
+					SET(lanes->HI, BROADCAST(0));
+					break;
+				case L_DIV:
+					for (i = 0; i < lanes->NUM_LANES; i++) {
+						if ((mask & (1u << i)) && R(op->rt)[i] != 0) {
+							lanes->LO[i] = R(op->rs)[i] / R(op->rt)[i];
+							lanes->HI[i] = R(op->rs)[i] % R(op->rt)[i];
+						}
+					}
+					break;
+				case L_LW:
+					/* a gather through every lane's own memory */
+					target = R(op->rs) + op->imm;
+					for (i = 0; i < lanes->NUM_LANES; i++) {
+						if (mask & (1u << i)) {
+							R(op->rt)[i] = mem_read_32(lanes->SIMS[i], target[i]);
+						}
+					}
+					break;
+				case L_SCALAR:
+					for (i = 0; i < lanes->NUM_LANES; i++) {
+						if (mask & (1u << i)) {
+							lane_scalar(lanes, i, op->d);
+						}
+					}
+					if (op->d->opcode == 0x38 && shared_text(lanes)) {
+						/* the sc may have changed what follows: end the block here */
+						end = op + 1;
+						n = end - start;
+						next = pc + 4 * n;
+					}
+					break;
+
+				/* jumps and branches: only ever the last op */
+				case L_JAL:
+					SET(R(31), BROADCAST(next));
+					/* fall through */
+				case L_J:
+					next = op->imm;
+					break;
+				case L_JR:
+				case L_JALR:
+					target = R(op->rs);
+					if (op->kind == L_JALR) {
+						SET(R(op->rd), BROADCAST(next));
+					}
+					next = target[__builtin_ctz(mask)];
+					for (i = 0; i < lanes->NUM_LANES; i++) {
+						if ((mask & (1u << i)) && target[i] != next) {
+							same = FALSE;
+						}
+					}
+					if (!same) {
+						SET(lanes->PC, target);
+					}
+					break;
+				case L_BEQ:
+				case L_BNE:
+				case L_BLEZ:
+				case L_BGTZ:
+					if (op->kind == L_BEQ) {
+						v = (lane_vec_t)(R(op->rs) == R(op->rt));
+					} else if (op->kind == L_BNE) {
+						v = (lane_vec_t)(R(op->rs) != R(op->rt));
+					} else if (op->kind == L_BLEZ) {
+						v = (lane_vec_t)((lane_svec_t)R(op->rs) <= 0);
+					} else {
+						v = (lane_vec_t)((lane_svec_t)R(op->rs) > 0);
+					}
+					bits = 0;
+					for (i = 0; i < lanes->NUM_LANES; i++) {
+						bits |= (v[i] & 1) << i;
+					}
+					bits &= mask;
+					if (bits == mask) {
+						next = op->imm;
+					} else if (bits != 0) {
+						/* taken lanes to the target, the others on */
+						same = FALSE;
+						v = LANE_MASK(bits);
+						SET(lanes->PC, (BROADCAST(op->imm) & v) | (BROADCAST(next) & ~v));
+					}
+					break;
+			}
+		}
+#undef R
+#undef SET
+
+		/* lanes that exited in a handler stop here, the rest move on */
+		lanes->COUNT += BROADCAST(n) & m;
+		steps -= n;
+		if (same) {
+			if (!lanes->DIVERGED && (mask & lanes->RUNNING) == lanes->RUNNING) {
+				lanes->UNIFORM_PC = next;
+			} else {
+				m = LANE_MASK(mask & lanes->RUNNING);
+				lanes->PC = (BROADCAST(next) & m) | (lanes->PC & ~m);
+			}
+		} else if (!lanes->DIVERGED) {
+			lanes->DIVERGED = TRUE;
+		}
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx512f")))
+static void lanes_loop_avx512(mips_lanes_t *lanes, uint32_t max)
+{
+	lanes_loop(lanes, max);
+}
+
+__attribute__((target("avx2")))
+static void lanes_loop_avx2(mips_lanes_t *lanes, uint32_t max)
+{
+	lanes_loop(lanes, max);
+}
+#endif
+
+static void lanes_loop_generic(mips_lanes_t *lanes, uint32_t max)
+{
+	lanes_loop(lanes, max);
+}
+
+/***************************************************************/
+/* Pick the widest loop the host runs                                  */
+/***************************************************************/
+static void lanes_select_isa()
+{
+	LANES_LOOP = lanes_loop_generic;
+	LANES_ISA = "generic";
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		LANES_LOOP = lanes_loop_avx512;
+		LANES_ISA = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		LANES_LOOP = lanes_loop_avx2;
+		LANES_ISA = "avx2";
+	}
+#endif
+}
+
+const char *mips_lanes_isa()
+{
+	pthread_once(&LANES_ISA_ONCE, lanes_select_isa);
+	return LANES_ISA;
+}
+
+mips_lanes_t *mips_lanes_create(uint32_t count)
+{
+	mips_lanes_t *lanes;
+	uint32_t i;
+
+	if (count < 1 || count > LANES_MAX) {
+		return NULL;
+	}
+	if (posix_memalign((void **)&lanes, sizeof(lane_vec_t), sizeof(mips_lanes_t)) != 0) {
+		return NULL;
+	}
+	memset(lanes, 0, sizeof(mips_lanes_t));
+	lanes->NUM_LANES = count;
+	lanes->BLOCKS = calloc(LANES_BLOCK_SIZE, sizeof(lanes_block_t *));
+	if (lanes->BLOCKS == NULL) {
+		free(lanes);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		lanes->SIMS[i] = mips_sim_create();
+		if (lanes->SIMS[i] == NULL) {
+			mips_lanes_destroy(lanes);
+			return NULL;
+		}
+	}
+	return lanes;
+}
+
+void mips_lanes_destroy(mips_lanes_t *lanes)
+{
+	uint32_t i;
+
+	if (lanes == NULL) {
+		return;
+	}
+	for (i = 0; i < lanes->NUM_LANES; i++) {
+		mips_sim_destroy(lanes->SIMS[i]);
+	}
+	for (i = 0; i < LANES_BLOCK_SIZE; i++) {
+		free(lanes->BLOCKS[i]);
+	}
+	free(lanes->BLOCKS);
+	free(lanes);
+}
+
+/***************************************************************/
+/* The first count lanes to the start of image, sims that already hold */
+/* it by their copy-on-write reset; the other lanes sit out until the  */
+/* next load                                                           */
+/***************************************************************/
+void mips_lanes_load(mips_lanes_t *lanes, mips_image_t *image, uint32_t count)
+{
+	mips_sim_t *sim;
+	uint32_t i;
+	int r;
+
+	for (i = 0; i < lanes->NUM_LANES; i++) {
+		sim = lanes->SIMS[i];
+		if (i >= count) {
+			sim->RUN_FLAG = FALSE;
+			lanes->TOTAL[i] = 0;
+			continue;
+		}
+		if (sim->IMAGE == image && sim->SNAPSHOT_VALID) {
+			mips_sim_reset(sim);
+		} else {
+			mips_sim_load(sim, image);
+		}
+		for (r = 0; r < MIPS_REGS; r++) {
+			lanes->REGS[r][i] = sim->CURRENT_STATE.REGS[r];
+		}
+		lanes->HI[i] = sim->CURRENT_STATE.HI;
+		lanes->LO[i] = sim->CURRENT_STATE.LO;
+		lanes->PC[i] = sim->CURRENT_STATE.PC;
+		lanes->TOTAL[i] = 0;
+	}
+	if (image != lanes->BLOCK_IMAGE || lanes->TEXT_WORDS != image->size) {
+		lanes->BLOCK_GEN++;
+		lanes->BLOCK_IMAGE = image;
+	}
+	lanes->TEXT_BASE = image->base;
+	lanes->TEXT_WORDS = image->size;
+}
+
+/***************************************************************/
+/* Up to max instructions on every lane, stopping the ones that exit.  */
+/* Returns the number executed, summed over the lanes.                 */
+/***************************************************************/
+uint64_t mips_lanes_run(mips_lanes_t *lanes, uint64_t max)
+{
+	uint64_t executed = 0, left = max, chunk;
+	uint32_t i;
+
+	pthread_once(&LANES_ISA_ONCE, lanes_select_isa);
+	while (left > 0) {
+		lanes->RUNNING = 0;
+		for (i = 0; i < lanes->NUM_LANES; i++) {
+			lanes->RUNNING |= (lanes->SIMS[i]->RUN_FLAG != 0) << i;
+		}
+		if (lanes->RUNNING == 0) {
+			break;
+		}
+		/* PC holds every lane's between runs; the loop finds out whether they agree */
+		lanes->DIVERGED = TRUE;
+		lanes->COUNT = BROADCAST(0);
+		chunk = (left < LANES_CHUNK) ? left : LANES_CHUNK;
+		LANES_LOOP(lanes, chunk);
+		for (i = 0; i < lanes->NUM_LANES; i++) {
+			lanes->TOTAL[i] += lanes->COUNT[i];
+			executed += lanes->COUNT[i];
+		}
+		left -= chunk;
+	}
+	for (i = 0; i < lanes->NUM_LANES; i++) {
+		console_flush(lanes->SIMS[i]);
+	}
+	return executed;
+}
+
+uint32_t mips_lanes_count(const mips_lanes_t *lanes)
+{
+	return lanes->NUM_LANES;
+}
+
+int mips_lanes_running(const mips_lanes_t *lanes, uint32_t lane)
+{
+	return lanes->SIMS[lane]->RUN_FLAG;
+}
+
+uint64_t mips_lanes_instruction_count(const mips_lanes_t *lanes, uint32_t lane)
+{
+	return lanes->TOTAL[lane];
+}
+
+uint32_t mips_lanes_get_reg(const mips_lanes_t *lanes, uint32_t lane, int reg)
+{
+	if (reg >= 0 && reg < MIPS_REGS) {
+		return lanes->REGS[reg][lane];
+	}
+	switch (reg) {
+		case MIPS_SIM_HI: return lanes->HI[lane];
+		case MIPS_SIM_LO: return lanes->LO[lane];
+		case MIPS_SIM_PC: return lanes->PC[lane];
+	}
+	return 0;
+}
+
+void mips_lanes_set_reg(mips_lanes_t *lanes, uint32_t lane, int reg, uint32_t value)
+{
+	if (reg >= 0 && reg < MIPS_REGS) {
+		lanes->REGS[reg][lane] = value;
+	} else if (reg == MIPS_SIM_HI) {
+		lanes->HI[lane] = value;
+	} else if (reg == MIPS_SIM_LO) {
+		lanes->LO[lane] = value;
+	} else if (reg == MIPS_SIM_PC) {
+		lanes->PC[lane] = value;
+	}
+}
+
+uint32_t mips_lanes_read_32(mips_lanes_t *lanes, uint32_t lane, uint32_t address)
+{
+	return mem_read_32(lanes->SIMS[lane], address);
+}
+
+void mips_lanes_write_32(mips_lanes_t *lanes, uint32_t lane, uint32_t address, uint32_t value)
+{
+	mem_write_32(lanes->SIMS[lane], address, value);
+}
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Program loader, built into libmu-mips.a. The file is mapped and     */
+/* parsed in place: hex text, raw big/little-endian words, an ELF32    */
+/* MIPS executable or assembly source (mu-mips-asm.c), see             */
+/* mips_image_load_format in mu-mips-sim.h.                            */
+/***************************************************************/
+
+/***************************************************************/
+/* Character classes for the hex parser: the digit value, or one of     */
+/* the flags above 15. Or-ing the entries of a token and testing the  */
+/* flag bits validates all of its characters with a single branch.    */
+/***************************************************************/
+#define HEX_SPACE	0x20
+#define HEX_BAD		0x40
+#define HEX_FLAGS	(HEX_SPACE | HEX_BAD)
+
+static const uint8_t HEX_CLASS[256] = {
+	[0 ... 255] = HEX_BAD,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+	[' '] = HEX_SPACE, ['\t'] = HEX_SPACE, ['\n'] = HEX_SPACE,
+	['\r'] = HEX_SPACE, ['\v'] = HEX_SPACE, ['\f'] = HEX_SPACE
+};
+
+#define ELF_HEADER_SIZE	52
+#define ELF_PHDR_SIZE	32
+#define ELF_EM_MIPS	8
+#define ELF_PT_LOAD	1
+#define ELF_PF_X	1
+
+/***************************************************************/
+/* Read a 16/32-bit field in the file's byte order                         */
+/***************************************************************/
+static uint32_t get_16(const uint8_t *p, int big)
+{
+	return big ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t get_32(const uint8_t *p, int big)
+{
+	if (big) {
+		return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+	return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static void *alloc_words(uint32_t count)
+{
+	void *p = malloc((count ? count : 1) * sizeof(uint32_t));
+
+	if (p == NULL) {
+		printf("Error: out of memory loading a program\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/***************************************************************/
+/* Split len bytes into words; a partial last word is zero padded       */
+/***************************************************************/
+static uint32_t *bytes_to_words(const uint8_t *p, size_t len, int big, uint32_t *count)
+{
+	uint32_t *words, n = len / 4, i;
+	uint8_t tail[4] = { 0, 0, 0, 0 };
+
+	*count = (len + 3) / 4;
+	words = alloc_words(*count);
+	for (i = 0; i < n; i++) {
+		words[i] = get_32(p + 4 * i, big);
+	}
+	if (n < *count) {
+		memcpy(tail, p + 4 * n, len - 4 * n);
+		words[n] = get_32(tail, big);
+	}
+	return words;
+}
+
+/***************************************************************/
+/* Append a data segment; the image takes over words                        */
+/***************************************************************/
+static void add_segment(mips_image_t *image, uint32_t base, uint32_t *words, uint32_t size)
+{
+	image->data = realloc(image->data, (image->num_data + 1) * sizeof(mips_segment_t));
+	if (image->data == NULL) {
+		printf("Error: out of memory loading a program\n");
+		exit(-1);
+	}
+	image->data[image->num_data].base = base;
+	image->data[image->num_data].size = size;
+	image->data[image->num_data].words = words;
+	image->num_data++;
+}
+
+/***************************************************************/
+/* Hex text: whitespace separated words with an optional 0x prefix.      */
+/* The common case, exactly eight digits and a separator, takes one     */
+/* unrolled table pass; anything else goes through the general token    */
+/* loop. Returns FALSE on a malformed token.                                 */
+/***************************************************************/
+static int parse_hex(mips_image_t *image, const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len, *start;
+	uint32_t word, bits, n = 0;
+	int i;
+
+	/* every token takes at least two bytes but the last */
+	image->words = alloc_words(len / 2 + 1);
+
+	while (1) {
+		while (p < end && HEX_CLASS[*p] == HEX_SPACE) {
+			p++;
+		}
+		if (p == end) {
+			break;
+		}
+		if (end - p > 8) {
+			word = 0;
+			bits = 0;
+			for (i = 0; i < 8; i++) {
+				bits |= HEX_CLASS[p[i]];
+				word = (word << 4) | (HEX_CLASS[p[i]] & 0xF);
+			}
+			if (!(bits & HEX_FLAGS) && HEX_CLASS[p[8]] == HEX_SPACE) {
+				image->words[n++] = word;
+				p += 9;
+				continue;
+			}
+		}
+
+		if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' && HEX_CLASS[p[2]] < 16) {
+			p += 2;
+		}
+		word = 0;
+		start = p;
+		while (p < end && HEX_CLASS[*p] < 16) {
+			word = (word << 4) | HEX_CLASS[*p++];
+		}
+		if (p == start || (p < end && HEX_CLASS[*p] != HEX_SPACE)) {
+			return FALSE;
+		}
+		image->words[n++] = word;
+	}
+	image->size = n;
+	image->words = realloc(image->words, (n ? n : 1) * sizeof(uint32_t));
+	return image->words != NULL;
+}
+
+/***************************************************************/
+/* ELF32 MIPS executable: the first executable PT_LOAD segment becomes    */
+/* the text, every other PT_LOAD segment a data segment. Words keep their */
+/* value whatever the file's byte order; the rest of each segment (bss)  */
+/* is zero already. Returns FALSE if the file is not one we can load.     */
+/***************************************************************/
+static int parse_elf(mips_image_t *image, const uint8_t *p, size_t len)
+{
+	const uint8_t *ph;
+	uint32_t phoff, phentsize, phnum, offset, vaddr, filesz, size, i;
+	uint32_t *words;
+	int big;
+
+	if (len < ELF_HEADER_SIZE || memcmp(p, "\177ELF", 4) != 0 || p[4] != 1 || (p[5] != 1 && p[5] != 2)) {
+		return FALSE;
+	}
+	big = (p[5] == 2);
+	if (get_16(p + 18, big) != ELF_EM_MIPS) {
+		return FALSE;
+	}
+	image->entry = get_32(p + 24, big);
+	phoff = get_32(p + 28, big);
+	phentsize = get_16(p + 42, big);
+	phnum = get_16(p + 44, big);
+	if (phentsize < ELF_PHDR_SIZE || phoff > len || phnum > (len - phoff) / phentsize) {
+		return FALSE;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		ph = p + phoff + i * phentsize;
+		offset = get_32(ph + 4, big);
+		vaddr = get_32(ph + 8, big);
+		filesz = get_32(ph + 16, big);
+		if (get_32(ph, big) != ELF_PT_LOAD || filesz == 0) {
+			continue;
+		}
+		if (offset > len || filesz > len - offset) {
+			return FALSE;
+		}
+		if (image->words == NULL && (get_32(ph + 24, big) & ELF_PF_X) && (vaddr & 0x3) == 0) {
+			image->base = vaddr;
+			image->words = bytes_to_words(p + offset, filesz, big, &image->size);
+		} else {
+			words = bytes_to_words(p + offset, filesz, big, &size);
+			add_segment(image, vaddr, words, size);
+		}
+	}
+	return image->words != NULL;
+}
+
+/***************************************************************/
+/* Decode the text once for every simulation that will run it              */
+/***************************************************************/
+static void decode_image(mips_image_t *image)
+{
+	uint32_t i;
+
+	image->decoded = calloc(image->size ? image->size : 1, sizeof(decoded_inst_t));
+	if (image->decoded == NULL) {
+		printf("Error: out of memory loading a program\n");
+		exit(-1);
+	}
+	for (i = 0; i < image->size; i++) {
+		decode_instruction(image->words[i], &image->decoded[i]);
+		image->decoded[i].pc = image->base + 4 * i;
+	}
+}
+
+/***************************************************************/
+/* Guess the format: ELF by its magic, hex when the start of the file is  */
+/* printable text (so a typo is reported, not run as binary), raw         */
+/* big-endian otherwise; real code has zero or high bytes within a few   */
+/* words.                                                                                      */
+/***************************************************************/
+static int detect_format(const uint8_t *p, size_t len)
+{
+	size_t i;
+
+	if (len >= 4 && memcmp(p, "\177ELF", 4) == 0) {
+		return MIPS_IMAGE_ELF;
+	}
+	for (i = 0; i < len && i < 64; i++) {
+		if ((p[i] < ' ' && HEX_CLASS[p[i]] != HEX_SPACE) || p[i] >= 0x7F) {
+			return MIPS_IMAGE_BIN_BE;
+		}
+	}
+	return MIPS_IMAGE_HEX;
+}
+
+/***************************************************************/
+/* Assembly sources are told apart by their name, .asm or .s            */
+/***************************************************************/
+static int is_assembly(const char *path)
+{
+	const char *dot = strrchr(path, '.');
+
+	return dot != NULL && (strcmp(dot, ".asm") == 0 || strcmp(dot, ".s") == 0 || strcmp(dot, ".S") == 0);
+}
+
+mips_image_t *mips_image_load_format(const char *path, int format)
+{
+	struct stat st;
+	const uint8_t *p = NULL;
+	mips_image_t *image;
+	size_t len;
+	int fd, ok;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	len = st.st_size;
+	if (len > 0) {
+		p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return NULL;
+		}
+	}
+	close(fd);
+
+	image = calloc(1, sizeof(mips_image_t));
+	if (image == NULL) {
+		printf("Error: out of memory loading %s\n", path);
+		exit(-1);
+	}
+	image->base = MEM_TEXT_BEGIN;
+	image->entry = MEM_TEXT_BEGIN;
+	if (format == MIPS_IMAGE_AUTO) {
+		format = is_assembly(path) ? MIPS_IMAGE_ASM : detect_format(p, len);
+	}
+	switch (format) {
+		case MIPS_IMAGE_HEX:
+			ok = parse_hex(image, p, len);
+			break;
+		case MIPS_IMAGE_BIN_BE:
+		case MIPS_IMAGE_BIN_LE:
+			image->words = bytes_to_words(p, len, format == MIPS_IMAGE_BIN_BE, &image->size);
+			ok = TRUE;
+			break;
+		case MIPS_IMAGE_ELF:
+			ok = parse_elf(image, p, len);
+			break;
+		case MIPS_IMAGE_ASM:
+			ok = asm_parse(image, p, len, path);
+			break;
+		default:
+			ok = FALSE;
+	}
+	if (len > 0) {
+		munmap((void *)p, len);
+	}
+
+	if (!ok) {
+		image->refs = 1;
+		mips_image_release(image);
+		errno = EINVAL;
+		return NULL;
+	}
+	decode_image(image);
+	image->refs = 1;
+	return image;
+}
+
+mips_image_t *mips_image_load(const char *path)
+{
+	return mips_image_load_format(path, MIPS_IMAGE_AUTO);
+}
+
+mips_image_t *mips_image_create(uint32_t base, uint32_t entry, const uint32_t *words, uint32_t count)
+{
+	mips_image_t *image = calloc(1, sizeof(mips_image_t));
+
+	if (image == NULL) {
+		printf("Error: out of memory creating a program\n");
+		exit(-1);
+	}
+	image->base = base;
+	image->entry = entry;
+	image->size = count;
+	image->words = alloc_words(count);
+	memcpy(image->words, words, count * sizeof(uint32_t));
+	decode_image(image);
+	image->refs = 1;
+	return image;
+}
+
+void mips_image_add_data(mips_image_t *image, uint32_t base, const uint32_t *words, uint32_t count)
+{
+	uint32_t *copy = alloc_words(count);
+
+	memcpy(copy, words, count * sizeof(uint32_t));
+	add_segment(image, base, copy, count);
+}
+
+mips_image_t *mips_image_retain(mips_image_t *image)
+{
+	__atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+	return image;
+}
+
+void mips_image_release(mips_image_t *image)
+{
+	uint32_t i;
+
+	if (image == NULL || __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+	for (i = 0; i < image->num_data; i++) {
+		free(image->data[i].words);
+	}
+	free(image->data);
+	for (i = 0; i < image->num_symbols; i++) {
+		free(image->symbols[i].name);
+	}
+	free(image->symbols);
+	free(image->words);
+	free(image->decoded);
+	free(image);
+}
+
+uint32_t mips_image_size(const mips_image_t *image)
+{
+	return image->size;
+}
+
+uint32_t mips_image_word(const mips_image_t *image, uint32_t index)
+{
+	return image->words[index];
+}
+
+uint32_t mips_image_base(const mips_image_t *image)
+{
+	return image->base;
+}
+
+uint32_t mips_image_entry(const mips_image_t *image)
+{
+	return image->entry;
+}
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* N cores sharing one memory (-n, mips_sim_set_cores()).              */
+/*                                                                     */
+/* Core 0 is the simulation itself; cores 1..N-1 are sims of their own */
+/* with MEM_OWNER pointing back at it, so every memory access goes to  */
+/* core 0's page table while registers, TLB, decode caches and engine  */
+/* state stay per core. All cores start at the entry point with the    */
+/* same registers except $k0, the core's number; $k1 holds N.          */
+/*                                                                     */
+/* Two ways to run them:                                               */
+/*                                                                     */
+/*   lockstep      one host thread gives each core in turn QUANTUM     */
+/*                 instructions (-q), so a run is repeatable; also     */
+/*                 used for runs too short to be worth threads         */
+/*   free-running  one host thread per core, each taking slices of its */
+/*                 share of the run; the interleaving is the host's    */
+/*                                                                     */
+/* The guest sees memory through ll/sc, which are host atomics, and    */
+/* sync. A core picks up the pages other cores mapped at its next      */
+/* slice, ll or sync; until then it may read a page's older copy. Code */
+/* one core writes reaches the others the same way: a store into a     */
+/* page any core has decoded or translated makes every other core drop */
+/* its decodes and translations at its next slice, ll or sync.         */
+/*                                                                     */
+/* Breakpoints, watchpoints, tracing and the models stay on core 0;    */
+/* checkpoints are refused while there is more than one core.          */
+/***************************************************************/
+#define MULTICORE_MAX		64
+#define MULTICORE_QUANTUM	1000		/* lockstep turn without -q */
+#define MULTICORE_SLICE		(1 << 16)	/* free-running: instructions between stop checks */
+
+#define REG_K0	26
+#define REG_K1	27
+
+typedef struct {
+	mips_sim_t *core;
+	uint32_t max, executed;
+	pthread_t thread;
+} core_thread_t;
+
+/***************************************************************/
+/* Use n cores from now on, all restarting from core 0's state. FALSE  */
+/* if n is out of range, sim is a secondary core or out of memory.     */
+/***************************************************************/
+int mips_sim_set_cores(mips_sim_t *sim, int n)
+{
+	mips_sim_t **cores;
+	int i;
+
+	if (n < 1 || n > MULTICORE_MAX || sim->MEM_OWNER != sim) {
+		return FALSE;
+	}
+	multicore_free(sim);
+	if (n == 1) {
+		return TRUE;
+	}
+	cores = calloc(n, sizeof(mips_sim_t *));
+	sim->SHARED_CODE_PAGES = calloc(CODE_PAGE_WORDS, sizeof(uint32_t));
+	if (cores == NULL || sim->SHARED_CODE_PAGES == NULL) {
+		free(cores);
+		free(sim->SHARED_CODE_PAGES);
+		sim->SHARED_CODE_PAGES = NULL;
+		return FALSE;
+	}
+	cores[0] = sim;
+	for (i = 1; i < n; i++) {
+		cores[i] = mips_sim_create();
+		if (cores[i] == NULL) {
+			while (--i > 0) {
+				mips_sim_destroy(cores[i]);
+			}
+			free(cores);
+			free(sim->SHARED_CODE_PAGES);
+			sim->SHARED_CODE_PAGES = NULL;
+			return FALSE;
+		}
+		cores[i]->MEM_OWNER = sim;
+		cores[i]->CORE_ID = i;
+	}
+	sim->CORES = cores;
+	sim->NUM_CORES = n;
+	multicore_reset(sim);
+	return TRUE;
+}
+
+void mips_sim_set_quantum(mips_sim_t *sim, uint32_t quantum)
+{
+	sim->QUANTUM = quantum;
+	sim->TURN_LEFT = 0;
+}
+
+mips_sim_t *mips_sim_core(mips_sim_t *sim, uint32_t index)
+{
+	if (index == 0) {
+		return sim;
+	}
+	return (index < sim->NUM_CORES) ? sim->CORES[index] : NULL;
+}
+
+/***************************************************************/
+/* Start every secondary core over from core 0's state, after a load   */
+/* or reset of core 0                                                  */
+/***************************************************************/
+void multicore_reset(mips_sim_t *sim)
+{
+	mips_sim_t *core;
+	uint32_t i, address;
+
+	if (sim->NUM_CORES <= 1) {
+		return;
+	}
+	/* every core may run the program text straight from the image */
+	for (i = 0; i < sim->IMAGE_WORDS; i++) {
+		address = sim->IMAGE_BASE + 4 * i;
+		sim->SHARED_CODE_PAGES[address >> (MEM_PAGE_BITS + 5)] |= CODE_PAGE_BIT(address);
+	}
+	sim->SHARED_CODE_SEEN = sim->SHARED_CODE_GEN;
+	sim->CURRENT_STATE.REGS[REG_K0] = 0;
+	sim->CURRENT_STATE.REGS[REG_K1] = sim->NUM_CORES;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->MEM_MAP_SEEN = sim->MEM_MAP_GEN;
+	sim->TURN_CORE = 0;
+	sim->TURN_LEFT = 0;
+
+	for (i = 1; i < sim->NUM_CORES; i++) {
+		core = sim->CORES[i];
+		if (core->IMAGE != sim->IMAGE) {
+			if (sim->IMAGE != NULL) {
+				mips_image_retain(sim->IMAGE);
+			}
+			mips_image_release(core->IMAGE);
+			core->IMAGE = sim->IMAGE;
+		}
+		/* the image's own decodes: core 0's may carry breakpoints */
+		core->IMAGE_BASE = sim->IMAGE_BASE;
+		core->IMAGE_WORDS = (sim->IMAGE != NULL) ? sim->IMAGE_WORDS : 0;
+		core->IMAGE_DECODED = (sim->IMAGE != NULL) ? sim->IMAGE->decoded : NULL;
+		mem_tlb_flush(core);
+		decode_flush(core);
+		core->MEM_MAP_SEEN = sim->MEM_MAP_GEN;
+		core->SHARED_CODE_SEEN = sim->SHARED_CODE_GEN;
+
+		core->CURRENT_STATE = sim->CURRENT_STATE;
+		core->CURRENT_STATE.REGS[REG_K0] = i;
+		core->NEXT_STATE = core->CURRENT_STATE;
+		core->INSTRUCTION_COUNT = 0;
+		core->RUN_FLAG = TRUE;
+		core->STOP_REASON = STOP_NONE;
+		core->RESUME = FALSE;
+		core->LL_VALID = FALSE;
+	}
+}
+
+/***************************************************************/
+/* Round-robin turns on this thread. The turn in progress carries over */
+/* to the next call, so run 100 twice is run 200.                      */
+/***************************************************************/
+static uint32_t lockstep_run(mips_sim_t *sim, uint32_t max)
+{
+	uint32_t quantum = sim->QUANTUM ? sim->QUANTUM : MULTICORE_QUANTUM;
+	uint32_t executed = 0, idle = 0, turn;
+	mips_sim_t *core;
+
+	if (sim->TURN_LEFT == 0 || sim->TURN_LEFT > quantum) {
+		sim->TURN_LEFT = quantum;
+	}
+	while (executed < max && idle < sim->NUM_CORES && sim->STOP_REASON == STOP_NONE) {
+		core = sim->CORES[sim->TURN_CORE];
+		if (core->RUN_FLAG) {
+			idle = 0;
+			turn = (sim->TURN_LEFT < max - executed) ? sim->TURN_LEFT : max - executed;
+			mem_sync(core);
+			turn = core_run(core, turn);
+			executed += turn;
+			sim->TURN_LEFT -= turn;
+			if (sim->TURN_LEFT > 0 && core->RUN_FLAG) {
+				/* out of instructions or stopped; the turn goes on next time */
+				continue;
+			}
+		} else {
+			idle++;
+		}
+		sim->TURN_CORE = (sim->TURN_CORE + 1) % sim->NUM_CORES;
+		sim->TURN_LEFT = quantum;
+	}
+	return executed;
+}
+
+static void *core_thread(void *arg)
+{
+	core_thread_t *t = arg;
+	mips_sim_t *core = t->core, *owner = core->MEM_OWNER;
+	uint32_t slice;
+
+	while (t->executed < t->max && core->RUN_FLAG && !__atomic_load_n(&owner->CORES_STOP, __ATOMIC_ACQUIRE)) {
+		slice = (t->max - t->executed < MULTICORE_SLICE) ? t->max - t->executed : MULTICORE_SLICE;
+		mem_sync(core);
+		t->executed += core_run(core, slice);
+		if (core->STOP_REASON != STOP_NONE) {
+			__atomic_store_n(&owner->CORES_STOP, TRUE, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+/***************************************************************/
+/* Free-running: an even share of max for every running core, core 0's */
+/* (or the first running one's) on this thread                         */
+/***************************************************************/
+static uint32_t threads_run(mips_sim_t *sim, uint32_t max)
+{
+	core_thread_t threads[MULTICORE_MAX];
+	uint32_t i, running = 0, executed = 0;
+
+	for (i = 0; i < sim->NUM_CORES; i++) {
+		if (sim->CORES[i]->RUN_FLAG) {
+			threads[running].core = sim->CORES[i];
+			threads[running].executed = 0;
+			running++;
+		}
+	}
+	if (running == 0) {
+		return 0;
+	}
+	for (i = 0; i < running; i++) {
+		threads[i].max = max / running;
+	}
+	threads[0].max += max % running;
+	for (i = 1; i < running; i++) {
+		if (pthread_create(&threads[i].thread, NULL, core_thread, &threads[i]) != 0) {
+			printf("Error: Can't start a thread for core %u\n", threads[i].core->CORE_ID);
+			exit(-1);
+		}
+	}
+	core_thread(&threads[0]);
+	for (i = 1; i < running; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	for (i = 0; i < running; i++) {
+		executed += threads[i].executed;
+	}
+	return executed;
+}
+
+/***************************************************************/
+/* engine_run() for more than one core: up to max instructions of all  */
+/* of them together                                                    */
+/***************************************************************/
+uint32_t multicore_run(mips_sim_t *sim, uint32_t max)
+{
+	mips_sim_t *core;
+	uint32_t i;
+
+	for (i = 1; i < sim->NUM_CORES; i++) {
+		core = sim->CORES[i];
+		core->ENGINE = sim->ENGINE;
+		core->CONSOLE_IN = sim->CONSOLE_IN;
+		core->CONSOLE_OUT = sim->CONSOLE_OUT;
+	}
+	sim->CORES_STOP = FALSE;
+	if (sim->QUANTUM > 0 || max <= sim->NUM_CORES * MULTICORE_SLICE) {
+		return lockstep_run(sim, max);
+	}
+	return threads_run(sim, max);
+}
+
+void multicore_free(mips_sim_t *sim)
+{
+	uint32_t i;
+
+	if (sim->CORES == NULL) {
+		return;
+	}
+	for (i = 1; i < sim->NUM_CORES; i++) {
+		mips_sim_destroy(sim->CORES[i]);
+	}
+	free(sim->CORES);
+	sim->CORES = NULL;
+	sim->NUM_CORES = 1;
+	free(sim->SHARED_CODE_PAGES);
+	sim->SHARED_CODE_PAGES = NULL;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Five-stage pipeline timing model (pipeline command, -P). It rides on */
+/* the interpreter like the profiler: after each instruction,            */
+/* pipeline_record() works out the cycle the instruction reaches ID in  */
+/* a classic in-order IF/ID/EX/MEM/WB pipeline, given what the earlier  */
+/* instructions produce and when. The functional state is untouched.    */
+/*                                                                                                                  */
+/* Per register it keeps the cycle the newest value is computed (end of */
+/* EX, end of MEM for loads) and the cycle it is written back. With      */
+/* forwarding an operand is usable in the stage after it is computed;   */
+/* without, only by an ID in or after the write-back cycle (the         */
+/* register file writes in the first half of a cycle, reads in the     */
+/* second). Operands are needed in EX, store data in MEM and branch and */
+/* jr operands in the branch resolution stage. Branches are predicted   */
+/* not taken; a taken branch or jr restarts fetch after it resolves, j */
+/* and jal after ID.                                                                                  */
+/***************************************************************/
+#define PIPE_REGS	(MIPS_REGS + 2)	/* R0-R31, HI, LO */
+#define PIPE_HI		MIPS_REGS
+#define PIPE_LO		(MIPS_REGS + 1)
+#define PIPE_NONE	0xFF
+
+/* stage offsets from ID */
+#define PIPE_AT_ID	0
+#define PIPE_AT_EX	1
+#define PIPE_AT_MEM	2
+
+typedef struct pipeline_struct {
+	int forwarding, branch_stage;
+
+	uint64_t next_id;		/* earliest ID cycle of the next instruction */
+	uint64_t last_id;
+	uint64_t ready[PIPE_REGS];	/* cycle the value is computed at the end of */
+	uint64_t written[PIPE_REGS];	/* write-back cycle */
+	uint8_t loaded[PIPE_REGS];	/* value comes from a load */
+
+	uint64_t instructions, loads, stores, branches, taken, jumps, forwards;
+	uint64_t load_use_stalls, data_stalls, branch_stalls, jump_stalls;
+} pipeline_t;
+
+/* what an instruction reads and writes, and when */
+typedef struct {
+	uint8_t src[3], at[3];		/* registers read and the stage they are needed in */
+	uint8_t dst[2];
+	int load, store, branch, jump;
+} pipe_inst_t;
+
+static const char *STAGE_NAMES[] = { "ID", "EX", "MEM" };
+
+/***************************************************************/
+/* Parse a branch resolution stage (id, ex, mem), -1 if unknown       */
+/***************************************************************/
+int pipeline_parse_stage(const char *name)
+{
+	int i;
+
+	for (i = PIPE_AT_ID; i <= PIPE_AT_MEM; i++) {
+		if (strcasecmp(name, STAGE_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void pipeline_start(mips_sim_t *sim, int forwarding, int branch_stage)
+{
+	pipeline_t *p;
+
+	pipeline_stop(sim);
+	p = calloc(1, sizeof(pipeline_t));
+	if (p == NULL) {
+		printf("Error: out of memory for the pipeline model\n");
+		exit(-1);
+	}
+	p->forwarding = forwarding;
+	p->branch_stage = branch_stage;
+	p->next_id = 1;			/* the first instruction is fetched in cycle 0 */
+	sim->PIPELINE = p;
+}
+
+void pipeline_stop(mips_sim_t *sim)
+{
+	free(sim->PIPELINE);
+	sim->PIPELINE = NULL;
+}
+
+static void reads(pipe_inst_t *in, int reg, int at)
+{
+	int i;
+
+	for (i = 0; in->src[i] != PIPE_NONE; i++);
+	in->src[i] = reg;
+	in->at[i] = at;
+}
+
+static void writes(pipe_inst_t *in, int reg)
+{
+	in->dst[in->dst[0] == PIPE_NONE ? 0 : 1] = reg;
+}
+
+/***************************************************************/
+/* Operands of an instruction. Unimplemented instructions flow through */
+/* like nops.                                                                                        */
+/***************************************************************/
+static void classify(const decoded_inst_t *d, int branch_stage, pipe_inst_t *in)
+{
+	memset(in, 0, sizeof(*in));
+	memset(in->src, PIPE_NONE, sizeof(in->src));
+	memset(in->dst, PIPE_NONE, sizeof(in->dst));
+	if (d->handler == NULL) {
+		return;
+	}
+
+	if (d->opcode == 0x00) {
+		switch (d->function) {
+			case 0x00: case 0x02: case 0x03:	/* shifts */
+				reads(in, d->rt, PIPE_AT_EX);
+				writes(in, d->rd);
+				break;
+			case 0x08:				/* jr */
+				reads(in, d->rs, branch_stage);
+				in->branch = TRUE;
+				break;
+			case 0x09:				/* jalr */
+				reads(in, d->rs, branch_stage);
+				writes(in, d->rd);
+				in->branch = TRUE;
+				break;
+			case 0x0C:				/* syscall: $v0 and $a0 in, $v0 out */
+				reads(in, 2, PIPE_AT_EX);
+				reads(in, 4, PIPE_AT_EX);
+				writes(in, 2);
+				break;
+			case 0x10:
+				reads(in, PIPE_HI, PIPE_AT_EX);
+				writes(in, d->rd);
+				break;
+			case 0x12:
+				reads(in, PIPE_LO, PIPE_AT_EX);
+				writes(in, d->rd);
+				break;
+			case 0x11:
+				reads(in, d->rs, PIPE_AT_EX);
+				writes(in, PIPE_HI);
+				break;
+			case 0x13:
+				reads(in, d->rs, PIPE_AT_EX);
+				writes(in, PIPE_LO);
+				break;
+			case 0x18: case 0x19: case 0x1A: case 0x1B:	/* mult, div */
+				reads(in, d->rs, PIPE_AT_EX);
+				reads(in, d->rt, PIPE_AT_EX);
+				writes(in, PIPE_HI);
+				writes(in, PIPE_LO);
+				break;
+			default:				/* three-register ALU */
+				reads(in, d->rs, PIPE_AT_EX);
+				reads(in, d->rt, PIPE_AT_EX);
+				writes(in, d->rd);
+				break;
+		}
+		return;
+	}
+
+	switch (d->opcode) {
+		case 0x02:					/* j */
+			in->jump = TRUE;
+			break;
+		case 0x03:					/* jal */
+			writes(in, 31);
+			in->jump = TRUE;
+			break;
+		case 0x04: case 0x05:				/* beq, bne */
+			reads(in, d->rs, branch_stage);
+			reads(in, d->rt, branch_stage);
+			in->branch = TRUE;
+			break;
+		case 0x01: case 0x06: case 0x07:		/* regimm, blez, bgtz */
+			reads(in, d->rs, branch_stage);
+			in->branch = TRUE;
+			break;
+		case 0x0F:					/* lui */
+			writes(in, d->rt);
+			break;
+		case 0x20: case 0x21: case 0x23: case 0x30:	/* lb, lh, lw, ll */
+			reads(in, d->rs, PIPE_AT_EX);
+			writes(in, d->rt);
+			in->load = TRUE;
+			break;
+		case 0x28: case 0x29: case 0x2B:		/* sb, sh, sw */
+			reads(in, d->rs, PIPE_AT_EX);
+			reads(in, d->rt, PIPE_AT_MEM);
+			in->store = TRUE;
+			break;
+		case 0x38:					/* sc, which also writes its result */
+			reads(in, d->rs, PIPE_AT_EX);
+			reads(in, d->rt, PIPE_AT_MEM);
+			writes(in, d->rt);
+			in->store = TRUE;
+			break;
+		default:					/* immediate ALU */
+			reads(in, d->rs, PIPE_AT_EX);
+			writes(in, d->rt);
+			break;
+	}
+}
+
+/***************************************************************/
+/* Time the instruction d that just ran at CURRENT_STATE.PC                */
+/***************************************************************/
+void pipeline_record(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	pipeline_t *p = sim->PIPELINE;
+	pipe_inst_t in;
+	uint64_t id = p->next_id, need;
+	int i, reg, binding = PIPE_NONE;
+
+	classify(d, p->branch_stage, &in);
+
+	/* ID waits until every operand can be had in the stage that needs it */
+	for (i = 0; in.src[i] != PIPE_NONE; i++) {
+		reg = in.src[i];
+		if (!p->forwarding) {
+			need = p->written[reg];
+		} else {
+			need = (p->ready[reg] + 1 > in.at[i]) ? p->ready[reg] + 1 - in.at[i] : 0;
+		}
+		if (need > id) {
+			id = need;
+			binding = reg;
+		}
+	}
+	if (binding != PIPE_NONE) {
+		if (p->loaded[binding]) {
+			p->load_use_stalls += id - p->next_id;
+		} else {
+			p->data_stalls += id - p->next_id;
+		}
+	}
+	if (p->forwarding) {
+		for (i = 0; in.src[i] != PIPE_NONE; i++) {
+			/* not in the register file yet when ID reads it */
+			if (id < p->written[in.src[i]]) {
+				p->forwards++;
+			}
+		}
+	}
+
+	for (i = 0; i < 2 && in.dst[i] != PIPE_NONE; i++) {
+		p->ready[in.dst[i]] = id + (in.load ? PIPE_AT_MEM : PIPE_AT_EX);
+		p->written[in.dst[i]] = id + 3;
+		p->loaded[in.dst[i]] = in.load;
+	}
+
+	p->next_id = id + 1;
+	if (in.jump) {
+		p->jumps++;
+		p->jump_stalls++;
+		p->next_id = id + 2;
+	} else if (in.branch) {
+		p->branches++;
+		if (sim->NEXT_STATE.PC != sim->CURRENT_STATE.PC + 4) {
+			p->taken++;
+			p->branch_stalls += p->branch_stage + 1;
+			p->next_id = id + p->branch_stage + 2;
+		}
+	}
+	p->loads += in.load;
+	p->stores += in.store;
+	p->instructions++;
+	p->last_id = id;
+}
+
+/***************************************************************/
+/* The cycle the last timed instruction reached ID; the difference     */
+/* over a stretch of a run is the cycles it took                       */
+/***************************************************************/
+uint64_t pipeline_cycle(const mips_sim_t *sim)
+{
+	return sim->PIPELINE->last_id;
+}
+
+/***************************************************************/
+/* Cycle count, CPI and where the stalls came from                         */
+/***************************************************************/
+void pipeline_print(mips_sim_t *sim)
+{
+	pipeline_t *p = sim->PIPELINE;
+	uint64_t cycles = p->instructions ? p->last_id + 4 : 0;
+	uint64_t stalls = p->load_use_stalls + p->data_stalls + p->branch_stalls + p->jump_stalls;
+
+	printf("-------------------------------------\n");
+	printf("Pipeline: 5 stages, forwarding %s, branches resolved in %s\n", p->forwarding ? "on" : "off",
+		STAGE_NAMES[p->branch_stage]);
+	printf("-------------------------------------\n");
+	printf("Instructions\t: %llu\n", (unsigned long long)p->instructions);
+	printf("Cycles\t\t: %llu\n", (unsigned long long)cycles);
+	printf("CPI\t\t: %.3f\n", p->instructions ? (double)cycles / p->instructions : 0.0);
+	printf("Stall cycles\t: %llu\n", (unsigned long long)stalls);
+	printf("  load-use\t: %llu\n", (unsigned long long)p->load_use_stalls);
+	printf("  data (RAW)\t: %llu\n", (unsigned long long)p->data_stalls);
+	printf("  branch\t: %llu (%llu of %llu branches taken)\n", (unsigned long long)p->branch_stalls,
+		(unsigned long long)p->taken, (unsigned long long)p->branches);
+	printf("  jump\t\t: %llu\n", (unsigned long long)p->jump_stalls);
+	printf("Forwarded\t: %llu operands\n", (unsigned long long)p->forwards);
+	printf("Loads/stores\t: %llu/%llu\n", (unsigned long long)p->loads, (unsigned long long)p->stores);
+	printf("-------------------------------------\n\n");
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Profiler (profile command, -p). While sim->PROFILE is set, runs go  */
+/* through the interpreter's profiled loop, which calls                */
+/* profile_record() after every instruction; with it unset no engine   */
+/* executes any profiling code.                                        */
+/*                                                                     */
+/* Opcode/function counters are exact. The PC histogram and the call   */
+/* stacks are sampled every PERIOD instructions (1 is exact). Call     */
+/* frames are inferred from the instructions: jal/jalr enter the       */
+/* function at their target, jr $31 leaves it. The stacks form a tree  */
+/* of (caller node, function) nodes, so a sample is one increment.     */
+/***************************************************************/
+#define PROFILE_COUNTERS	128	/* opcodes, then 64 + function for opcode 0x00 */
+#define PROFILE_MAX_DEPTH	256	/* deeper calls are charged to the deepest frame */
+#define PROFILE_NONE		0xFFFFFFFF
+#define PROFILE_HOT_PCS		20
+
+typedef struct {
+	uint32_t func;			/* entry address of the function */
+	uint32_t parent, first_child, next_sibling;
+	uint64_t samples;
+} profile_node_t;
+
+typedef struct profile_struct {
+	uint32_t period, countdown;
+	uint64_t executed, samples;
+	uint64_t counters[PROFILE_COUNTERS];
+
+	/* PC histogram, open addressing, PROFILE_NONE marks a free slot */
+	uint32_t *pcs;
+	uint64_t *pc_samples;
+	uint32_t pc_capacity, pc_used;
+
+	profile_node_t *nodes;
+	uint32_t num_nodes, node_capacity;
+	uint32_t current;		/* node of the running function */
+	uint32_t depth, overflow;	/* calls not pushed past PROFILE_MAX_DEPTH */
+} profile_t;
+
+static void *profile_alloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		printf("Error: out of memory for the profile\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static uint32_t new_node(profile_t *p, uint32_t parent, uint32_t func)
+{
+	profile_node_t *n;
+
+	if (p->num_nodes == p->node_capacity) {
+		p->node_capacity = p->node_capacity ? 2 * p->node_capacity : 256;
+		p->nodes = profile_alloc(p->nodes, p->node_capacity * sizeof(profile_node_t));
+	}
+	n = &p->nodes[p->num_nodes];
+	n->func = func;
+	n->parent = parent;
+	n->first_child = PROFILE_NONE;
+	n->samples = 0;
+	if (parent != PROFILE_NONE) {
+		n->next_sibling = p->nodes[parent].first_child;
+		p->nodes[parent].first_child = p->num_nodes;
+	} else {
+		n->next_sibling = PROFILE_NONE;
+	}
+	return p->num_nodes++;
+}
+
+/***************************************************************/
+/* Start profiling from the current PC, dropping any earlier profile   */
+/***************************************************************/
+void profile_start(mips_sim_t *sim, uint32_t period)
+{
+	profile_t *p;
+
+	profile_stop(sim);
+	p = profile_alloc(NULL, sizeof(profile_t));
+	memset(p, 0, sizeof(profile_t));
+	p->period = period ? period : 1;
+	p->countdown = p->period;
+	p->pc_capacity = 1024;
+	p->pcs = profile_alloc(NULL, p->pc_capacity * sizeof(uint32_t));
+	p->pc_samples = profile_alloc(NULL, p->pc_capacity * sizeof(uint64_t));
+	memset(p->pcs, 0xFF, p->pc_capacity * sizeof(uint32_t));
+	p->current = new_node(p, PROFILE_NONE, sim->CURRENT_STATE.PC);
+	sim->PROFILE = p;
+}
+
+void profile_stop(mips_sim_t *sim)
+{
+	profile_t *p = sim->PROFILE;
+
+	if (p == NULL) {
+		return;
+	}
+	free(p->pcs);
+	free(p->pc_samples);
+	free(p->nodes);
+	free(p);
+	sim->PROFILE = NULL;
+}
+
+static uint32_t pc_slot(const profile_t *p, uint32_t pc)
+{
+	uint32_t i = ((pc >> 2) * 2654435761u) & (p->pc_capacity - 1);
+
+	while (p->pcs[i] != pc && p->pcs[i] != PROFILE_NONE) {
+		i = (i + 1) & (p->pc_capacity - 1);
+	}
+	return i;
+}
+
+static void pc_grow(profile_t *p)
+{
+	uint32_t *pcs = p->pcs, old = p->pc_capacity, i, slot;
+	uint64_t *samples = p->pc_samples;
+
+	p->pc_capacity *= 2;
+	p->pcs = profile_alloc(NULL, p->pc_capacity * sizeof(uint32_t));
+	p->pc_samples = profile_alloc(NULL, p->pc_capacity * sizeof(uint64_t));
+	memset(p->pcs, 0xFF, p->pc_capacity * sizeof(uint32_t));
+	for (i = 0; i < old; i++) {
+		if (pcs[i] != PROFILE_NONE) {
+			slot = pc_slot(p, pcs[i]);
+			p->pcs[slot] = pcs[i];
+			p->pc_samples[slot] = samples[i];
+		}
+	}
+	free(pcs);
+	free(samples);
+}
+
+static void sample(profile_t *p, uint32_t pc)
+{
+	uint32_t slot = pc_slot(p, pc);
+
+	if (p->pcs[slot] == PROFILE_NONE) {
+		if (2 * (p->pc_used + 1) > p->pc_capacity) {
+			pc_grow(p);
+			slot = pc_slot(p, pc);
+		}
+		p->pcs[slot] = pc;
+		p->pc_samples[slot] = 0;
+		p->pc_used++;
+	}
+	p->pc_samples[slot]++;
+	p->nodes[p->current].samples++;
+	p->samples++;
+}
+
+static void call(profile_t *p, uint32_t func)
+{
+	uint32_t child;
+
+	if (p->depth == PROFILE_MAX_DEPTH) {
+		p->overflow++;
+		return;
+	}
+	for (child = p->nodes[p->current].first_child; child != PROFILE_NONE; child = p->nodes[child].next_sibling) {
+		if (p->nodes[child].func == func) {
+			break;
+		}
+	}
+	if (child == PROFILE_NONE) {
+		child = new_node(p, p->current, func);
+	}
+	p->current = child;
+	p->depth++;
+}
+
+static void ret(profile_t *p)
+{
+	if (p->overflow > 0) {
+		p->overflow--;
+	} else if (p->depth > 0) {
+		p->current = p->nodes[p->current].parent;
+		p->depth--;
+	}
+}
+
+/***************************************************************/
+/* Account the instruction d that just ran at CURRENT_STATE.PC        */
+/***************************************************************/
+void profile_record(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	profile_t *p = sim->PROFILE;
+
+	p->executed++;
+	p->counters[d->opcode ? d->opcode : 64 + d->function]++;
+	if (--p->countdown == 0) {
+		p->countdown = p->period;
+		sample(p, sim->CURRENT_STATE.PC);
+	}
+	if (d->opcode == 0x03 || (d->opcode == 0x00 && d->function == 0x09)) {
+		call(p, sim->NEXT_STATE.PC);
+	} else if (d->opcode == 0x00 && d->function == 0x08 && d->rs == 31) {
+		ret(p);
+	}
+}
+
+static int compare_desc(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x < y) - (x > y);
+}
+
+/***************************************************************/
+/* The stats command: instruction mix and the hottest PCs              */
+/***************************************************************/
+void profile_print(mips_sim_t *sim)
+{
+	profile_t *p = sim->PROFILE;
+	uint64_t order[PROFILE_COUNTERS][2], (*hot)[2];
+	uint32_t i, n, word;
+	char text[TRACE_LINE_MAX], *c;
+
+	if (p == NULL) {
+		printf("Profiling is off (profile <period>)\n\n");
+		return;
+	}
+	printf("-------------------------------------\n");
+	printf("Profile: %llu instructions, %llu samples (every %u)\n", (unsigned long long)p->executed,
+		(unsigned long long)p->samples, p->period);
+	printf("-------------------------------------\n");
+	printf("[Instruction]\t[Count]\t\t[%%]\n");
+	for (i = 0, n = 0; i < PROFILE_COUNTERS; i++) {
+		if (p->counters[i]) {
+			order[n][0] = p->counters[i];
+			order[n++][1] = i;
+		}
+	}
+	qsort(order, n, sizeof(order[0]), compare_desc);
+	for (i = 0; i < n; i++) {
+		word = (order[i][1] < 64) ? order[i][1] << 26 : order[i][1] - 64;
+		printf("%-8s\t%-12llu\t%5.2f\n", instruction_name(word), (unsigned long long)order[i][0],
+			100.0 * order[i][0] / p->executed);
+	}
+
+	printf("-------------------------------------\n");
+	printf("[PC]\t\t[Samples]\t[%%]\t[Instruction]\n");
+	hot = profile_alloc(NULL, (p->pc_used ? p->pc_used : 1) * sizeof(hot[0]));
+	for (i = 0, n = 0; i < p->pc_capacity; i++) {
+		if (p->pcs[i] != PROFILE_NONE) {
+			hot[n][0] = p->pc_samples[i];
+			hot[n++][1] = p->pcs[i];
+		}
+	}
+	qsort(hot, n, sizeof(hot[0]), compare_desc);
+	for (i = 0; i < n && i < PROFILE_HOT_PCS; i++) {
+		format_instruction(mem_read_32(sim, hot[i][1]), text, sizeof(text));
+		for (c = text; *c; c++) {
+			if (*c == '\n') {
+				*c = ' ';
+			}
+		}
+		printf("0x%08x\t%-12llu\t%5.2f\t%s\n", (uint32_t)hot[i][1], (unsigned long long)hot[i][0],
+			100.0 * hot[i][0] / p->samples, text);
+	}
+	free(hot);
+	printf("-------------------------------------\n\n");
+}
+
+/***************************************************************/
+/* Folded stacks for flamegraph.pl: one line per call path with       */
+/* samples, frames named by function address, outermost first.        */
+/***************************************************************/
+int profile_write_folded(mips_sim_t *sim, FILE *out)
+{
+	profile_t *p = sim->PROFILE;
+	uint32_t path[PROFILE_MAX_DEPTH + 1];
+	uint32_t i, node;
+	int depth;
+
+	if (p == NULL) {
+		return FALSE;
+	}
+	for (i = 0; i < p->num_nodes; i++) {
+		if (p->nodes[i].samples == 0) {
+			continue;
+		}
+		depth = 0;
+		for (node = i; node != PROFILE_NONE; node = p->nodes[node].parent) {
+			path[depth++] = p->nodes[node].func;
+		}
+		while (depth-- > 0) {
+			fprintf(out, "0x%08x%c", path[depth], depth ? ';' : ' ');
+		}
+		fprintf(out, "%llu\n", (unsigned long long)p->nodes[i].samples);
+	}
+	return TRUE;
+}
@@ -0,0 +1,747 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Sampled simulation (sample command), SimPoint style. The detailed   */
+/* models cost far more per instruction than the engines, so instead   */
+/* of timing a whole run:                                              */
+/*                                                                     */
+/*   1. run the program from its reset state functionally, cutting it */
+/*      into fixed intervals and recording for each one its basic      */
+/*      block vector: how many instructions every block executed. The  */
+/*      interpreter's block runner provides the blocks, so this costs  */
+/*      about an untraced interpreter run.                             */
+/*   2. project the vectors to SAMPLE_DIMS random dimensions, cluster  */
+/*      them with k-means for k = 1..clusters and keep the smallest k  */
+/*      that scores within SAMPLE_BIC_THRESHOLD of the best BIC.       */
+/*   3. pick per cluster the interval nearest its centre plus up to    */
+/*      samples-1 random others, then run the program again: the       */
+/*      selected engine fast-forwards to each of them (the functional  */
+/*      checkpoint, written to a file when asked), the models warm up  */
+/*      for warmup instructions and time the interval.                 */
+/*                                                                     */
+/* The whole-program CPI is the instruction-weighted mean of the       */
+/* clusters' sampled CPIs, a stratified sample: its confidence bounds  */
+/* come from the spread within the clusters, which needs at least two  */
+/* samples from every cluster that was not run in full.                */
+/*                                                                     */
+/* CPI is the pipeline model's; the other models that are on run in    */
+/* the detailed intervals too. Both passes run with the guest console  */
+/* off (output dropped, read_int reads 0) so they execute the same     */
+/* instructions; afterwards the program is reset.                      */
+/***************************************************************/
+#define SAMPLE_DIMS		15
+#define SAMPLE_CLUSTERS		10	/* defaults of interval:clusters:samples:warmup */
+#define SAMPLE_SAMPLES		3
+#define SAMPLE_SEEDS		5	/* k-means starts per k, the least distorted wins */
+#define SAMPLE_ITERATIONS	100
+#define SAMPLE_BIC_THRESHOLD	0.9
+#define SAMPLE_FIT_MAX		2000	/* intervals k-means runs on */
+#define SAMPLE_NONE		0xFFFFFFFF
+#define SAMPLE_PATH_MAX		1024
+
+typedef struct {
+	uint32_t interval, clusters, samples, warmup;
+
+	/* basic blocks by start PC, open addressing, SAMPLE_NONE marks a free slot */
+	uint32_t *pcs, *ids;
+	uint32_t capacity, used;
+	uint32_t *counts;		/* by block id: instructions in the current interval */
+	double *projection;		/* by block id: SAMPLE_DIMS random weights */
+	uint32_t *touched, num_touched;	/* blocks with a count */
+	uint32_t block_capacity;
+
+	/* per interval: its projected vector and length */
+	double *vectors;
+	uint32_t *lengths;
+	uint32_t num_intervals, interval_capacity;
+
+	uint64_t random;
+} sampler_t;
+
+typedef struct {
+	uint32_t interval, cluster;
+	int representative;		/* the cluster's interval nearest its centre */
+	double cpi;
+} sample_point_t;
+
+/* Student's t for a two-sided 95% interval by degrees of freedom; 1.96 past 30 */
+static const double T_95[31] = { 0,
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static void *sample_alloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		printf("Error: out of memory for sampling\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/* xorshift64*, seeded the same every time so a sampling repeats */
+static uint64_t next_random(sampler_t *s)
+{
+	s->random ^= s->random >> 12;
+	s->random ^= s->random << 25;
+	s->random ^= s->random >> 27;
+	return s->random * 2685821657736338717ull;
+}
+
+static double uniform(sampler_t *s)
+{
+	return (next_random(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double seconds_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/***************************************************************/
+/* Pass 1: basic block vectors                                         */
+/***************************************************************/
+static void grow_blocks(sampler_t *s)
+{
+	uint32_t *pcs = s->pcs, *ids = s->ids, old = s->capacity, i, slot;
+
+	s->capacity = old ? 2 * old : 1024;
+	s->pcs = sample_alloc(NULL, s->capacity * sizeof(uint32_t));
+	s->ids = sample_alloc(NULL, s->capacity * sizeof(uint32_t));
+	memset(s->pcs, 0xFF, s->capacity * sizeof(uint32_t));
+	for (i = 0; i < old; i++) {
+		if (pcs[i] == SAMPLE_NONE) {
+			continue;
+		}
+		for (slot = (pcs[i] >> 2) & (s->capacity - 1); s->pcs[slot] != SAMPLE_NONE; slot = (slot + 1) & (s->capacity - 1));
+		s->pcs[slot] = pcs[i];
+		s->ids[slot] = ids[i];
+	}
+	free(pcs);
+	free(ids);
+}
+
+static uint32_t block_id(sampler_t *s, uint32_t pc)
+{
+	uint32_t slot, id, j;
+
+	if (2 * (s->used + 1) > s->capacity) {
+		grow_blocks(s);
+	}
+	for (slot = (pc >> 2) & (s->capacity - 1); s->pcs[slot] != SAMPLE_NONE; slot = (slot + 1) & (s->capacity - 1)) {
+		if (s->pcs[slot] == pc) {
+			return s->ids[slot];
+		}
+	}
+	id = s->used++;
+	s->pcs[slot] = pc;
+	s->ids[slot] = id;
+	if (id == s->block_capacity) {
+		s->block_capacity = s->block_capacity ? 2 * s->block_capacity : 1024;
+		s->counts = sample_alloc(s->counts, s->block_capacity * sizeof(uint32_t));
+		s->touched = sample_alloc(s->touched, s->block_capacity * sizeof(uint32_t));
+		s->projection = sample_alloc(s->projection, s->block_capacity * SAMPLE_DIMS * sizeof(double));
+	}
+	s->counts[id] = 0;
+	for (j = 0; j < SAMPLE_DIMS; j++) {
+		s->projection[id * SAMPLE_DIMS + j] = 2 * uniform(s) - 1;
+	}
+	return id;
+}
+
+static void count_block(sampler_t *s, uint32_t pc, uint32_t n)
+{
+	uint32_t id = block_id(s, pc);
+
+	if (s->counts[id] == 0) {
+		s->touched[s->num_touched++] = id;
+	}
+	s->counts[id] += n;
+}
+
+/* project the finished interval's normalized vector and clear the counts */
+static void end_interval(sampler_t *s, uint32_t length)
+{
+	double *v, w;
+	uint32_t i, j, id;
+
+	if (s->num_intervals == s->interval_capacity) {
+		s->interval_capacity = s->interval_capacity ? 2 * s->interval_capacity : 256;
+		s->vectors = sample_alloc(s->vectors, s->interval_capacity * SAMPLE_DIMS * sizeof(double));
+		s->lengths = sample_alloc(s->lengths, s->interval_capacity * sizeof(uint32_t));
+	}
+	v = &s->vectors[s->num_intervals * SAMPLE_DIMS];
+	memset(v, 0, SAMPLE_DIMS * sizeof(double));
+	for (i = 0; i < s->num_touched; i++) {
+		id = s->touched[i];
+		w = (double)s->counts[id] / length;
+		for (j = 0; j < SAMPLE_DIMS; j++) {
+			v[j] += w * s->projection[id * SAMPLE_DIMS + j];
+		}
+		s->counts[id] = 0;
+	}
+	s->num_touched = 0;
+	s->lengths[s->num_intervals++] = length;
+}
+
+/* the whole program, or its first max instructions, a block at a time */
+static uint64_t collect_vectors(mips_sim_t *sim, sampler_t *s, uint64_t max)
+{
+	uint64_t executed = 0, left;
+	uint32_t pc, n, in_interval = 0;
+
+	while (sim->RUN_FLAG && executed < max) {
+		left = s->interval - in_interval;
+		if (left > max - executed) {
+			left = max - executed;
+		}
+		pc = sim->CURRENT_STATE.PC;
+		n = interp_block(sim, left);
+		sim->INSTRUCTION_COUNT += n;
+		executed += n;
+		count_block(s, pc, n);
+		in_interval += n;
+		if (in_interval == s->interval) {
+			end_interval(s, in_interval);
+			in_interval = 0;
+		}
+	}
+	if (in_interval > 0) {
+		end_interval(s, in_interval);
+	}
+	return executed;
+}
+
+/***************************************************************/
+/* Pass 2: k-means and the Bayesian information criterion              */
+/***************************************************************/
+static double distance(const double *a, const double *b)
+{
+	double d = 0;
+	int j;
+
+	for (j = 0; j < SAMPLE_DIMS; j++) {
+		d += (a[j] - b[j]) * (a[j] - b[j]);
+	}
+	return d;
+}
+
+/* k-means++ seeding, then Lloyd's iterations over the n vectors x; */
+/* returns the distortion                                            */
+static double kmeans(sampler_t *s, const double *x, uint32_t n, uint32_t k, double *centres, uint32_t *assignment,
+	double *nearest)
+{
+	uint32_t i, c, best, *sizes;
+	double total, pick, d, distortion = 0;
+	int changed, iteration;
+
+	memcpy(centres, &x[(next_random(s) % n) * SAMPLE_DIMS], SAMPLE_DIMS * sizeof(double));
+	for (i = 0; i < n; i++) {
+		nearest[i] = distance(&x[i * SAMPLE_DIMS], centres);
+	}
+	for (c = 1; c < k; c++) {
+		total = 0;
+		for (i = 0; i < n; i++) {
+			total += nearest[i];
+		}
+		pick = uniform(s) * total;
+		for (i = 0; i + 1 < n && (pick -= nearest[i]) > 0; i++);
+		memcpy(&centres[c * SAMPLE_DIMS], &x[i * SAMPLE_DIMS], SAMPLE_DIMS * sizeof(double));
+		for (i = 0; i < n; i++) {
+			d = distance(&x[i * SAMPLE_DIMS], &centres[c * SAMPLE_DIMS]);
+			if (d < nearest[i]) {
+				nearest[i] = d;
+			}
+		}
+	}
+
+	sizes = sample_alloc(NULL, k * sizeof(uint32_t));
+	memset(assignment, 0xFF, n * sizeof(uint32_t));
+	for (iteration = 0; iteration < SAMPLE_ITERATIONS; iteration++) {
+		changed = FALSE;
+		distortion = 0;
+		for (i = 0; i < n; i++) {
+			best = 0;
+			nearest[i] = distance(&x[i * SAMPLE_DIMS], centres);
+			for (c = 1; c < k; c++) {
+				d = distance(&x[i * SAMPLE_DIMS], &centres[c * SAMPLE_DIMS]);
+				if (d < nearest[i]) {
+					nearest[i] = d;
+					best = c;
+				}
+			}
+			if (assignment[i] != best) {
+				assignment[i] = best;
+				changed = TRUE;
+			}
+			distortion += nearest[i];
+		}
+		if (!changed) {
+			break;
+		}
+		memset(centres, 0, k * SAMPLE_DIMS * sizeof(double));
+		memset(sizes, 0, k * sizeof(uint32_t));
+		for (i = 0; i < n; i++) {
+			sizes[assignment[i]]++;
+			for (c = 0; c < SAMPLE_DIMS; c++) {
+				centres[assignment[i] * SAMPLE_DIMS + c] += x[i * SAMPLE_DIMS + c];
+			}
+		}
+		for (c = 0; c < k * SAMPLE_DIMS; c++) {
+			/* an emptied cluster keeps a zero centre, which is only ever further away */
+			centres[c] /= sizes[c / SAMPLE_DIMS] ? sizes[c / SAMPLE_DIMS] : 1;
+		}
+	}
+	free(sizes);
+	return distortion;
+}
+
+/* BIC of a clustering under identical spherical Gaussians (X-means) */
+static double bic(uint32_t n, uint32_t k, const uint32_t *assignment, double distortion)
+{
+	double variance, likelihood = 0, size;
+	uint32_t i, c, *sizes;
+
+	if (n <= k) {
+		return -HUGE_VAL;
+	}
+	sizes = sample_alloc(NULL, k * sizeof(uint32_t));
+	memset(sizes, 0, k * sizeof(uint32_t));
+	for (i = 0; i < n; i++) {
+		sizes[assignment[i]]++;
+	}
+	variance = distortion / (SAMPLE_DIMS * (double)(n - k));
+	if (variance < 1e-300) {
+		variance = 1e-300;
+	}
+	for (c = 0; c < k; c++) {
+		size = sizes[c];
+		if (size == 0) {
+			continue;
+		}
+		likelihood += size * log(size) - size * log((double)n) - size * SAMPLE_DIMS / 2.0 * log(2 * M_PI * variance)
+			- (size - 1) * SAMPLE_DIMS / 2.0;
+	}
+	free(sizes);
+	return likelihood - (k - 1 + SAMPLE_DIMS * k + 1) / 2.0 * log((double)n);
+}
+
+/***************************************************************/
+/* Cluster the intervals into assignment; returns the number of        */
+/* clusters. Long runs are fitted on SAMPLE_FIT_MAX random intervals,  */
+/* then every interval joins the nearest centre.                       */
+/***************************************************************/
+static uint32_t cluster(sampler_t *s, double *centres, uint32_t *assignment)
+{
+	uint32_t n = s->num_intervals, fit = (n < SAMPLE_FIT_MAX) ? n : SAMPLE_FIT_MAX;
+	uint32_t max_k = (s->clusters < fit) ? s->clusters : fit, k, seed, chosen = 1, i, j, c;
+	uint32_t *trial = sample_alloc(NULL, fit * sizeof(uint32_t));
+	uint32_t *order = sample_alloc(NULL, n * sizeof(uint32_t));
+	double *x = s->vectors, *trial_centres = sample_alloc(NULL, max_k * SAMPLE_DIMS * sizeof(double));
+	double *all_centres = sample_alloc(NULL, (size_t)max_k * max_k * SAMPLE_DIMS * sizeof(double));
+	double *nearest = sample_alloc(NULL, fit * sizeof(double));
+	double *score = sample_alloc(NULL, (max_k + 1) * sizeof(double));
+	double best, distortion, low = HUGE_VAL, high = -HUGE_VAL, d, closest;
+
+	if (fit < n) {
+		for (i = 0; i < n; i++) {
+			order[i] = i;
+		}
+		x = sample_alloc(NULL, (size_t)fit * SAMPLE_DIMS * sizeof(double));
+		for (i = 0; i < fit; i++) {
+			j = i + next_random(s) % (n - i);
+			c = order[i];
+			order[i] = order[j];
+			order[j] = c;
+			memcpy(&x[i * SAMPLE_DIMS], &s->vectors[order[i] * SAMPLE_DIMS], SAMPLE_DIMS * sizeof(double));
+		}
+	}
+	for (k = 1; k <= max_k; k++) {
+		best = HUGE_VAL;
+		for (seed = 0; seed < SAMPLE_SEEDS; seed++) {
+			distortion = kmeans(s, x, fit, k, trial_centres, trial, nearest);
+			if (distortion < best) {
+				best = distortion;
+				memcpy(&all_centres[(k - 1) * max_k * SAMPLE_DIMS], trial_centres, k * SAMPLE_DIMS * sizeof(double));
+				score[k] = bic(fit, k, trial, distortion);
+			}
+		}
+		if (score[k] > -HUGE_VAL) {
+			low = (score[k] < low) ? score[k] : low;
+			high = (score[k] > high) ? score[k] : high;
+		}
+	}
+	for (k = 1; k <= max_k; k++) {
+		if (score[k] > -HUGE_VAL && score[k] >= low + SAMPLE_BIC_THRESHOLD * (high - low)) {
+			chosen = k;
+			break;
+		}
+	}
+	memcpy(centres, &all_centres[(chosen - 1) * max_k * SAMPLE_DIMS], chosen * SAMPLE_DIMS * sizeof(double));
+	for (i = 0; i < n; i++) {
+		assignment[i] = 0;
+		closest = distance(&s->vectors[i * SAMPLE_DIMS], centres);
+		for (c = 1; c < chosen; c++) {
+			d = distance(&s->vectors[i * SAMPLE_DIMS], &centres[c * SAMPLE_DIMS]);
+			if (d < closest) {
+				closest = d;
+				assignment[i] = c;
+			}
+		}
+	}
+	if (x != s->vectors) {
+		free(x);
+	}
+	free(trial);
+	free(order);
+	free(trial_centres);
+	free(all_centres);
+	free(nearest);
+	free(score);
+	return chosen;
+}
+
+/* per cluster the interval nearest its centre, then random members */
+static uint32_t choose_samples(sampler_t *s, uint32_t k, const double *centres, const uint32_t *assignment,
+	sample_point_t *points)
+{
+	uint32_t n = s->num_intervals, *members = sample_alloc(NULL, n * sizeof(uint32_t));
+	uint32_t c, i, m, count = 0, rep, j, swap;
+	double d, best;
+
+	for (c = 0; c < k; c++) {
+		m = 0;
+		rep = 0;
+		best = HUGE_VAL;
+		for (i = 0; i < n; i++) {
+			if (assignment[i] != c) {
+				continue;
+			}
+			d = distance(&s->vectors[i * SAMPLE_DIMS], &centres[c * SAMPLE_DIMS]);
+			if (d < best) {
+				best = d;
+				rep = m;
+			}
+			members[m++] = i;
+		}
+		if (m == 0) {
+			continue;
+		}
+		swap = members[0];
+		members[0] = members[rep];
+		members[rep] = swap;
+		for (i = 0; i < s->samples && i < m; i++) {
+			if (i > 0) {
+				j = i + next_random(s) % (m - i);
+				swap = members[i];
+				members[i] = members[j];
+				members[j] = swap;
+			}
+			points[count].interval = members[i];
+			points[count].cluster = c;
+			points[count].representative = (i == 0);
+			count++;
+		}
+	}
+	free(members);
+	return count;
+}
+
+static int compare_points(const void *a, const void *b)
+{
+	const sample_point_t *x = a, *y = b;
+
+	return (x->interval > y->interval) - (x->interval < y->interval);
+}
+
+/***************************************************************/
+/* Pass 3: detail on the chosen intervals                              */
+/***************************************************************/
+typedef struct {
+	struct profile_struct *profile;
+	struct pipeline_struct *pipeline;
+	struct cache_struct *cache;
+	struct branch_struct *branch;
+} models_t;
+
+static void detach_models(mips_sim_t *sim, models_t *m)
+{
+	m->profile = sim->PROFILE;
+	m->pipeline = sim->PIPELINE;
+	m->cache = sim->CACHE;
+	m->branch = sim->BRANCH;
+	sim->PROFILE = NULL;
+	sim->PIPELINE = NULL;
+	sim->CACHE = NULL;
+	sim->BRANCH = NULL;
+}
+
+static void attach_models(mips_sim_t *sim, const models_t *m)
+{
+	sim->PROFILE = m->profile;
+	sim->PIPELINE = m->pipeline;
+	sim->CACHE = m->cache;
+	sim->BRANCH = m->branch;
+}
+
+/* up to n instructions on whatever engine_run() picks; the number run */
+static uint64_t run_for(mips_sim_t *sim, uint64_t n)
+{
+	uint64_t executed = 0, left;
+
+	while (sim->RUN_FLAG && executed < n) {
+		left = n - executed;
+		executed += engine_run(sim, left < UINT32_MAX ? left : UINT32_MAX);
+	}
+	return executed;
+}
+
+/* time every point, in interval order; FALSE if the run ended early */
+static int time_points(mips_sim_t *sim, sampler_t *s, sample_point_t *points, uint32_t count, const char *prefix)
+{
+	models_t models;
+	uint64_t position = 0, start, warm, cycle;
+	uint32_t i, length;
+	char path[SAMPLE_PATH_MAX];
+
+	mips_sim_reset(sim);
+	detach_models(sim, &models);
+	for (i = 0; i < count; i++) {
+		start = (uint64_t)points[i].interval * s->interval;
+		length = s->lengths[points[i].interval];
+		warm = (start - position > s->warmup) ? start - s->warmup : position;
+		position += run_for(sim, warm - position);
+		if (position != warm) {
+			break;
+		}
+		if (prefix != NULL) {
+			snprintf(path, sizeof(path), "%s.%u.ckpt", prefix, points[i].interval);
+			if (!mips_sim_save(sim, path)) {
+				printf("Error: Can't write checkpoint %s\n", path);
+			}
+		}
+		attach_models(sim, &models);
+		position += run_for(sim, start - position);
+		cycle = pipeline_cycle(sim);
+		position += run_for(sim, length);
+		points[i].cpi = (double)(pipeline_cycle(sim) - cycle) / length;
+		detach_models(sim, &models);
+		if (position != start + length) {
+			break;
+		}
+	}
+	attach_models(sim, &models);
+	return i == count;
+}
+
+/***************************************************************/
+/* The estimate: per-cluster lines, CPI with its 95% bounds            */
+/***************************************************************/
+static void report(sampler_t *s, uint64_t executed, uint32_t k, const uint32_t *assignment,
+	const sample_point_t *points, uint32_t count, const char *prefix, double functional_seconds, double detail_seconds)
+{
+	uint32_t c, i, n, members, df = 0;
+	uint64_t instructions, detailed = 0;
+	int exact = TRUE;
+	double weight, mean, var, cpi = 0, variance = 0, t, half;
+
+	printf("-------------------------------------\n");
+	printf("Sampling: %u-instruction intervals, %u of up to %u clusters, up to %u samples per cluster, %u warm-up\n",
+		s->interval, k, s->clusters, s->samples, s->warmup);
+	printf("-------------------------------------\n");
+	printf("Instructions\t: %llu in %u intervals, %u blocks\n", (unsigned long long)executed, s->num_intervals, s->used);
+	printf("Cluster\tIntervals\tWeight\tCPI\tStdDev\tSampled intervals (*: nearest the centre)\n");
+	for (c = 0; c < k; c++) {
+		members = 0;
+		instructions = 0;
+		for (i = 0; i < s->num_intervals; i++) {
+			if (assignment[i] == c) {
+				members++;
+				instructions += s->lengths[i];
+			}
+		}
+		if (members == 0) {
+			continue;
+		}
+		weight = (double)instructions / executed;
+		n = 0;
+		mean = 0;
+		for (i = 0; i < count; i++) {
+			if (points[i].cluster == c) {
+				n++;
+				mean += points[i].cpi;
+				detailed += s->lengths[points[i].interval];
+			}
+		}
+		mean /= n;
+		var = 0;
+		for (i = 0; i < count; i++) {
+			if (points[i].cluster == c) {
+				var += (points[i].cpi - mean) * (points[i].cpi - mean);
+			}
+		}
+		var = (n > 1) ? var / (n - 1) : 0;
+		cpi += weight * mean;
+		if (n < members) {
+			if (n < 2) {
+				exact = FALSE;
+			}
+			variance += weight * weight * (1 - (double)n / members) * var / n;
+			df += n - 1;
+		}
+		printf("%u\t%u\t\t%.1f%%\t%.3f\t%.3f\t", c, members, 100 * weight, mean, sqrt(var));
+		for (i = 0; i < count; i++) {
+			if (points[i].cluster == c) {
+				printf(" %u%s", points[i].interval, points[i].representative ? "*" : "");
+			}
+		}
+		printf("\n");
+	}
+	printf("CPI\t\t: %.3f", cpi);
+	if (!exact) {
+		printf(" (no bounds: a cluster has a single sample)\n");
+	} else if (df == 0) {
+		printf(" (every interval ran in detail)\n");
+	} else {
+		t = (df < 31) ? T_95[df] : 1.96;
+		half = t * sqrt(variance);
+		printf(" +/- %.3f (95%% confidence: %.3f..%.3f, %u degrees of freedom)\n", half, cpi - half, cpi + half, df);
+	}
+	if (prefix != NULL) {
+		printf("Checkpoints\t: %s.<sampled interval>.ckpt, %u warm-up instructions before each\n", prefix, s->warmup);
+	}
+	printf("Cycles\t\t: %.0f (extrapolated)\n", cpi * executed);
+	printf("Detailed\t: %llu instructions in %u intervals (%.2f%% of the run)\n", (unsigned long long)detailed, count,
+		100.0 * detailed / executed);
+	printf("Time\t\t: %.3f s profiling and clustering, %.3f s detailed\n", functional_seconds, detail_seconds);
+	printf("-------------------------------------\n\n");
+}
+
+static void sampler_free(sampler_t *s)
+{
+	free(s->pcs);
+	free(s->ids);
+	free(s->counts);
+	free(s->projection);
+	free(s->touched);
+	free(s->vectors);
+	free(s->lengths);
+}
+
+/***************************************************************/
+/* interval[:clusters[:samples[:warmup]]]; FALSE if malformed          */
+/***************************************************************/
+static int parse_spec(sampler_t *s, const char *spec)
+{
+	char buf[64], *field, *end, *save;
+	uint32_t *values[4] = { &s->interval, &s->clusters, &s->samples, &s->warmup };
+	int i;
+
+	s->clusters = SAMPLE_CLUSTERS;
+	s->samples = SAMPLE_SAMPLES;
+	s->warmup = SAMPLE_NONE;
+	snprintf(buf, sizeof(buf), "%s", spec);
+	field = strtok_r(buf, ":", &save);
+	for (i = 0; i < 4 && field != NULL; i++) {
+		*values[i] = strtoul(field, &end, 0);
+		if (*end != '\0') {
+			return FALSE;
+		}
+		field = strtok_r(NULL, ":", &save);
+	}
+	if (i == 0 || field != NULL || s->interval == 0 || s->clusters == 0 || s->samples == 0) {
+		return FALSE;
+	}
+	if (s->warmup == SAMPLE_NONE) {
+		s->warmup = s->interval / 10;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Sample the program's first max instructions (all of them with       */
+/* UINT64_MAX) and print the estimate. Checkpoints of the intervals'   */
+/* starts go to prefix.<interval>.ckpt unless prefix is NULL. FALSE,   */
+/* after saying why, if it can't.                                      */
+/***************************************************************/
+int sample_run(mips_sim_t *sim, const char *spec, uint64_t max, const char *prefix)
+{
+	sampler_t s;
+	FILE *console_in = sim->CONSOLE_IN, *console_out = sim->CONSOLE_OUT;
+	int trace_level = sim->TRACE_LEVEL, own_pipeline = FALSE, complete;
+	uint32_t k, count, *assignment;
+	double *centres, start, functional_seconds;
+	sample_point_t *points;
+	models_t models;
+	uint64_t executed;
+
+	memset(&s, 0, sizeof(s));
+	s.random = 0x9E3779B97F4A7C15ull;
+	if (!parse_spec(&s, spec)) {
+		printf("Error: sample <interval>[:clusters[:samples[:warmup]]] [max instructions] [checkpoint prefix]\n\n");
+		return FALSE;
+	}
+	if (sim->IMAGE == NULL && !sim->SNAPSHOT_VALID) {
+		printf("Error: no program to sample\n\n");
+		return FALSE;
+	}
+	if (sim->NUM_CORES > 1 || SIM_DEBUGGING(sim)) {
+		printf("Error: sampling needs one core and no breakpoints or watchpoints\n\n");
+		return FALSE;
+	}
+	if (sim->PIPELINE == NULL) {
+		/* the default timing: forwarding, branches resolved in EX */
+		pipeline_start(sim, TRUE, 1);
+		own_pipeline = TRUE;
+	}
+	console_flush(sim);
+	mips_sim_set_console(sim, NULL, NULL);
+	sim->TRACE_LEVEL = TRACE_OFF;
+
+	start = seconds_now();
+	mips_sim_reset(sim);
+	detach_models(sim, &models);
+	executed = collect_vectors(sim, &s, max);
+	attach_models(sim, &models);
+	assignment = sample_alloc(NULL, s.num_intervals * sizeof(uint32_t));
+	centres = sample_alloc(NULL, s.clusters * SAMPLE_DIMS * sizeof(double));
+	points = sample_alloc(NULL, (size_t)s.clusters * s.samples * sizeof(sample_point_t));
+	k = (s.num_intervals > 0) ? cluster(&s, centres, assignment) : 0;
+	count = choose_samples(&s, k, centres, assignment, points);
+	qsort(points, count, sizeof(sample_point_t), compare_points);
+	functional_seconds = seconds_now() - start;
+
+	start = seconds_now();
+	complete = time_points(sim, &s, points, count, prefix);
+	if (!complete) {
+		printf("Error: the program ran differently the second time; no estimate\n\n");
+	} else if (count == 0) {
+		printf("Nothing to sample: the program does not run\n\n");
+	} else {
+		report(&s, executed, k, assignment, points, count, prefix, functional_seconds, seconds_now() - start);
+	}
+
+	mips_sim_reset(sim);
+	sim->TRACE_LEVEL = trace_level;
+	mips_sim_set_console(sim, console_in, console_out);
+	if (own_pipeline) {
+		pipeline_stop(sim);
+	}
+	free(assignment);
+	free(centres);
+	free(points);
+	sampler_free(&s);
+	return complete;
+}
@@ -0,0 +1,1346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Simulator core, built into libmu-mips.a (API in mu-mips-sim.h).    */
+/* Every function works on the mips_sim_t it is given; the only data  */
+/* shared between simulations is read-only.                                 */
+/***************************************************************/
+
+/* regions only bound the legal addresses, the backing store is the page table */
+static const mem_region_t MEM_REGIONS[NUM_MEM_REGION] = {
+	{ MEM_TEXT_BEGIN, MEM_TEXT_END },
+	{ MEM_DATA_BEGIN, MEM_DATA_END },
+	{ MEM_KDATA_BEGIN, MEM_KDATA_END },
+	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END }
+};
+
+/***************************************************************/
+/* Find the page table entry of a guest address                                               */
+/* alloc: create the second-level table if it does not exist yet                           */
+/***************************************************************/
+static mem_page_t *mem_page_entry(mips_sim_t *sim, uint32_t address, int alloc)
+{
+	mips_sim_t *owner = sim->MEM_OWNER;
+	mem_page_t *table = owner->MEM_PAGE_TABLE[MEM_L1_INDEX(address)];
+	mem_page_t *entry;
+
+	if (table == NULL) {
+		if (!alloc) {
+			return NULL;
+		}
+		table = calloc(MEM_L2_ENTRIES, sizeof(mem_page_t));
+		if (table == NULL) {
+			printf("Error: out of memory mapping address 0x%08x\n", address);
+			exit(-1);
+		}
+		owner->MEM_PAGE_TABLE[MEM_L1_INDEX(address)] = table;
+	}
+	entry = &table[MEM_L2_INDEX(address)];
+	if (entry->packed != NULL) {
+		/* first touch of a checkpoint page: it becomes a pristine page */
+		entry->data = malloc(MEM_PAGE_SIZE);
+		if (entry->data == NULL) {
+			printf("Error: out of memory mapping address 0x%08x\n", address);
+			exit(-1);
+		}
+		checkpoint_unpack(entry->packed, entry->data);
+		entry->pristine = entry->data;
+		entry->packed = NULL;
+		owner->MEM_PAGES_ALLOCATED++;
+	}
+	return entry;
+}
+
+/***************************************************************/
+/* Map a checkpoint page without unpacking it, see mem_page_entry()    */
+/***************************************************************/
+void mem_map_packed(mips_sim_t *sim, uint32_t page_no, const uint8_t *packed)
+{
+	mem_page_t *table = sim->MEM_PAGE_TABLE[MEM_L1_INDEX(page_no << MEM_PAGE_BITS)];
+
+	if (table == NULL) {
+		mem_page_entry(sim, page_no << MEM_PAGE_BITS, TRUE);
+		table = sim->MEM_PAGE_TABLE[MEM_L1_INDEX(page_no << MEM_PAGE_BITS)];
+	}
+	table[MEM_L2_INDEX(page_no << MEM_PAGE_BITS)].packed = packed;
+}
+
+/***************************************************************/
+/* Remember that a page was written since the last snapshot                                */
+/***************************************************************/
+static void mark_dirty(mips_sim_t *sim, uint32_t page_no)
+{
+	mips_sim_t *owner = sim->MEM_OWNER;
+
+	if (owner->NUM_DIRTY_PAGES == owner->DIRTY_PAGES_CAPACITY) {
+		owner->DIRTY_PAGES_CAPACITY = owner->DIRTY_PAGES_CAPACITY ? 2 * owner->DIRTY_PAGES_CAPACITY : 64;
+		owner->DIRTY_PAGES = realloc(owner->DIRTY_PAGES, owner->DIRTY_PAGES_CAPACITY * sizeof(uint32_t));
+		if (owner->DIRTY_PAGES == NULL) {
+			printf("Error: out of memory tracking dirty pages\n");
+			exit(-1);
+		}
+	}
+	owner->DIRTY_PAGES[owner->NUM_DIRTY_PAGES++] = page_no;
+}
+
+/***************************************************************/
+/* Software TLB: a direct-mapped cache of guest page -> host page in front */
+/* of the page table and the region list, so a hit costs one compare.      */
+/* read points at the page contents (a shared zero page when the page is   */
+/* unmapped or outside every region), write is set only once the page is  */
+/* private, so stores to shared snapshot pages still take the slow path.   */
+/***************************************************************/
+#define MEM_TLB_INVALID 0xFFFFFFFF	/* never a page number */
+
+static const uint8_t MEM_ZERO_PAGE[MEM_PAGE_SIZE];
+
+/***************************************************************/
+/* Drop every cached translation; called whenever pages are replaced      */
+/***************************************************************/
+void mem_tlb_flush(mips_sim_t *sim)
+{
+	int i;
+	for (i = 0; i < MEM_TLB_ENTRIES; i++) {
+		sim->MEM_TLB[i].page_no = MEM_TLB_INVALID;
+	}
+}
+
+static uint8_t *map_page(mips_sim_t *sim, uint32_t address, int write)
+{
+	mem_page_t *entry = mem_page_entry(sim, address, write);
+	uint8_t *page;
+
+	if (entry == NULL) {
+		return NULL;
+	}
+	if (!write || (entry->data != NULL && entry->data != entry->pristine)) {
+		return entry->data;
+	}
+
+	page = malloc(MEM_PAGE_SIZE);
+	if (page == NULL) {
+		printf("Error: out of memory mapping address 0x%08x\n", address);
+		exit(-1);
+	}
+	if (entry->data != NULL) {
+		memcpy(page, entry->data, MEM_PAGE_SIZE);
+	} else {
+		memset(page, 0, MEM_PAGE_SIZE);
+		sim->MEM_OWNER->MEM_PAGES_ALLOCATED++;
+	}
+	entry->data = page;
+	mark_dirty(sim, address >> MEM_PAGE_BITS);
+	sim->MEM_TLB[MEM_TLB_INDEX(address)].page_no = MEM_TLB_INVALID;
+	if (MEM_SHARED(sim)) {
+		/* the other cores may still translate to the old page */
+		__atomic_add_fetch(&sim->MEM_OWNER->MEM_MAP_GEN, 1, __ATOMIC_RELEASE);
+	}
+	return page;
+}
+
+/***************************************************************/
+/* Look up the host page backing a guest address                                           */
+/* write: return a private page the caller may modify, allocating a zero   */
+/* page or copying the pristine snapshot page on the first write              */
+/***************************************************************/
+uint8_t *mem_page(mips_sim_t *sim, uint32_t address, int write)
+{
+	uint8_t *page;
+
+	if (!MEM_SHARED(sim)) {
+		return map_page(sim, address, write);
+	}
+	pthread_mutex_lock(&sim->MEM_OWNER->MEM_LOCK);
+	page = map_page(sim, address, write);
+	pthread_mutex_unlock(&sim->MEM_OWNER->MEM_LOCK);
+	return page;
+}
+
+/***************************************************************/
+/* Region bounds are page aligned, so one check covers the whole page     */
+/***************************************************************/
+static int mem_in_region(uint32_t address)
+{
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* TLB miss: translate the page of address and cache the result. A     */
+/* watched page is never cached, so every access to it ends up here.   */
+/***************************************************************/
+static mem_tlb_entry_t *mem_tlb_fill(mips_sim_t *sim, uint32_t address, int access)
+{
+	mem_tlb_entry_t *tlb = &sim->MEM_TLB[MEM_TLB_INDEX(address)];
+	int shared = MEM_SHARED(sim);
+	mem_page_t *entry;
+
+	if (shared) {
+		pthread_mutex_lock(&sim->MEM_OWNER->MEM_LOCK);
+	}
+	entry = mem_in_region(address) ? mem_page_entry(sim, address, FALSE) : NULL;
+	tlb->page_no = address >> MEM_PAGE_BITS;
+	if (entry == NULL || entry->data == NULL) {
+		tlb->read = MEM_ZERO_PAGE;
+		tlb->write = NULL;
+	} else {
+		tlb->read = entry->data;
+		tlb->write = (entry->data != entry->pristine) ? entry->data : NULL;
+	}
+	if (shared) {
+		pthread_mutex_unlock(&sim->MEM_OWNER->MEM_LOCK);
+	}
+	if (sim->WATCH_PAGES != NULL && WATCH_PAGE_TEST(sim, address)) {
+		tlb->page_no = MEM_TLB_INVALID;
+		if (sim->WATCH_ARMED) {
+			debug_watch_hit(sim, address, access);
+		}
+	}
+	return tlb;
+}
+
+static inline mem_tlb_entry_t *mem_tlb_lookup(mips_sim_t *sim, uint32_t address, int access)
+{
+	mem_tlb_entry_t *tlb = &sim->MEM_TLB[MEM_TLB_INDEX(address)];
+
+	if (tlb->page_no != address >> MEM_PAGE_BITS) {
+		tlb = mem_tlb_fill(sim, address, access);
+	}
+	return tlb;
+}
+
+/***************************************************************/
+/* Host access to a little-endian guest word                              */
+/***************************************************************/
+static inline uint32_t load_32(const uint8_t *p)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+#else
+	return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+#endif
+}
+
+static inline void store_32(uint8_t *p, uint32_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(p, &value, 4);
+#else
+	p[3] = value >> 24;
+	p[2] = value >> 16;
+	p[1] = value >> 8;
+	p[0] = value;
+#endif
+}
+
+/***************************************************************/
+/* Read a 32-bit word from memory                                                                            */
+/***************************************************************/
+uint32_t mem_read_32(mips_sim_t *sim, uint32_t address)
+{
+	uint32_t offset = address & MEM_PAGE_MASK;
+	uint32_t value = 0;
+	int j;
+
+	if (offset <= MEM_PAGE_SIZE - 4) {
+		return load_32(mem_tlb_lookup(sim, address, WATCH_READ)->read + offset);
+	}
+
+	/* word straddles two pages, assemble it a byte at a time */
+	for (j = 3; j >= 0; j--) {
+		value = (value << 8) | mem_tlb_lookup(sim, address + j, WATCH_READ)->read[(address + j) & MEM_PAGE_MASK];
+	}
+	return value;
+}
+
+/***************************************************************/
+/* Store one byte outside the TLB fast path: bytes outside every region   */
+/* are dropped and a zero byte does not map a new page                    */
+/***************************************************************/
+static void mem_write_byte(mips_sim_t *sim, uint32_t address, uint8_t byte)
+{
+	mem_tlb_entry_t *tlb = mem_tlb_lookup(sim, address, WATCH_WRITE);
+
+	if (tlb->write == NULL) {
+		if (tlb->read == MEM_ZERO_PAGE && (byte == 0 || !mem_in_region(address))) {
+			return;
+		}
+		mem_page(sim, address, TRUE);
+		tlb = mem_tlb_fill(sim, address, WATCH_WRITE);
+	}
+	tlb->write[address & MEM_PAGE_MASK] = byte;
+}
+
+/***************************************************************/
+/* Write a 32-bit word to memory                                                                                */
+/***************************************************************/
+void mem_write_32(mips_sim_t *sim, uint32_t address, uint32_t value)
+{
+	uint32_t offset = address & MEM_PAGE_MASK;
+	mem_tlb_entry_t *tlb;
+	int j;
+
+	if (offset <= MEM_PAGE_SIZE - 4) {
+		tlb = mem_tlb_lookup(sim, address, WATCH_WRITE);
+		if (tlb->write == NULL) {
+			/* writing zero to an unmapped page leaves it implicit */
+			if (tlb->read == MEM_ZERO_PAGE && (value == 0 || !mem_in_region(address))) {
+				return;
+			}
+			mem_page(sim, address, TRUE);
+			tlb = mem_tlb_fill(sim, address, WATCH_WRITE);
+		}
+		store_32(tlb->write + offset, value);
+	} else {
+		/* word straddles two pages, store it a byte at a time */
+		for (j = 0; j < 4; j++) {
+			mem_write_byte(sim, address + j, (value >> (8 * j)) & 0xFF);
+		}
+	}
+	decode_invalidate(sim, address);
+}
+
+/***************************************************************/
+/* Pick up the pages other cores mapped since this one last looked:    */
+/* until then its TLB may still point at the zero or snapshot page.    */
+/* Likewise drop its decodes and translations once another core has    */
+/* stored into code.                                                   */
+/***************************************************************/
+void mem_sync(mips_sim_t *sim)
+{
+	uint32_t gen;
+
+	if (!MEM_SHARED(sim)) {
+		return;
+	}
+	gen = __atomic_load_n(&sim->MEM_OWNER->MEM_MAP_GEN, __ATOMIC_ACQUIRE);
+	if (gen != sim->MEM_MAP_SEEN) {
+		sim->MEM_MAP_SEEN = gen;
+		mem_tlb_flush(sim);
+	}
+	gen = __atomic_load_n(&sim->MEM_OWNER->SHARED_CODE_GEN, __ATOMIC_ACQUIRE);
+	if (gen != sim->SHARED_CODE_SEEN) {
+		/* some core rewrote code: decode the program from memory again */
+		sim->SHARED_CODE_SEEN = gen;
+		sim->IMAGE_WORDS = 0;
+		decode_flush(sim);
+	}
+}
+
+/***************************************************************/
+/* LL/SC. ll remembers the word it loaded; sc replaces it with one     */
+/* host compare-and-swap that succeeds only while the word still holds */
+/* that value, so cores on different host threads need no lock. Like   */
+/* any value-based emulation it misses a word changed and changed back */
+/* in between.                                                         */
+/***************************************************************/
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_WORD(value) (value)
+#else
+#define HOST_WORD(value) __builtin_bswap32(value)
+#endif
+
+uint32_t mem_load_linked(mips_sim_t *sim, uint32_t address)
+{
+	const uint8_t *read;
+
+	mem_sync(sim);
+	if (address & 0x3) {
+		/* sc to it fails anyway */
+		sim->LL_VALUE = mem_read_32(sim, address);
+	} else {
+		read = mem_tlb_lookup(sim, address, WATCH_READ)->read + (address & MEM_PAGE_MASK);
+		sim->LL_VALUE = HOST_WORD(__atomic_load_n((const uint32_t *)read, __ATOMIC_SEQ_CST));
+	}
+	sim->LL_ADDRESS = address;
+	sim->LL_VALID = TRUE;
+	return sim->LL_VALUE;
+}
+
+int mem_store_conditional(mips_sim_t *sim, uint32_t address, uint32_t value)
+{
+	int linked = sim->LL_VALID && sim->LL_ADDRESS == address;
+	mem_tlb_entry_t *tlb;
+	uint32_t expected;
+
+	sim->LL_VALID = FALSE;
+	if (!linked || (address & 0x3) || !mem_in_region(address)) {
+		return FALSE;
+	}
+	tlb = mem_tlb_lookup(sim, address, WATCH_WRITE);
+	if (tlb->write == NULL) {
+		mem_page(sim, address, TRUE);
+		tlb = mem_tlb_fill(sim, address, WATCH_WRITE);
+	}
+	expected = HOST_WORD(sim->LL_VALUE);
+	if (!__atomic_compare_exchange_n((uint32_t *)(tlb->write + (address & MEM_PAGE_MASK)), &expected,
+		HOST_WORD(value), FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return FALSE;
+	}
+	decode_invalidate(sim, address);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Write count words starting at address a page at a time, for loading  */
+/* programs. Words outside every region are dropped. Like a store into  */
+/* the image text it detaches the image's decodes; mips_sim_load()       */
+/* attaches them again once everything is written.                       */
+/***************************************************************/
+void mem_write_words(mips_sim_t *sim, uint32_t address, const uint32_t *words, uint32_t count)
+{
+	uint32_t offset, n, i;
+	uint8_t *page;
+
+	while (count > 0) {
+		offset = address & MEM_PAGE_MASK;
+		if (offset & 0x3) {
+			/* misaligned, so every page boundary splits a word */
+			mem_write_32(sim, address, *words);
+			n = 1;
+		} else {
+			n = (MEM_PAGE_SIZE - offset) / 4;
+			n = (n < count) ? n : count;
+			if (mem_in_region(address)) {
+				page = mem_page(sim, address, TRUE);
+				for (i = 0; i < n; i++) {
+					store_32(page + offset + 4 * i, words[i]);
+				}
+			}
+		}
+		address += 4 * n;
+		words += n;
+		count -= n;
+	}
+	sim->IMAGE_WORDS = 0;
+	decode_flush(sim);
+}
+
+/***************************************************************/
+/* Execute one cycle                                                                                                              */
+/***************************************************************/
+void cycle(mips_sim_t *sim) {                                                
+	handle_instruction(sim);
+	sim->CURRENT_STATE = sim->NEXT_STATE;
+	sim->INSTRUCTION_COUNT++;
+}
+
+/***************************************************************/
+/* Execute up to max instructions with the selected engine, stopping  */
+/* early when RUN_FLAG drops. Returns the number executed. With more  */
+/* than one core, max and the result count the instructions of all.  */
+/***************************************************************/
+uint32_t engine_run(mips_sim_t *sim, uint32_t max) {
+	if (sim->NUM_CORES > 1) {
+		return multicore_run(sim, max);
+	}
+	return core_run(sim, max);
+}
+
+/***************************************************************/
+/* engine_run() for one core                                           */
+/***************************************************************/
+uint32_t core_run(mips_sim_t *sim, uint32_t max) {
+	uint32_t executed;
+
+	sim->WATCH_ARMED = (sim->NUM_WATCHES > 0);
+	if (sim->TRACE_LEVEL >= TRACE_INSTRUCTION || SIM_OBSERVED(sim) || SIM_DEBUGGING(sim)) {
+		/* only the interpreter traces, feeds the models and stops at breakpoints */
+		if (sim->TRACE_LEVEL == TRACE_BINARY) {
+			trace_binary_sync(sim, &sim->CURRENT_STATE);
+		}
+		executed = interp_run(sim, max);
+	} else if (sim->ENGINE == ENGINE_THREADED) {
+		executed = threaded_run(sim, max);
+	} else if (sim->ENGINE == ENGINE_JIT) {
+		executed = jit_run(sim, max);
+	} else {
+		executed = interp_run(sim, max);
+	}
+	sim->WATCH_ARMED = FALSE;
+	if (sim->STOP_REASON == STOP_BREAK && executed > 0) {
+		/* the breakpoint's instruction did not run */
+		executed--;
+		sim->INSTRUCTION_COUNT--;
+	}
+	trace_flush(sim);
+	console_flush(sim);
+	return executed;
+}
+
+/***************************************************************/
+/* Set memory to zero: pages are allocated lazily on first write                */
+/***************************************************************/
+void init_memory(mips_sim_t *sim) {                                           
+	memset(sim->MEM_PAGE_TABLE, 0, sizeof(sim->MEM_PAGE_TABLE));
+	sim->MEM_PAGES_ALLOCATED = 0;
+	mem_tlb_flush(sim);
+	sim->DECODE_GEN = 1;
+}
+
+/***************************************************************/
+/* Release every guest page, second-level table and the snapshot             */
+/***************************************************************/
+void free_memory(mips_sim_t *sim) {
+	int i, j;
+	for (i = 0; i < MEM_L1_ENTRIES; i++) {
+		if (sim->MEM_PAGE_TABLE[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < MEM_L2_ENTRIES; j++) {
+			if (sim->MEM_PAGE_TABLE[i][j].data != sim->MEM_PAGE_TABLE[i][j].pristine) {
+				free(sim->MEM_PAGE_TABLE[i][j].data);
+			}
+			free(sim->MEM_PAGE_TABLE[i][j].pristine);
+		}
+		free(sim->MEM_PAGE_TABLE[i]);
+		sim->MEM_PAGE_TABLE[i] = NULL;
+	}
+	sim->MEM_PAGES_ALLOCATED = 0;
+	sim->NUM_DIRTY_PAGES = 0;
+	sim->SNAPSHOT_VALID = FALSE;
+	checkpoint_unmap(sim);
+	sim->IMAGE_WORDS = 0;
+	mem_tlb_flush(sim);
+	decode_flush(sim);
+}
+
+/***************************************************************/
+/* Capture the current registers and memory as the reset image             */
+/* Only pages written since the previous snapshot have to be visited.      */
+/***************************************************************/
+void snapshot_take(mips_sim_t *sim) {
+	uint32_t i;
+	mem_page_t *entry;
+
+	for (i = 0; i < sim->NUM_DIRTY_PAGES; i++) {
+		entry = mem_page_entry(sim, sim->DIRTY_PAGES[i] << MEM_PAGE_BITS, FALSE);
+		if (entry->pristine != entry->data) {
+			free(entry->pristine);
+			entry->pristine = entry->data;
+		}
+	}
+	sim->NUM_DIRTY_PAGES = 0;
+	mem_tlb_flush(sim);
+	sim->SNAPSHOT_STATE = sim->CURRENT_STATE;
+	sim->SNAPSHOT_INSTRUCTION_COUNT = sim->INSTRUCTION_COUNT;
+	sim->SNAPSHOT_IMAGE_WORDS = sim->IMAGE_WORDS;
+	sim->SNAPSHOT_HEAP_BREAK = sim->HEAP_BREAK;
+	sim->SNAPSHOT_VALID = TRUE;
+}
+
+/***************************************************************/
+/* Return to the last snapshot by dropping the pages written since        */
+/***************************************************************/
+void snapshot_restore(mips_sim_t *sim) {
+	uint32_t i;
+	mem_page_t *entry;
+
+	for (i = 0; i < sim->NUM_DIRTY_PAGES; i++) {
+		entry = mem_page_entry(sim, sim->DIRTY_PAGES[i] << MEM_PAGE_BITS, FALSE);
+		if (entry->data == entry->pristine) {
+			continue;
+		}
+		free(entry->data);
+		if (entry->pristine == NULL) {
+			sim->MEM_PAGES_ALLOCATED--;
+		}
+		entry->data = entry->pristine;
+	}
+	sim->NUM_DIRTY_PAGES = 0;
+	sim->IMAGE_WORDS = sim->SNAPSHOT_IMAGE_WORDS;
+	mem_tlb_flush(sim);
+	decode_flush(sim);
+
+	sim->CURRENT_STATE = sim->SNAPSHOT_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->HEAP_BREAK = sim->SNAPSHOT_HEAP_BREAK;
+	sim->INSTRUCTION_COUNT = sim->SNAPSHOT_INSTRUCTION_COUNT;
+	sim->RUN_FLAG = TRUE;
+	sim->STOP_REASON = STOP_NONE;
+	sim->RESUME = FALSE;
+	sim->LL_VALID = FALSE;
+	multicore_reset(sim);
+}
+
+/************************************************************/
+/* Instruction handlers: one per opcode/function, operating on a       */
+/* pre-decoded instruction. They read CURRENT_STATE and write through  */
+/* sim->NEXT, which is CURRENT_STATE itself when running in place, so  */
+/* each reads all its operands before its first write and takes its   */
+/* own address from d->pc.                                             */
+/************************************************************/
+static void inst_syscall(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	syscall_run(sim, sim->NEXT);
+}
+
+static void inst_add(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rs] + sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_sub(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rs] - sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_mult(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	uint64_t product;
+	product = sim->CURRENT_STATE.REGS[d->rs] * sim->CURRENT_STATE.REGS[d->rt];
+	sim->NEXT->HI = product >> 32;
+	sim->NEXT->LO = product & 0xFFFFFFFF;
+}
+
+/* division by zero leaves HI and LO alone, as the result is unpredictable */
+static void inst_div(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (sim->CURRENT_STATE.REGS[d->rt] == 0) {
+		return;
+	}
+	sim->NEXT->LO = sim->CURRENT_STATE.REGS[d->rs] / sim->CURRENT_STATE.REGS[d->rt];
+	sim->NEXT->HI = sim->CURRENT_STATE.REGS[d->rs] % sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_and(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rs] & sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_or(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rs] | sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_xor(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rs] ^ sim->CURRENT_STATE.REGS[d->rt];
+}
+
+static void inst_nor(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = ~(sim->CURRENT_STATE.REGS[d->rs] | sim->CURRENT_STATE.REGS[d->rt]);
+}
+
+static void inst_slt(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if(sim->CURRENT_STATE.REGS[d->rs] < sim->CURRENT_STATE.REGS[d->rt]){
+		sim->NEXT->REGS[d->rd] = 0x00000001;
+	}
+	else{
+		sim->NEXT->REGS[d->rd] = 0x00000000;
+	}
+}
+
+static void inst_sll(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rt] << d->sa;
+}
+
+static void inst_srl(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	/* sra shares this handler: both shift in zeros */
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.REGS[d->rt] >> d->sa;
+}
+
+static void inst_jr(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->PC = sim->CURRENT_STATE.REGS[d->rs];
+}
+
+static void inst_jalr(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	uint32_t target = sim->CURRENT_STATE.REGS[d->rs];
+
+	sim->NEXT->REGS[d->rd] = d->pc + 4;
+	sim->NEXT->PC = target;
+}
+
+static void inst_mfhi(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.HI;
+}
+
+static void inst_mthi(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->HI = sim->CURRENT_STATE.REGS[d->rs];
+}
+
+static void inst_mflo(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rd] = sim->CURRENT_STATE.LO;
+}
+
+static void inst_mtlo(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->LO = sim->CURRENT_STATE.REGS[d->rs];
+}
+
+static void inst_nop(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	/* decoded but not implemented yet (regimm, lb, lh, sw, sb, sh) */
+}
+
+static void inst_j(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->PC = ((d->pc >> 28) << 28) + (d->offset << 2);
+}
+
+static void inst_jal(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->PC = ((d->pc >> 28) << 28) + (d->offset << 2);
+	sim->NEXT->REGS[31] = d->pc + 4;
+}
+
+static void inst_beq(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (sim->CURRENT_STATE.REGS[d->rs] == sim->CURRENT_STATE.REGS[d->rt]){
+		sim->NEXT->PC = d->pc + (((int32_t)((int16_t)d->immediate)) << 2);
+	}
+}
+
+static void inst_bne(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (sim->CURRENT_STATE.REGS[d->rs] != sim->CURRENT_STATE.REGS[d->rt]){
+		sim->NEXT->PC = d->pc + (((int32_t)((int16_t)d->immediate)) << 2);
+	}
+}
+
+static void inst_blez(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (((int32_t)sim->CURRENT_STATE.REGS[d->rs]) <= 0){
+		sim->NEXT->PC = d->pc + (((int32_t)((int16_t)d->immediate)) << 2);
+	}
+}
+
+static void inst_bgtz(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (((int32_t)sim->CURRENT_STATE.REGS[d->rs]) > 0){
+		sim->NEXT->PC = d->pc + (((int32_t)((int16_t)d->immediate)) << 2);
+	}
+}
+
+static void inst_addi(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = sim->CURRENT_STATE.REGS[d->rs] + (int32_t)((int16_t)d->immediate);
+}
+
+static void inst_addiu(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = sim->CURRENT_STATE.REGS[d->rs] + (uint32_t)((uint16_t)d->immediate);
+}
+
+static void inst_andi(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = d->immediate & sim->CURRENT_STATE.REGS[d->rs] & 0xFFFF;
+}
+
+static void inst_ori(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = sim->CURRENT_STATE.REGS[d->rs] | (uint32_t)((uint16_t)d->immediate);
+}
+
+static void inst_xori(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = sim->CURRENT_STATE.REGS[d->rs] ^ (uint32_t)((uint16_t)d->immediate);
+}
+
+static void inst_slti(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if(sim->CURRENT_STATE.REGS[d->rs] < (int32_t)((int16_t)d->immediate)){
+		sim->NEXT->REGS[d->rt] = 0x00000001;
+	}
+	else{
+		sim->NEXT->REGS[d->rt] = 0x00000000;
+	}
+}
+
+static void inst_lw(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = mem_read_32(sim, ((uint32_t)((uint16_t)d->immediate)) + sim->CURRENT_STATE.REGS[d->rs]);
+}
+
+static void inst_lui(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = ((uint32_t)d->immediate) << 16;
+}
+
+static void inst_ll(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = mem_load_linked(sim, ((uint32_t)((uint16_t)d->immediate)) + sim->CURRENT_STATE.REGS[d->rs]);
+}
+
+static void inst_sc(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	sim->NEXT->REGS[d->rt] = mem_store_conditional(sim, ((uint32_t)((uint16_t)d->immediate)) + sim->CURRENT_STATE.REGS[d->rs],
+		sim->CURRENT_STATE.REGS[d->rt]);
+}
+
+static void inst_sync(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	mem_sync(sim);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* handlers for opcode 0x00 indexed by function, NULL is not implemented */
+static const inst_handler_t FUNCTION_HANDLERS[64] = {
+	[0x0C] = inst_syscall,
+	[0x0F] = inst_sync,
+	[0x20] = inst_add,	[0x21] = inst_add,
+	[0x22] = inst_sub,	[0x23] = inst_sub,
+	[0x18] = inst_mult,	[0x19] = inst_mult,
+	[0x1A] = inst_div,	[0x1B] = inst_div,
+	[0x24] = inst_and,
+	[0x25] = inst_or,
+	[0x26] = inst_xor,
+	[0x27] = inst_nor,
+	[0x2A] = inst_slt,
+	[0x00] = inst_sll,
+	[0x02] = inst_srl,	[0x03] = inst_srl,
+	[0x08] = inst_jr,
+	[0x09] = inst_jalr,
+	[0x10] = inst_mfhi,
+	[0x11] = inst_mthi,
+	[0x12] = inst_mflo,
+	[0x13] = inst_mtlo,
+};
+
+/* handlers for the remaining opcodes, NULL is not implemented */
+static const inst_handler_t OPCODE_HANDLERS[64] = {
+	[0x01] = inst_nop,
+	[0x02] = inst_j,
+	[0x03] = inst_jal,
+	[0x04] = inst_beq,
+	[0x05] = inst_bne,
+	[0x06] = inst_blez,
+	[0x07] = inst_bgtz,
+	[0x08] = inst_addi,
+	[0x09] = inst_addiu,
+	[0x0C] = inst_andi,
+	[0x0D] = inst_ori,
+	[0x0E] = inst_xori,
+	[0x0A] = inst_slti,
+	[0x20] = inst_nop,	/* lb */
+	[0x23] = inst_lw,
+	[0x21] = inst_nop,	/* lh */
+	[0x2B] = inst_nop,	/* sw */
+	[0x28] = inst_nop,	/* sb */
+	[0x29] = inst_nop,	/* sh */
+	[0x0F] = inst_lui,
+	[0x30] = inst_ll,
+	[0x38] = inst_sc,
+};
+
+/************************************************************/
+/* Split an instruction word into its fields and pick its handler          */
+/************************************************************/
+void decode_instruction(uint32_t instruction, decoded_inst_t *d)
+{
+	d->instruction = instruction;
+	d->opcode = (instruction & 0xFC000000) >> 26;
+	d->rs = (instruction & 0x3E00000) >> 21;
+	d->rt = (instruction & 0x1F0000) >> 16;
+	d->rd = (instruction & 0xF800) >> 11;
+	d->sa = (instruction & 0x7C0) >> 6;
+	d->immediate = (instruction & 0xFFFF);
+	d->function = (instruction & 0x3F);
+	d->offset = (instruction & 0x3FFFFFF);
+	d->handler = (d->opcode == 0x00) ? FUNCTION_HANDLERS[d->function] : OPCODE_HANDLERS[d->opcode];
+	if (d->opcode == 0x00) {
+		d->ends_block = (d->function == 0x08 || d->function == 0x09 || d->function == 0x0C);
+	} else {
+		d->ends_block = (d->opcode >= 0x02 && d->opcode <= 0x07);
+	}
+}
+
+/************************************************************/
+/* Flag the page of address as code for every core. Marked before the */
+/* code is read, so a store from another core either comes first or  */
+/* sees the flag.                                                     */
+/************************************************************/
+static void shared_code_mark(mips_sim_t *sim, uint32_t address)
+{
+	uint32_t *word = &sim->MEM_OWNER->SHARED_CODE_PAGES[address >> (MEM_PAGE_BITS + 5)];
+
+	if (!(__atomic_load_n(word, __ATOMIC_SEQ_CST) & CODE_PAGE_BIT(address))) {
+		__atomic_fetch_or(word, CODE_PAGE_BIT(address), __ATOMIC_SEQ_CST);
+	}
+}
+
+static int shared_code_test(mips_sim_t *sim, uint32_t address)
+{
+	return (__atomic_load_n(&sim->MEM_OWNER->SHARED_CODE_PAGES[address >> (MEM_PAGE_BITS + 5)],
+		__ATOMIC_SEQ_CST) & CODE_PAGE_BIT(address)) != 0;
+}
+
+/************************************************************/
+/* A translation of the code on address's page is about to be made    */
+/************************************************************/
+void code_page_mark(mips_sim_t *sim, uint32_t address)
+{
+	CODE_PAGE_MARK(sim, address);
+	if (MEM_SHARED(sim)) {
+		shared_code_mark(sim, address);
+	}
+}
+
+/************************************************************/
+/* Return the decoded instruction at pc, decoding it on a cache miss    */
+/************************************************************/
+const decoded_inst_t *decode_fetch(mips_sim_t *sim, uint32_t pc)
+{
+	uint32_t index = (pc - sim->IMAGE_BASE) >> 2;
+	decoded_inst_t *d;
+	int armed;
+
+	if (index < sim->IMAGE_WORDS && (pc & 0x3) == 0) {
+		/* unmodified program text, decoded once when the image was loaded */
+		return &sim->IMAGE_DECODED[index];
+	}
+	d = &sim->DECODE_CACHE[DECODE_INDEX(pc)];
+	if (d->pc == pc && d->gen == sim->DECODE_GEN) {
+		return d;
+	}
+	if (pc & 0x3) {
+		/* misaligned fetches are rare; keep them out of the word-indexed cache */
+		d = &sim->DECODE_UNCACHED;
+	}
+	if (MEM_SHARED(sim)) {
+		shared_code_mark(sim, pc);
+	}
+	/* a fetch is not a data access for watchpoints */
+	armed = sim->WATCH_ARMED;
+	sim->WATCH_ARMED = FALSE;
+	decode_instruction(mem_read_32(sim, pc), d);
+	sim->WATCH_ARMED = armed;
+	d->pc = pc;
+	d->gen = sim->DECODE_GEN;
+	if (sim->NUM_BREAKPOINTS > 0) {
+		debug_patch(sim, d);
+	}
+	return d;
+}
+
+/************************************************************/
+/* Drop cached decodes of any instruction a store to address overlaps */
+/************************************************************/
+void decode_invalidate(mips_sim_t *sim, uint32_t address)
+{
+	decoded_inst_t *d;
+
+	d = &sim->DECODE_CACHE[DECODE_INDEX(address)];
+	if (d->pc == (address & ~0x3)) {
+		d->gen = 0;
+	}
+	d = &sim->DECODE_CACHE[DECODE_INDEX(address + 3)];
+	if (d->pc == ((address + 3) & ~0x3)) {
+		d->gen = 0;
+	}
+
+	if (CODE_PAGE_TEST(sim, address) || CODE_PAGE_TEST(sim, address + 3)) {
+		sim->CODE_GEN++;
+	}
+	if (address + 3 - sim->IMAGE_BASE < 4 * sim->IMAGE_WORDS + 3) {
+		/* the program changed itself, stop using the shared decodes */
+		sim->IMAGE_WORDS = 0;
+	}
+	if (MEM_SHARED(sim) && (shared_code_test(sim, address) || shared_code_test(sim, address + 3))) {
+		__atomic_add_fetch(&sim->MEM_OWNER->SHARED_CODE_GEN, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/************************************************************/
+/* Invalidate the whole decode cache                                                  */
+/************************************************************/
+void decode_flush(mips_sim_t *sim)
+{
+	sim->DECODE_GEN++;
+	sim->CODE_GEN++;
+}
+
+/************************************************************/
+/* Execute the instruction at CURRENT_STATE.PC. trace is a constant at */
+/* every call site, so the untraced copies carry no trace code at all.   */
+/* Returns the instruction, for the profiler.                                   */
+/************************************************************/
+static inline __attribute__((always_inline)) const decoded_inst_t *execute_instruction(mips_sim_t *sim, const int trace)
+{
+	const decoded_inst_t *d = decode_fetch(sim, sim->CURRENT_STATE.PC);
+
+	sim->NEXT_STATE.PC = sim->CURRENT_STATE.PC + 4;
+	if (d->handler != NULL) {
+		d->handler(sim, d);
+		if (trace == TRACE_INSTRUCTION && sim->STOP_REASON != STOP_BREAK) {
+			trace_instruction(sim, d->instruction);
+		}
+	}
+	if (trace == TRACE_BINARY && sim->STOP_REASON != STOP_BREAK) {
+		trace_binary_record(sim, &sim->CURRENT_STATE, &sim->NEXT_STATE, d->instruction);
+	}
+	return d;
+}
+
+/************************************************************/
+/* decode and execute instruction                                                                     */ 
+/************************************************************/
+void handle_instruction(mips_sim_t *sim)
+{
+	/* execute one instruction at a time. Use/update CURRENT_STATE and and NEXT_STATE, as necessary.*/
+	if (sim->TRACE_LEVEL == TRACE_INSTRUCTION) {
+		execute_instruction(sim, TRACE_INSTRUCTION);
+	} else if (sim->TRACE_LEVEL == TRACE_BINARY) {
+		execute_instruction(sim, TRACE_BINARY);
+	} else {
+		execute_instruction(sim, TRACE_OFF);
+	}
+}
+
+/************************************************************/
+/* Hand an executed instruction to every model that is switched on    */
+/************************************************************/
+static inline void observe_instruction(mips_sim_t *sim, const decoded_inst_t *d)
+{
+	if (sim->PROFILE != NULL) {
+		profile_record(sim, d);
+	}
+	if (sim->PIPELINE != NULL) {
+		pipeline_record(sim, d);
+	}
+	if (sim->CACHE != NULL) {
+		cache_record(sim, d);
+	}
+	if (sim->BRANCH != NULL) {
+		branch_record(sim, d);
+	}
+}
+
+static inline __attribute__((always_inline)) uint32_t interp_loop(mips_sim_t *sim, uint32_t max, const int trace, const int observe)
+{
+	const decoded_inst_t *d;
+	uint32_t i;
+
+	for (i = 0; i < max && sim->RUN_FLAG; i++) {
+		d = execute_instruction(sim, trace);
+		if (observe && sim->STOP_REASON != STOP_BREAK) {
+			observe_instruction(sim, d);
+		}
+		sim->CURRENT_STATE = sim->NEXT_STATE;
+	}
+	sim->INSTRUCTION_COUNT += i;
+	return i;
+}
+
+/************************************************************/
+/* Run up to and including the next jump, branch or syscall, at most  */
+/* max (> 0) instructions, in place: sim->NEXT must be CURRENT_STATE.  */
+/* Only those instructions can stop a run, so nothing is checked      */
+/* between the others and nothing is copied.                          */
+/************************************************************/
+static inline __attribute__((always_inline)) uint32_t run_block(mips_sim_t *sim, uint32_t max)
+{
+	const decoded_inst_t *d;
+	uint32_t i = 0;
+
+	do {
+		d = decode_fetch(sim, sim->CURRENT_STATE.PC);
+		sim->CURRENT_STATE.PC += 4;
+		if (d->handler != NULL) {
+			d->handler(sim, d);
+		}
+		i++;
+	} while (!d->ends_block && i < max);
+	return i;
+}
+
+/************************************************************/
+/* Untraced, unobserved runs: blocks in place on CURRENT_STATE, with   */
+/* RUN_FLAG checked and the count kept between blocks. The result is */
+/* the same as cycle() per instruction, NEXT_STATE included.          */
+/************************************************************/
+static uint32_t interp_in_place(mips_sim_t *sim, uint32_t max)
+{
+	uint32_t i = 0;
+
+	sim->NEXT = &sim->CURRENT_STATE;
+	while (i < max && sim->RUN_FLAG) {
+		i += run_block(sim, max - i);
+	}
+	sim->NEXT = &sim->NEXT_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->INSTRUCTION_COUNT += i;
+	return i;
+}
+
+/************************************************************/
+/* One block in place for the other engines' cold paths; the caller   */
+/* adds the count to INSTRUCTION_COUNT.                                */
+/************************************************************/
+uint32_t interp_block(mips_sim_t *sim, uint32_t max)
+{
+	uint32_t i;
+
+	sim->NEXT = &sim->CURRENT_STATE;
+	i = run_block(sim, max);
+	sim->NEXT = &sim->NEXT_STATE;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	return i;
+}
+
+/************************************************************/
+/* Interpreter engine: up to max instructions, stopping when RUN_FLAG */
+/* drops. Returns the number executed.                                               */
+/************************************************************/
+uint32_t interp_run(mips_sim_t *sim, uint32_t max)
+{
+	if (SIM_OBSERVED(sim)) {
+		if (sim->TRACE_LEVEL == TRACE_INSTRUCTION) {
+			return interp_loop(sim, max, TRACE_INSTRUCTION, TRUE);
+		}
+		if (sim->TRACE_LEVEL == TRACE_BINARY) {
+			return interp_loop(sim, max, TRACE_BINARY, TRUE);
+		}
+		return interp_loop(sim, max, TRACE_OFF, TRUE);
+	}
+	if (sim->TRACE_LEVEL == TRACE_INSTRUCTION) {
+		return interp_loop(sim, max, TRACE_INSTRUCTION, FALSE);
+	}
+	if (sim->TRACE_LEVEL == TRACE_BINARY) {
+		return interp_loop(sim, max, TRACE_BINARY, FALSE);
+	}
+	if (sim->NUM_WATCHES > 0) {
+		/* a watchpoint stops the run right after the accessing instruction */
+		return interp_loop(sim, max, TRACE_OFF, FALSE);
+	}
+	return interp_in_place(sim, max);
+}
+
+/************************************************************/
+/* Trace writer: executed instructions are disassembled into a large */
+/* per-simulation buffer that goes to stdout in bulk when full and     */
+/* after every run.                                                                        */
+/************************************************************/
+void trace_instruction(mips_sim_t *sim, uint32_t instruction)
+{
+	if (sim->TRACE_BUFFER == NULL) {
+		sim->TRACE_BUFFER = malloc(TRACE_BUFFER_SIZE);
+		if (sim->TRACE_BUFFER == NULL) {
+			printf("Error: out of memory for the trace buffer\n");
+			exit(-1);
+		}
+	}
+	if (sim->TRACE_LEN > TRACE_BUFFER_SIZE - TRACE_LINE_MAX) {
+		trace_flush(sim);
+	}
+	sim->TRACE_LEN += format_instruction(instruction, sim->TRACE_BUFFER + sim->TRACE_LEN, TRACE_LINE_MAX);
+}
+
+void trace_flush(mips_sim_t *sim)
+{
+	if (sim->TRACE_LEN > 0) {
+		fwrite(sim->TRACE_BUFFER, 1, sim->TRACE_LEN, stdout);
+		sim->TRACE_LEN = 0;
+	}
+	trace_binary_flush(sim);
+}
+
+/************************************************************/
+/* Parse a trace level name (off, summary, inst, bin), -1 if unknown */
+/************************************************************/
+int parse_trace_level(const char *name)
+{
+	if (strcmp(name, "off") == 0) {
+		return TRACE_OFF;
+	}
+	if (strcmp(name, "summary") == 0) {
+		return TRACE_SUMMARY;
+	}
+	if (strcmp(name, "inst") == 0) {
+		return TRACE_INSTRUCTION;
+	}
+	if (strcmp(name, "bin") == 0) {
+		return TRACE_BINARY;
+	}
+	return -1;
+}
+
+/************************************************************/
+/* Simulations                                                                                             */
+/************************************************************/
+mips_sim_t *mips_sim_create()
+{
+	mips_sim_t *sim = calloc(1, sizeof(mips_sim_t));
+
+	if (sim == NULL) {
+		return NULL;
+	}
+	sim->MEM_OWNER = sim;
+	sim->NUM_CORES = 1;
+	pthread_mutex_init(&sim->MEM_LOCK, NULL);
+	init_memory(sim);
+	sim->NEXT = &sim->NEXT_STATE;
+	sim->CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->RUN_FLAG = TRUE;
+	sim->ENGINE = ENGINE_INTERP;
+	sim->TRACE_LEVEL = TRACE_OFF;
+	return sim;
+}
+
+void mips_sim_destroy(mips_sim_t *sim)
+{
+	if (sim == NULL) {
+		return;
+	}
+	multicore_free(sim);
+	free_memory(sim);
+	free(sim->DIRTY_PAGES);
+	threaded_free(sim);
+	jit_free(sim);
+	trace_binary_close(sim);
+	free(sim->TRACE_BUFFER);
+	profile_stop(sim);
+	pipeline_stop(sim);
+	cache_stop(sim);
+	branch_stop(sim);
+	debug_free(sim);
+	console_free(sim);
+	mips_image_release(sim->IMAGE);
+	pthread_mutex_destroy(&sim->MEM_LOCK);
+	free(sim);
+}
+
+void mips_sim_load(mips_sim_t *sim, mips_image_t *image)
+{
+	uint32_t i;
+
+	mips_image_retain(image);
+	mips_image_release(sim->IMAGE);
+	sim->IMAGE = image;
+
+	free_memory(sim);
+	memset(&sim->CURRENT_STATE, 0, sizeof(CPU_State));
+	for (i = 0; i < image->num_data; i++) {
+		mem_write_words(sim, image->data[i].base, image->data[i].words, image->data[i].size);
+	}
+	mem_write_words(sim, image->base, image->words, image->size);
+	/* after the writes above, which detach the image from decode_fetch() */
+	sim->IMAGE_BASE = image->base;
+	sim->IMAGE_WORDS = image->size;
+	debug_attach_image(sim);
+
+	sim->INSTRUCTION_COUNT = 0;
+	sim->CURRENT_STATE.PC = image->entry;
+	sim->HEAP_BREAK = syscall_heap_start(image);
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->RUN_FLAG = TRUE;
+	sim->STOP_REASON = STOP_NONE;
+	sim->RESUME = FALSE;
+	sim->LL_VALID = FALSE;
+	snapshot_take(sim);
+	multicore_reset(sim);
+}
+
+void mips_sim_reset(mips_sim_t *sim)
+{
+	if (sim->SNAPSHOT_VALID) {
+		snapshot_restore(sim);
+	} else if (sim->IMAGE != NULL) {
+		mips_sim_load(sim, sim->IMAGE);
+	}
+}
+
+uint32_t mips_sim_step(mips_sim_t *sim)
+{
+	return mips_sim_running(sim) ? engine_run(sim, 1) : 0;
+}
+
+uint64_t mips_sim_run(mips_sim_t *sim, uint64_t max)
+{
+	uint64_t executed = 0, left;
+
+	while (mips_sim_running(sim) && executed < max) {
+		left = max - executed;
+		executed += engine_run(sim, left < UINT32_MAX ? left : UINT32_MAX);
+	}
+	return executed;
+}
+
+int mips_sim_running(const mips_sim_t *sim)
+{
+	uint32_t i;
+
+	if (sim->NUM_CORES > 1 && sim->STOP_REASON == STOP_NONE) {
+		for (i = 0; i < sim->NUM_CORES; i++) {
+			if (sim->CORES[i]->RUN_FLAG) {
+				return TRUE;
+			}
+		}
+	}
+	return sim->RUN_FLAG;
+}
+
+uint64_t mips_sim_instruction_count(const mips_sim_t *sim)
+{
+	uint64_t count = sim->INSTRUCTION_COUNT;
+	uint32_t i;
+
+	for (i = 1; i < sim->NUM_CORES; i++) {
+		count += sim->CORES[i]->INSTRUCTION_COUNT;
+	}
+	return count;
+}
+
+uint32_t mips_sim_get_reg(const mips_sim_t *sim, int reg)
+{
+	if (reg >= 0 && reg < MIPS_REGS) {
+		return sim->CURRENT_STATE.REGS[reg];
+	}
+	switch (reg) {
+		case MIPS_SIM_HI: return sim->CURRENT_STATE.HI;
+		case MIPS_SIM_LO: return sim->CURRENT_STATE.LO;
+		case MIPS_SIM_PC: return sim->CURRENT_STATE.PC;
+	}
+	return 0;
+}
+
+void mips_sim_set_reg(mips_sim_t *sim, int reg, uint32_t value)
+{
+	if (reg >= 0 && reg < MIPS_REGS) {
+		sim->CURRENT_STATE.REGS[reg] = value;
+	} else if (reg == MIPS_SIM_HI) {
+		sim->CURRENT_STATE.HI = value;
+	} else if (reg == MIPS_SIM_LO) {
+		sim->CURRENT_STATE.LO = value;
+	} else if (reg == MIPS_SIM_PC) {
+		sim->CURRENT_STATE.PC = value;
+	}
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+}
+
+uint32_t mips_sim_read_32(mips_sim_t *sim, uint32_t address)
+{
+	return mem_read_32(sim, address);
+}
+
+void mips_sim_write_32(mips_sim_t *sim, uint32_t address, uint32_t value)
+{
+	mem_write_32(sim, address, value);
+}
+
+void mips_sim_set_engine(mips_sim_t *sim, int engine)
+{
+	sim->ENGINE = engine;
+}
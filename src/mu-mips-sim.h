@@ -0,0 +1,133 @@
+#ifndef MU_MIPS_SIM_H
+#define MU_MIPS_SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/******************************************************************************/
+/* libmu-mips: the simulator as a library                                     */
+/*                                                                            */
+/* Every simulation lives in its own mips_sim_t, so one process can run any  */
+/* number of guests, each on its own thread. A program is loaded once into a */
+/* mips_image_t (words plus their decoded form); the image is read-only and  */
+/* reference counted, so any number of simulations can share it.             */
+/*                                                                            */
+/*   mips_image_t *image = mips_image_load("prog.in");                       */
+/*   mips_sim_t *sim = mips_sim_create();                                    */
+/*   mips_sim_load(sim, image);                                              */
+/*   mips_sim_run(sim, UINT64_MAX);                                          */
+/*   printf("%08x\n", mips_sim_get_reg(sim, 2));                             */
+/*   mips_sim_destroy(sim);                                                  */
+/*   mips_image_release(image);                                              */
+/******************************************************************************/
+
+typedef struct mips_sim mips_sim_t;
+typedef struct mips_image mips_image_t;
+
+/* register numbers for mips_sim_get_reg/mips_sim_set_reg besides R0-R31 */
+#define MIPS_SIM_HI 32
+#define MIPS_SIM_LO 33
+#define MIPS_SIM_PC 34
+
+/* engines for mips_sim_set_engine, same as -e */
+#define MIPS_SIM_INTERP		0
+#define MIPS_SIM_THREADED	1
+#define MIPS_SIM_JIT		2
+
+/* program file formats for mips_image_load_format */
+#define MIPS_IMAGE_AUTO		0	/* ELF by its magic, else hex text, else raw big-endian */
+#define MIPS_IMAGE_HEX		1	/* one hex word per line (or any whitespace) */
+#define MIPS_IMAGE_BIN_BE	2	/* raw big-endian words, loaded at the start of text */
+#define MIPS_IMAGE_BIN_LE	3	/* raw little-endian words */
+#define MIPS_IMAGE_ELF		4	/* ELF32 MIPS executable, either byte order */
+#define MIPS_IMAGE_ASM		5	/* assembly source; AUTO picks it for .asm and .s files */
+
+/* Read a program. NULL if the file can't be read (errno from the system) */
+/* or is not a valid program of the format (errno EINVAL).                */
+mips_image_t *mips_image_load(const char *path);
+mips_image_t *mips_image_load_format(const char *path, int format);
+/* Build a program from words in memory: text at base, execution starting */
+/* at entry. Data segments can be added until the image is first loaded.  */
+mips_image_t *mips_image_create(uint32_t base, uint32_t entry, const uint32_t *words, uint32_t count);
+void mips_image_add_data(mips_image_t *image, uint32_t base, const uint32_t *words, uint32_t count);
+mips_image_t *mips_image_retain(mips_image_t *image);
+void mips_image_release(mips_image_t *image);
+uint32_t mips_image_size(const mips_image_t *image);	/* in words */
+uint32_t mips_image_word(const mips_image_t *image, uint32_t index);
+uint32_t mips_image_base(const mips_image_t *image);	/* address of word 0 */
+uint32_t mips_image_entry(const mips_image_t *image);	/* initial PC */
+/* Address of a label of an assembled program; FALSE if there is none */
+int mips_image_symbol(const mips_image_t *image, const char *name, uint32_t *address);
+
+mips_sim_t *mips_sim_create();
+void mips_sim_destroy(mips_sim_t *sim);
+
+/* Copy the image into memory, set PC to its entry and take the reset snapshot */
+void mips_sim_load(mips_sim_t *sim, mips_image_t *image);
+/* Back to the state right after mips_sim_load (or mips_sim_restore) */
+void mips_sim_reset(mips_sim_t *sim);
+
+/* Write registers, instruction count and every non-zero page to a        */
+/* checkpoint file / replace all of them from one, which also becomes the  */
+/* reset state. TRUE on success, else FALSE with errno from the system,   */
+/* EINVAL if the file is not a checkpoint or ENOTSUP with several cores.  */
+int mips_sim_save(mips_sim_t *sim, const char *path);
+int mips_sim_restore(mips_sim_t *sim, const char *path);
+
+/* Execute one instruction / up to max instructions. Both stop when the     */
+/* program exits (syscall 10, or one this simulator does not implement) and */
+/* return the number of instructions executed.                              */
+uint32_t mips_sim_step(mips_sim_t *sim);
+uint64_t mips_sim_run(mips_sim_t *sim, uint64_t max);
+int mips_sim_running(const mips_sim_t *sim);	/* FALSE once the program exited */
+uint64_t mips_sim_instruction_count(const mips_sim_t *sim);
+
+uint32_t mips_sim_get_reg(const mips_sim_t *sim, int reg);
+void mips_sim_set_reg(mips_sim_t *sim, int reg, uint32_t value);
+uint32_t mips_sim_read_32(mips_sim_t *sim, uint32_t address);
+void mips_sim_write_32(mips_sim_t *sim, uint32_t address, uint32_t value);
+
+void mips_sim_set_engine(mips_sim_t *sim, int engine);
+
+/* Run n cores (1-64) on the simulation's memory, all restarting from its */
+/* state with their number in $k0 and n in $k1; FALSE if n is out of      */
+/* range. Runs and counts then cover every core; the registers and count  */
+/* of core i are those of mips_sim_core(sim, i), NULL past the last one.  */
+/* A quantum > 0 runs the cores in turns of that many instructions on     */
+/* the calling thread, the same way every time; 0 (the default) gives     */
+/* each core a host thread of its own.                                    */
+int mips_sim_set_cores(mips_sim_t *sim, int n);
+void mips_sim_set_quantum(mips_sim_t *sim, uint32_t quantum);
+mips_sim_t *mips_sim_core(mips_sim_t *sim, uint32_t index);
+
+/* One program over many inputs at once: a group of 1-MIPS_LANES_MAX    */
+/* lanes, each a guest with its own registers and memory, that execute  */
+/* every instruction they are all at together as one vector operation.  */
+/* Load, set each lane's inputs, run, read each lane's results; a run   */
+/* gives the same results as mips_sim_run() would on every lane.        */
+#define MIPS_LANES_MAX 16
+
+typedef struct mips_lanes mips_lanes_t;
+
+mips_lanes_t *mips_lanes_create(uint32_t count);
+void mips_lanes_destroy(mips_lanes_t *lanes);
+/* the first count lanes to the start of image, the rest sit out the runs */
+void mips_lanes_load(mips_lanes_t *lanes, mips_image_t *image, uint32_t count);
+/* up to max instructions per lane; returns the sum over the lanes */
+uint64_t mips_lanes_run(mips_lanes_t *lanes, uint64_t max);
+uint32_t mips_lanes_count(const mips_lanes_t *lanes);
+int mips_lanes_running(const mips_lanes_t *lanes, uint32_t lane);
+uint64_t mips_lanes_instruction_count(const mips_lanes_t *lanes, uint32_t lane);
+uint32_t mips_lanes_get_reg(const mips_lanes_t *lanes, uint32_t lane, int reg);
+void mips_lanes_set_reg(mips_lanes_t *lanes, uint32_t lane, int reg, uint32_t value);
+uint32_t mips_lanes_read_32(mips_lanes_t *lanes, uint32_t lane, uint32_t address);
+void mips_lanes_write_32(mips_lanes_t *lanes, uint32_t lane, uint32_t address, uint32_t value);
+/* the vector instructions runs use: "avx512", "avx2" or "generic" */
+const char *mips_lanes_isa();
+
+/* Where print_int/print_string write and read_int reads: none until set.  */
+/* Output is buffered and written after every run; NULL drops it / makes  */
+/* every read_int return 0.                                                */
+void mips_sim_set_console(mips_sim_t *sim, FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* SPIM system calls, by the code in $v0:                              */
+/*                                                                     */
+/*   1  print_int     $a0 in decimal                                   */
+/*   4  print_string  the NUL-terminated string at $a0                 */
+/*   5  read_int      a line of input, its number into $v0             */
+/*   9  sbrk          $a0 more bytes of heap, their address into $v0   */
+/*   10 exit                                                           */
+/*                                                                     */
+/* Any other code stops the run like exit, as every syscall did before */
+/* this layer, so existing programs still end where they did.          */
+/*                                                                     */
+/* Output collects in a per-simulation buffer that goes to CONSOLE_OUT */
+/* in bulk when full, before input is read and after every run, not a  */
+/* host write per print. While instructions are traced it is written   */
+/* at once, after the pending trace, so the two stay in order.         */
+/*                                                                     */
+/* The heap is an arena in the data segment from the end of the        */
+/* program's data up to SYSCALL_HEAP_LIMIT; the break is reset and     */
+/* checkpointed with the registers. Its pages are mapped lazily on     */
+/* first write like any other.                                         */
+/***************************************************************/
+#define SYSCALL_PRINT_INT	1
+#define SYSCALL_PRINT_STRING	4
+#define SYSCALL_READ_INT	5
+#define SYSCALL_SBRK		9
+#define SYSCALL_EXIT		10
+
+#define CONSOLE_BUFFER_SIZE	(1 << 16)
+#define CONSOLE_INPUT_MAX	256
+#define SYSCALL_HEAP_LIMIT	0x7F000000	/* 16MB below the top of the stack */
+
+#define REG_V0	2
+#define REG_A0	4
+
+void console_flush(mips_sim_t *sim)
+{
+	if (sim->CONSOLE_LEN > 0) {
+		fwrite(sim->CONSOLE_BUFFER, 1, sim->CONSOLE_LEN, sim->CONSOLE_OUT);
+		sim->CONSOLE_LEN = 0;
+	}
+}
+
+static void console_write(mips_sim_t *sim, const char *s, uint32_t n)
+{
+	if (sim->CONSOLE_OUT == NULL) {
+		return;
+	}
+	if (sim->TRACE_LEVEL == TRACE_INSTRUCTION) {
+		trace_flush(sim);
+		fwrite(s, 1, n, sim->CONSOLE_OUT);
+		return;
+	}
+	if (sim->CONSOLE_BUFFER == NULL) {
+		sim->CONSOLE_BUFFER = malloc(CONSOLE_BUFFER_SIZE);
+		if (sim->CONSOLE_BUFFER == NULL) {
+			printf("Error: out of memory for the console buffer\n");
+			exit(-1);
+		}
+	}
+	if (n > CONSOLE_BUFFER_SIZE - sim->CONSOLE_LEN) {
+		console_flush(sim);
+		if (n >= CONSOLE_BUFFER_SIZE) {
+			fwrite(s, 1, n, sim->CONSOLE_OUT);
+			return;
+		}
+	}
+	memcpy(sim->CONSOLE_BUFFER + sim->CONSOLE_LEN, s, n);
+	sim->CONSOLE_LEN += n;
+}
+
+/***************************************************************/
+/* Print guest memory from address up to its NUL a page at a time: an  */
+/* unmapped page reads as zeros, so it ends the string.                */
+/***************************************************************/
+static void print_string(mips_sim_t *sim, uint32_t address)
+{
+	const uint8_t *page, *nul;
+	uint32_t offset, n;
+
+	for (;;) {
+		page = mem_page(sim, address, FALSE);
+		if (page == NULL) {
+			return;
+		}
+		offset = address & MEM_PAGE_MASK;
+		n = MEM_PAGE_SIZE - offset;
+		nul = memchr(page + offset, 0, n);
+		if (nul != NULL) {
+			console_write(sim, (const char *)page + offset, nul - (page + offset));
+			return;
+		}
+		console_write(sim, (const char *)page + offset, n);
+		address += n;
+		if (address == 0) {
+			return;
+		}
+	}
+}
+
+static uint32_t read_int(mips_sim_t *sim)
+{
+	char line[CONSOLE_INPUT_MAX];
+	size_t len;
+	int c;
+
+	/* show any prompt first */
+	if (sim->CONSOLE_OUT != NULL) {
+		trace_flush(sim);
+		console_flush(sim);
+		fflush(sim->CONSOLE_OUT);
+	}
+	if (sim->CONSOLE_IN == NULL || fgets(line, sizeof(line), sim->CONSOLE_IN) == NULL) {
+		return 0;
+	}
+	len = strlen(line);
+	if (len > 0 && line[len - 1] != '\n') {
+		/* drop the rest of an over-long line */
+		while ((c = fgetc(sim->CONSOLE_IN)) != EOF && c != '\n') {
+		}
+	}
+	return (uint32_t)strtoll(line, NULL, 10);
+}
+
+/* grow the shared heap by increment bytes; the old break, or -1 if it can't */
+static uint32_t sbrk(mips_sim_t *sim, int32_t increment)
+{
+	uint32_t *heap_break = &sim->MEM_OWNER->HEAP_BREAK;
+	uint32_t size = ((uint32_t)increment + 3) & ~0x3;
+	uint32_t old = __atomic_load_n(heap_break, __ATOMIC_RELAXED);
+
+	do {
+		if (increment < 0 || size > SYSCALL_HEAP_LIMIT - old) {
+			return 0xFFFFFFFF;
+		}
+	} while (!__atomic_compare_exchange_n(heap_break, &old, old + size, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return old;
+}
+
+/***************************************************************/
+/* Run the syscall whose PC is already past it: arguments come from    */
+/* CURRENT_STATE, results go to next (sim->NEXT for the interpreter,   */
+/* CURRENT_STATE for the threaded engine).                             */
+/***************************************************************/
+void syscall_run(mips_sim_t *sim, CPU_State *next)
+{
+	uint32_t a0 = sim->CURRENT_STATE.REGS[REG_A0];
+	char number[16];
+
+	switch (sim->CURRENT_STATE.REGS[REG_V0]) {
+		case SYSCALL_PRINT_INT:
+			console_write(sim, number, sprintf(number, "%d", (int32_t)a0));
+			break;
+		case SYSCALL_PRINT_STRING:
+			print_string(sim, a0);
+			break;
+		case SYSCALL_READ_INT:
+			next->REGS[REG_V0] = read_int(sim);
+			break;
+		case SYSCALL_SBRK:
+			next->REGS[REG_V0] = sbrk(sim, (int32_t)a0);
+			break;
+		case SYSCALL_EXIT:
+		default:
+			sim->RUN_FLAG = FALSE;
+			break;
+	}
+}
+
+/***************************************************************/
+/* The initial break: past the program's highest data segment          */
+/***************************************************************/
+uint32_t syscall_heap_start(const mips_image_t *image)
+{
+	uint32_t i, end, start = MEM_DATA_BEGIN;
+
+	for (i = 0; i < image->num_data; i++) {
+		end = image->data[i].base + 4 * image->data[i].size;
+		if (image->data[i].base >= MEM_DATA_BEGIN && end < SYSCALL_HEAP_LIMIT && end > start) {
+			start = end;
+		}
+	}
+	return (start + 7) & ~0x7;
+}
+
+void console_free(mips_sim_t *sim)
+{
+	if (sim->CONSOLE_OUT != NULL) {
+		console_flush(sim);
+	}
+	free(sim->CONSOLE_BUFFER);
+	sim->CONSOLE_BUFFER = NULL;
+}
+
+void mips_sim_set_console(mips_sim_t *sim, FILE *in, FILE *out)
+{
+	console_flush(sim);
+	sim->CONSOLE_IN = in;
+	sim->CONSOLE_OUT = out;
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Direct-threaded execution engine (-e threaded)                                          */
+/*                                                                                                                               */
+/* A basic block is translated once into an array of ops whose first field */
+/* is the address of the code implementing it (GCC labels-as-values). Each */
+/* op ends by jumping straight to the next op, so there is no switch in the */
+/* loop. Blocks end at the first jump, branch or syscall, at a page       */
+/* boundary or after BLOCK_MAX_OPS instructions. The engine works in place */
+/* on CURRENT_STATE and leaves NEXT_STATE equal to it when it returns.     */
+/* It never traces: engine_run() uses the interpreter at TRACE_INSTRUCTION. */
+/***************************************************************/
+
+enum {
+	T_ADD, T_SUB, T_MULT, T_DIV, T_AND, T_OR, T_XOR, T_NOR, T_SLT,
+	T_SLL, T_SRL, T_JR, T_JALR, T_MFHI, T_MTHI, T_MFLO, T_MTLO, T_SYSCALL,
+	T_J, T_JAL, T_BEQ, T_BNE, T_BLEZ, T_BGTZ,
+	T_ADDI, T_ADDIU, T_ANDI, T_ORI, T_XORI, T_SLTI, T_LW, T_LUI,
+	T_LL, T_SC, T_SYNC,
+	T_NOP,		/* no effect: unimplemented, or decoded only (lb, sw, ...) */
+	T_FALLTHROUGH,	/* pseudo op closing a block that does not end in a jump */
+	T_NUM_OPS
+};
+
+typedef struct {
+	const void *label;
+	uint32_t pc;
+	uint32_t imm;	/* immediate, already extended, or the absolute jump/branch target */
+	uint8_t rs, rt, rd, sa;
+} threaded_op_t;
+
+typedef struct threaded_block_struct {
+	uint32_t pc;		/* address of the first instruction */
+	uint32_t gen;		/* valid only while equal to CODE_GEN */
+	uint32_t count;		/* guest instructions in the block */
+	threaded_op_t ops[];	/* count ops, plus a T_FALLTHROUGH op if needed */
+} threaded_block_t;
+
+#define BLOCK_MAX_OPS 64
+#define BLOCK_CACHE_BITS 12
+#define BLOCK_CACHE_SIZE (1 << BLOCK_CACHE_BITS)
+
+/***************************************************************/
+/* Map a decoded instruction to its op kind and fill in the operands.     */
+/* Sets *end when the instruction has to close the block.                    */
+/***************************************************************/
+static int threaded_op_kind(const decoded_inst_t *d, threaded_op_t *op, int *end)
+{
+	uint32_t simm = (uint32_t)(int32_t)(int16_t)d->immediate;
+
+	op->rs = d->rs;
+	op->rt = d->rt;
+	op->rd = d->rd;
+	op->sa = d->sa;
+	op->imm = d->immediate;
+
+	if (d->handler == NULL) {
+		return T_NOP;
+	}
+
+	if (d->opcode == 0x00) {
+		switch (d->function) {
+			case 0x0C: *end = TRUE; return T_SYSCALL;
+			case 0x20: case 0x21: return T_ADD;
+			case 0x22: case 0x23: return T_SUB;
+			case 0x18: case 0x19: return T_MULT;
+			case 0x1A: case 0x1B: return T_DIV;
+			case 0x24: return T_AND;
+			case 0x25: return T_OR;
+			case 0x26: return T_XOR;
+			case 0x27: return T_NOR;
+			case 0x2A: return T_SLT;
+			case 0x00: return T_SLL;
+			case 0x02: case 0x03: return T_SRL;
+			case 0x08: *end = TRUE; return T_JR;
+			case 0x09: *end = TRUE; return T_JALR;
+			case 0x10: return T_MFHI;
+			case 0x11: return T_MTHI;
+			case 0x12: return T_MFLO;
+			case 0x13: return T_MTLO;
+			case 0x0F: return T_SYNC;
+		}
+		return T_NOP;
+	}
+
+	switch (d->opcode) {
+		case 0x02:
+		case 0x03:
+			*end = TRUE;
+			op->imm = ((op->pc >> 28) << 28) + (d->offset << 2);
+			return (d->opcode == 0x02) ? T_J : T_JAL;
+		case 0x04:
+		case 0x05:
+		case 0x06:
+		case 0x07:
+			*end = TRUE;
+			op->imm = op->pc + (simm << 2);
+			return T_BEQ + (d->opcode - 0x04);
+		case 0x08: op->imm = simm; return T_ADDI;
+		case 0x09: return T_ADDIU;
+		case 0x0C: return T_ANDI;
+		case 0x0D: return T_ORI;
+		case 0x0E: return T_XORI;
+		case 0x0A: op->imm = simm; return T_SLTI;
+		case 0x23: return T_LW;
+		case 0x0F: op->imm = d->immediate << 16; return T_LUI;
+		case 0x30: return T_LL;
+		case 0x38: return T_SC;
+	}
+	return T_NOP;
+}
+
+/***************************************************************/
+/* Translate the basic block starting at pc                                                     */
+/***************************************************************/
+static threaded_block_t *threaded_translate(mips_sim_t *sim, uint32_t pc, const void * const *labels)
+{
+	threaded_op_t ops[BLOCK_MAX_OPS + 1];
+	threaded_block_t *block;
+	decoded_inst_t d;
+	uint32_t n = 0, addr = pc;
+	int end = FALSE;
+
+	code_page_mark(sim, pc);
+	while (!end && n < BLOCK_MAX_OPS) {
+		decode_instruction(mem_read_32(sim, addr), &d);
+		ops[n].pc = addr;
+		ops[n].label = labels[threaded_op_kind(&d, &ops[n], &end)];
+		n++;
+		addr += 4;
+		if ((addr & MEM_PAGE_MASK) == 0) {
+			break;
+		}
+	}
+
+	block = malloc(sizeof(threaded_block_t) + (n + 1) * sizeof(threaded_op_t));
+	if (block == NULL) {
+		printf("Error: out of memory translating block at 0x%08x\n", pc);
+		exit(-1);
+	}
+	block->pc = pc;
+	block->gen = sim->CODE_GEN;
+	block->count = n;
+	memcpy(block->ops, ops, n * sizeof(threaded_op_t));
+	block->ops[n].label = labels[T_FALLTHROUGH];
+	block->ops[n].pc = addr;
+	return block;
+}
+
+/***************************************************************/
+/* Find (or translate) the block at pc, NULL if pc is misaligned         */
+/***************************************************************/
+static threaded_block_t *threaded_lookup(mips_sim_t *sim, uint32_t pc, const void * const *labels)
+{
+	threaded_block_t **slot;
+
+	if (pc & 0x3) {
+		return NULL;
+	}
+	if (sim->BLOCK_CACHE == NULL) {
+		sim->BLOCK_CACHE = calloc(BLOCK_CACHE_SIZE, sizeof(threaded_block_t *));
+		if (sim->BLOCK_CACHE == NULL) {
+			printf("Error: out of memory for the block cache\n");
+			exit(-1);
+		}
+	}
+	slot = &sim->BLOCK_CACHE[(pc >> 2) & (BLOCK_CACHE_SIZE - 1)];
+	if (*slot != NULL && (*slot)->pc == pc && (*slot)->gen == sim->CODE_GEN) {
+		return *slot;
+	}
+	free(*slot);
+	*slot = threaded_translate(sim, pc, labels);
+	return *slot;
+}
+
+/***************************************************************/
+/* Execute up to max instructions, stopping early when RUN_FLAG drops. */
+/* Returns the number of instructions executed.                                    */
+/***************************************************************/
+uint32_t threaded_run(mips_sim_t *sim, uint32_t max)
+{
+	static const void * const labels[T_NUM_OPS] = {
+		[T_ADD] = &&op_add, [T_SUB] = &&op_sub, [T_MULT] = &&op_mult,
+		[T_DIV] = &&op_div, [T_AND] = &&op_and, [T_OR] = &&op_or,
+		[T_XOR] = &&op_xor, [T_NOR] = &&op_nor, [T_SLT] = &&op_slt,
+		[T_SLL] = &&op_sll, [T_SRL] = &&op_srl, [T_JR] = &&op_jr,
+		[T_JALR] = &&op_jalr, [T_MFHI] = &&op_mfhi, [T_MTHI] = &&op_mthi,
+		[T_MFLO] = &&op_mflo, [T_MTLO] = &&op_mtlo, [T_SYSCALL] = &&op_syscall,
+		[T_J] = &&op_j, [T_JAL] = &&op_jal, [T_BEQ] = &&op_beq,
+		[T_BNE] = &&op_bne, [T_BLEZ] = &&op_blez, [T_BGTZ] = &&op_bgtz,
+		[T_ADDI] = &&op_addi, [T_ADDIU] = &&op_addiu, [T_ANDI] = &&op_andi,
+		[T_ORI] = &&op_ori, [T_XORI] = &&op_xori, [T_SLTI] = &&op_slti,
+		[T_LW] = &&op_lw, [T_LUI] = &&op_lui, [T_LL] = &&op_ll,
+		[T_SC] = &&op_sc, [T_SYNC] = &&op_sync, [T_NOP] = &&op_nop,
+		[T_FALLTHROUGH] = &&op_fallthrough,
+	};
+	uint32_t *regs = sim->CURRENT_STATE.REGS;
+	uint32_t executed = 0, target;
+	uint64_t product;
+	threaded_block_t *block;
+	const threaded_op_t *op;
+
+/* go straight to the next op / leave the block */
+#define NEXT()	do { op++; goto *op->label; } while (0)
+#define END()	goto block_done
+
+	while (sim->RUN_FLAG && executed < max) {
+		block = threaded_lookup(sim, sim->CURRENT_STATE.PC, labels);
+		if (block == NULL || block->count > max - executed) {
+			/* misaligned pc, or the budget ends inside the block: interpret */
+			executed += interp_block(sim, max - executed);
+			continue;
+		}
+		op = block->ops;
+		goto *op->label;
+
+	op_add:
+		regs[op->rd] = regs[op->rs] + regs[op->rt];
+		NEXT();
+	op_sub:
+		regs[op->rd] = regs[op->rs] - regs[op->rt];
+		NEXT();
+	op_mult:
+		product = regs[op->rs] * regs[op->rt];
+		sim->CURRENT_STATE.HI = product >> 32;
+		sim->CURRENT_STATE.LO = product & 0xFFFFFFFF;
+		NEXT();
+	op_div:
+		if (regs[op->rt] == 0) {
+			NEXT();
+		}
+		sim->CURRENT_STATE.LO = regs[op->rs] / regs[op->rt];
+		sim->CURRENT_STATE.HI = regs[op->rs] % regs[op->rt];
+		NEXT();
+	op_and:
+		regs[op->rd] = regs[op->rs] & regs[op->rt];
+		NEXT();
+	op_or:
+		regs[op->rd] = regs[op->rs] | regs[op->rt];
+		NEXT();
+	op_xor:
+		regs[op->rd] = regs[op->rs] ^ regs[op->rt];
+		NEXT();
+	op_nor:
+		regs[op->rd] = ~(regs[op->rs] | regs[op->rt]);
+		NEXT();
+	op_slt:
+		regs[op->rd] = (regs[op->rs] < regs[op->rt]) ? 1 : 0;
+		NEXT();
+	op_sll:
+		regs[op->rd] = regs[op->rt] << op->sa;
+		NEXT();
+	op_srl:
+		regs[op->rd] = regs[op->rt] >> op->sa;
+		NEXT();
+	op_mfhi:
+		regs[op->rd] = sim->CURRENT_STATE.HI;
+		NEXT();
+	op_mthi:
+		sim->CURRENT_STATE.HI = regs[op->rs];
+		NEXT();
+	op_mflo:
+		regs[op->rd] = sim->CURRENT_STATE.LO;
+		NEXT();
+	op_mtlo:
+		sim->CURRENT_STATE.LO = regs[op->rs];
+		NEXT();
+	op_addi:
+	op_addiu:
+		regs[op->rt] = regs[op->rs] + op->imm;
+		NEXT();
+	op_andi:
+		regs[op->rt] = regs[op->rs] & op->imm;
+		NEXT();
+	op_ori:
+		regs[op->rt] = regs[op->rs] | op->imm;
+		NEXT();
+	op_xori:
+		regs[op->rt] = regs[op->rs] ^ op->imm;
+		NEXT();
+	op_slti:
+		regs[op->rt] = (regs[op->rs] < op->imm) ? 1 : 0;
+		NEXT();
+	op_lw:
+		regs[op->rt] = mem_read_32(sim, op->imm + regs[op->rs]);
+		NEXT();
+	op_lui:
+		regs[op->rt] = op->imm;
+		NEXT();
+	op_ll:
+		regs[op->rt] = mem_load_linked(sim, op->imm + regs[op->rs]);
+		NEXT();
+	op_sc:
+		regs[op->rt] = mem_store_conditional(sim, op->imm + regs[op->rs], regs[op->rt]);
+		if (block->gen != sim->CODE_GEN) {
+			/* the store rewrote translated code, maybe the rest of this block */
+			sim->CURRENT_STATE.PC = op->pc + 4;
+			executed += op - block->ops + 1;
+			continue;
+		}
+		NEXT();
+	op_sync:
+		mem_sync(sim);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		NEXT();
+	op_nop:
+		NEXT();
+
+	op_syscall:
+		sim->CURRENT_STATE.PC = op->pc + 4;
+		syscall_run(sim, &sim->CURRENT_STATE);
+		END();
+	op_jr:
+		sim->CURRENT_STATE.PC = regs[op->rs];
+		END();
+	op_jalr:
+		target = regs[op->rs];
+		regs[op->rd] = op->pc + 4;
+		sim->CURRENT_STATE.PC = target;
+		END();
+	op_j:
+		sim->CURRENT_STATE.PC = op->imm;
+		END();
+	op_jal:
+		regs[31] = op->pc + 4;
+		sim->CURRENT_STATE.PC = op->imm;
+		END();
+	op_beq:
+		sim->CURRENT_STATE.PC = (regs[op->rs] == regs[op->rt]) ? op->imm : op->pc + 4;
+		END();
+	op_bne:
+		sim->CURRENT_STATE.PC = (regs[op->rs] != regs[op->rt]) ? op->imm : op->pc + 4;
+		END();
+	op_blez:
+		sim->CURRENT_STATE.PC = ((int32_t)regs[op->rs] <= 0) ? op->imm : op->pc + 4;
+		END();
+	op_bgtz:
+		sim->CURRENT_STATE.PC = ((int32_t)regs[op->rs] > 0) ? op->imm : op->pc + 4;
+		END();
+	op_fallthrough:
+		sim->CURRENT_STATE.PC = op->pc;
+
+	block_done:
+		executed += block->count;
+	}
+
+#undef NEXT
+#undef END
+
+	sim->NEXT_STATE = sim->CURRENT_STATE;
+	sim->INSTRUCTION_COUNT += executed;
+	return executed;
+}
+
+/***************************************************************/
+/* Release the translated blocks of a simulation                                        */
+/***************************************************************/
+void threaded_free(mips_sim_t *sim)
+{
+	int i;
+
+	if (sim->BLOCK_CACHE == NULL) {
+		return;
+	}
+	for (i = 0; i < BLOCK_CACHE_SIZE; i++) {
+		free(sim->BLOCK_CACHE[i]);
+	}
+	free(sim->BLOCK_CACHE);
+	sim->BLOCK_CACHE = NULL;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+#include "mu-mips-trace.h"
+
+/***************************************************************/
+/* Binary trace writer (format in mu-mips-trace.h). Records are encoded */
+/* into a large buffer that is written to the trace file in chunks.       */
+/* Each simulation has its own writer, sim->BINARY_TRACE.                 */
+/***************************************************************/
+typedef struct trace_binary_struct {
+	FILE *file;
+	uint32_t chunk_len;
+	uint32_t next_pc;
+	uint32_t cached_pc[1 << TRACE_WORD_CACHE_BITS];
+	uint32_t cached_word[1 << TRACE_WORD_CACHE_BITS];
+	uint8_t chunk[TRACE_BUFFER_SIZE];
+} trace_binary_t;
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	return p + 4;
+}
+
+static uint32_t state_reg(const CPU_State *s, int i)
+{
+	if (i < MIPS_REGS) {
+		return s->REGS[i];
+	}
+	return (i == MIPS_REGS) ? s->HI : s->LO;
+}
+
+/***************************************************************/
+/* Open the trace file and write its header. Returns FALSE on error.   */
+/***************************************************************/
+int trace_binary_open(mips_sim_t *sim, const char *path)
+{
+	trace_binary_t *t;
+
+	trace_binary_close(sim);
+	t = malloc(sizeof(trace_binary_t));
+	if (t == NULL) {
+		return FALSE;
+	}
+	t->file = fopen(path, "wb");
+	if (t->file == NULL) {
+		free(t);
+		return FALSE;
+	}
+	fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, t->file);
+	t->chunk_len = 0;
+	t->next_pc = 0;
+	memset(t->cached_pc, 0xFF, sizeof(t->cached_pc));
+	memset(t->cached_word, 0, sizeof(t->cached_word));
+	sim->BINARY_TRACE = t;
+	return TRUE;
+}
+
+int trace_binary_is_open(const mips_sim_t *sim)
+{
+	return sim->BINARY_TRACE != NULL;
+}
+
+/***************************************************************/
+/* Write out the buffered records                                                               */
+/***************************************************************/
+void trace_binary_flush(mips_sim_t *sim)
+{
+	trace_binary_t *t = sim->BINARY_TRACE;
+
+	if (t == NULL) {
+		return;
+	}
+	fwrite(t->chunk, 1, t->chunk_len, t->file);
+	fflush(t->file);
+	t->chunk_len = 0;
+}
+
+void trace_binary_close(mips_sim_t *sim)
+{
+	if (sim->BINARY_TRACE == NULL) {
+		return;
+	}
+	trace_binary_flush(sim);
+	fclose(sim->BINARY_TRACE->file);
+	free(sim->BINARY_TRACE);
+	sim->BINARY_TRACE = NULL;
+}
+
+/***************************************************************/
+/* Record the full register file; issued at the start of every run so */
+/* changes made between runs (input, reset, ...) reach the decoder.   */
+/***************************************************************/
+void trace_binary_sync(mips_sim_t *sim, const CPU_State *s)
+{
+	trace_binary_t *t = sim->BINARY_TRACE;
+	uint8_t *p;
+	int i;
+
+	if (t->chunk_len > TRACE_BUFFER_SIZE - 1 - 4 * TRACE_SYNC_WORDS) {
+		trace_binary_flush(sim);
+	}
+	p = t->chunk + t->chunk_len;
+	*p++ = TRACE_SYNC;
+	p = put32(p, s->PC);
+	for (i = 0; i < TRACE_NUM_REGS; i++) {
+		p = put32(p, state_reg(s, i));
+	}
+	t->chunk_len = p - t->chunk;
+	t->next_pc = s->PC;
+}
+
+/***************************************************************/
+/* Record one executed instruction: before is the state it ran in,    */
+/* after the state it produced.                                                        */
+/***************************************************************/
+void trace_binary_record(mips_sim_t *sim, const CPU_State *before, const CPU_State *after, uint32_t instruction)
+{
+	trace_binary_t *t = sim->BINARY_TRACE;
+	uint8_t *p, *header;
+	uint8_t flags = 0;
+	uint32_t pc = before->PC, idx = TRACE_WORD_INDEX(pc);
+	uint8_t written[TRACE_NUM_REGS];
+	int i, n = 0;
+
+	if (t->chunk_len > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX) {
+		trace_binary_flush(sim);
+	}
+	header = p = t->chunk + t->chunk_len;
+	p++;
+
+	if (pc != t->next_pc) {
+		flags |= TRACE_NONSEQ;
+		p = trace_put_varint(p, trace_zigzag(pc - t->next_pc));
+	}
+	t->next_pc = pc + 4;
+
+	if (t->cached_pc[idx] != pc || t->cached_word[idx] != instruction) {
+		flags |= TRACE_WORD;
+		p = put32(p, instruction);
+		t->cached_pc[idx] = pc;
+		t->cached_word[idx] = instruction;
+	}
+
+	for (i = 0; i < TRACE_NUM_REGS; i++) {
+		if (state_reg(before, i) != state_reg(after, i)) {
+			written[n++] = i;
+		}
+	}
+	if (n == 1) {
+		flags |= (written[0] + 1) << TRACE_REG_SHIFT;
+	} else if (n > 1) {
+		flags |= TRACE_REG_MANY << TRACE_REG_SHIFT;
+		*p++ = n;
+	}
+	for (i = 0; i < n; i++) {
+		if (n > 1) {
+			*p++ = written[i];
+		}
+		p = trace_put_varint(p, trace_zigzag(state_reg(after, written[i]) - state_reg(before, written[i])));
+	}
+
+	*header = flags;
+	t->chunk_len = p - t->chunk;
+}
@@ -0,0 +1,78 @@
+#ifndef MU_MIPS_TRACE_H
+#define MU_MIPS_TRACE_H
+
+#include <stdint.h>
+
+/******************************************************************************/
+/* Binary execution trace (-T <file>), read back by mu-mips-tracedump          */
+/*                                                                            */
+/* The file starts with TRACE_MAGIC, followed by a stream of records. Every   */
+/* run starts with a sync record holding the full register file; after that */
+/* each executed instruction is one record:                                   */
+/*                                                                            */
+/*   header byte    bit 0: PC is not the previous PC + 4, a varint follows    */
+/*                         with the zigzag encoded difference                 */
+/*                  bit 1: the instruction word follows (4 bytes, LE); it is  */
+/*                         omitted when it matches the word last seen at that */
+/*                         PC in a small direct-mapped table on both sides    */
+/*                  bits 2-7: register written, TRACE_REG_NONE, reg + 1 for   */
+/*                         R0-R31, HI, LO, or TRACE_REG_MANY (count byte)     */
+/*   per write      register number byte (TRACE_REG_MANY only), then varint  */
+/*                  zigzag of new value - old value                           */
+/*                                                                            */
+/* A header byte of TRACE_SYNC is a sync record: 35 LE words, PC, R0-R31,     */
+/* HI and LO.                                                                 */
+/******************************************************************************/
+#define TRACE_MAGIC "MUTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+#define TRACE_NONSEQ	0x01
+#define TRACE_WORD	0x02
+#define TRACE_REG_SHIFT	2
+#define TRACE_REG_NONE	0
+#define TRACE_REG_MANY	62
+#define TRACE_SYNC	0xFF
+
+#define TRACE_NUM_REGS	34	/* R0-R31, HI (32), LO (33) */
+#define TRACE_SYNC_WORDS 35
+
+#define TRACE_WORD_CACHE_BITS 12
+#define TRACE_WORD_INDEX(pc) (((pc) >> 2) & ((1 << TRACE_WORD_CACHE_BITS) - 1))
+
+/* largest record: header, pc delta, word, count and every register */
+#define TRACE_RECORD_MAX (1 + 5 + 4 + 1 + TRACE_NUM_REGS * 6)
+
+static inline uint8_t *trace_put_varint(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static inline const uint8_t *trace_get_varint(const uint8_t *p, uint32_t *v)
+{
+	uint32_t result = 0;
+	int shift = 0;
+
+	while (*p & 0x80) {
+		result |= (uint32_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	*v = result | ((uint32_t)*p++ << shift);
+	return p;
+}
+
+static inline uint32_t trace_zigzag(uint32_t v)
+{
+	return (v << 1) ^ (uint32_t)((int32_t)v >> 31);
+}
+
+static inline uint32_t trace_unzigzag(uint32_t v)
+{
+	return (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+}
+
+#endif
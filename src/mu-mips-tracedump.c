@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mu-mips.h"
+#include "mu-mips-trace.h"
+
+/***************************************************************/
+/* mu-mips-tracedump: turn a binary trace (mu-mips -T) back into the     */
+/* disassembly text the simulator prints at trace level inst. With -v   */
+/* every instruction gets one line with its PC, word and register writes. */
+/***************************************************************/
+
+#define CHUNK_SIZE (1 << 20)
+
+static uint8_t IN[CHUNK_SIZE + TRACE_RECORD_MAX];
+static size_t IN_LEN;
+static char OUT[CHUNK_SIZE];
+static size_t OUT_LEN;
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void out_flush()
+{
+	fwrite(OUT, 1, OUT_LEN, stdout);
+	OUT_LEN = 0;
+}
+
+static const char *reg_name(int i, char *buf)
+{
+	if (i == MIPS_REGS) {
+		return "HI";
+	}
+	if (i == MIPS_REGS + 1) {
+		return "LO";
+	}
+	sprintf(buf, "R%d", i);
+	return buf;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *fp;
+	uint32_t regs[TRACE_NUM_REGS], word_pc[1 << TRACE_WORD_CACHE_BITS], word[1 << TRACE_WORD_CACHE_BITS];
+	uint32_t pc = 0, instruction, delta, idx;
+	uint64_t records = 0;
+	const uint8_t *p, *end;
+	size_t got;
+	int opt, verbose = FALSE, eof = FALSE, i, n, reg, field;
+	uint8_t flags;
+	char text[TRACE_LINE_MAX], name[8];
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v') {
+			verbose = TRUE;
+		} else {
+			exit(1);
+		}
+	}
+	if (optind >= argc) {
+		printf("Usage: %s [-v] <trace file>\n", argv[0]);
+		exit(1);
+	}
+
+	fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open trace file %s\n", argv[optind]);
+		exit(1);
+	}
+	if (fread(IN, 1, TRACE_MAGIC_LEN, fp) != TRACE_MAGIC_LEN || memcmp(IN, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+		printf("Error: %s is not a mu-mips trace\n", argv[optind]);
+		exit(1);
+	}
+
+	memset(regs, 0, sizeof(regs));
+	memset(word_pc, 0xFF, sizeof(word_pc));
+	memset(word, 0, sizeof(word));
+	IN_LEN = 0;
+	p = end = IN;
+
+	while (1) {
+		/* keep at least one whole record buffered */
+		if (!eof && end - p < TRACE_RECORD_MAX + 4 * TRACE_SYNC_WORDS) {
+			IN_LEN = end - p;
+			memmove(IN, p, IN_LEN);
+			got = fread(IN + IN_LEN, 1, CHUNK_SIZE + TRACE_RECORD_MAX - IN_LEN, fp);
+			eof = (got == 0);
+			IN_LEN += got;
+			p = IN;
+			end = IN + IN_LEN;
+		}
+		if (p >= end) {
+			break;
+		}
+		if (OUT_LEN > CHUNK_SIZE - 4 * TRACE_LINE_MAX - 16 * TRACE_NUM_REGS) {
+			out_flush();
+		}
+
+		flags = *p++;
+		if (flags == TRACE_SYNC) {
+			pc = get32(p);
+			p += 4;
+			for (i = 0; i < TRACE_NUM_REGS; i++, p += 4) {
+				regs[i] = get32(p);
+			}
+			continue;
+		}
+
+		if (flags & TRACE_NONSEQ) {
+			p = trace_get_varint(p, &delta);
+			pc += trace_unzigzag(delta);
+		}
+		idx = TRACE_WORD_INDEX(pc);
+		if (flags & TRACE_WORD) {
+			word_pc[idx] = pc;
+			word[idx] = get32(p);
+			p += 4;
+		}
+		instruction = word[idx];
+
+		format_instruction(instruction, text, sizeof(text));
+		if (verbose) {
+			/* one line per instruction: drop the disassembly's own newlines */
+			for (i = 0; text[i]; i++) {
+				if (text[i] == '\n') {
+					text[i] = ' ';
+				}
+			}
+			OUT_LEN += sprintf(OUT + OUT_LEN, "0x%08x\t0x%08x\t%s", pc, instruction, text);
+		} else {
+			OUT_LEN += sprintf(OUT + OUT_LEN, "%s", text);
+		}
+
+		field = flags >> TRACE_REG_SHIFT;
+		n = (field == TRACE_REG_MANY) ? *p++ : (field != TRACE_REG_NONE);
+		for (i = 0; i < n; i++) {
+			reg = (field == TRACE_REG_MANY) ? *p++ : field - 1;
+			p = trace_get_varint(p, &delta);
+			regs[reg] += trace_unzigzag(delta);
+			if (verbose) {
+				OUT_LEN += sprintf(OUT + OUT_LEN, "\t%s=0x%08x", reg_name(reg, name), regs[reg]);
+			}
+		}
+		if (verbose) {
+			OUT[OUT_LEN++] = '\n';
+		}
+		pc += 4;
+		records++;
+	}
+	out_flush();
+	fclose(fp);
+
+	if (verbose) {
+		printf("%llu instructions\n", (unsigned long long)records);
+	}
+	return 0;
+}
@@ -3,9 +3,36 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <getopt.h>
 
 #include "mu-mips.h"
 
+/***************************************************************/
+/* Command lines, interactive or from a -b script                      */
+/***************************************************************/
+#define COMMAND_LINE_MAX	1024	/* including the newline and NUL */
+#define COMMAND_ARGS_MAX	8
+#define COMMAND_TOKEN_MAX	255	/* a file name, say */
+
+#define COMMAND_OK		0
+#define COMMAND_ERROR		1
+#define COMMAND_QUIT		2
+#define COMMAND_EOF		(-1)	/* read_command() only */
+#define COMMAND_BAD_LINE	(-2)
+
+/* -b exit status */
+#define BATCH_HALTED		0
+#define BATCH_FAILED		1
+#define BATCH_RUNNING		2
+#define BATCH_BUFFER_SIZE	(1 << 16)
+
+/* the core rdump, input, high and low work on (core <n>) */
+static uint32_t SELECTED_CORE;
+
 /***************************************************************/
 /* Print out a list of commands available                                                                  */
 /***************************************************************/
@@ -21,98 +48,130 @@ void help() {
 	printf("high <val>\t-- set the HI register to <val>\n");
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
+	printf("save <file>\t-- write registers and memory to a checkpoint file\n");
+	printf("load <file>\t-- continue from a checkpoint file; reset then returns to it\n");
+	printf("break <addr>\t-- stop runs before the instruction at <addr>\n");
+	printf("watch <addr> [r|w|rw]\t-- stop runs after an instruction reads or writes the word at <addr>\n");
+	printf("delete <addr|all>\t-- remove the breakpoint and watchpoint at <addr>, or all of them\n");
+	printf("continue\t-- resume a run stopped at a breakpoint or watchpoint\n");
+	printf("core [<n>]\t-- make core <n> the one rdump, input, high and low work on; list the cores without <n>\n");
+	printf("trace <off|summary|inst|bin>\t-- set how much a run prints (bin: to the -T file)\n");
+	printf("profile <n|off>\t-- profile runs, sampling PCs every <n> instructions (1: exact)\n");
+	printf("pipeline <off|fwd|nofwd> <id|ex|mem>\t-- time runs on a 5-stage pipeline, with or without forwarding, branches resolved in the given stage\n");
+	printf("cache <on|off|level=spec,...>\t-- model L1I/L1D/L2 caches; spec is size:ways:line:lru|plru|random:wb|wt[:latency] for l1i, l1d, l2, or mem=<latency>\n");
+	printf("branch <off|static|bimodal|gshare|tournament>[:bits[:penalty]]\t-- model branch prediction with 2^bits-entry tables\n");
+	printf("sample <interval>[:clusters[:samples[:warmup]]] [max] [prefix]\t-- estimate the pipeline CPI from representative intervals run in detail, writing their checkpoints to <prefix>.<interval>.ckpt\n");
+	printf("stats\t-- show the profile, pipeline timing, cache and branch statistics\n");
+	printf("folded <file>\t-- write the profile's call stacks for flamegraph.pl\n");
+	printf("(addresses are hex, or labels of a .asm program)\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Seconds on a monotonic clock, for the speed report                        */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
-{
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
-		}
-	}
-	return 0;
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
 /***************************************************************/
-/* Write a 32-bit word to memory                                                                                */
+/* Parse a -f program format name, -1 if unknown                                 */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
-{
+static int parse_image_format(const char *name) {
+	static const char *names[] = { "auto", "hex", "bin", "binle", "elf", "asm" };
+	static const int formats[] = { MIPS_IMAGE_AUTO, MIPS_IMAGE_HEX, MIPS_IMAGE_BIN_BE, MIPS_IMAGE_BIN_LE, MIPS_IMAGE_ELF,
+		MIPS_IMAGE_ASM };
 	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
-
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+
+	for (i = 0; i < 6; i++) {
+		if (strcmp(name, names[i]) == 0) {
+			return formats[i];
 		}
 	}
+	return -1;
 }
 
-/***************************************************************/
-/* Execute one cycle                                                                                                              */
-/***************************************************************/
-void cycle() {                                                
-	handle_instruction();
-	CURRENT_STATE = NEXT_STATE;
-	INSTRUCTION_COUNT++;
+static const char *ENGINE_NAMES[] = { "interp", "threaded", "jit" };
+
+static void print_speed(mips_sim_t *sim, uint64_t executed, double seconds) {
+	int engine = (sim->TRACE_LEVEL >= TRACE_INSTRUCTION || SIM_OBSERVED(sim)) ? ENGINE_INTERP : sim->ENGINE;
+
+	if (sim->TRACE_LEVEL == TRACE_OFF) {
+		return;
+	}
+	printf("%llu instructions in %.3f s (%.2f MIPS, %s engine", (unsigned long long)executed, seconds,
+		seconds > 0 ? executed / seconds / 1e6 : 0.0, ENGINE_NAMES[engine]);
+	if (sim->NUM_CORES > 1) {
+		printf(", %u cores", sim->NUM_CORES);
+	}
+	printf(")\n");
+	if (engine == ENGINE_JIT) {
+		printf("JIT: %u blocks compiled, %llu instructions run natively%s\n", sim->JIT_BLOCKS_COMPILED,
+			(unsigned long long)sim->JIT_NATIVE_INSTRUCTIONS, sim->JIT_VERIFY ? " (verified)" : "");
+	}
 }
 
 /***************************************************************/
 /* Simulate MIPS for n cycles                                                                                       */
 /***************************************************************/
-void run(int num_cycles) {                                      
+void run(mips_sim_t *sim, int num_cycles) {                                      
+	uint32_t executed;
+	double start;
 	
-	if (RUN_FLAG == FALSE) {
+	debug_resume(sim);
+	if (!mips_sim_running(sim)) {
 		printf("Simulation Stopped\n\n");
 		return;
 	}
 
 	printf("Running simulator for %d cycles...\n\n", num_cycles);
-	int i;
-	for (i = 0; i < num_cycles; i++) {
-		if (RUN_FLAG == FALSE) {
-			printf("Simulation Stopped.\n\n");
-			break;
-		}
-		cycle();
+	if (num_cycles <= 0) {
+		return;
+	}
+	start = now_seconds();
+	executed = engine_run(sim, num_cycles);
+	if (sim->STOP_REASON != STOP_NONE) {
+		debug_report(sim);
+	} else if (executed < (uint32_t)num_cycles) {
+		printf("Simulation Stopped.\n\n");
 	}
+	print_speed(sim, executed, now_seconds() - start);
 }
 
 /***************************************************************/
 /* simulate to completion                                                                                               */
 /***************************************************************/
-void runAll() {                                                     
-	if (RUN_FLAG == FALSE) {
+void runAll(mips_sim_t *sim) {                                                     
+	uint64_t executed = 0;
+	double start;
+
+	debug_resume(sim);
+	if (!mips_sim_running(sim)) {
 		printf("Simulation Stopped.\n\n");
 		return;
 	}
 
 	printf("Simulation Started...\n\n");
-	while (RUN_FLAG){
-		cycle();
+	start = now_seconds();
+	while (mips_sim_running(sim)){
+		executed += engine_run(sim, UINT32_MAX);
 	}
-	printf("Simulation Finished.\n\n");
+	if (sim->STOP_REASON != STOP_NONE) {
+		debug_report(sim);
+	} else {
+		printf("Simulation Finished.\n\n");
+	}
+	print_speed(sim, executed, now_seconds() - start);
 }
 
 /***************************************************************/ 
 /* Dump a word-aligned region of memory to the terminal                              */
 /***************************************************************/
-void mdump(uint32_t start, uint32_t stop) {          
+void mdump(mips_sim_t *sim, uint32_t start, uint32_t stop) {          
 	uint32_t address;
 
 	printf("-------------------------------------------------------------\n");
@@ -120,7 +179,7 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("-------------------------------------------------------------\n");
 	printf("\t[Address in Hex (Dec) ]\t[Value]\n");
 	for (address = start; address <= stop; address += 4){
-		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(address));
+		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(sim, address));
 	}
 	printf("\n");
 }
@@ -128,810 +187,706 @@ void mdump(uint32_t start, uint32_t stop) {
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */   
 /***************************************************************/
-void rdump() {                               
+void rdump(mips_sim_t *sim) {                               
 	int i; 
 	printf("-------------------------------------\n");
 	printf("Dumping Register Content\n");
 	printf("-------------------------------------\n");
-	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
-	printf("PC\t: 0x%08x\n", CURRENT_STATE.PC);
+	if (sim->MEM_OWNER->NUM_CORES > 1) {
+		printf("Core\t: %u of %u\n", sim->CORE_ID, sim->MEM_OWNER->NUM_CORES);
+	}
+	printf("# Instructions Executed\t: %llu\n", (unsigned long long)sim->INSTRUCTION_COUNT);
+	printf("PC\t: 0x%08x\n", sim->CURRENT_STATE.PC);
 	printf("-------------------------------------\n");
 	printf("[Register]\t[Value]\n");
 	printf("-------------------------------------\n");
 	for (i = 0; i < MIPS_REGS; i++){
-		printf("[R%d]\t: 0x%08x\n", i, CURRENT_STATE.REGS[i]);
+		printf("[R%d]\t: 0x%08x\n", i, sim->CURRENT_STATE.REGS[i]);
 	}
 	printf("-------------------------------------\n");
-	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
-	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
+	printf("[HI]\t: 0x%08x\n", sim->CURRENT_STATE.HI);
+	printf("[LO]\t: 0x%08x\n", sim->CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
 }
 
 /***************************************************************/
-/* Read a command from standard input.                                                               */  
+/* Report of every model that is switched on                                                 */
 /***************************************************************/
-void handle_command() {                         
-	char buffer[20];
-	uint32_t start, stop, cycles;
-	uint32_t register_no;
-	int register_value;
-	int hi_reg_value, lo_reg_value;
+static void stats(mips_sim_t *sim) {
+	if (!SIM_OBSERVED(sim)) {
+		printf("Nothing to report: profile, pipeline, caches and branch predictor are off\n\n");
+		return;
+	}
+	if (sim->PROFILE != NULL) {
+		profile_print(sim);
+	}
+	if (sim->PIPELINE != NULL) {
+		pipeline_print(sim);
+	}
+	if (sim->CACHE != NULL) {
+		cache_print(sim);
+	}
+	if (sim->BRANCH != NULL) {
+		branch_print(sim);
+	}
+}
 
-	printf("MU-MIPS SIM:> ");
+/***************************************************************/
+/* Configure the pipeline model: off, or forwarding and branch stage        */
+/***************************************************************/
+static int pipeline_command(mips_sim_t *sim, const char *forwarding, const char *stage) {
+	int branch_stage = stage ? pipeline_parse_stage(stage) : -1;
 
-	if (scanf("%s", buffer) == EOF){
-		exit(0);
+	if (strcmp(forwarding, "off") == 0) {
+		pipeline_stop(sim);
+		return TRUE;
+	}
+	if ((strcmp(forwarding, "fwd") != 0 && strcmp(forwarding, "nofwd") != 0) || branch_stage < 0) {
+		printf("Error: pipeline <off|fwd|nofwd> <id|ex|mem>\n\n");
+		return FALSE;
+	}
+	pipeline_start(sim, strcmp(forwarding, "fwd") == 0, branch_stage);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Configure the cache model: off, on with the defaults, or level specs  */
+/***************************************************************/
+static int cache_command(mips_sim_t *sim, const char *specs) {
+	if (strcmp(specs, "off") == 0) {
+		cache_stop(sim);
+		return TRUE;
+	}
+	if (!cache_start(sim, strcmp(specs, "on") == 0 ? "" : specs)) {
+		printf("Error: cache <on|off|l1i=size:ways:line:lru|plru|random:wb|wt[:latency],l1d=...,l2=...,mem=latency>\n\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Configure the branch predictor: off or kind[:bits[:penalty]]          */
+/***************************************************************/
+static int branch_command(mips_sim_t *sim, const char *spec) {
+	if (strcmp(spec, "off") == 0) {
+		branch_stop(sim);
+		return TRUE;
+	}
+	if (!branch_start(sim, spec)) {
+		printf("Error: branch <off|static|bimodal|gshare|tournament>[:bits[:penalty]]\n\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Parse a whole token as a 32-bit number in base (0: C syntax, so     */
+/* 0x.. is hex); a leading minus wraps, as scanf's %i did              */
+/***************************************************************/
+static int parse_number(const char *token, int base, uint32_t *value) {
+	const char *digits = (token[0] == '-') ? token + 1 : token;
+	unsigned long long v;
+	char *end;
+
+	if (!isxdigit((unsigned char)digits[0])) {
+		return FALSE;
+	}
+	errno = 0;
+	v = strtoull(digits, &end, base);
+	if (*end != '\0' || errno != 0 || v > UINT32_MAX) {
+		return FALSE;
+	}
+	*value = (token[0] == '-') ? -(uint32_t)v : (uint32_t)v;
+	return TRUE;
+}
+
+/***************************************************************/
+/* An address: a label of the loaded program, or hex                   */
+/***************************************************************/
+static int parse_address(mips_sim_t *sim, const char *token, uint32_t *address) {
+	if (sim->IMAGE != NULL && mips_image_symbol(sim->IMAGE, token, address)) {
+		return TRUE;
 	}
+	return parse_number(token, 16, address);
+}
 
-	switch(buffer[0]) {
-		case 'S':
+static int usage(const char *synopsis) {
+	printf("Usage: %s\n\n", synopsis);
+	return COMMAND_ERROR;
+}
+
+/***************************************************************/
+/* sample <interval>[:clusters[:samples[:warmup]]] [max] [prefix]      */
+/***************************************************************/
+static int sample_command(mips_sim_t *sim, int argc, char **argv) {
+	uint64_t max = UINT64_MAX;
+	char *end;
+
+	if (argc < 2 || argc > 4) {
+		return usage("sample <interval>[:clusters[:samples[:warmup]]] [max instructions] [checkpoint prefix]");
+	}
+	if (argc > 2) {
+		max = strtoull(argv[2], &end, 0);
+		if (*end != '\0' || max == 0) {
+			return usage("sample <interval>[:clusters[:samples[:warmup]]] [max instructions] [checkpoint prefix]");
+		}
+	}
+	return sample_run(sim, argv[1], max, argc > 3 ? argv[3] : NULL) ? COMMAND_OK : COMMAND_ERROR;
+}
+
+/***************************************************************/
+/* core [<n>]                                                          */
+/***************************************************************/
+static int core_command(mips_sim_t *sim, int argc, char **argv) {
+	mips_sim_t *core;
+	uint32_t i;
+
+	if (argc == 1) {
+		for (i = 0; (core = mips_sim_core(sim, i)) != NULL; i++) {
+			printf("%c core %u\tPC 0x%08x\t%llu instructions\t%s\n", i == SELECTED_CORE ? '*' : ' ', i,
+				core->CURRENT_STATE.PC, (unsigned long long)core->INSTRUCTION_COUNT,
+				core->STOP_REASON != STOP_NONE ? "stopped" : core->RUN_FLAG ? "running" : "exited");
+		}
+		printf("\n");
+		return COMMAND_OK;
+	}
+	if (argc != 2 || !parse_number(argv[1], 0, &i) || mips_sim_core(sim, i) == NULL) {
+		printf("Usage: core [0-%u]\n\n", sim->NUM_CORES - 1);
+		return COMMAND_ERROR;
+	}
+	SELECTED_CORE = i;
+	return COMMAND_OK;
+}
+
+/***************************************************************/
+/* watch <addr> [r|w|rw]                                               */
+/***************************************************************/
+static int watch_command(mips_sim_t *sim, int argc, char **argv) {
+	uint32_t address;
+	int access = WATCH_READ | WATCH_WRITE;
+
+	if (argc < 2 || argc > 3 || !parse_address(sim, argv[1], &address)) {
+		return usage("watch <address> [r|w|rw]");
+	}
+	if (argc == 3) {
+		if (strcmp(argv[2], "r") == 0) {
+			access = WATCH_READ;
+		} else if (strcmp(argv[2], "w") == 0) {
+			access = WATCH_WRITE;
+		} else if (strcmp(argv[2], "rw") != 0) {
+			return usage("watch <address> [r|w|rw]");
+		}
+	}
+	if (!debug_watch(sim, address, access)) {
+		printf("Error: at most %d watchpoints\n\n", DEBUG_MAX_WATCHES);
+		return COMMAND_ERROR;
+	}
+	debug_list(sim);
+	return COMMAND_OK;
+}
+
+/***************************************************************/
+/* Write the profile's folded stacks to path                                                  */
+/***************************************************************/
+static int folded(mips_sim_t *sim, const char *path) {
+	FILE *out;
+
+	if (sim->PROFILE == NULL) {
+		printf("Profiling is off (profile <period>)\n\n");
+		return COMMAND_ERROR;
+	}
+	out = fopen(path, "w");
+	if (out == NULL) {
+		printf("Error: Can't create %s\n\n", path);
+		return COMMAND_ERROR;
+	}
+	profile_write_folded(sim, out);
+	fclose(out);
+	printf("Folded stacks written to %s\n\n", path);
+	return COMMAND_OK;
+}
+
+/***************************************************************/
+/* Read one command line from in and split it into argv. Returns the   */
+/* number of words (0 for a blank line or a # comment), COMMAND_EOF at */
+/* the end of the input, or COMMAND_BAD_LINE when the line, one of its */
+/* words or their number is over the limits.                           */
+/***************************************************************/
+static int read_command(FILE *in, char *line, char **argv) {
+	char *token;
+	size_t len;
+	int argc = 0, c;
+
+	if (fgets(line, COMMAND_LINE_MAX, in) == NULL) {
+		return COMMAND_EOF;
+	}
+	len = strlen(line);
+	if (len == COMMAND_LINE_MAX - 1 && line[len - 1] != '\n') {
+		while ((c = getc(in)) != EOF && c != '\n');
+		printf("Error: command longer than %d characters\n\n", COMMAND_LINE_MAX - 2);
+		return COMMAND_BAD_LINE;
+	}
+	for (token = strtok(line, " \t\r\n"); token != NULL && token[0] != '#'; token = strtok(NULL, " \t\r\n")) {
+		if (argc == COMMAND_ARGS_MAX) {
+			printf("Error: more than %d words in a command\n\n", COMMAND_ARGS_MAX);
+			return COMMAND_BAD_LINE;
+		}
+		if (strlen(token) > COMMAND_TOKEN_MAX) {
+			printf("Error: word longer than %d characters\n\n", COMMAND_TOKEN_MAX);
+			return COMMAND_BAD_LINE;
+		}
+		argv[argc++] = token;
+	}
+	return argc;
+}
+
+/***************************************************************/
+/* Execute one tokenized command. Returns COMMAND_OK, COMMAND_ERROR    */
+/* (after printing why) or COMMAND_QUIT.                               */
+/***************************************************************/
+static int execute_command(mips_sim_t *sim, int argc, char **argv) {
+	size_t len = strlen(argv[0]);
+	char c1 = (len > 1) ? tolower((unsigned char)argv[0][1]) : '\0';
+	char c2 = (len > 2) ? tolower((unsigned char)argv[0][2]) : '\0';
+	mips_sim_t *core = mips_sim_core(sim, SELECTED_CORE);
+	uint32_t start, stop, value;
+	int level;
+
+	switch (tolower((unsigned char)argv[0][0])) {
 		case 's':
-			runAll(); 
-			break;
-		case 'M':
+			if (c1 == 't') {
+				stats(sim);
+			} else if (c1 == 'a' && c2 == 'm') {
+				return sample_command(sim, argc, argv);
+			} else if (c1 == 'a') {
+				if (argc != 2) {
+					return usage("save <file>");
+				}
+				if (!mips_sim_save(sim, argv[1])) {
+					printf("Error: Can't write checkpoint %s: %s\n\n", argv[1], strerror(errno));
+					return COMMAND_ERROR;
+				}
+				printf("Checkpoint written to %s\n\n", argv[1]);
+			} else {
+				runAll(sim);
+			}
+			return COMMAND_OK;
+		case 'b':
+			if (c2 == 'e') {
+				if (argc != 2 || !parse_address(sim, argv[1], &start)) {
+					return usage("break <address>");
+				}
+				if (!debug_break(sim, start)) {
+					printf("Error: at most %d breakpoints\n\n", DEBUG_MAX_BREAKPOINTS);
+					return COMMAND_ERROR;
+				}
+				debug_list(sim);
+				return COMMAND_OK;
+			}
+			if (argc != 2) {
+				return usage("branch <off|static|bimodal|gshare|tournament>[:bits[:penalty]]");
+			}
+			return branch_command(sim, argv[1]) ? COMMAND_OK : COMMAND_ERROR;
+		case 'c':
+			if (c1 == 'o' && c2 == 'r') {
+				return core_command(sim, argc, argv);
+			}
+			if (c1 == 'o') {
+				if (sim->STOP_REASON == STOP_NONE) {
+					printf("Not stopped at a breakpoint or watchpoint\n\n");
+					return COMMAND_ERROR;
+				}
+				runAll(sim);
+				return COMMAND_OK;
+			}
+			if (argc != 2) {
+				return usage("cache <on|off|specs>");
+			}
+			return cache_command(sim, argv[1]) ? COMMAND_OK : COMMAND_ERROR;
+		case 'w':
+			return watch_command(sim, argc, argv);
+		case 'd':
+			if (argc != 2) {
+				return usage("delete <address|all>");
+			}
+			if (strcmp(argv[1], "all") == 0) {
+				debug_delete_all(sim);
+			} else if (!parse_address(sim, argv[1], &start) || debug_delete(sim, start) == 0) {
+				printf("No breakpoint or watchpoint at %s\n\n", argv[1]);
+				return COMMAND_ERROR;
+			}
+			debug_list(sim);
+			return COMMAND_OK;
+		case 'f':
+			if (argc != 2) {
+				return usage("folded <file>");
+			}
+			return folded(sim, argv[1]);
 		case 'm':
-			if (scanf("%x %x", &start, &stop) != 2){
-				break;
+			if (argc != 3 || !parse_address(sim, argv[1], &start) || !parse_address(sim, argv[2], &stop)) {
+				return usage("mdump <start> <stop>");
 			}
-			mdump(start, stop);
-			break;
+			mdump(sim, start, stop);
+			return COMMAND_OK;
 		case '?':
 			help();
-			break;
-		case 'Q':
+			return COMMAND_OK;
 		case 'q':
-			printf("**************************\n");
-			printf("Exiting MU-MIPS! Good Bye...\n");
-			printf("**************************\n");
-			exit(0);
-		case 'R':
+			return COMMAND_QUIT;
 		case 'r':
-			if (buffer[1] == 'd' || buffer[1] == 'D'){
-				rdump();
-			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
-				reset();
-			}
-			else {
-				if (scanf("%d", &cycles) != 1) {
-					break;
+			if (c1 == 'd') {
+				rdump(core);
+			} else if (c1 == 'e') {
+				reset(sim);
+			} else {
+				if (argc != 2 || !parse_number(argv[1], 0, &value) || value > INT32_MAX) {
+					return usage("run <n>");
 				}
-				run(cycles);
+				run(sim, value);
 			}
-			break;
-		case 'I':
+			return COMMAND_OK;
 		case 'i':
-			if (scanf("%u %i", &register_no, &register_value) != 2){
-				break;
+			if (argc != 3 || !parse_number(argv[1], 0, &start) || start >= MIPS_REGS
+				|| !parse_number(argv[2], 0, &value)) {
+				return usage("input <reg 0-31> <value>");
 			}
-			CURRENT_STATE.REGS[register_no] = register_value;
-			NEXT_STATE.REGS[register_no] = register_value;
-			break;
-		case 'H':
+			core->CURRENT_STATE.REGS[start] = value;
+			core->NEXT_STATE.REGS[start] = value;
+			return COMMAND_OK;
 		case 'h':
-			if (scanf("%i", &hi_reg_value) != 1){
-				break;
+			if (argc != 2 || !parse_number(argv[1], 0, &value)) {
+				return usage("high <value>");
 			}
-			CURRENT_STATE.HI = hi_reg_value; 
-			NEXT_STATE.HI = hi_reg_value; 
-			break;
-		case 'L':
+			core->CURRENT_STATE.HI = value;
+			core->NEXT_STATE.HI = value;
+			return COMMAND_OK;
 		case 'l':
-			if (scanf("%i", &lo_reg_value) != 1){
-				break;
+			if (c2 == 'a') {
+				if (argc != 2) {
+					return usage("load <file>");
+				}
+				if (mips_sim_restore(sim, argv[1])) {
+					printf("Checkpoint %s loaded (%llu instructions executed)\n\n", argv[1],
+						(unsigned long long)sim->INSTRUCTION_COUNT);
+					return COMMAND_OK;
+				}
+				if (errno == EINVAL) {
+					printf("Error: %s is not a checkpoint\n\n", argv[1]);
+				} else {
+					printf("Error: Can't open checkpoint %s: %s\n\n", argv[1], strerror(errno));
+				}
+				return COMMAND_ERROR;
+			}
+			if (argc != 2 || !parse_number(argv[1], 0, &value)) {
+				return usage("low <value>");
 			}
-			CURRENT_STATE.LO = lo_reg_value;
-			NEXT_STATE.LO = lo_reg_value;
-			break;
-		case 'P':
+			core->CURRENT_STATE.LO = value;
+			core->NEXT_STATE.LO = value;
+			return COMMAND_OK;
 		case 'p':
-			print_program(); 
-			break;
+			if (c1 == 'i') {
+				if (argc == 2 && strcmp(argv[1], "off") == 0) {
+					return pipeline_command(sim, argv[1], NULL) ? COMMAND_OK : COMMAND_ERROR;
+				}
+				if (argc != 3) {
+					return usage("pipeline <off|fwd|nofwd> <id|ex|mem>");
+				}
+				return pipeline_command(sim, argv[1], argv[2]) ? COMMAND_OK : COMMAND_ERROR;
+			}
+			if (c1 == 'r' && c2 == 'o') {
+				if (argc != 2) {
+					return usage("profile <n|off>");
+				}
+				if (strcmp(argv[1], "off") == 0) {
+					profile_stop(sim);
+				} else if (parse_number(argv[1], 0, &value)) {
+					profile_start(sim, value);
+				} else {
+					return usage("profile <n|off>");
+				}
+				return COMMAND_OK;
+			}
+			print_program(sim);
+			return COMMAND_OK;
+		case 't':
+			if (argc != 2) {
+				return usage("trace <off|summary|inst|bin>");
+			}
+			level = parse_trace_level(argv[1]);
+			if (level < 0) {
+				printf("Invalid trace level %s (off, summary, inst, bin).\n", argv[1]);
+				return COMMAND_ERROR;
+			}
+			if (level == TRACE_BINARY && !trace_binary_is_open(sim)) {
+				printf("No binary trace file, start the simulator with -T <file>.\n");
+				return COMMAND_ERROR;
+			}
+			sim->TRACE_LEVEL = level;
+			return COMMAND_OK;
 		default:
 			printf("Invalid Command.\n");
-			break;
+			return COMMAND_ERROR;
 	}
 }
 
 /***************************************************************/
-/* reset registers/memory and reload program                                                    */
+/* Read a command from standard input.                                                               */  
 /***************************************************************/
-void reset() {   
-	int i;
-	/*reset registers*/
-	for (i = 0; i < MIPS_REGS; i++){
-		CURRENT_STATE.REGS[i] = 0;
+void handle_command(mips_sim_t *sim) {                         
+	char line[COMMAND_LINE_MAX], *argv[COMMAND_ARGS_MAX];
+	int argc;
+
+	printf("MU-MIPS SIM:> ");
+
+	argc = read_command(stdin, line, argv);
+	if (argc == COMMAND_EOF) {
+		exit(0);
 	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
-	
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+	if (argc > 0 && execute_command(sim, argc, argv) == COMMAND_QUIT) {
+		printf("**************************\n");
+		printf("Exiting MU-MIPS! Good Bye...\n");
+		printf("**************************\n");
+		exit(0);
 	}
-	
-	/*load program*/
-	load_program();
-	
-	/*reset PC*/
-	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Batch mode (-b/--batch): run every command of a script, or of      */
+/* standard input for -, without prompts. Stops at the first failing   */
+/* command. Returns the exit status: BATCH_HALTED when the program     */
+/* exited, BATCH_RUNNING when it can still run (or stopped at a        */
+/* breakpoint or watchpoint), BATCH_FAILED after a bad command.        */
 /***************************************************************/
-void init_memory() {                                           
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+static int run_batch(mips_sim_t *sim, const char *script) {
+	static char in_buffer[BATCH_BUFFER_SIZE];
+	char line[COMMAND_LINE_MAX], *argv[COMMAND_ARGS_MAX];
+	FILE *in = stdin;
+	int argc, line_no = 0, result = COMMAND_OK;
+
+	if (strcmp(script, "-") != 0) {
+		in = fopen(script, "r");
+		if (in == NULL) {
+			printf("Error: Can't open script %s: %s\n", script, strerror(errno));
+			return BATCH_FAILED;
+		}
+	}
+	/* commands are read in large blocks; main() did the same for stdout */
+	setvbuf(in, in_buffer, _IOFBF, sizeof(in_buffer));
+
+	while (result == COMMAND_OK && (argc = read_command(in, line, argv)) != COMMAND_EOF) {
+		line_no++;
+		if (argc == COMMAND_BAD_LINE) {
+			result = COMMAND_ERROR;
+		} else if (argc > 0) {
+			result = execute_command(sim, argc, argv);
+		}
+	}
+	if (in != stdin) {
+		fclose(in);
 	}
+	if (result == COMMAND_ERROR) {
+		printf("Error: %s line %d failed\n", strcmp(script, "-") == 0 ? "standard input" : script, line_no);
+		return BATCH_FAILED;
+	}
+	return (mips_sim_running(sim) || sim->STOP_REASON != STOP_NONE) ? BATCH_RUNNING : BATCH_HALTED;
+}
+
+/***************************************************************/
+/* reset registers/memory and reload program                                                    */
+/***************************************************************/
+void reset(mips_sim_t *sim) {   
+	if (sim->SNAPSHOT_VALID) {
+		/*only the pages written since the program or checkpoint was loaded need restoring*/
+		printf("Restoring the state loaded at instruction %llu (%u pages written since)\n\n",
+			(unsigned long long)sim->SNAPSHOT_INSTRUCTION_COUNT, sim->NUM_DIRTY_PAGES);
+		snapshot_restore(sim);
+		return;
+	}
+
+	/*clear registers and memory, then load the program again*/
+	load_program(sim, sim->IMAGE);
 }
 
 /**************************************************************/
 /* load program into memory                                                                                      */
 /**************************************************************/
-void load_program() {                   
-	FILE * fp;
-	int i, word;
-	uint32_t address;
+void load_program(mips_sim_t *sim, mips_image_t *image) {
+	uint32_t i, words = image->size;
 
-	/* Open program file. */
-	fp = fopen(prog_file, "r");
-	if (fp == NULL) {
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+	for (i = 0; i < image->num_data; i++) {
+		words += image->data[i].size;
 	}
+	mips_sim_load(sim, image);
+	printf("Program loaded into memory.\n%d words written into memory.\n\n", words);
+}
 
-	/* Read in the program. */
-
-	i = 0;
-	while( fscanf(fp, "%x\n", &word) != EOF ) {
-		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
-		i += 4;
+/************************************************************/
+/* Print the program loaded into memory (in MIPS assembly format)    */ 
+/************************************************************/
+void print_program(mips_sim_t *sim){
+	uint32_t i, addr;
+	
+	for(i=0; i<sim->IMAGE->size; i++){
+		addr = sim->IMAGE->base + (i*4);
+		printf("[0x%x]\t", addr);
+		print_instruction(sim, addr);
 	}
-	PROGRAM_SIZE = i/4;
-	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
-	fclose(fp);
 }
 
 /************************************************************/
-/* decode and execute instruction                                                                     */ 
+/* Print the instruction at given memory address (in MIPS assembly format)    */
 /************************************************************/
-void handle_instruction()
-{
-	/*IMPLEMENT THIS*/
-	/* execute one instruction at a time. Use/update CURRENT_STATE and and NEXT_STATE, as necessary.*/
-	uint32_t instruction, opcode, rs, rt, rd, sa, immediate, function, target, offset;
-	uint64_t product;
-	instruction = mem_read_32(CURRENT_STATE.PC);
-
-	NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-	opcode = (instruction & 0xFC000000) >> 26;
-	rs = (instruction & 0x3E00000) >> 21;
-	rt = (instruction & 0x1F0000) >> 16;
-	rd = (instruction & 0xF800) >> 11;
-	sa = (instruction & 0x7C0) >> 6;
-	immediate = (instruction & 0xFFFF);
-	function = (instruction & 0x3F);
-	offset = (instruction & 0x3FFFFFF);
-	
-	if(opcode == 0x00){
+void print_instruction(mips_sim_t *sim, uint32_t addr){
+	char text[TRACE_LINE_MAX];
+
+	format_instruction(mem_read_32(sim, addr), text, sizeof(text));
+	fputs(text, stdout);
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[]) {                              
+	mips_sim_t *sim;
+	mips_image_t *image;
+	int opt, format = MIPS_IMAGE_AUTO;
+	uint32_t profile_period = 0, value;
+	char *pipeline_stage;
+	const char *script = NULL;
+	static char out_buffer[BATCH_BUFFER_SIZE];
+	static const struct option long_options[] = {
+		{ "batch", required_argument, NULL, 'b' },
+		{ "cores", required_argument, NULL, 'n' },
+		{ "quantum", required_argument, NULL, 'q' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	sim = mips_sim_create();
+	if (sim == NULL) {
+		printf("Error: out of memory\n");
+		exit(-1);
+	}
+	sim->TRACE_LEVEL = TRACE_INSTRUCTION;
+	mips_sim_set_console(sim, stdin, stdout);
 	
-		switch(function){
-			
-			case 0x0C:
-				//syscall
-				RUN_FLAG = FALSE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20:
-				//add
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] + CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21:
-				//addu
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] + CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x22:
-				//sub
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] - CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23:
-				//subu
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] - CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x18:
-				//mult
-				product = CURRENT_STATE.REGS[rs] * CURRENT_STATE.REGS[rt];
-				NEXT_STATE.HI = product >> 32;
-				NEXT_STATE.LO = product & 0xFFFFFFFF;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x19:
-				//multu 
-				product = CURRENT_STATE.REGS[rs] * CURRENT_STATE.REGS[rt];
-				NEXT_STATE.HI = product >> 32;
-				NEXT_STATE.LO = product & 0xFFFFFFFF;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1A:
-				//div
-				NEXT_STATE.LO = CURRENT_STATE.REGS[rs] / CURRENT_STATE.REGS[rt];
-				NEXT_STATE.HI = CURRENT_STATE.REGS[rs] % CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1B:
-				//divu
-				NEXT_STATE.LO = CURRENT_STATE.REGS[rs] / CURRENT_STATE.REGS[rt];
-				NEXT_STATE.HI = CURRENT_STATE.REGS[rs] % CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x24:
-				//and
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] & CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x25:
-				//or
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] | CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x26:
-				//xor
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] ^ CURRENT_STATE.REGS[rt];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x27:
-				//nor
-				NEXT_STATE.REGS[rd] = ~(CURRENT_STATE.REGS[rs] | CURRENT_STATE.REGS[rt]);
-				print_instruction(CURRENT_STATE.PC);
+	while ((opt = getopt_long(argc, argv, "b:B:C:e:f:n:p:P:q:t:T:V", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'b':
+				/* - reads standard input */
+				script = optarg;
+				break;
+			case 't':
+				sim->TRACE_LEVEL = parse_trace_level(optarg);
+				if (sim->TRACE_LEVEL < 0 || sim->TRACE_LEVEL == TRACE_BINARY) {
+					printf("Error: unknown trace level %s (off, summary, inst; use -T for bin)\n\n", optarg);
+					exit(1);
+				}
 				break;
-			case 0x2A:
-				//slt
-				if(CURRENT_STATE.REGS[rs] < CURRENT_STATE.REGS[rt]){
-					NEXT_STATE.REGS[rd] = 0x00000001;
+			case 'T':
+				if (!trace_binary_open(sim, optarg)) {
+					printf("Error: Can't create trace file %s\n\n", optarg);
+					exit(1);
 				}
-				else{
-					NEXT_STATE.REGS[rd] = 0x00000000;
+				sim->TRACE_LEVEL = TRACE_BINARY;
+				break;
+			case 'e':
+				if (strcmp(optarg, "interp") == 0) {
+					sim->ENGINE = ENGINE_INTERP;
+				} else if (strcmp(optarg, "threaded") == 0) {
+					sim->ENGINE = ENGINE_THREADED;
+				} else if (strcmp(optarg, "jit") == 0) {
+					sim->ENGINE = ENGINE_JIT;
+				} else {
+					printf("Error: unknown engine %s (interp, threaded, jit)\n\n", optarg);
+					exit(1);
 				}
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x00:
-				//sll
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] << sa;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x02:
-				//srl
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] >> sa;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x03:
-				//sra
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] >> sa;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x08:
-				//jr
-				NEXT_STATE.PC = CURRENT_STATE.REGS[rs];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x09:
-				//jalr
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.PC + 4;
-				NEXT_STATE.PC = CURRENT_STATE.REGS[rs];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x10:
-				//mfhi
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.HI;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x11:
-				//mthi
-				NEXT_STATE.HI = CURRENT_STATE.REGS[rs];
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x12:
-				//mflo
-				NEXT_STATE.REGS[rd] = CURRENT_STATE.LO;
-				print_instruction(CURRENT_STATE.PC);
 				break;
-			case 0x13:
-				//mtlo
-				NEXT_STATE.LO = CURRENT_STATE.REGS[rs];
-				print_instruction(CURRENT_STATE.PC);
+			case 'f':
+				format = parse_image_format(optarg);
+				if (format < 0) {
+					printf("Error: unknown program format %s (auto, hex, bin, binle, elf, asm)\n\n", optarg);
+					exit(1);
+				}
 				break;
-
-		}
-	
-	}
-	else{
-		switch(opcode){
-			case 0x01:
-							//confused
-				print_instruction(CURRENT_STATE.PC);
+			case 'n':
+				if (!parse_number(optarg, 0, &value) || value > INT32_MAX || !mips_sim_set_cores(sim, value)) {
+					printf("Error: bad number of cores %s (1-64)\n\n", optarg);
+					exit(1);
+				}
 				break;
-			case 0x02:
-				//j
-				target = offset << 2;
-				NEXT_STATE.PC = ((CURRENT_STATE.PC >> 28) << 28) + target;
-				print_instruction(CURRENT_STATE.PC);
+			case 'q':
+				/* lockstep turns of this many instructions; without -q, a thread per core */
+				if (optarg[0] == '-' || !parse_number(optarg, 0, &value) || value == 0) {
+					printf("Error: bad quantum %s (1 or more instructions per turn)\n\n", optarg);
+					exit(1);
+				}
+				mips_sim_set_quantum(sim, value);
 				break;
-			case 0x03:
-				//jal
-				target = offset << 2;
-				NEXT_STATE.PC = ((CURRENT_STATE.PC >> 28) << 28) + target;
-				NEXT_STATE.REGS[31] = CURRENT_STATE.PC + 4;
-				print_instruction(CURRENT_STATE.PC);
+			case 'p':
+				profile_period = strtoul(optarg, NULL, 0);
 				break;
-			case 0x04:
-				//beq
-				target = ((int32_t)((int16_t)immediate)) << 2;
-				if (CURRENT_STATE.REGS[rs] == CURRENT_STATE.REGS[rt]){
-					NEXT_STATE.PC = CURRENT_STATE.PC + target;
+			case 'P':
+				/* fwd,ex style: forwarding and branch stage */
+				pipeline_stage = strchr(optarg, ',');
+				if (pipeline_stage != NULL) {
+					*pipeline_stage++ = '\0';
 				}
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x05:
-				//bne
-				target = ((int32_t)((int16_t)immediate)) << 2;
-				if (CURRENT_STATE.REGS[rs] != CURRENT_STATE.REGS[rt]){
-					NEXT_STATE.PC = CURRENT_STATE.PC + target;
+				if (!pipeline_command(sim, optarg, pipeline_stage)) {
+					exit(1);
 				}
-				print_instruction(CURRENT_STATE.PC);
 				break;
-			case 0x06:
-				//blez
-				target = ((int32_t)((int16_t)immediate)) << 2;
-				if (((int32_t)CURRENT_STATE.REGS[rs]) <= 0){
-					NEXT_STATE.PC = CURRENT_STATE.PC + target;
+			case 'B':
+				if (!branch_command(sim, optarg)) {
+					exit(1);
 				}
-				print_instruction(CURRENT_STATE.PC);
 				break;
-			case 0x07:
-				//bgtz
-				target = ((int32_t)((int16_t)immediate)) << 2;
-				if (((int32_t)CURRENT_STATE.REGS[rs]) > 0){
-					NEXT_STATE.PC = CURRENT_STATE.PC + target;
+			case 'C':
+				if (!cache_command(sim, optarg)) {
+					exit(1);
 				}
-				print_instruction(CURRENT_STATE.PC);
 				break;
-			case 0x08:
-				//ADDI
-				NEXT_STATE.REGS[rt] = CURRENT_STATE.REGS[rs] + (int32_t)((int16_t)immediate);
-				print_instruction(CURRENT_STATE.PC);
+			case 'V':
+				sim->JIT_VERIFY = TRUE;
 				break;
-			case 0x09:
-				//ADDIU
-				NEXT_STATE.REGS[rt] = CURRENT_STATE.REGS[rs] + (uint32_t)((uint16_t)immediate);
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C:
-				//ANDI
-				NEXT_STATE.REGS[rt] = immediate & CURRENT_STATE.REGS[rs] & 0xFFFF;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0D:
-				//ori
-				NEXT_STATE.REGS[rt] = CURRENT_STATE.REGS[rs] | (uint32_t)((uint16_t)immediate);
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0E:
-				//xori
-				NEXT_STATE.REGS[rt] = CURRENT_STATE.REGS[rs] ^ (uint32_t)((uint16_t)immediate);
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0A:
-				//slti
-				if(CURRENT_STATE.REGS[rs] < (int32_t)((int16_t)immediate)){
-					NEXT_STATE.REGS[rt] = 0x00000001;
-				}
-				else{
-					NEXT_STATE.REGS[rt] = 0x00000000;
-				}
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20:
-                                //lb
-								//confused
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-			case 0x23:
-                                //lw
-				target = ((uint32_t)((uint16_t)immediate)) + CURRENT_STATE.REGS[rs];
-				NEXT_STATE.REGS[rt] = mem_read_32(target);
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-                        case 0x21:
-                                //lh
-								//confused
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-			case 0x2B:
-                                //sw
-								//confused
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-                        case 0x28:
-                                //sb
-								//confused
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-                        case 0x29:
-                                //sh
-								//confused
-				print_instruction(CURRENT_STATE.PC);
-                                break;
-			case 0x0F:
-                                //lui
-				NEXT_STATE.REGS[rt] = ((uint32_t)immediate) << 16;
-				print_instruction(CURRENT_STATE.PC);
-                                break;		
+			default:
+				exit(1);
 		}
 	}
-}
 
-
-/************************************************************/
-/* Initialize Memory                                                                                                    */ 
-/************************************************************/
-void initialize() { 
-	init_memory();
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
-}
-
-/************************************************************/
-/* Print the program loaded into memory (in MIPS assembly format)    */ 
-/************************************************************/
-void print_program(){
-	int i;
-	uint32_t addr;
-	
-	for(i=0; i<PROGRAM_SIZE; i++){
-		addr = MEM_TEXT_BEGIN + (i*4);
-		printf("[0x%x]\t", addr);
-		print_instruction(addr);
+	if (optind >= argc) {
+		printf("Error: You should provide input file.\nUsage: %s [-b script | --batch script, - for stdin] [-B branch predictor] [-C on|cache specs] [-e interp|threaded|jit] [-f auto|hex|bin|binle|elf|asm] [-n cores] [-p profile period] [-P fwd|nofwd,id|ex|mem] [-q quantum] [-t off|summary|inst] [-T trace file] [-V] <input program> \n\n",  argv[0]);
+		exit(1);
 	}
-}
-
-/************************************************************/
-/* Print the instruction at given memory address (in MIPS assembly format)    */
-/************************************************************/
-void print_instruction(uint32_t addr){
-	/*IMPLEMENT THIS*/
-	uint32_t instruction, opcode, rs, rt, rd, sa, immediate, function, target, offset;
-	
-	instruction = mem_read_32(addr);
-
-	opcode = (instruction & 0xFC000000) >> 26;
-        rs = (instruction & 0x3E00000) >> 21;
-        rt = (instruction & 0x1F0000) >> 16;
-        rd = (instruction & 0xF800) >> 11;
-        sa = (instruction & 0x7C0) >> 6;
-        immediate = (instruction & 0xFFFF);
-        function = (instruction & 0x3F);
-        offset = (instruction & 0x3FFFFFF);
-
-	//printf("From print: %x", instruction);
-
-	if(opcode == 0x00){
-		switch(function){
-
-                        case 0x0C:
-                                //syscall
-				printf("SYSCALL\n");
-                                break;
-                        case 0x20:
-                                //add
-                                printf("\nADD  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-			case 0x21:
-                                //addu
-                                printf("\nADD  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-
-                        case 0x22:
-                                //sub
-				printf("\nSUB  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x23:
-                                //subu
-				printf("\nSUBU  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x18:
-                                //mult
-				printf("\nMULT  ");
-				printf("$%d ", rs);
-				printf("$%d \n", rt);
-
-                                break;
-                        case 0x19:
-                                //multu
-				printf("\nMULTU  ");
-				printf("$%d ", rs);
-				printf("$%d ", rt);
-
-                                break;
-                        case 0x1A:
-                                //div
-				printf("\nDIV  ");
-				printf("$%d ", rs);
-				printf("$%d ", rt);
-                                break;
-                        case 0x1B:
-                                //divu
-				printf("\nDIVU  ");
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x24:
-                                //and
-				printf("\nAND  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x25:
-                                //or
-				printf("\nOR  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x26:
-                                //xor
-				printf("\nXOR  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x27:
-                                //nor
-				printf("\nNOR  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x2A:
-                                //slt
-				printf("\nSLT  ");
-				printf("$%d ", rd);
-				printf("$%d ", rs);
-				printf("$%d\n", rt);
-                                break;
-                        case 0x00:
-                                //sll
-				printf("\nSLL  ");
-				printf("$%d ", rd);
-				printf("$%d ", rt);
-				printf("$%d\n", sa);
-                                break;
-			case 0x02:
-                                //srl
-				printf("\nSRL  ");
-				printf("$%d ", rd);
-				printf("$%d ", rt);
-				printf("$%d\n", sa);
-                                break;
-                        case 0x03:
-                                //sra
-				printf("\nSRA  ");
-				printf("$%d ", rd);
-				printf("$%d ", rt);
-				printf("$%d\n", sa);
-                                break;
-                        case 0x08:
-                                //jr
-				printf("\nJR  ");
-				printf("$%d\n", rs);
-                                break;
-                        case 0x09:
-                                 //jalr
-				printf("\nJALR  ");
-				printf("$%d \n", rs);
-				printf("JALR $%d ", rd);
-				printf("$%d\n", rs);
-                                break;
-			case 0x10:
-                                //mfhi
-				printf("\nMFHI  ");
-				printf("$%d \n", rd);
-                                break;
-                        case 0x11:
-                                //mthi
-				printf("\nMTHI  ");
-				printf("$%d \n", rs);
-                                break;
-                        case 0x12:
-                                //mflo
-				printf("\nMFLO  ");
-				printf("$%d \n", rd);
-                                break;
-                        case 0x13:
-                                //mtlo
-				printf("\nMTLO  ");
-				printf("$%d \n", rs);
-                                break;
-                }
-	                                      
-
-        }
-        else{
-                switch(opcode){
-                        case 0x02:
-				//J
-                                printf("\nJ  ");
-				printf("%d\n", offset);
-                                break;
-                        case 0x03:
-				//JAL
-                                printf("\nJAL  ");
-				printf("%d\n", offset);
-                                break;
-                        case 0x04:
-                                //beq
-				printf("\nBEQ  ");
-				printf("$%d ", rs);
-				printf("$%d ", rt);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x05:
-                                //bne
-				printf("\nBNE  ");
-				printf("$%d ", rs);
-				printf("$%d ", rt);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x06:
-                                //blez
-				printf("\nBLEZ  ");
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x07:
-                                //bgtz
-				printf("\nBGTZ  ");
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x08:
-                                //ADDI
-				printf("\nADDI  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x09:
-                                //ADDIU
-				printf("\nADDIU  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x0C:
-                                //ANDI
-				printf("\nANDI  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x0D:
-                                //ori
-				printf("\nORI  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x0E:
-                                //xori
-				printf("\nXORI  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x0A:
-                                //slti
-				printf("\nSLTI  ");
-				printf("$%d ", rt);
-				printf("$%d ", rs);
-				printf("%d\n", immediate);
-                                break;
-                        case 0x20:
-                                //lb
-				printf("\nLB  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d \n", rs);
-				break;
-                        case 0x23:
-                                //lw
-				printf("\nLW  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d \n", rs);
-                                break;
-                        case 0x21:
-                                //lh
-				printf("\nLH  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d \n", rs);
-                                break;
-                        case 0x2B:
-                                //sw
-				printf("\nSW  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d \n", rs);
-                                break;
-                        case 0x28:
-                                //sb
-				printf("\nSB  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d \n", rs);
-                                break;
-                        case 0x29:
-                                //sh
-				printf("\nSH  ");
-				printf("$%d ", rt);
-				printf("%d ", immediate);
-				printf("$%d\n", rs);
-                                break;
-                        case 0x0F:
-                                //lui
-				printf("\nLUI  ");
-				printf("$%d ", rt);
-				printf("%d\n", immediate);
-                                break;
-                }
-        }
-}
 
-/***************************************************************/
-/* main                                                                                                                                   */
-/***************************************************************/
-int main(int argc, char *argv[]) {                              
-	printf("\n**************************\n");
-	printf("Welcome to MU-MIPS SIM...\n");
-	printf("**************************\n\n");
-	
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
-		exit(1);
+	if (script != NULL) {
+		/* before anything is written to stdout */
+		setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+	} else {
+		printf("\n**************************\n");
+		printf("Welcome to MU-MIPS SIM...\n");
+		printf("**************************\n\n");
 	}
 
-	strcpy(prog_file, argv[1]);
-	initialize();
-	load_program();
+	image = mips_image_load_format(argv[optind], format);
+	if (image == NULL && errno == EINVAL) {
+		printf("Error: %s is not a valid program (hex words, raw binary, ELF32 MIPS or assembly)\n", argv[optind]);
+		exit(-1);
+	}
+	if (image == NULL) {
+		printf("Error: Can't open program file %s\n", argv[optind]);
+		exit(-1);
+	}
+	load_program(sim, image);
+	mips_image_release(image);
+	if (profile_period > 0) {
+		profile_start(sim, profile_period);
+	}
+	if (script != NULL) {
+		exit(run_batch(sim, script));
+	}
 	help();
 	while (1){
-		handle_command();
+		handle_command(sim);
 	}
 	return 0;
 }
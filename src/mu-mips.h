@@ -1,10 +1,17 @@
+#ifndef MU_MIPS_H
+#define MU_MIPS_H
+
+#include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#include "mu-mips-sim.h"
 
 #define FALSE 0
 #define TRUE  1
 
 /******************************************************************************/
-/* MIPS memory layout                                                                                                                                      */
+/* MIPS memory layout                                                  */
 /******************************************************************************/
 #define MEM_TEXT_BEGIN  0x00400000
 #define MEM_TEXT_END      0x0FFFFFFF
@@ -24,18 +31,46 @@
 
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
-};
-
 #define NUM_MEM_REGION 4
+
+/******************************************************************************/
+/* Sparse guest memory: two-level page table of 4KB pages              */
+/* Pages are allocated on the first non-zero write, missing pages read as 0.  */
+/* A snapshot marks every mapped page pristine; the first write after it      */
+/* copies the page (copy-on-write) and records it in the dirty list.   */
+/* Pages of a loaded checkpoint stay packed in the mapped file until first    */
+/* touched, see mu-mips-checkpoint.c.                                  */
+/******************************************************************************/
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+
+#define MEM_L2_BITS 10
+#define MEM_L2_ENTRIES (1 << MEM_L2_BITS)
+#define MEM_L1_ENTRIES (1 << (32 - MEM_L2_BITS - MEM_PAGE_BITS))
+
+#define MEM_L1_INDEX(addr) ((addr) >> (MEM_L2_BITS + MEM_PAGE_BITS))
+#define MEM_L2_INDEX(addr) (((addr) >> MEM_PAGE_BITS) & (MEM_L2_ENTRIES - 1))
+
+typedef struct {
+	uint8_t *data;		/* current contents, NULL while the page is all zero */
+	uint8_t *pristine;	/* contents at the last snapshot, shared with data until written */
+	const uint8_t *packed;	/* checkpoint contents not unpacked yet, data is NULL meanwhile */
+} mem_page_t;
+
+/* software TLB in front of the page table, see mem_read_32()          */
+#define MEM_TLB_BITS 8
+#define MEM_TLB_ENTRIES (1 << MEM_TLB_BITS)
+#define MEM_TLB_INDEX(addr) (((addr) >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1))
+
+typedef struct {
+	uint32_t page_no;
+	const uint8_t *read;	/* page contents, or a shared zero page */
+	uint8_t *write;		/* page contents once private, else NULL */
+} mem_tlb_entry_t;
+
 #define MIPS_REGS 32
 
 typedef struct CPU_State_Struct {
@@ -46,36 +81,313 @@ typedef struct CPU_State_Struct {
 } CPU_State;
 
 
+/***************************************************************/
+/* Decoded instruction cache, direct mapped and keyed by PC.           */
+/* Stores invalidate the entries they overlap, flushes bump DECODE_GEN.  */
+/***************************************************************/
+typedef struct decoded_inst_struct decoded_inst_t;
+typedef void (*inst_handler_t)(mips_sim_t *sim, const decoded_inst_t *);
+
+struct decoded_inst_struct {
+	uint32_t pc;			/* address the entry was decoded from */
+	uint32_t gen;			/* valid only while equal to DECODE_GEN */
+	uint32_t instruction;
+	uint8_t opcode, rs, rt, rd, sa, function;
+	uint32_t immediate;		/* low 16 bits, not extended */
+	uint32_t offset;		/* low 26 bits (jump target) */
+	inst_handler_t handler;	/* NULL for unimplemented instructions */
+	uint8_t ends_block;		/* jump, branch or syscall */
+};
+
+#define DECODE_CACHE_BITS 14
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_BITS)
+#define DECODE_INDEX(pc) (((pc) >> 2) & (DECODE_CACHE_SIZE - 1))
+
+/***************************************************************/
+/* A loaded program: its words and their decoded form, read-only once  */
+/* built so any number of simulations can fetch from it concurrently.  */
+/* Hex and raw binary programs are all text at MEM_TEXT_BEGIN; an ELF  */
+/* file or an assembled .asm source may add data segments, which are  */
+/* copied in but not decoded.                                           */
+/***************************************************************/
+typedef struct {
+	uint32_t base;			/* guest address of words[0] */
+	uint32_t size;			/* in words */
+	uint32_t *words;
+} mips_segment_t;
+
+typedef struct {
+	char *name;
+	uint32_t address;
+} mips_symbol_t;
+
+struct mips_image {
+	int refs;			/* atomic, see mips_image_retain() */
+	uint32_t entry;			/* initial PC */
+	uint32_t base;			/* guest address of the text */
+	uint32_t size;			/* text, in words */
+	uint32_t *words;
+	decoded_inst_t *decoded;
+	mips_segment_t *data;
+	uint32_t num_data;
+	mips_symbol_t *symbols;		/* labels of an assembled program, sorted by name */
+	uint32_t num_symbols;
+};
 
 /***************************************************************/
-/* CPU State info.                                                                                                               */
+/* Pages holding translated code (threaded blocks). A store to one of  */
+/* them bumps CODE_GEN, which invalidates every translation. With more */
+/* than one core, MEM_OWNER's SHARED_CODE_PAGES flags every page any   */
+/* core decoded or translated, and a store to one of those bumps its   */
+/* SHARED_CODE_GEN for the other cores to see at their mem_sync().    */
 /***************************************************************/
+#define CODE_PAGE_WORDS (1 << (32 - MEM_PAGE_BITS - 5))
+#define CODE_PAGE_BIT(addr) (1u << (((addr) >> MEM_PAGE_BITS) & 31))
+#define CODE_PAGE_TEST(sim, addr) ((sim)->CODE_PAGES[(addr) >> (MEM_PAGE_BITS + 5)] & CODE_PAGE_BIT(addr))
+#define CODE_PAGE_MARK(sim, addr) ((sim)->CODE_PAGES[(addr) >> (MEM_PAGE_BITS + 5)] |= CODE_PAGE_BIT(addr))
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t PROGRAM_SIZE; /*in words*/
+/***************************************************************/
+/* Breakpoints and watchpoints, see mu-mips-debug.c. Watched pages are */
+/* flagged in a bitmap laid out like CODE_PAGES.                       */
+/***************************************************************/
+#define DEBUG_MAX_BREAKPOINTS	32
+#define DEBUG_MAX_WATCHES	16
+
+#define WATCH_READ	1
+#define WATCH_WRITE	2
+
+#define STOP_NONE	0
+#define STOP_BREAK	1	/* before the instruction at STOP_PC */
+#define STOP_WATCH	2	/* after the instruction at STOP_PC accessed STOP_ADDRESS */
+
+#define WATCH_PAGE_TEST(sim, addr) ((sim)->WATCH_PAGES[(addr) >> (MEM_PAGE_BITS + 5)] & CODE_PAGE_BIT(addr))
+#define WATCH_PAGE_MARK(sim, addr) ((sim)->WATCH_PAGES[(addr) >> (MEM_PAGE_BITS + 5)] |= CODE_PAGE_BIT(addr))
+
+typedef struct {
+	uint32_t address;
+	int access;		/* WATCH_READ and/or WATCH_WRITE */
+} watchpoint_t;
+
+/***************************************************************/
+/* Execution engines, selected with -e at startup                      */
+/***************************************************************/
+#define ENGINE_INTERP	MIPS_SIM_INTERP		/* decode cache + handler per instruction */
+#define ENGINE_THREADED	MIPS_SIM_THREADED	/* direct-threaded basic blocks (mu-mips-threaded.c) */
+#define ENGINE_JIT	MIPS_SIM_JIT		/* interpreter + x86-64 code for hot blocks (mu-mips-jit.c) */
+
+/***************************************************************/
+/* Trace level, set with -t or the trace command                       */
+/***************************************************************/
+#define TRACE_OFF		0	/* only command output */
+#define TRACE_SUMMARY		1	/* instruction count, time and MIPS after every run */
+#define TRACE_INSTRUCTION	2	/* also disassemble every executed instruction */
+#define TRACE_BINARY		3	/* summary, plus a binary record per instruction to the -T file */
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_LINE_MAX 64	/* longest line format_instruction() produces */
+
+/* engine and trace writer state, private to their source files        */
+struct threaded_block_struct;
+struct jit_state_struct;
+struct trace_binary_struct;
+
+/***************************************************************/
+/* One simulation. Nothing outside this struct changes while a guest   */
+/* runs, so simulations on different threads do not interfere.         */
+/***************************************************************/
+struct mips_sim {
+	/* CPU state info; first, so the JIT reaches it with short offsets */
+	CPU_State CURRENT_STATE, NEXT_STATE;
+	CPU_State *NEXT;	/* where handlers write: &NEXT_STATE, or &CURRENT_STATE in place */
+	int RUN_FLAG;	/* run flag*/
+	uint64_t INSTRUCTION_COUNT;
+
+	/* memory */
+	mem_page_t *MEM_PAGE_TABLE[MEM_L1_ENTRIES];
+	uint32_t MEM_PAGES_ALLOCATED;
+	mem_tlb_entry_t MEM_TLB[MEM_TLB_ENTRIES];
+	/* pages written since the last snapshot, by guest page number */
+	uint32_t *DIRTY_PAGES;
+	uint32_t NUM_DIRTY_PAGES, DIRTY_PAGES_CAPACITY;
+	/* mapped checkpoint file the packed pages point into */
+	const uint8_t *CHECKPOINT_MAP;
+	size_t CHECKPOINT_SIZE;
+
+	/* architectural state captured right after the program (or a */
+	/* checkpoint) was loaded */
+	CPU_State SNAPSHOT_STATE;
+	uint64_t SNAPSHOT_INSTRUCTION_COUNT;
+	int SNAPSHOT_VALID;
+
+	/* the loaded program; decode_fetch() serves its text straight from */
+	/* IMAGE->decoded until a store lands in it (IMAGE_WORDS drops to 0) */
+	mips_image_t *IMAGE;
+	uint32_t IMAGE_BASE, IMAGE_WORDS, SNAPSHOT_IMAGE_WORDS;
+	/* IMAGE->decoded, or PATCHED_DECODES while breakpoints are set */
+	const decoded_inst_t *IMAGE_DECODED;
+	decoded_inst_t *PATCHED_DECODES;
+
+	decoded_inst_t DECODE_CACHE[DECODE_CACHE_SIZE];
+	decoded_inst_t DECODE_UNCACHED;	/* misaligned fetches */
+	uint32_t DECODE_GEN;
+	uint32_t CODE_PAGES[CODE_PAGE_WORDS];
+	uint32_t CODE_GEN;
+
+	int ENGINE;
+	struct threaded_block_struct **BLOCK_CACHE;	/* threaded engine, allocated on first use */
+	struct jit_state_struct *JIT;			/* JIT engine, allocated on first use */
+	/* -V: replay every compiled block on the interpreter and compare */
+	int JIT_VERIFY;
+	uint64_t JIT_NATIVE_INSTRUCTIONS;
+	uint32_t JIT_BLOCKS_COMPILED;
+
+	int TRACE_LEVEL;
+	char *TRACE_BUFFER;	/* TRACE_INSTRUCTION text, allocated on first use */
+	int TRACE_LEN;
+	struct trace_binary_struct *BINARY_TRACE;	/* -T file */
+
+	/* models watching every instruction; any of them runs the interpreter */
+	struct profile_struct *PROFILE;		/* mu-mips-profile.c */
+	struct pipeline_struct *PIPELINE;	/* mu-mips-pipeline.c */
+	struct cache_struct *CACHE;		/* mu-mips-cache.c */
+	struct branch_struct *BRANCH;		/* mu-mips-branch.c */
+
+	/* breakpoints and watchpoints; any of them runs the interpreter */
+	uint32_t BREAKPOINTS[DEBUG_MAX_BREAKPOINTS];
+	uint32_t NUM_BREAKPOINTS;
+	watchpoint_t WATCHES[DEBUG_MAX_WATCHES];
+	uint32_t NUM_WATCHES;
+	uint32_t *WATCH_PAGES;		/* NULL without watchpoints */
+	int WATCH_ARMED;		/* guest accesses are checked, not host ones */
+	int STOP_REASON;
+	uint32_t STOP_PC, STOP_ADDRESS;
+	int STOP_ACCESS;
+	int RESUME;			/* continue: run the instruction at STOP_PC once */
+
+	/* the guest's console and heap, see mu-mips-syscall.c */
+	FILE *CONSOLE_IN, *CONSOLE_OUT;	/* NULL: reads get 0, output is dropped */
+	char *CONSOLE_BUFFER;		/* output, allocated on first use */
+	uint32_t CONSOLE_LEN;
+	uint32_t HEAP_BREAK, SNAPSHOT_HEAP_BREAK;	/* core 0's serves every core */
+
+	/* multi-core, see mu-mips-multicore.c. Cores 1..NUM_CORES-1 are sims */
+	/* of their own that use MEM_OWNER's (core 0's) memory; every other    */
+	/* sim is its own MEM_OWNER. MEM_LOCK guards the page table while more */
+	/* than one core runs and MEM_MAP_GEN counts the pages mapped since;   */
+	/* SHARED_CODE_GEN counts the stores into code any core has run.      */
+	struct mips_sim *MEM_OWNER;
+	struct mips_sim **CORES;	/* core 0 only, CORES[0] is itself */
+	uint32_t NUM_CORES, CORE_ID;
+	uint32_t QUANTUM;		/* instructions per turn in lockstep, 0: free-running threads */
+	uint32_t TURN_CORE, TURN_LEFT;	/* lockstep: whose turn it is, and how much of it is left */
+	int CORES_STOP;			/* core 0 only: stop every core at its next check */
+	pthread_mutex_t MEM_LOCK;
+	uint32_t MEM_MAP_GEN, MEM_MAP_SEEN;
+	uint32_t *SHARED_CODE_PAGES;	/* core 0 only, while NUM_CORES > 1 */
+	uint32_t SHARED_CODE_GEN, SHARED_CODE_SEEN;
+	/* LL/SC link: the word ll loaded, which sc expects to find */
+	int LL_VALID;
+	uint32_t LL_ADDRESS, LL_VALUE;
+};
 
-char prog_file[32];
+#define SIM_OBSERVED(sim) ((sim)->PROFILE != NULL || (sim)->PIPELINE != NULL || (sim)->CACHE != NULL \
+	|| (sim)->BRANCH != NULL)
+#define SIM_DEBUGGING(sim) ((sim)->NUM_BREAKPOINTS > 0 || (sim)->NUM_WATCHES > 0)
+#define MEM_SHARED(sim) ((sim)->MEM_OWNER->NUM_CORES > 1)
 
 
 /***************************************************************/
-/* Function Declerations.                                                                                                */
+/* Function Declerations.                                              */
 /***************************************************************/
 void help();
-uint32_t mem_read_32(uint32_t address);
-void mem_write_32(uint32_t address, uint32_t value);
-void cycle();
-void run(int num_cycles);
-void runAll();
-void mdump(uint32_t start, uint32_t stop) ;
-void rdump();
-void handle_command();
-void reset();
-void init_memory();
-void load_program();
-void handle_instruction(); /*IMPLEMENT THIS*/
-void initialize();
-void print_program(); /*IMPLEMENT THIS*/
-void print_instruction(uint32_t);
+uint32_t mem_read_32(mips_sim_t *sim, uint32_t address);
+void mem_write_32(mips_sim_t *sim, uint32_t address, uint32_t value);
+void mem_write_words(mips_sim_t *sim, uint32_t address, const uint32_t *words, uint32_t count);
+uint8_t *mem_page(mips_sim_t *sim, uint32_t address, int write);
+void mem_map_packed(mips_sim_t *sim, uint32_t page_no, const uint8_t *packed);
+void free_memory(mips_sim_t *sim);
+void snapshot_take(mips_sim_t *sim);
+void snapshot_restore(mips_sim_t *sim);
+void cycle(mips_sim_t *sim);
+void run(mips_sim_t *sim, int num_cycles);
+void runAll(mips_sim_t *sim);
+void mdump(mips_sim_t *sim, uint32_t start, uint32_t stop) ;
+void rdump(mips_sim_t *sim);
+void handle_command(mips_sim_t *sim);
+void reset(mips_sim_t *sim);
+void init_memory(mips_sim_t *sim);
+void load_program(mips_sim_t *sim, mips_image_t *image);
+void handle_instruction(mips_sim_t *sim); /*IMPLEMENT THIS*/
+void decode_instruction(uint32_t instruction, decoded_inst_t *d);
+const decoded_inst_t *decode_fetch(mips_sim_t *sim, uint32_t pc);
+void decode_invalidate(mips_sim_t *sim, uint32_t address);
+void decode_flush(mips_sim_t *sim);
+void code_page_mark(mips_sim_t *sim, uint32_t address);
+uint32_t engine_run(mips_sim_t *sim, uint32_t max);
+uint32_t core_run(mips_sim_t *sim, uint32_t max);
+uint32_t interp_run(mips_sim_t *sim, uint32_t max);
+uint32_t interp_block(mips_sim_t *sim, uint32_t max);
+uint32_t threaded_run(mips_sim_t *sim, uint32_t max);
+void threaded_free(mips_sim_t *sim);
+uint32_t jit_run(mips_sim_t *sim, uint32_t max);
+void jit_free(mips_sim_t *sim);
+void print_program(mips_sim_t *sim); /*IMPLEMENT THIS*/
+void print_instruction(mips_sim_t *sim, uint32_t);
+int format_instruction(uint32_t instruction, char *buf, int size);
+const char *instruction_name(uint32_t instruction);
+void trace_instruction(mips_sim_t *sim, uint32_t instruction);
+void trace_flush(mips_sim_t *sim);
+int parse_trace_level(const char *name);
+int trace_binary_open(mips_sim_t *sim, const char *path);
+int trace_binary_is_open(const mips_sim_t *sim);
+void trace_binary_sync(mips_sim_t *sim, const CPU_State *s);
+void trace_binary_record(mips_sim_t *sim, const CPU_State *before, const CPU_State *after, uint32_t instruction);
+void trace_binary_flush(mips_sim_t *sim);
+void trace_binary_close(mips_sim_t *sim);
+void profile_start(mips_sim_t *sim, uint32_t period);
+void profile_stop(mips_sim_t *sim);
+void profile_record(mips_sim_t *sim, const decoded_inst_t *d);
+void profile_print(mips_sim_t *sim);
+int profile_write_folded(mips_sim_t *sim, FILE *out);
+int pipeline_parse_stage(const char *name);
+void pipeline_start(mips_sim_t *sim, int forwarding, int branch_stage);
+void pipeline_stop(mips_sim_t *sim);
+uint64_t pipeline_cycle(const mips_sim_t *sim);
+void pipeline_record(mips_sim_t *sim, const decoded_inst_t *d);
+void pipeline_print(mips_sim_t *sim);
+int cache_start(mips_sim_t *sim, const char *specs);
+void cache_stop(mips_sim_t *sim);
+void cache_record(mips_sim_t *sim, const decoded_inst_t *d);
+void cache_print(mips_sim_t *sim);
+int branch_start(mips_sim_t *sim, const char *spec);
+void branch_stop(mips_sim_t *sim);
+void branch_record(mips_sim_t *sim, const decoded_inst_t *d);
+void branch_print(mips_sim_t *sim);
+int asm_parse(mips_image_t *image, const uint8_t *p, size_t len, const char *path);
+int checkpoint_unpack(const uint8_t *packed, uint8_t *page);
+void checkpoint_unmap(mips_sim_t *sim);
+void mem_tlb_flush(mips_sim_t *sim);
+void mem_sync(mips_sim_t *sim);
+uint32_t mem_load_linked(mips_sim_t *sim, uint32_t address);
+int mem_store_conditional(mips_sim_t *sim, uint32_t address, uint32_t value);
+void debug_patch(mips_sim_t *sim, decoded_inst_t *d);
+void debug_attach_image(mips_sim_t *sim);
+int debug_break(mips_sim_t *sim, uint32_t address);
+int debug_watch(mips_sim_t *sim, uint32_t address, int access);
+int debug_delete(mips_sim_t *sim, uint32_t address);
+void debug_delete_all(mips_sim_t *sim);
+void debug_watch_hit(mips_sim_t *sim, uint32_t address, int access);
+void debug_resume(mips_sim_t *sim);
+void debug_list(const mips_sim_t *sim);
+void debug_report(const mips_sim_t *sim);
+void debug_free(mips_sim_t *sim);
+void syscall_run(mips_sim_t *sim, CPU_State *next);
+uint32_t syscall_heap_start(const mips_image_t *image);
+void console_flush(mips_sim_t *sim);
+void console_free(mips_sim_t *sim);
+uint32_t multicore_run(mips_sim_t *sim, uint32_t max);
+void multicore_reset(mips_sim_t *sim);
+void multicore_free(mips_sim_t *sim);
+int sample_run(mips_sim_t *sim, const char *spec, uint64_t max, const char *prefix);
 
+#endif